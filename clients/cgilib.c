@@ -18,6 +18,8 @@
 */
 
 #include <ctype.h>
+#include <setjmp.h>
+#include <sys/socket.h>
 
 #include "common.h"
 #include "cgilib.h"
@@ -154,23 +156,53 @@ static void cgilib_err(const char *errmsg)
 	upslogx(LOG_ERR, "Fatal error in parseconf(ups.conf): %s", errmsg);
 }
 
-int checkhost(const char *host, char **desc)
+	/* hosts.conf as last read by checkhost, and its stat() */
+	static	char	**hostname = NULL, **hostdesc = NULL;
+	static	size_t	numhosts = 0;
+	static	struct	stat	hostst;
+
+static void free_hosts(void)
+{
+	size_t	i;
+
+	for (i = 0; i < numhosts; i++) {
+		free(hostname[i]);
+		free(hostdesc[i]);
+	}
+
+	free(hostname);
+	free(hostdesc);
+
+	hostname = hostdesc = NULL;
+	numhosts = 0;
+	memset(&hostst, 0, sizeof(hostst));
+}
+
+/* (re)read hosts.conf, unless it hasn't changed since the last time */
+static int load_hosts(void)
 {
 	char	fn[SMALLBUF];
+	struct	stat	st;
 	PCONF_CTX_t	ctx;
 
-	if (!host)
-		return 0;		/* deny null hostnames */
-
 	snprintf(fn, sizeof(fn), "%s/hosts.conf", confpath());
 
+	if (stat(fn, &st) != 0)
+		memset(&st, 0, sizeof(st));
+
+	if ((st.st_ino != 0) && (hostst.st_ino == st.st_ino)
+		&& (hostst.st_mtime == st.st_mtime) && (hostst.st_size == st.st_size))
+		return 1;
+
+	free_hosts();
+
 	pconf_init(&ctx, cgilib_err);
 
 	if (!pconf_file_begin(&ctx, fn)) {
 		pconf_finish(&ctx);
 		fprintf(stderr, "%s\n", ctx.errmsg);
 
-		return 0;	/* failed: deny access */
+		return 0;
 	}
 
 	while (pconf_file_next(&ctx)) {
@@ -187,16 +219,471 @@ int checkhost(const char *host, char **desc)
 		if (strcmp(ctx.arglist[0], "MONITOR") != 0)
 			continue;
 
-		if (!strcmp(ctx.arglist[1], host)) {
+		hostname = xrealloc(hostname, (numhosts + 1) * sizeof(*hostname));
+		hostdesc = xrealloc(hostdesc, (numhosts + 1) * sizeof(*hostdesc));
+
+		hostname[numhosts] = xstrdup(ctx.arglist[1]);
+		hostdesc[numhosts] = xstrdup(ctx.arglist[2]);
+		numhosts++;
+	}
+
+	pconf_finish(&ctx);
+
+	hostst = st;
+
+	return 1;
+}
+
+int checkhost(const char *host, char **desc)
+{
+	size_t	i;
+
+	if (!host)
+		return 0;		/* deny null hostnames */
+
+	if (!load_hosts())
+		return 0;	/* failed: deny access */
+
+	for (i = 0; i < numhosts; i++) {
+		if (!strcmp(hostname[i], host)) {
 			if (desc)
-				*desc = xstrdup(ctx.arglist[2]);
+				*desc = xstrdup(hostdesc[i]);
 
-			pconf_finish(&ctx);
 			return 1;	/* found: allow access */
 		}
 	}
 
-	pconf_finish(&ctx);
-
 	return 0;	/* not found: access denied */
-}	
+}
+
+/* --- FastCGI --- */
+
+/* from the FastCGI specification */
+#define FCGI_VERSION_1		1
+
+#define FCGI_BEGIN_REQUEST	1
+#define FCGI_ABORT_REQUEST	2
+#define FCGI_END_REQUEST	3
+#define FCGI_PARAMS		4
+#define FCGI_STDIN		5
+#define FCGI_STDOUT		6
+#define FCGI_GET_VALUES		9
+#define FCGI_GET_VALUES_RESULT	10
+#define FCGI_UNKNOWN_TYPE	11
+
+#define FCGI_RESPONDER		1
+#define FCGI_KEEP_CONN		1
+
+#define FCGI_REQUEST_COMPLETE	0
+#define FCGI_CANT_MPX_CONN	1
+#define FCGI_UNKNOWN_ROLE	3
+
+#define FCGI_MAXREC		65535
+
+/* more than any web server should send us */
+#define FCGI_MAXPARAMS		(16 * FCGI_MAXREC)
+
+	static	int	fcgi = 0;
+	static	jmp_buf	cgi_jmp;
+	static	int	cgi_status;
+
+	/* what the last request put in the environment */
+	static	char	**envname = NULL;
+	static	size_t	numenv = 0;
+
+static int fcgi_readn(int fd, unsigned char *buf, size_t len)
+{
+	ssize_t	ret;
+
+	while (len > 0) {
+		ret = read(fd, buf, len);
+
+		if ((ret < 0) && (errno == EINTR))
+			continue;
+
+		if (ret <= 0)
+			return 0;
+
+		buf += ret;
+		len -= ret;
+	}
+
+	return 1;
+}
+
+static int fcgi_writen(int fd, const unsigned char *buf, size_t len)
+{
+	ssize_t	ret;
+
+	while (len > 0) {
+		ret = write(fd, buf, len);
+
+		if ((ret < 0) && (errno == EINTR))
+			continue;
+
+		if (ret <= 0)
+			return 0;
+
+		buf += ret;
+		len -= ret;
+	}
+
+	return 1;
+}
+
+/* buf must hold FCGI_MAXREC + 255 bytes, for the padding */
+static int fcgi_read_rec(int fd, int *type, int *id, unsigned char *buf, size_t *len)
+{
+	unsigned char	hdr[8];
+
+	if ((!fcgi_readn(fd, hdr, sizeof(hdr))) || (hdr[0] != FCGI_VERSION_1))
+		return 0;
+
+	*type = hdr[1];
+	*id = (hdr[2] << 8) | hdr[3];
+	*len = (hdr[4] << 8) | hdr[5];
+
+	return fcgi_readn(fd, buf, *len + hdr[6]);
+}
+
+static int fcgi_write_rec(int fd, int type, int id, const unsigned char *buf, size_t len)
+{
+	unsigned char	hdr[8];
+
+	hdr[0] = FCGI_VERSION_1;
+	hdr[1] = type;
+	hdr[2] = (id >> 8) & 0xff;
+	hdr[3] = id & 0xff;
+	hdr[4] = (len >> 8) & 0xff;
+	hdr[5] = len & 0xff;
+	hdr[6] = 0;
+	hdr[7] = 0;
+
+	return fcgi_writen(fd, hdr, sizeof(hdr)) && fcgi_writen(fd, buf, len);
+}
+
+static int fcgi_end_request(int fd, int id, int status, int protostatus)
+{
+	unsigned char	body[8];
+
+	memset(body, 0, sizeof(body));
+
+	body[0] = (status >> 24) & 0xff;
+	body[1] = (status >> 16) & 0xff;
+	body[2] = (status >> 8) & 0xff;
+	body[3] = status & 0xff;
+	body[4] = protostatus;
+
+	return fcgi_write_rec(fd, FCGI_END_REQUEST, id, body, sizeof(body));
+}
+
+/* the length of a name or value in a name-value pair */
+static int fcgi_get_len(const unsigned char **pos, const unsigned char *end, size_t *len)
+{
+	const	unsigned char	*p = *pos;
+
+	if (p >= end)
+		return 0;
+
+	if ((*p & 0x80) == 0) {
+		*len = *p;
+		*pos = p + 1;
+	} else {
+		if (end - p < 4)
+			return 0;
+
+		*len = ((size_t) (p[0] & 0x7f) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+		*pos = p + 4;
+	}
+
+	return (size_t) (end - *pos) >= *len;
+}
+
+/* replace the previous request's environment with these params */
+static void fcgi_setenv(const unsigned char *buf, size_t len)
+{
+	const	unsigned char	*pos = buf, *end = buf + len;
+	char	*name, *val;
+	size_t	i, nlen, vlen;
+
+	/* the programs treat an empty variable like a missing one */
+	for (i = 0; i < numenv; i++) {
+		setenv(envname[i], "", 1);
+		free(envname[i]);
+	}
+
+	free(envname);
+	envname = NULL;
+	numenv = 0;
+
+	while ((fcgi_get_len(&pos, end, &nlen)) && (fcgi_get_len(&pos, end, &vlen))
+		&& ((size_t) (end - pos) >= nlen + vlen)) {
+
+		name = xmalloc(nlen + 1);
+		memcpy(name, pos, nlen);
+		name[nlen] = '\0';
+
+		val = xmalloc(vlen + 1);
+		memcpy(val, pos + nlen, vlen);
+		val[vlen] = '\0';
+
+		pos += nlen + vlen;
+
+		setenv(name, val, 1);
+		free(val);
+
+		envname = xrealloc(envname, (numenv + 1) * sizeof(*envname));
+		envname[numenv++] = name;
+	}
+}
+
+static void fcgi_put_pair(unsigned char *buf, size_t *len, const char *name, const char *val)
+{
+	size_t	nlen = strlen(name), vlen = strlen(val);
+
+	/* short names and values only */
+	buf[(*len)++] = nlen;
+	buf[(*len)++] = vlen;
+
+	memcpy(buf + *len, name, nlen);
+	*len += nlen;
+
+	memcpy(buf + *len, val, vlen);
+	*len += vlen;
+}
+
+/* tell the web server that we take one request at a time */
+static int fcgi_get_values(int fd, const unsigned char *buf, size_t len)
+{
+	const	unsigned char	*pos = buf, *end = buf + len;
+	unsigned char	res[256];
+	size_t	i, nlen, vlen, reslen = 0;
+
+	static	const	char	*known[][2] = {
+		{ "FCGI_MAX_CONNS",	"1" },
+		{ "FCGI_MAX_REQS",	"1" },
+		{ "FCGI_MPXS_CONNS",	"0" },
+	};
+
+	while ((fcgi_get_len(&pos, end, &nlen)) && (fcgi_get_len(&pos, end, &vlen))
+		&& ((size_t) (end - pos) >= nlen + vlen)) {
+
+		for (i = 0; i < sizeof(known) / sizeof(known[0]); i++) {
+			if ((nlen == strlen(known[i][0])) && (!memcmp(pos, known[i][0], nlen)))
+				fcgi_put_pair(res, &reslen, known[i][0], known[i][1]);
+		}
+
+		pos += nlen + vlen;
+	}
+
+	return fcgi_write_rec(fd, FCGI_GET_VALUES_RESULT, 0, res, reslen);
+}
+
+static int cgi_run(void (*handler)(void), void (*cleanup)(void))
+{
+	cgi_status = EXIT_SUCCESS;
+
+	if (setjmp(cgi_jmp) == 0)
+		handler();
+
+	/* also when cgi_exit() skipped the rest of the handler */
+	if (cleanup)
+		cleanup();
+
+	fflush(stdout);
+
+	return cgi_status;
+}
+
+/* send what the handler wrote to stdout, and start over */
+static int fcgi_send_output(int fd, int id)
+{
+	unsigned char	buf[FCGI_MAXREC];
+	ssize_t	ret;
+	int	ok = 1;
+
+	lseek(STDOUT_FILENO, 0, SEEK_SET);
+
+	while ((ok) && ((ret = read(STDOUT_FILENO, buf, sizeof(buf))) > 0))
+		ok = fcgi_write_rec(fd, FCGI_STDOUT, id, buf, ret);
+
+	if (ftruncate(STDOUT_FILENO, 0) != 0)
+		fatal_with_errno(EXIT_FAILURE, "Can't truncate the output file");
+
+	lseek(STDOUT_FILENO, 0, SEEK_SET);
+
+	/* the empty record ends the stream */
+	return (ok) && (fcgi_write_rec(fd, FCGI_STDOUT, id, buf, 0));
+}
+
+static void fcgi_reset_input(void)
+{
+	if (ftruncate(STDIN_FILENO, 0) != 0)
+		fatal_with_errno(EXIT_FAILURE, "Can't truncate the input file");
+
+	lseek(STDIN_FILENO, 0, SEEK_SET);
+}
+
+/* serve the requests the web server sends on this connection */
+static void fcgi_serve(int fd, void (*handler)(void), void (*cleanup)(void))
+{
+	static	unsigned char	buf[FCGI_MAXREC + 255];
+	unsigned char	*params = NULL;
+	size_t	len, plen = 0;
+	int	type, id, reqid = 0, keep = 0, status;
+
+	while (fcgi_read_rec(fd, &type, &id, buf, &len)) {
+
+		/* management records */
+		if (id == 0) {
+			if (type == FCGI_GET_VALUES) {
+				if (!fcgi_get_values(fd, buf, len))
+					break;
+				continue;
+			}
+
+			memset(buf, 0, 8);
+			buf[0] = type;
+
+			if (!fcgi_write_rec(fd, FCGI_UNKNOWN_TYPE, 0, buf, 8))
+				break;
+
+			continue;
+		}
+
+		if (type == FCGI_BEGIN_REQUEST) {
+			if (len < 8)
+				break;
+
+			if (reqid != 0) {
+				if (!fcgi_end_request(fd, id, 0, FCGI_CANT_MPX_CONN))
+					break;
+				continue;
+			}
+
+			keep = buf[2] & FCGI_KEEP_CONN;
+
+			if (((buf[0] << 8) | buf[1]) != FCGI_RESPONDER) {
+				if ((!fcgi_end_request(fd, id, 0, FCGI_UNKNOWN_ROLE)) || (!keep))
+					break;
+				continue;
+			}
+
+			reqid = id;
+			plen = 0;
+			fcgi_reset_input();
+			continue;
+		}
+
+		/* not ours, or already over */
+		if ((id != reqid) || (reqid == 0))
+			continue;
+
+		switch (type)
+		{
+		case FCGI_ABORT_REQUEST:
+			reqid = 0;
+
+			if ((!fcgi_end_request(fd, id, EXIT_FAILURE, FCGI_REQUEST_COMPLETE)) || (!keep))
+				goto out;
+			break;
+
+		case FCGI_PARAMS:
+			if (len == 0) {
+				fcgi_setenv(params, plen);
+				break;
+			}
+
+			if (plen + len > FCGI_MAXPARAMS)
+				goto out;
+
+			params = xrealloc(params, plen + len);
+			memcpy(params + plen, buf, len);
+			plen += len;
+			break;
+
+		case FCGI_STDIN:
+			if (len > 0) {
+				if (!fcgi_writen(STDIN_FILENO, buf, len))
+					fatal_with_errno(EXIT_FAILURE, "Can't write the input file");
+				break;
+			}
+
+			/* all in: run it, as the CGI would with this input */
+			lseek(STDIN_FILENO, 0, SEEK_SET);
+			clearerr(stdin);
+			fseek(stdin, 0, SEEK_SET);
+
+			status = cgi_run(handler, cleanup);
+			reqid = 0;
+
+			if ((!fcgi_send_output(fd, id))
+				|| (!fcgi_end_request(fd, id, status, FCGI_REQUEST_COMPLETE))
+				|| (!keep))
+				goto out;
+			break;
+
+		default:
+			break;
+		}
+	}
+
+out:
+	free(params);
+}
+
+void cgi_main(void (*handler)(void), void (*cleanup)(void))
+{
+	struct	sockaddr_storage	sa;
+	socklen_t	salen = sizeof(sa);
+	FILE	*in, *out;
+	int	listenfd, fd;
+
+	/* FastCGI applications get a listening socket as stdin */
+	if ((getpeername(STDIN_FILENO, (struct sockaddr *) &sa, &salen) == 0)
+		|| (errno != ENOTCONN)) {
+		handler();
+		return;
+	}
+
+	fcgi = 1;
+
+	signal(SIGPIPE, SIG_IGN);
+
+	/* the programs read the POSTed data from stdin and write the
+	 * page to stdout, so keep these in files for them */
+	listenfd = dup(STDIN_FILENO);
+	in = tmpfile();
+	out = tmpfile();
+
+	if ((listenfd < 0) || (!in) || (!out))
+		fatal_with_errno(EXIT_FAILURE, "Can't set up for FastCGI");
+
+	fflush(stdout);
+
+	if ((dup2(fileno(in), STDIN_FILENO) < 0) || (dup2(fileno(out), STDOUT_FILENO) < 0))
+		fatal_with_errno(EXIT_FAILURE, "Can't set up for FastCGI");
+
+	for (;;) {
+		fd = accept(listenfd, NULL, NULL);
+
+		if (fd < 0) {
+			if ((errno == EINTR) || (errno == ECONNABORTED))
+				continue;
+
+			fatal_with_errno(EXIT_FAILURE, "accept");
+		}
+
+		fcgi_serve(fd, handler, cleanup);
+		close(fd);
+	}
+}
+
+void cgi_exit(int status)
+{
+	if (!fcgi)
+		exit(status);
+
+	cgi_status = status;
+	longjmp(cgi_jmp, 1);
+}
@@ -35,6 +35,15 @@ void extractpostargs(void);
 /* see if a host is allowed per the hosts.conf */
 int checkhost(const char *host, char **desc);
 
+/* call handler to answer the request, and return - or keep answering
+   the requests that come, when run as a FastCGI application, calling
+   cleanup (unless NULL) after each one to release what it left behind,
+   including when it ended with cgi_exit() */
+void cgi_main(void (*handler)(void), void (*cleanup)(void));
+
+/* end the current request early - this only exits a plain CGI */
+void cgi_exit(int status);
+
 #ifdef __cplusplus
 /* *INDENT-OFF* */
 }
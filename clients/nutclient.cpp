@@ -20,6 +20,8 @@
 #include "nutclient.h"
 
 #include <sstream>
+#include <algorithm>
+#include <memory>
 
 #include <errno.h>
 #include <string.h>
@@ -32,11 +34,15 @@
 #else
 #  include <sys/types.h>
 #  include <sys/socket.h>
+#  include <sys/un.h> /* sockaddr_un */
 #  include <netinet/in.h>
 #  include <arpa/inet.h>
 #  include <unistd.h> /* close */
 #  include <netdb.h> /* gethostbyname */
 #  include <fcntl.h>
+#  include <limits.h> /* IOV_MAX */
+#  include <netinet/tcp.h> /* TCP_NODELAY */
+#  include <sys/uio.h> /* writev */
 #  define INVALID_SOCKET -1
 #  define SOCKET_ERROR -1
 #  define closesocket(s) close(s) 
@@ -85,6 +91,256 @@ std::string SystemException::err()
 namespace internal
 {
 
+/**
+ * Non-owning reference to a piece of a string (a la string_view).
+ */
+class StringRef
+{
+public:
+	StringRef():_data(NULL),_size(0){}
+	StringRef(const char* data, size_t size):_data(data),_size(size){}
+
+	const char* data()const{return _data;}
+	size_t size()const{return _size;}
+	bool empty()const{return _size==0;}
+	std::string str()const{return std::string(_data, _size);}
+
+	bool startsWith(const std::string& str)const
+	{
+		return _size>=str.size() && memcmp(_data, str.data(), str.size())==0;
+	}
+	bool operator==(const std::string& str)const
+	{
+		return _size==str.size() && memcmp(_data, str.data(), _size)==0;
+	}
+
+private:
+	const char* _data;
+	size_t _size;
+};
+
+/**
+ * Receive buffer, split in lines.
+ * Data is received in place, and lines are handed out as pointers into the
+ * buffer, which stay valid until the next call to space(). Only the
+ * incomplete last line is ever moved, to make room at the end.
+ */
+class LineBuffer
+{
+public:
+	LineBuffer():_data(4096),_head(0),_scan(0),_tail(0){}
+
+	/**
+	 * Retrieve the next complete line (without its end of line).
+	 * \return Start of the line, or NULL if none is complete yet.
+	 */
+	char* next(size_t& len);
+	/**
+	 * Retrieve the free space at the end of the buffer, to receive into.
+	 */
+	char* space(size_t& len);
+	/**
+	 * Account for data received in the free space.
+	 */
+	void commit(size_t len){_tail += len;}
+	void clear(){_head = _scan = _tail = 0;}
+
+private:
+	std::vector<char> _data;
+	size_t _head; /* Start of the first line not handed out yet */
+	size_t _scan; /* Where to look for the next end of line */
+	size_t _tail; /* End of received data */
+};
+
+char* LineBuffer::next(size_t& len)
+{
+	char* base = &_data[0];
+	char* eol = (char*)memchr(base + _scan, '\n', _tail - _scan);
+
+	if(eol == NULL)
+	{
+		_scan = _tail;
+		return NULL;
+	}
+
+	char* line = base + _head;
+	len = eol - line;
+	_head = _scan = eol - base + 1;
+	return line;
+}
+
+char* LineBuffer::space(size_t& len)
+{
+	if(_head == _tail)
+	{
+		// Everything was handed out: start over
+		_head = _scan = _tail = 0;
+	}
+	else if(_tail == _data.size())
+	{
+		if(_head > 0)
+		{
+			memmove(&_data[0], &_data[_head], _tail - _head);
+			_scan -= _head;
+			_tail -= _head;
+			_head = 0;
+		}
+		else
+		{
+			// A single line fills the whole buffer
+			_data.resize(_data.size() * 2);
+		}
+	}
+
+	len = _data.size() - _tail;
+	return &_data[_tail];
+}
+
+/**
+ * Split a line into words, with the grammar of TcpClient::explode(), but in
+ * place: escapes are resolved inside the line itself (the result is never
+ * longer), and words point into it.
+ */
+static void tokenize(char* begin, char* end, std::vector<StringRef>& res)
+{
+	char* out = begin;
+	char* word = begin;
+
+	enum STATE {
+		INIT,
+		SIMPLE_STRING,
+		QUOTED_STRING,
+		SIMPLE_ESCAPE,
+		QUOTED_ESCAPE
+	} state = INIT;
+
+	res.clear();
+
+	for(char* in=begin; in<end; ++in)
+	{
+		char c = *in;
+		switch(state)
+		{
+		case INIT:
+			if(c==' ' /* || c=='\t' */)
+			{ /* Do nothing */ }
+			else if(c=='"')
+			{
+				word = out;
+				state = QUOTED_STRING;
+			}
+			else if(c=='\\')
+			{
+				word = out;
+				state = SIMPLE_ESCAPE;
+			}
+			/* What about bad characters ? */
+			else
+			{
+				word = out;
+				*out++ = c;
+				state = SIMPLE_STRING;
+			}
+			break;
+		case SIMPLE_STRING:
+			if(c==' ' /* || c=='\t' */)
+			{
+				res.push_back(StringRef(word, out - word));
+				state = INIT;
+			}
+			else if(c=='\\')
+			{
+				state = SIMPLE_ESCAPE;
+			}
+			else if(c=='"')
+			{
+				res.push_back(StringRef(word, out - word));
+				word = out;
+				state = QUOTED_STRING;
+			}
+			/* What about bad characters ? */
+			else
+			{
+				*out++ = c;
+			}
+			break;
+		case QUOTED_STRING:
+			if(c=='\\')
+			{
+				state = QUOTED_ESCAPE;
+			}
+			else if(c=='"')
+			{
+				res.push_back(StringRef(word, out - word));
+				state = INIT;
+			}
+			/* What about bad characters ? */
+			else
+			{
+				*out++ = c;
+			}
+			break;
+		case SIMPLE_ESCAPE:
+			if(c=='\\' || c=='"' || c==' ' /* || c=='\t'*/)
+			{
+				*out++ = c;
+			}
+			else
+			{
+				/* Unknown escape: keep it as is (two characters were read) */
+				*out++ = '\\';
+				*out++ = c;
+			}
+			state = SIMPLE_STRING;
+			break;
+		case QUOTED_ESCAPE:
+			if(c=='\\' || c=='"')
+			{
+				*out++ = c;
+			}
+			else
+			{
+				*out++ = '\\';
+				*out++ = c;
+			}
+			state = QUOTED_STRING;
+			break;
+		}
+	}
+
+	if(state != INIT && out > word)
+	{
+		res.push_back(StringRef(word, out - word));
+	}
+}
+
+/**
+ * Copy words (starting at the first-th) into strings.
+ */
+static void materialize(const std::vector<StringRef>& words, size_t first, std::vector<std::string>& res)
+{
+	res.clear();
+	if(first >= words.size())
+		return;
+
+	res.reserve(words.size() - first);
+	for(size_t n=first; n<words.size(); ++n)
+	{
+		res.push_back(words[n].str());
+	}
+}
+
+/**
+ * Throw the NutException matching an "ERR ..." line.
+ */
+static void detectError(const StringRef& line)throw(nut::NutException)
+{
+	if(line.startsWith("ERR"))
+	{
+		throw nut::NutException(line.size() > 4 ? std::string(line.data() + 4, line.size() - 4) : std::string());
+	}
+}
+
 /**
  * Internal socket wrapper.
  * Provides only client socket functions.
@@ -97,9 +353,14 @@ public:
 	Socket();
 	~Socket();
 
+	/**
+	 * Connect to host:port, or to the Unix socket <path> if host is
+	 * "unix:<path>".
+	 */
 	void connect(const std::string& host, int port)throw(nut::IOException);
 	void disconnect();
 	bool isConnected()const;
+	SOCKET getFd()const{return _sock;}
 
 	void setTimeout(long timeout);
 	bool hasTimeout()const{return _tv.tv_sec>=0;}
@@ -107,14 +368,26 @@ public:
 	size_t read(void* buf, size_t sz)throw(nut::IOException);
 	size_t write(const void* buf, size_t sz)throw(nut::IOException);
 
+	/**
+	 * Read a line, in place.
+	 * \return Start of the line (not terminated), valid until the next read.
+	 */
+	char* readLine(size_t& len)throw(nut::IOException);
 	std::string read()throw(nut::IOException);
 	void write(const std::string& str)throw(nut::IOException);
+	/**
+	 * Write lines with as few system calls (and packets) as possible.
+	 */
+	void write(const std::vector<std::string>& lines)throw(nut::IOException);
 
 
 private:
+	void connectUnix(const std::string& path)throw(nut::IOException);
+	void writev(struct iovec* iov, int iovcnt)throw(nut::IOException);
+
 	SOCKET _sock;
 	struct timeval	_tv;
-	std::string _buffer; /* Received buffer, string because data should be text only. */
+	LineBuffer _buffer; /* Received data */
 };
 
 Socket::Socket():
@@ -145,6 +418,7 @@ void Socket::connect(const std::string& host, int port)throw(nut::IOException)
 	int			error;
 	socklen_t		error_size;
 	long			fd_flags;
+	int			tries;
 
 	_sock = -1;
 
@@ -152,6 +426,11 @@ void Socket::connect(const std::string& host, int port)throw(nut::IOException)
 		throw nut::UnknownHostException();
 	}
 
+	if (host.compare(0, 5, "unix:") == 0) {
+		connectUnix(host.substr(5));
+		return;
+	}
+
 	snprintf(sport, sizeof(sport), "%hu", (unsigned short int)port);
 
 	memset(&hints, 0, sizeof(hints));
@@ -159,11 +438,17 @@ void Socket::connect(const std::string& host, int port)throw(nut::IOException)
 	hints.ai_socktype = SOCK_STREAM;
 	hints.ai_protocol = IPPROTO_TCP;
 
-	while ((v = getaddrinfo(host.c_str(), sport, &hints, &res)) != 0) {
+	for (tries = 0; (v = getaddrinfo(host.c_str(), sport, &hints, &res)) != 0; tries++) {
 		switch (v)
 		{
 		case EAI_AGAIN:
-			continue;
+			/* resolver temporarily unavailable: back off a little,
+			 * but do not spin forever on a dead DNS server */
+			if (tries < 3) {
+				usleep(100000 << tries);
+				continue;
+			}
+			throw nut::IOException("Temporary failure in name resolution");
 		case EAI_NONAME:
 			throw nut::UnknownHostException();
 		case EAI_SYSTEM:
@@ -248,6 +533,11 @@ void Socket::connect(const std::string& host, int port)throw(nut::IOException)
 			fcntl(sock_fd, F_SETFL, fd_flags);
 		}
 
+		/* requests are small and answered before the next one is
+		 * sent (or sent together): do not wait for more data */
+		v = 1;
+		setsockopt(sock_fd, IPPROTO_TCP, TCP_NODELAY, &v, sizeof(v));
+
 		_sock = sock_fd;
 //		ups->upserror = 0;
 //		ups->syserrno = 0;
@@ -289,6 +579,36 @@ void Socket::connect(const std::string& host, int port)throw(nut::IOException)
 #endif // OLD
 }
 
+void Socket::connectUnix(const std::string& path)throw(nut::IOException)
+{
+	struct sockaddr_un	sa;
+	int			sock_fd;
+
+	if (path.empty() || path.size() >= sizeof(sa.sun_path)) {
+		throw nut::UnknownHostException();
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	memcpy(sa.sun_path, path.c_str(), path.size());
+
+	sock_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sock_fd < 0) {
+		throw nut::SystemException();
+	}
+
+	/* local connections complete (or fail) at once: no timeout needed */
+	while (::connect(sock_fd, (struct sockaddr *) &sa, sizeof(sa)) < 0) {
+		if (errno == EINTR) {
+			continue;
+		}
+		close(sock_fd);
+		throw nut::IOException("Cannot connect to host");
+	}
+
+	_sock = sock_fd;
+}
+
 void Socket::disconnect()
 {
 	if(_sock != INVALID_SOCKET)
@@ -358,43 +678,162 @@ size_t Socket::write(const void* buf, size_t sz)throw(nut::IOException)
 	return (size_t) res;
 }
 
+char* Socket::readLine(size_t& len)throw(nut::IOException)
+{
+	char* line;
+
+	while((line = _buffer.next(len)) == NULL)
+	{
+		// Read directly in the buffer
+		size_t sz;
+		char* space = _buffer.space(sz);
+		sz = read(space, sz);
+		if(sz==0)
+		{
+			disconnect();
+			throw nut::IOException("Server closed connection unexpectedly");
+		}
+		_buffer.commit(sz);
+	}
+
+	return line;
+}
+
 std::string Socket::read()throw(nut::IOException)
 {
-	std::string res;
-	char buff[256];
+	size_t len;
+	char* line = readLine(len);
+	return std::string(line, len);
+}
+
+/**
+ * Reader for the lines of a LIST answer.
+ * The header is checked on construction, then next() returns the words of
+ * each line (except the "<subject>" prefix) until the footer.
+ */
+class ListReader
+{
+public:
+	ListReader(Socket& socket, const std::string& req)throw(nut::NutException);
+
+	bool next(std::vector<StringRef>& words)throw(nut::NutException);
+
+private:
+	Socket& _socket;
+	const std::string& _req;
+	std::string _end;
+};
+
+ListReader::ListReader(Socket& socket, const std::string& req)throw(nut::NutException):
+_socket(socket),
+_req(req),
+_end("END LIST " + req)
+{
+	size_t len;
+	char* line = _socket.readLine(len);
+	StringRef res(line, len);
+
+	detectError(res);
+	if(!(res.size() == 11 + req.size() && res.startsWith("BEGIN LIST ")
+		&& memcmp(line + 11, req.data(), req.size()) == 0))
+	{
+		throw nut::NutException("Invalid response");
+	}
+}
+
+bool ListReader::next(std::vector<StringRef>& words)throw(nut::NutException)
+{
+	size_t len;
+	char* line = _socket.readLine(len);
+	StringRef res(line, len);
+
+	detectError(res);
+	if(res == _end)
+	{
+		return false;
+	}
+	if(!res.startsWith(_req))
+	{
+		throw nut::NutException("Invalid response");
+	}
+
+	tokenize(line + _req.size(), line + len, words);
+	return true;
+}
+
+void Socket::writev(struct iovec* iov, int iovcnt)throw(nut::IOException)
+{
+	if(!isConnected())
+	{
+		throw nut::NotConnectedException();
+	}
 
-	while(true)
+	while(iovcnt > 0)
 	{
-		// Look at already read data in _buffer
-		if(!_buffer.empty())
+		if(_tv.tv_sec>=0)
 		{
-			size_t idx = _buffer.find('\n');
-			if(idx!=std::string::npos)
-			{
-				res += _buffer.substr(0, idx);
-				_buffer.erase(0, idx+1);
-				return res;
+			struct timeval tv = _tv;
+			fd_set fds;
+			FD_ZERO(&fds);
+			FD_SET(_sock, &fds);
+			int ret = select(_sock+1, NULL, &fds, NULL, &tv);
+			if (ret < 1) {
+				throw nut::TimeoutException();
 			}
-			res += _buffer;
 		}
 
-		// Read new buffer
-		size_t sz = read(&buff, 256);
-		if(sz==0)
+		ssize_t res = ::writev(_sock, iov, iovcnt > IOV_MAX ? IOV_MAX : iovcnt);
+		if(res==-1)
 		{
+			if(errno == EINTR)
+				continue;
 			disconnect();
-			throw nut::IOException("Server closed connection unexpectedly");
+			throw nut::IOException("Error while writing on socket");
+		}
+
+		// Skip what was written
+		while(iovcnt > 0 && (size_t)res >= iov->iov_len)
+		{
+			res -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if(iovcnt > 0)
+		{
+			iov->iov_base = (char*)iov->iov_base + res;
+			iov->iov_len -= res;
 		}
-		_buffer.assign(buff, sz);
 	}
 }
 
 void Socket::write(const std::string& str)throw(nut::IOException)
 {
-//	write(str.c_str(), str.size());
-//	write("\n", 1);
-	std::string buff = str + "\n";
-	write(buff.c_str(), buff.size());
+	struct iovec iov[2];
+
+	iov[0].iov_base = const_cast<char*>(str.data());
+	iov[0].iov_len = str.size();
+	iov[1].iov_base = const_cast<char*>("\n");
+	iov[1].iov_len = 1;
+
+	writev(iov, 2);
+}
+
+void Socket::write(const std::vector<std::string>& lines)throw(nut::IOException)
+{
+	if(lines.empty())
+		return;
+
+	std::vector<struct iovec> iov(lines.size() * 2);
+
+	for(size_t n=0; n<lines.size(); ++n)
+	{
+		iov[2*n].iov_base = const_cast<char*>(lines[n].data());
+		iov[2*n].iov_len = lines[n].size();
+		iov[2*n+1].iov_base = const_cast<char*>("\n");
+		iov[2*n+1].iov_len = 1;
+	}
+
+	writev(&iov[0], iov.size());
 }
 
 }/* namespace internal */
@@ -449,6 +888,24 @@ bool Client::hasDeviceVariable(const std::string& dev, const std::string& name)t
 	return names.find(name) != names.end();
 }
 
+double Client::getDeviceVariableNumber(const std::string& dev, const std::string& name)throw(NutException)
+{
+	std::vector<std::string> values = getDeviceVariableValue(dev, name);
+	if(values.empty())
+	{
+		throw NutException("INVALID-VALUE");
+	}
+
+	const char* str = values[0].c_str();
+	char* end;
+	double number = strtod(str, &end);
+	if(end == str || *end != '\0')
+	{
+		throw NutException("INVALID-VALUE");
+	}
+	return number;
+}
+
 std::map<std::string,std::vector<std::string> > Client::getDeviceVariableValues(const std::string& dev)throw(NutException)
 {
   std::map<std::string,std::vector<std::string> > res;
@@ -650,22 +1107,35 @@ std::vector<std::string> TcpClient::getDeviceVariableValue(const std::string& de
 	return get("VAR", dev + " " + name);
 }
 
-std::map<std::string,std::vector<std::string> > TcpClient::getDeviceVariableValues(const std::string& dev)throw(NutException)
+double TcpClient::getDeviceVariableNumber(const std::string& dev, const std::string& name)throw(NutException)
 {
-
-	std::map<std::string,std::vector<std::string> >  map;
-	
-	std::vector<std::vector<std::string> > res = list("VAR", dev);
-	for(size_t n=0; n<res.size(); ++n)
+	std::vector<std::string> res;
+	try
+	{
+		res = get("VARNUM", dev + " " + name);
+	}
+	catch(NutException& ex)
 	{
-		std::vector<std::string>& vals = res[n];
-		std::string var = vals[0];
-		vals.erase(vals.begin());
-		map[var] = vals;
+		// Servers predating GET VARNUM: parse the text value ourselves.
+		if(ex.str() != "INVALID-ARGUMENT")
+			throw;
+		return Client::getDeviceVariableNumber(dev, name);
 	}
 
-	return map;
-}
+	if(res.empty())
+	{
+		throw NutException("Invalid response");
+	}
+	return strtod(res[0].c_str(), NULL);
+}
+
+std::map<std::string,std::vector<std::string> > TcpClient::getDeviceVariableValues(const std::string& dev)throw(NutException)
+{
+	std::vector<std::string> query;
+	query.push_back("LIST VAR " + dev);
+	sendAsyncQueries(query);
+	return parseListValues("VAR " + dev);
+}
 
 std::map<std::string,std::map<std::string,std::vector<std::string> > > TcpClient::getDevicesVariableValues(const std::set<std::string>& devs)throw(NutException)
 {
@@ -682,16 +1152,7 @@ std::map<std::string,std::map<std::string,std::vector<std::string> > > TcpClient
 	{
 		try
 		{
-			std::map<std::string,std::vector<std::string> > map2;
-			std::vector<std::vector<std::string> > res = parseList("VAR " + *it);
-			for (std::vector<std::vector<std::string> >::iterator it2=res.begin(); it2!=res.end(); ++it2)
-			{
-				std::vector<std::string>& vals = *it2;
-				std::string var = vals[0];
-				vals.erase(vals.begin()),
-				map2[var] = vals;
-			}
-			map[*it] = map2;
+			map[*it] = parseListValues("VAR " + *it);
 		}
 		catch (NutException&)
 		{
@@ -716,345 +1177,2348 @@ TrackingID TcpClient::setDeviceVariable(const std::string& dev, const std::strin
 
 TrackingID TcpClient::setDeviceVariable(const std::string& dev, const std::string& name, const std::vector<std::string>& values)throw(NutException)
 {
-	std::string query = "SET VAR " + dev + " " + name;
-	for(size_t n=0; n<values.size(); ++n)
+	std::string query = "SET VAR " + dev + " " + name;
+	for(size_t n=0; n<values.size(); ++n)
+	{
+		query += " " + escape(values[n]);
+	}
+	return sendTrackingQuery(query);
+}
+
+std::set<std::string> TcpClient::getDeviceCommandNames(const std::string& dev)throw(NutException)
+{
+	std::set<std::string> cmds;
+
+	std::vector<std::vector<std::string> > res = list("CMD", dev);
+	for(size_t n=0; n<res.size(); ++n)
+	{
+		cmds.insert(res[n][0]);
+	}
+
+	return cmds;
+}
+
+std::string TcpClient::getDeviceCommandDescription(const std::string& dev, const std::string& name)throw(NutException)
+{
+	return get("CMDDESC", dev + " " + name)[0];
+}
+
+TrackingID TcpClient::executeDeviceCommand(const std::string& dev, const std::string& name, const std::string& param)throw(NutException)
+{
+	return sendTrackingQuery("INSTCMD " + dev + " " + name + " " + param);
+}
+
+void TcpClient::deviceLogin(const std::string& dev)throw(NutException)
+{
+	detectError(sendQuery("LOGIN " + dev));
+}
+
+void TcpClient::deviceMaster(const std::string& dev)throw(NutException)
+{
+	detectError(sendQuery("MASTER " + dev));
+}
+
+void TcpClient::deviceForcedShutdown(const std::string& dev)throw(NutException)
+{
+	detectError(sendQuery("FSD " + dev));
+}
+
+int TcpClient::deviceGetNumLogins(const std::string& dev)throw(NutException)
+{
+	std::string num = get("NUMLOGINS", dev)[0];
+	return atoi(num.c_str());
+}
+
+TrackingResult TcpClient::getTrackingResult(const TrackingID& id)throw(NutException)
+{
+	if (id.empty())
+	{
+		return TrackingResult::SUCCESS;
+	}
+
+	std::string result = sendQuery("GET TRACKING " + id);
+
+	if (result == "PENDING")
+	{
+		return TrackingResult::PENDING;
+	}
+	else if (result == "SUCCESS")
+	{
+		return TrackingResult::SUCCESS;
+	}
+	else if (result == "ERR UNKNOWN")
+	{
+		return TrackingResult::UNKNOWN;
+	}
+	else if (result == "ERR INVALID-ARGUMENT")
+	{
+		return TrackingResult::INVALID_ARGUMENT;
+	}
+	else
+	{
+		return TrackingResult::FAILURE;
+	}
+}
+
+bool TcpClient::isFeatureEnabled(const Feature& feature)throw(NutException)
+{
+	std::string result = sendQuery("GET " + feature);
+	detectError(result);
+
+	if (result == "ON")
+	{
+		return true;
+	}
+	else if (result == "OFF")
+	{
+		return false;
+	}
+	else
+	{
+		throw NutException("Unknown feature result " + result);
+	}
+}
+void TcpClient::setFeature(const Feature& feature, bool status)throw(NutException)
+{
+	std::string result = sendQuery("SET " + feature + " " + (status ? "ON" : "OFF"));
+	detectError(result);
+}
+
+std::vector<std::string> TcpClient::get
+	(const std::string& subcmd, const std::string& params) throw(NutException)
+{
+	std::string req = subcmd;
+	if(!params.empty())
+	{
+		req += " " + params;
+	}
+	_socket->write("GET " + req);
+
+	size_t len;
+	char* line = _socket->readLine(len);
+	internal::StringRef res(line, len);
+	internal::detectError(res);
+	if(!res.startsWith(req))
+	{
+		throw NutException("Invalid response");
+	}
+
+	std::vector<internal::StringRef> words;
+	internal::tokenize(line + req.size(), line + len, words);
+
+	std::vector<std::string> vals;
+	internal::materialize(words, 0, vals);
+	return vals;
+}
+
+std::vector<std::vector<std::string> > TcpClient::list
+	(const std::string& subcmd, const std::string& params) throw(NutException)
+{
+	std::string req = subcmd;
+	if(!params.empty())
+	{
+		req += " " + params;
+	}
+	std::vector<std::string> query;
+	query.push_back("LIST " + req);
+	sendAsyncQueries(query);
+	return parseList(req);
+}
+
+std::vector<std::vector<std::string> > TcpClient::parseList
+	(const std::string& req) throw(NutException)
+{
+	internal::ListReader reader(*_socket, req);
+	std::vector<internal::StringRef> words;
+
+	std::vector<std::vector<std::string> > arr;
+	while(reader.next(words))
+	{
+		arr.push_back(std::vector<std::string>());
+		internal::materialize(words, 0, arr.back());
+	}
+	return arr;
+}
+
+std::map<std::string,std::vector<std::string> > TcpClient::parseListValues
+	(const std::string& req) throw(NutException)
+{
+	internal::ListReader reader(*_socket, req);
+	std::vector<internal::StringRef> words;
+
+	std::map<std::string,std::vector<std::string> > map;
+	while(reader.next(words))
+	{
+		if(words.empty())
+			continue;
+		internal::materialize(words, 1, map[words[0].str()]);
+	}
+	return map;
+}
+
+std::string TcpClient::sendQuery(const std::string& req)throw(IOException)
+{
+	_socket->write(req);
+	return _socket->read();
+}
+
+void TcpClient::sendAsyncQueries(const std::vector<std::string>& req)throw(IOException)
+{
+	_socket->write(req);
+}
+
+void TcpClient::detectError(const std::string& req)throw(NutException)
+{
+	if(req.substr(0,3)=="ERR")
+	{
+		throw NutException(req.substr(4));
+	}
+}
+
+std::vector<std::string> TcpClient::explode(const std::string& str, size_t begin)
+{
+	std::vector<std::string> res;
+
+	if(begin >= str.size())
+	{
+		return res;
+	}
+
+	// Tokenized in place, so work on a copy
+	std::vector<char> buff(str.begin() + begin, str.end());
+	std::vector<internal::StringRef> words;
+	internal::tokenize(&buff[0], &buff[0] + buff.size(), words);
+	internal::materialize(words, 0, res);
+
+	return res;
+}
+
+std::string TcpClient::escape(const std::string& str)
+{
+	std::string res = "\"";
+	
+	for(size_t n=0; n<str.size(); n++)
+	{
+		char c = str[n];
+		if(c=='"')
+			res += "\\\"";
+		else if(c=='\\')
+			res += "\\\\";
+		else
+			res += c;
+	}
+
+	res += '"';
+	return res; 
+}
+
+TrackingID TcpClient::sendTrackingQuery(const std::string& req)throw(NutException)
+{
+	std::string reply = sendQuery(req);
+	detectError(reply);
+	std::vector<std::string> res = explode(reply);
+
+	if (res.size() == 1 && res[0] == "OK")
+	{
+		return TrackingID("");
+	}
+	else if (res.size() == 3 && res[0] == "OK" && res[1] == "TRACKING")
+	{
+		return TrackingID(res[2]);
+	}
+	else
+	{
+		throw NutException("Unknown query result");
+	}
+}
+
+/*
+ *
+ * Unix client implementation
+ *
+ */
+
+UnixClient::UnixClient(const std::string& path)throw(IOException):
+TcpClient(path.compare(0, 5, "unix:") == 0 ? path : "unix:" + path)
+{
+}
+
+std::string UnixClient::getPath()const
+{
+	return getHost().substr(5);
+}
+
+/*
+ *
+ * Asynchronous client implementation
+ *
+ */
+
+namespace internal
+{
+
+/**
+ * Request sent by an AsyncClient, waiting for its answer.
+ */
+struct AsyncRequest
+{
+	std::string req; /* Subject of LIST answers (ex: "VAR ups"). */
+	bool list; /* Multi-line answer expected. */
+	bool begun; /* "BEGIN LIST" received. */
+	std::vector<std::string> lines;
+	bool hasDeadline;
+	std::chrono::steady_clock::time_point deadline;
+	std::function<void(const std::vector<std::string>&, std::exception_ptr)> done;
+};
+
+template<typename T>
+static void fulfil(std::promise<T>& promise,
+	const std::function<T(const std::vector<std::string>&)>& parse,
+	const std::vector<std::string>& lines)
+{
+	promise.set_value(parse(lines));
+}
+
+static void fulfil(std::promise<void>& promise,
+	const std::function<void(const std::vector<std::string>&)>& parse,
+	const std::vector<std::string>& lines)
+{
+	parse(lines);
+	promise.set_value();
+}
+
+} /* namespace internal */
+
+AsyncLoop::AsyncLoop()
+{
+}
+
+AsyncLoop::~AsyncLoop()
+{
+	// Clients left over are disconnected, and can only be destroyed now.
+	// Their callbacks may destroy some of them.
+	std::vector<std::pair<AsyncClient*, std::shared_ptr<bool> > > clients;
+	for(std::vector<AsyncClient*>::iterator it=_clients.begin(); it!=_clients.end(); ++it)
+	{
+		(*it)->_loop = NULL;
+		clients.push_back(std::make_pair(*it, (*it)->_alive));
+	}
+	_clients.clear();
+	for(size_t i = 0; i < clients.size(); i++)
+	{
+		if(*clients[i].second)
+			clients[i].first->disconnect();
+	}
+}
+
+void AsyncLoop::attach(AsyncClient* client)
+{
+	_clients.push_back(client);
+}
+
+void AsyncLoop::detach(AsyncClient* client)
+{
+	_clients.erase(std::remove(_clients.begin(), _clients.end(), client), _clients.end());
+}
+
+size_t AsyncLoop::pending()const
+{
+	size_t count = 0;
+	for(std::vector<AsyncClient*>::const_iterator it=_clients.begin(); it!=_clients.end(); ++it)
+	{
+		count += (*it)->pending();
+	}
+	return count;
+}
+
+size_t AsyncLoop::runOnce(long timeout)
+{
+	typedef std::chrono::steady_clock clock;
+
+	clock::time_point now = clock::now(), deadline, next;
+	bool hasDeadline = false;
+	struct timeval tv, *ptv = NULL;
+	fd_set rfds, wfds;
+	SOCKET maxfd = INVALID_SOCKET;
+	size_t completed = 0;
+
+	if(timeout >= 0)
+	{
+		deadline = now + std::chrono::milliseconds(timeout);
+		hasDeadline = true;
+	}
+
+	FD_ZERO(&rfds);
+	FD_ZERO(&wfds);
+
+	for(std::vector<AsyncClient*>::iterator it=_clients.begin(); it!=_clients.end(); ++it)
+	{
+		AsyncClient* client = *it;
+		if(!client->isConnected())
+			continue;
+
+		SOCKET fd = client->_socket->getFd();
+		FD_SET(fd, &rfds);
+		if(client->wantWrite())
+			FD_SET(fd, &wfds);
+		if(maxfd == INVALID_SOCKET || fd > maxfd)
+			maxfd = fd;
+
+		if(client->nextDeadline(next) && (!hasDeadline || next < deadline))
+		{
+			deadline = next;
+			hasDeadline = true;
+		}
+	}
+
+	if(maxfd == INVALID_SOCKET)
+	{
+		// Nothing to wait for
+		return 0;
+	}
+
+	if(hasDeadline)
+	{
+		long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count();
+		if(ms < 0)
+			ms = 0;
+		tv.tv_sec = ms / 1000;
+		tv.tv_usec = (ms % 1000) * 1000;
+		ptv = &tv;
+	}
+
+	if(select(maxfd+1, &rfds, &wfds, NULL, ptv) < 0)
+	{
+		if(errno == EINTR)
+			return 0;
+		throw nut::SystemException();
+	}
+
+	now = clock::now();
+
+	// Callbacks may create or destroy clients: work on a copy, and check
+	// that a client is still alive after each call that may run some.
+	std::vector<std::pair<AsyncClient*, std::shared_ptr<bool> > > clients;
+	for(std::vector<AsyncClient*>::iterator it=_clients.begin(); it!=_clients.end(); ++it)
+	{
+		clients.push_back(std::make_pair(*it, (*it)->_alive));
+	}
+	for(size_t i = 0; i < clients.size(); i++)
+	{
+		AsyncClient* client = clients[i].first;
+		const std::shared_ptr<bool>& alive = clients[i].second;
+		if(!*alive || !client->isConnected())
+			continue;
+
+		SOCKET fd = client->_socket->getFd();
+		if(FD_ISSET(fd, &wfds))
+			client->onWritable();
+		if(*alive && client->isConnected() && FD_ISSET(fd, &rfds))
+			completed += client->onReadable();
+		if(*alive)
+			completed += client->onTimeout(now);
+	}
+
+	return completed;
+}
+
+bool AsyncLoop::run(long timeout)
+{
+	typedef std::chrono::steady_clock clock;
+
+	clock::time_point end = clock::now() + std::chrono::milliseconds(timeout);
+
+	while(pending() > 0)
+	{
+		long left = -1;
+		if(timeout >= 0)
+		{
+			left = std::chrono::duration_cast<std::chrono::milliseconds>(end - clock::now()).count();
+			if(left <= 0)
+				return false;
+		}
+		runOnce(left);
+	}
+
+	return true;
+}
+
+AsyncClient::AsyncClient(AsyncLoop& loop):
+_loop(&loop),
+_alive(std::make_shared<bool>(true)),
+_timeout(-1),
+_socket(new internal::Socket),
+_in(new internal::LineBuffer),
+_generation(0)
+{
+	_loop->attach(this);
+}
+
+AsyncClient::~AsyncClient()
+{
+	disconnect();
+	*_alive = false;
+	if(_loop)
+		_loop->detach(this);
+	delete _in;
+	delete _socket;
+}
+
+void AsyncClient::connect(const std::string& host, int port)throw(nut::IOException)
+{
+	disconnect();
+
+	_socket->setTimeout(_timeout);
+	_socket->connect(host, port);
+
+	// From now on, the loop does all the waiting
+	long fd_flags = fcntl(_socket->getFd(), F_GETFL);
+	fcntl(_socket->getFd(), F_SETFL, fd_flags | O_NONBLOCK);
+}
+
+bool AsyncClient::isConnected()const
+{
+	return _socket->isConnected();
+}
+
+void AsyncClient::disconnect()
+{
+	drop(std::make_exception_ptr(NotConnectedException()));
+}
+
+void AsyncClient::setTimeout(long timeout)
+{
+	_timeout = timeout;
+}
+
+long AsyncClient::getTimeout()const
+{
+	return _timeout;
+}
+
+size_t AsyncClient::pending()const
+{
+	return _pending.size();
+}
+
+template<typename T>
+std::shared_future<T> AsyncClient::submit(const std::string& query, const std::string& req, bool list,
+	const std::function<T(const std::vector<std::string>&)>& parse, const AsyncCallback<T>& cb)
+{
+	if(!isConnected())
+	{
+		throw NotConnectedException();
+	}
+
+	std::shared_ptr<std::promise<T> > promise = std::make_shared<std::promise<T> >();
+	std::shared_future<T> future = promise->get_future().share();
+
+	internal::AsyncRequest* request = new internal::AsyncRequest;
+	request->req = req;
+	request->list = list;
+	request->begun = false;
+	request->hasDeadline = _timeout >= 0;
+	if(request->hasDeadline)
+	{
+		request->deadline = std::chrono::steady_clock::now() + std::chrono::seconds(_timeout);
+	}
+	request->done = [promise, future, parse, cb](const std::vector<std::string>& lines, std::exception_ptr err)
+	{
+		if(err)
+		{
+			promise->set_exception(err);
+		}
+		else
+		{
+			try
+			{
+				internal::fulfil(*promise, parse, lines);
+			}
+			catch(...)
+			{
+				promise->set_exception(std::current_exception());
+			}
+		}
+		if(cb)
+		{
+			cb(future);
+		}
+	};
+
+	_pending.push_back(request);
+	_out += query;
+	_out += '\n';
+
+	// Send right away if the socket can take it
+	onWritable();
+
+	return future;
+}
+
+bool AsyncClient::wantWrite()const
+{
+	return !_out.empty();
+}
+
+void AsyncClient::onWritable()
+{
+	if(_out.empty() || !isConnected())
+		return;
+
+	ssize_t res = ::write(_socket->getFd(), _out.data(), _out.size());
+	if(res < 0)
+	{
+		if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+			return;
+		drop(std::make_exception_ptr(IOException("Error while writing on socket")));
+		return;
+	}
+	_out.erase(0, res);
+}
+
+size_t AsyncClient::onReadable()
+{
+	size_t sz;
+	char* space = _in->space(sz);
+
+	ssize_t res = ::read(_socket->getFd(), space, sz);
+	if(res < 0)
+	{
+		if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+			return 0;
+		return drop(std::make_exception_ptr(IOException("Error while reading on socket")));
+	}
+	if(res == 0)
+	{
+		return drop(std::make_exception_ptr(IOException("Server closed connection unexpectedly")));
+	}
+	_in->commit(res);
+
+	// Stop if a callback destroys the client, or drops the connection (and
+	// the buffer with it). Nothing of this must be touched then.
+	std::shared_ptr<bool> alive = _alive;
+	size_t completed = 0, len;
+	unsigned long generation = _generation;
+	char* line;
+	while(*alive && generation == _generation && (line = _in->next(len)) != NULL)
+	{
+		completed += processLine(std::string(line, len));
+	}
+	return completed;
+}
+
+size_t AsyncClient::onTimeout(const std::chrono::steady_clock::time_point& now)
+{
+	std::chrono::steady_clock::time_point deadline;
+
+	if(nextDeadline(deadline) && deadline <= now)
+	{
+		return drop(std::make_exception_ptr(TimeoutException()));
+	}
+	return 0;
+}
+
+bool AsyncClient::nextDeadline(std::chrono::steady_clock::time_point& deadline)const
+{
+	// Answers come in order: only the oldest request can be late.
+	if(_pending.empty() || !_pending.front()->hasDeadline)
+		return false;
+	deadline = _pending.front()->deadline;
+	return true;
+}
+
+size_t AsyncClient::processLine(const std::string& line)
+{
+	if(_pending.empty())
+	{
+		return drop(std::make_exception_ptr(NutException("Unexpected response")));
+	}
+
+	internal::AsyncRequest* request = _pending.front();
+
+	if(!request->list)
+	{
+		request->lines.push_back(line);
+		return complete(std::exception_ptr());
+	}
+
+	if(!request->begun)
+	{
+		try
+		{
+			TcpClient::detectError(line);
+		}
+		catch(...)
+		{
+			return complete(std::current_exception());
+		}
+		if(line != "BEGIN LIST " + request->req)
+		{
+			return drop(std::make_exception_ptr(NutException("Invalid response")));
+		}
+		request->begun = true;
+		return 0;
+	}
+
+	if(line.compare(0, 9, "END LIST ") == 0 && line.compare(9, std::string::npos, request->req) == 0)
+	{
+		return complete(std::exception_ptr());
+	}
+	if(line.compare(0, request->req.size(), request->req) != 0)
+	{
+		return drop(std::make_exception_ptr(NutException("Invalid response")));
+	}
+	request->lines.push_back(line);
+	return 0;
+}
+
+size_t AsyncClient::complete(std::exception_ptr err)
+{
+	internal::AsyncRequest* request = _pending.front();
+	_pending.pop_front();
+
+	request->done(request->lines, err);
+	delete request;
+
+	return 1;
+}
+
+size_t AsyncClient::drop(std::exception_ptr err)
+{
+	_generation++;
+	_socket->disconnect();
+	_out.clear();
+	_in->clear();
+
+	// Callbacks may issue new requests: fail only the current ones.
+	std::deque<internal::AsyncRequest*> requests;
+	requests.swap(_pending);
+
+	for(std::deque<internal::AsyncRequest*>::iterator it=requests.begin(); it!=requests.end(); ++it)
+	{
+		(*it)->done((*it)->lines, err);
+		delete *it;
+	}
+
+	return requests.size();
+}
+
+std::vector<std::string> AsyncClient::parseGet(const std::string& req, const std::vector<std::string>& lines)
+	throw(NutException)
+{
+	const std::string& res = lines[0];
+	TcpClient::detectError(res);
+	if(res.substr(0, req.size()) != req)
+	{
+		throw NutException("Invalid response");
+	}
+	return TcpClient::explode(res, req.size());
+}
+
+std::vector<std::vector<std::string> > AsyncClient::parseList(const std::string& req, const std::vector<std::string>& lines)
+	throw(NutException)
+{
+	std::vector<std::vector<std::string> > arr;
+	for(size_t n=0; n<lines.size(); ++n)
+	{
+		arr.push_back(TcpClient::explode(lines[n], req.size()));
+	}
+	return arr;
+}
+
+std::set<std::string> AsyncClient::parseNames(const std::string& req, const std::vector<std::string>& lines)
+	throw(NutException)
+{
+	std::set<std::string> names;
+
+	std::vector<std::vector<std::string> > res = parseList(req, lines);
+	for(size_t n=0; n<res.size(); ++n)
+	{
+		if(!res[n].empty() && !res[n][0].empty())
+			names.insert(res[n][0]);
+	}
+	return names;
+}
+
+TrackingID AsyncClient::parseTracking(const std::vector<std::string>& lines)throw(NutException)
+{
+	TcpClient::detectError(lines[0]);
+	std::vector<std::string> res = TcpClient::explode(lines[0]);
+
+	if (res.size() == 1 && res[0] == "OK")
+	{
+		return TrackingID("");
+	}
+	else if (res.size() == 3 && res[0] == "OK" && res[1] == "TRACKING")
+	{
+		return TrackingID(res[2]);
+	}
+	else
+	{
+		throw NutException("Unknown query result");
+	}
+}
+
+std::shared_future<void> AsyncClient::authenticate(const std::string& user, const std::string& passwd,
+	const AsyncCallback<void>& cb)throw(NutException)
+{
+	// Answers come in order: the USERNAME error, if any, is known when
+	// the PASSWORD answer is processed.
+	std::shared_ptr<std::exception_ptr> error = std::make_shared<std::exception_ptr>();
+
+	submit<void>("USERNAME " + user, "", false,
+		[](const std::vector<std::string>& lines)
+		{
+			TcpClient::detectError(lines[0]);
+		},
+		[error](const std::shared_future<void>& res)
+		{
+			try
+			{
+				res.get();
+			}
+			catch(...)
+			{
+				*error = std::current_exception();
+			}
+		});
+
+	return submit<void>("PASSWORD " + passwd, "", false,
+		[error](const std::vector<std::string>& lines)
+		{
+			if(*error)
+				std::rethrow_exception(*error);
+			TcpClient::detectError(lines[0]);
+		}, cb);
+}
+
+std::shared_future<void> AsyncClient::logout(const AsyncCallback<void>& cb)throw(NutException)
+{
+	return submit<void>("LOGOUT", "", false,
+		[](const std::vector<std::string>& lines)
+		{
+			TcpClient::detectError(lines[0]);
+		}, cb);
+}
+
+std::shared_future<std::set<std::string> > AsyncClient::getDeviceNames(
+	const AsyncCallback<std::set<std::string> >& cb)throw(NutException)
+{
+	return submit<std::set<std::string> >("LIST UPS", "UPS", true,
+		[](const std::vector<std::string>& lines) -> std::set<std::string>
+		{
+			return parseNames("UPS", lines);
+		}, cb);
+}
+
+std::shared_future<std::string> AsyncClient::getDeviceDescription(const std::string& name,
+	const AsyncCallback<std::string>& cb)throw(NutException)
+{
+	std::string req = "UPSDESC " + name;
+	return submit<std::string>("GET " + req, "", false,
+		[req](const std::vector<std::string>& lines) -> std::string
+		{
+			return parseGet(req, lines)[0];
+		}, cb);
+}
+
+std::shared_future<std::set<std::string> > AsyncClient::getDeviceVariableNames(const std::string& dev,
+	const AsyncCallback<std::set<std::string> >& cb)throw(NutException)
+{
+	std::string req = "VAR " + dev;
+	return submit<std::set<std::string> >("LIST " + req, req, true,
+		[req](const std::vector<std::string>& lines) -> std::set<std::string>
+		{
+			return parseNames(req, lines);
+		}, cb);
+}
+
+std::shared_future<std::set<std::string> > AsyncClient::getDeviceRWVariableNames(const std::string& dev,
+	const AsyncCallback<std::set<std::string> >& cb)throw(NutException)
+{
+	std::string req = "RW " + dev;
+	return submit<std::set<std::string> >("LIST " + req, req, true,
+		[req](const std::vector<std::string>& lines) -> std::set<std::string>
+		{
+			return parseNames(req, lines);
+		}, cb);
+}
+
+std::shared_future<std::string> AsyncClient::getDeviceVariableDescription(const std::string& dev, const std::string& name,
+	const AsyncCallback<std::string>& cb)throw(NutException)
+{
+	std::string req = "DESC " + dev + " " + name;
+	return submit<std::string>("GET " + req, "", false,
+		[req](const std::vector<std::string>& lines) -> std::string
+		{
+			return parseGet(req, lines)[0];
+		}, cb);
+}
+
+std::shared_future<std::vector<std::string> > AsyncClient::getDeviceVariableValue(const std::string& dev, const std::string& name,
+	const AsyncCallback<std::vector<std::string> >& cb)throw(NutException)
+{
+	std::string req = "VAR " + dev + " " + name;
+	return submit<std::vector<std::string> >("GET " + req, "", false,
+		[req](const std::vector<std::string>& lines) -> std::vector<std::string>
+		{
+			return parseGet(req, lines);
+		}, cb);
+}
+
+std::shared_future<std::map<std::string,std::vector<std::string> > > AsyncClient::getDeviceVariableValues(const std::string& dev,
+	const AsyncCallback<std::map<std::string,std::vector<std::string> > >& cb)throw(NutException)
+{
+	std::string req = "VAR " + dev;
+	return submit<std::map<std::string,std::vector<std::string> > >("LIST " + req, req, true,
+		[req](const std::vector<std::string>& lines) -> std::map<std::string,std::vector<std::string> >
+		{
+			std::map<std::string,std::vector<std::string> > map;
+			std::vector<std::vector<std::string> > res = parseList(req, lines);
+			for(size_t n=0; n<res.size(); ++n)
+			{
+				if(res[n].empty())
+					continue;
+				map[res[n][0]] = std::vector<std::string>(res[n].begin()+1, res[n].end());
+			}
+			return map;
+		}, cb);
+}
+
+std::shared_future<TrackingID> AsyncClient::setDeviceVariable(const std::string& dev, const std::string& name, const std::string& value,
+	const AsyncCallback<TrackingID>& cb)throw(NutException)
+{
+	return submit<TrackingID>("SET VAR " + dev + " " + name + " " + TcpClient::escape(value), "", false,
+		[](const std::vector<std::string>& lines) -> TrackingID
+		{
+			return parseTracking(lines);
+		}, cb);
+}
+
+std::shared_future<std::set<std::string> > AsyncClient::getDeviceCommandNames(const std::string& dev,
+	const AsyncCallback<std::set<std::string> >& cb)throw(NutException)
+{
+	std::string req = "CMD " + dev;
+	return submit<std::set<std::string> >("LIST " + req, req, true,
+		[req](const std::vector<std::string>& lines) -> std::set<std::string>
+		{
+			return parseNames(req, lines);
+		}, cb);
+}
+
+std::shared_future<std::string> AsyncClient::getDeviceCommandDescription(const std::string& dev, const std::string& name,
+	const AsyncCallback<std::string>& cb)throw(NutException)
+{
+	std::string req = "CMDDESC " + dev + " " + name;
+	return submit<std::string>("GET " + req, "", false,
+		[req](const std::vector<std::string>& lines) -> std::string
+		{
+			return parseGet(req, lines)[0];
+		}, cb);
+}
+
+std::shared_future<TrackingID> AsyncClient::executeDeviceCommand(const std::string& dev, const std::string& name, const std::string& param,
+	const AsyncCallback<TrackingID>& cb)throw(NutException)
+{
+	std::string query = "INSTCMD " + dev + " " + name;
+	if(!param.empty())
+	{
+		query += " " + param;
+	}
+	return submit<TrackingID>(query, "", false,
+		[](const std::vector<std::string>& lines) -> TrackingID
+		{
+			return parseTracking(lines);
+		}, cb);
+}
+
+std::shared_future<void> AsyncClient::deviceLogin(const std::string& dev, const AsyncCallback<void>& cb)throw(NutException)
+{
+	return submit<void>("LOGIN " + dev, "", false,
+		[](const std::vector<std::string>& lines)
+		{
+			TcpClient::detectError(lines[0]);
+		}, cb);
+}
+
+std::shared_future<void> AsyncClient::deviceMaster(const std::string& dev, const AsyncCallback<void>& cb)throw(NutException)
+{
+	return submit<void>("MASTER " + dev, "", false,
+		[](const std::vector<std::string>& lines)
+		{
+			TcpClient::detectError(lines[0]);
+		}, cb);
+}
+
+std::shared_future<void> AsyncClient::deviceForcedShutdown(const std::string& dev, const AsyncCallback<void>& cb)throw(NutException)
+{
+	return submit<void>("FSD " + dev, "", false,
+		[](const std::vector<std::string>& lines)
+		{
+			TcpClient::detectError(lines[0]);
+		}, cb);
+}
+
+std::shared_future<int> AsyncClient::deviceGetNumLogins(const std::string& dev, const AsyncCallback<int>& cb)throw(NutException)
+{
+	std::string req = "NUMLOGINS " + dev;
+	return submit<int>("GET " + req, "", false,
+		[req](const std::vector<std::string>& lines) -> int
+		{
+			return atoi(parseGet(req, lines)[0].c_str());
+		}, cb);
+}
+
+std::shared_future<TrackingResult> AsyncClient::getTrackingResult(const TrackingID& id,
+	const AsyncCallback<TrackingResult>& cb)throw(NutException)
+{
+	if (id.empty())
+	{
+		std::promise<TrackingResult> promise;
+		std::shared_future<TrackingResult> future = promise.get_future().share();
+		promise.set_value(TrackingResult::SUCCESS);
+		if(cb)
+		{
+			cb(future);
+		}
+		return future;
+	}
+
+	return submit<TrackingResult>("GET TRACKING " + id, "", false,
+		[](const std::vector<std::string>& lines) -> TrackingResult
+		{
+			const std::string& result = lines[0];
+
+			if (result == "PENDING")
+			{
+				return TrackingResult::PENDING;
+			}
+			else if (result == "SUCCESS")
+			{
+				return TrackingResult::SUCCESS;
+			}
+			else if (result == "ERR UNKNOWN")
+			{
+				return TrackingResult::UNKNOWN;
+			}
+			else if (result == "ERR INVALID-ARGUMENT")
+			{
+				return TrackingResult::INVALID_ARGUMENT;
+			}
+			else
+			{
+				return TrackingResult::FAILURE;
+			}
+		}, cb);
+}
+
+/*
+ *
+ * Shared client implementation
+ *
+ */
+
+namespace internal
+{
+
+/**
+ * Request of a SharedClient caller.
+ * Lives on the caller's stack: must not be touched once done is set.
+ */
+struct SharedRequest
+{
+	std::function<void(AsyncClient&)> submit; /* Issue the request, run by the leader. */
+	std::function<bool()> ready; /* Has the answer arrived? */
+	std::exception_ptr error; /* Thrown by submit. */
+	std::atomic<bool> done;
+	SharedRequest* next; /* In SharedClient::_queue. */
+
+	SharedRequest():done(false), next(NULL) {}
+};
+
+} /* namespace internal */
+
+SharedClient::SharedClient():
+_client(_loop),
+_port(3493),
+_timeout(-1),
+_queue(NULL),
+_leading(false)
+{
+}
+
+SharedClient::SharedClient(const std::string& host, int port)throw(IOException):
+_client(_loop),
+_port(3493),
+_timeout(-1),
+_queue(NULL),
+_leading(false)
+{
+	connect(host, port);
+}
+
+SharedClient::~SharedClient()
+{
+	// Nobody may be calling us any more: _client fails what is left.
+}
+
+void SharedClient::connect(const std::string& host, int port)throw(IOException)
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_host = host;
+		_port = port;
+	}
+	connect();
+}
+
+void SharedClient::connect()throw(IOException)
+{
+	std::string host = getHost();
+	int port = getPort();
+	long timeout = getTimeout();
+
+	control([&host, port, timeout](AsyncClient& client)
+	{
+		client.setTimeout(timeout);
+		client.connect(host, port);
+	});
+}
+
+bool SharedClient::isConnected()
+{
+	bool connected = false;
+	control([&connected](AsyncClient& client)
+	{
+		connected = client.isConnected();
+	});
+	return connected;
+}
+
+void SharedClient::disconnect()
+{
+	control([](AsyncClient& client)
+	{
+		client.disconnect();
+	});
+}
+
+void SharedClient::setTimeout(long timeout)
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_timeout = timeout;
+	}
+	control([timeout](AsyncClient& client)
+	{
+		client.setTimeout(timeout);
+	});
+}
+
+long SharedClient::getTimeout()const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _timeout;
+}
+
+std::string SharedClient::getHost()const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _host;
+}
+
+int SharedClient::getPort()const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _port;
+}
+
+template<typename T>
+T SharedClient::call(const std::function<std::shared_future<T>(AsyncClient&)>& submit)throw(NutException)
+{
+	std::shared_future<T> future;
+
+	internal::SharedRequest request;
+	request.submit = [&future, &submit](AsyncClient& client)
+	{
+		future = submit(client);
+	};
+	request.ready = [&future]()
+	{
+		return future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+	};
+	execute(request);
+
+	return future.get();
+}
+
+void SharedClient::control(const std::function<void(AsyncClient&)>& action)throw(NutException)
+{
+	internal::SharedRequest request;
+	request.submit = action;
+	request.ready = []()
+	{
+		return true;
+	};
+	execute(request);
+}
+
+void SharedClient::execute(internal::SharedRequest& request)throw(NutException)
+{
+	// Lock-free push; the leader reverses the stack to restore the order.
+	request.next = _queue.load(std::memory_order_relaxed);
+	while(!_queue.compare_exchange_weak(request.next, &request,
+		std::memory_order_release, std::memory_order_relaxed))
+		;
+
+	while(!request.done.load(std::memory_order_acquire))
+	{
+		bool idle = false;
+		if(_leading.compare_exchange_strong(idle, true, std::memory_order_acquire))
+		{
+			lead(request);
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				_leading.store(false, std::memory_order_release);
+			}
+			// Other requests may still be in flight: let one of their callers lead.
+			_cond.notify_all();
+		}
+		else
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_cond.wait(lock, [this, &request]()
+			{
+				return request.done.load(std::memory_order_acquire) ||
+					!_leading.load(std::memory_order_acquire);
+			});
+		}
+	}
+
+	if(request.error)
+	{
+		std::rethrow_exception(request.error);
+	}
+}
+
+void SharedClient::lead(internal::SharedRequest& own)
+{
+	std::vector<internal::SharedRequest*> batch;
+
+	for(;;)
+	{
+		// Issue everything queued so far, oldest first.
+		batch.clear();
+		for(internal::SharedRequest* queued = _queue.exchange(NULL, std::memory_order_acquire);
+			queued != NULL; queued = queued->next)
+		{
+			batch.push_back(queued);
+		}
+		for(std::vector<internal::SharedRequest*>::reverse_iterator it=batch.rbegin(); it!=batch.rend(); ++it)
+		{
+			try
+			{
+				(*it)->submit(_client);
+			}
+			catch(...)
+			{
+				(*it)->error = std::current_exception();
+			}
+			_inflight.push_back(*it);
+		}
+
+		// Hand the answers over to their callers.
+		bool completed = false;
+		for(size_t n=0; n<_inflight.size(); )
+		{
+			internal::SharedRequest* request = _inflight[n];
+			if(request->error || request->ready())
+			{
+				_inflight.erase(_inflight.begin() + n);
+				request->done.store(true, std::memory_order_release);
+				completed = true;
+			}
+			else
+			{
+				++n;
+			}
+		}
+		if(completed)
+		{
+			// Waiters test their flag with the mutex held: cycling it
+			// guarantees none of them misses the notification.
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+			}
+			_cond.notify_all();
+		}
+
+		if(own.done.load(std::memory_order_relaxed))
+			return;
+
+		try
+		{
+			_loop.runOnce();
+		}
+		catch(...)
+		{
+			// Fails the pending requests, completing their futures.
+			_client.disconnect();
+		}
+	}
+}
+
+void SharedClient::authenticate(const std::string& user, const std::string& passwd)throw(NutException)
+{
+	call<void>([&user, &passwd](AsyncClient& client)
+	{
+		return client.authenticate(user, passwd);
+	});
+}
+
+void SharedClient::logout()throw(NutException)
+{
+	call<void>([](AsyncClient& client)
+	{
+		return client.logout();
+	});
+}
+
+Device SharedClient::getDevice(const std::string& name)throw(NutException)
+{
+	try
+	{
+		getDeviceDescription(name);
+	}
+	catch(NutException& ex)
+	{
+		if(ex.str()=="UNKNOWN-UPS")
+			return Device(NULL, "");
+		else
+			throw;
+	}
+	return Device(this, name);
+}
+
+std::set<std::string> SharedClient::getDeviceNames()throw(NutException)
+{
+	return call<std::set<std::string> >([](AsyncClient& client)
+	{
+		return client.getDeviceNames();
+	});
+}
+
+std::string SharedClient::getDeviceDescription(const std::string& name)throw(NutException)
+{
+	return call<std::string>([&name](AsyncClient& client)
+	{
+		return client.getDeviceDescription(name);
+	});
+}
+
+std::set<std::string> SharedClient::getDeviceVariableNames(const std::string& dev)throw(NutException)
+{
+	return call<std::set<std::string> >([&dev](AsyncClient& client)
+	{
+		return client.getDeviceVariableNames(dev);
+	});
+}
+
+std::set<std::string> SharedClient::getDeviceRWVariableNames(const std::string& dev)throw(NutException)
+{
+	return call<std::set<std::string> >([&dev](AsyncClient& client)
+	{
+		return client.getDeviceRWVariableNames(dev);
+	});
+}
+
+std::string SharedClient::getDeviceVariableDescription(const std::string& dev, const std::string& name)throw(NutException)
+{
+	return call<std::string>([&dev, &name](AsyncClient& client)
+	{
+		return client.getDeviceVariableDescription(dev, name);
+	});
+}
+
+std::vector<std::string> SharedClient::getDeviceVariableValue(const std::string& dev, const std::string& name)throw(NutException)
+{
+	return call<std::vector<std::string> >([&dev, &name](AsyncClient& client)
+	{
+		return client.getDeviceVariableValue(dev, name);
+	});
+}
+
+double SharedClient::getDeviceVariableNumber(const std::string& dev, const std::string& name)throw(NutException)
+{
+	std::string req = "VARNUM " + dev + " " + name;
+	try
+	{
+		return call<double>([&req](AsyncClient& client)
+		{
+			return client.submit<double>("GET " + req, "", false,
+				[req](const std::vector<std::string>& lines) -> double
+				{
+					std::vector<std::string> res = AsyncClient::parseGet(req, lines);
+					if(res.empty())
+					{
+						throw NutException("Invalid response");
+					}
+					return strtod(res[0].c_str(), NULL);
+				}, AsyncCallback<double>());
+		});
+	}
+	catch(NutException& ex)
+	{
+		// Servers predating GET VARNUM: parse the text value ourselves.
+		if(ex.str() != "INVALID-ARGUMENT")
+			throw;
+		return Client::getDeviceVariableNumber(dev, name);
+	}
+}
+
+std::map<std::string,std::vector<std::string> > SharedClient::getDeviceVariableValues(const std::string& dev)throw(NutException)
+{
+	return call<std::map<std::string,std::vector<std::string> > >([&dev](AsyncClient& client)
+	{
+		return client.getDeviceVariableValues(dev);
+	});
+}
+
+std::map<std::string,std::map<std::string,std::vector<std::string> > > SharedClient::getDevicesVariableValues(const std::set<std::string>& devs)throw(NutException)
+{
+	typedef std::shared_future<std::map<std::string,std::vector<std::string> > > Future;
+	std::map<std::string,Future> futures;
+
+	// One request for all devices, so that their lists are pipelined.
+	internal::SharedRequest request;
+	request.submit = [&devs, &futures](AsyncClient& client)
+	{
+		for(std::set<std::string>::const_iterator it=devs.begin(); it!=devs.end(); ++it)
+		{
+			futures[*it] = client.getDeviceVariableValues(*it);
+		}
+	};
+	request.ready = [&futures]()
+	{
+		for(std::map<std::string,Future>::const_iterator it=futures.begin(); it!=futures.end(); ++it)
+		{
+			if(it->second.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+				return false;
+		}
+		return true;
+	};
+	execute(request);
+
+	std::map<std::string,std::map<std::string,std::vector<std::string> > > map;
+	for(std::map<std::string,Future>::const_iterator it=futures.begin(); it!=futures.end(); ++it)
+	{
+		try
+		{
+			map[it->first] = it->second.get();
+		}
+		catch (NutException&)
+		{
+			// Same as TcpClient: skip the devices that failed.
+		}
+	}
+
+	if (map.empty())
+	{
+		// We may fail on some devices, but not on ALL devices.
+		throw NutException("Invalid device");
+	}
+
+	return map;
+}
+
+TrackingID SharedClient::setDeviceVariable(const std::string& dev, const std::string& name, const std::string& value)throw(NutException)
+{
+	return call<TrackingID>([&dev, &name, &value](AsyncClient& client)
+	{
+		return client.setDeviceVariable(dev, name, value);
+	});
+}
+
+TrackingID SharedClient::setDeviceVariable(const std::string& dev, const std::string& name, const std::vector<std::string>& values)throw(NutException)
+{
+	std::string query = "SET VAR " + dev + " " + name;
+	for(size_t n=0; n<values.size(); ++n)
+	{
+		query += " " + TcpClient::escape(values[n]);
+	}
+	return call<TrackingID>([&query](AsyncClient& client)
+	{
+		return client.submit<TrackingID>(query, "", false,
+			[](const std::vector<std::string>& lines) -> TrackingID
+			{
+				return AsyncClient::parseTracking(lines);
+			}, AsyncCallback<TrackingID>());
+	});
+}
+
+std::set<std::string> SharedClient::getDeviceCommandNames(const std::string& dev)throw(NutException)
+{
+	return call<std::set<std::string> >([&dev](AsyncClient& client)
+	{
+		return client.getDeviceCommandNames(dev);
+	});
+}
+
+std::string SharedClient::getDeviceCommandDescription(const std::string& dev, const std::string& name)throw(NutException)
+{
+	return call<std::string>([&dev, &name](AsyncClient& client)
+	{
+		return client.getDeviceCommandDescription(dev, name);
+	});
+}
+
+TrackingID SharedClient::executeDeviceCommand(const std::string& dev, const std::string& name, const std::string& param)throw(NutException)
+{
+	return call<TrackingID>([&dev, &name, &param](AsyncClient& client)
+	{
+		return client.executeDeviceCommand(dev, name, param);
+	});
+}
+
+void SharedClient::deviceLogin(const std::string& dev)throw(NutException)
+{
+	call<void>([&dev](AsyncClient& client)
+	{
+		return client.deviceLogin(dev);
+	});
+}
+
+void SharedClient::deviceMaster(const std::string& dev)throw(NutException)
+{
+	call<void>([&dev](AsyncClient& client)
+	{
+		return client.deviceMaster(dev);
+	});
+}
+
+void SharedClient::deviceForcedShutdown(const std::string& dev)throw(NutException)
+{
+	call<void>([&dev](AsyncClient& client)
+	{
+		return client.deviceForcedShutdown(dev);
+	});
+}
+
+int SharedClient::deviceGetNumLogins(const std::string& dev)throw(NutException)
+{
+	return call<int>([&dev](AsyncClient& client)
+	{
+		return client.deviceGetNumLogins(dev);
+	});
+}
+
+TrackingResult SharedClient::getTrackingResult(const TrackingID& id)throw(NutException)
+{
+	return call<TrackingResult>([&id](AsyncClient& client)
+	{
+		return client.getTrackingResult(id);
+	});
+}
+
+bool SharedClient::isFeatureEnabled(const Feature& feature)throw(NutException)
+{
+	return call<bool>([&feature](AsyncClient& client)
+	{
+		return client.submit<bool>("GET " + feature, "", false,
+			[](const std::vector<std::string>& lines) -> bool
+			{
+				const std::string& result = lines[0];
+				TcpClient::detectError(result);
+
+				if (result == "ON")
+				{
+					return true;
+				}
+				else if (result == "OFF")
+				{
+					return false;
+				}
+				else
+				{
+					throw NutException("Unknown feature result " + result);
+				}
+			}, AsyncCallback<bool>());
+	});
+}
+
+void SharedClient::setFeature(const Feature& feature, bool status)throw(NutException)
+{
+	std::string query = "SET " + feature + " " + (status ? "ON" : "OFF");
+	call<void>([&query](AsyncClient& client)
+	{
+		return client.submit<void>(query, "", false,
+			[](const std::vector<std::string>& lines)
+			{
+				TcpClient::detectError(lines[0]);
+			}, AsyncCallback<void>());
+	});
+}
+
+/*
+ *
+ * Client pool implementation
+ *
+ */
+
+namespace internal
+{
+
+struct PoolHost
+{
+	std::string host;
+	int port;
+	long timeout; /* Deadline in ms, negative for the pool one. */
+	AsyncClient* client;
+	std::set<std::string> devices;
+	bool hasDevices;
+	std::chrono::steady_clock::time_point listed;
+	std::string error; /* Why the current query failed, if it did. */
+};
+
+} /* namespace internal */
+
+ClientPool::ClientPool(long timeout):
+_timeout(timeout),
+_refresh(30000)
+{
+}
+
+ClientPool::~ClientPool()
+{
+	for(std::vector<internal::PoolHost*>::iterator it=_hosts.begin(); it!=_hosts.end(); ++it)
+	{
+		delete (*it)->client;
+		delete *it;
+	}
+}
+
+std::string ClientPool::key(const std::string& host, int port)
+{
+	std::ostringstream stm;
+	stm << host << ':' << port;
+	return stm.str();
+}
+
+void ClientPool::addHost(const std::string& host, int port, long timeout)
+{
+	if(std::find_if(_hosts.begin(), _hosts.end(), [&](const internal::PoolHost* h)
+		{return h->host == host && h->port == port;}) != _hosts.end())
+	{
+		return;
+	}
+
+	internal::PoolHost* h = new internal::PoolHost;
+	h->host = host;
+	h->port = port;
+	h->timeout = timeout;
+	h->client = new AsyncClient(_loop);
+	h->client->setTimeout((deadline(*h) + 999) / 1000);
+	h->hasDevices = false;
+	_hosts.push_back(h);
+}
+
+void ClientPool::removeHost(const std::string& host, int port)
+{
+	for(std::vector<internal::PoolHost*>::iterator it=_hosts.begin(); it!=_hosts.end(); ++it)
+	{
+		if((*it)->host == host && (*it)->port == port)
+		{
+			delete (*it)->client;
+			delete *it;
+			_hosts.erase(it);
+			return;
+		}
+	}
+}
+
+std::vector<std::string> ClientPool::getHosts()const
+{
+	std::vector<std::string> res;
+	for(std::vector<internal::PoolHost*>::const_iterator it=_hosts.begin(); it!=_hosts.end(); ++it)
+	{
+		res.push_back(key((*it)->host, (*it)->port));
+	}
+	return res;
+}
+
+void ClientPool::setTimeout(long timeout)
+{
+	_timeout = timeout;
+	for(std::vector<internal::PoolHost*>::iterator it=_hosts.begin(); it!=_hosts.end(); ++it)
+	{
+		(*it)->client->setTimeout((deadline(**it) + 999) / 1000);
+	}
+}
+
+long ClientPool::getTimeout()const
+{
+	return _timeout;
+}
+
+void ClientPool::setCredentials(const std::string& user, const std::string& passwd)
+{
+	_user = user;
+	_passwd = passwd;
+}
+
+void ClientPool::setRefreshInterval(long interval)
+{
+	_refresh = interval;
+}
+
+long ClientPool::getRefreshInterval()const
+{
+	return _refresh;
+}
+
+bool ClientPool::isConnected(const std::string& host, int port)const
+{
+	for(std::vector<internal::PoolHost*>::const_iterator it=_hosts.begin(); it!=_hosts.end(); ++it)
+	{
+		if((*it)->host == host && (*it)->port == port)
+			return (*it)->client->isConnected();
+	}
+	return false;
+}
+
+long ClientPool::deadline(const internal::PoolHost& host)const
+{
+	return host.timeout >= 0 ? host.timeout : _timeout;
+}
+
+void ClientPool::fail(internal::PoolHost& host, const std::string& msg)
+{
+	// Keep the first error, the others are usually consequences of it
+	if(host.error.empty())
+		host.error = msg;
+}
+
+void ClientPool::connect()
+{
+	// Notice the connections closed by the servers while idle
+	_loop.runOnce(0);
+
+	std::vector<internal::PoolHost*> closed;
+	for(std::vector<internal::PoolHost*>::iterator it=_hosts.begin(); it!=_hosts.end(); ++it)
+	{
+		(*it)->error.clear();
+		if(!(*it)->client->isConnected())
+			closed.push_back(*it);
+	}
+
+	// Name resolution and connection are blocking: open them in parallel
+	std::vector<std::future<void> > opening;
+	for(std::vector<internal::PoolHost*>::iterator it=closed.begin(); it!=closed.end(); ++it)
+	{
+		internal::PoolHost* h = *it;
+		opening.push_back(std::async(closed.size() > 1 ? std::launch::async : std::launch::deferred,
+			[h]() {h->client->connect(h->host, h->port);}));
+	}
+
+	for(size_t n=0; n<closed.size(); ++n)
+	{
+		internal::PoolHost* h = closed[n];
+		h->hasDevices = false;
+		try
+		{
+			opening[n].get();
+		}
+		catch(NutException& ex)
+		{
+			fail(*h, ex.str());
+			continue;
+		}
+
+		if(!_user.empty())
+		{
+			h->client->authenticate(_user, _passwd, [h](const std::shared_future<void>& res)
+			{
+				try
+				{
+					res.get();
+				}
+				catch(NutException& ex)
+				{
+					fail(*h, ex.str());
+				}
+			});
+		}
+	}
+}
+
+void ClientPool::withDevices(internal::PoolHost& host, const std::function<void(internal::PoolHost&)>& next)
+{
+	if(host.hasDevices && std::chrono::steady_clock::now() - host.listed < std::chrono::milliseconds(_refresh))
+	{
+		next(host);
+		return;
+	}
+
+	internal::PoolHost* h = &host;
+	host.client->getDeviceNames([h, next](const std::shared_future<std::set<std::string> >& res)
+	{
+		try
+		{
+			h->devices = res.get();
+			h->hasDevices = true;
+			h->listed = std::chrono::steady_clock::now();
+			next(*h);
+		}
+		catch(NutException& ex)
+		{
+			fail(*h, ex.str());
+		}
+	});
+}
+
+void ClientPool::run(const std::chrono::steady_clock::time_point& start)
+{
+	typedef std::chrono::steady_clock clock;
+
+	for(;;)
+	{
+		clock::time_point now = clock::now();
+		long wait = -1;
+
+		for(std::vector<internal::PoolHost*>::iterator it=_hosts.begin(); it!=_hosts.end(); ++it)
+		{
+			internal::PoolHost* h = *it;
+			if(h->client->pending() == 0)
+				continue;
+
+			clock::time_point end = start + std::chrono::milliseconds(deadline(*h));
+			if(end <= now)
+			{
+				// Late answers could not be matched any more: start over
+				fail(*h, TimeoutException().str());
+				h->client->disconnect();
+				continue;
+			}
+
+			long left = std::chrono::duration_cast<std::chrono::milliseconds>(end - now + std::chrono::microseconds(999)).count();
+			if(wait < 0 || left < wait)
+				wait = left;
+		}
+
+		if(wait < 0)
+			break;
+
+		_loop.runOnce(wait);
+	}
+}
+
+template<typename T>
+PoolResult<T> ClientPool::fanOut(const std::function<void(internal::PoolHost&, T&)>& query)
+{
+	PoolResult<T> res;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	connect();
+
+	for(std::vector<internal::PoolHost*>::iterator it=_hosts.begin(); it!=_hosts.end(); ++it)
+	{
+		internal::PoolHost* h = *it;
+		if(!h->error.empty())
+			continue;
+		try
+		{
+			query(*h, res.values[key(h->host, h->port)]);
+		}
+		catch(NutException& ex)
+		{
+			fail(*h, ex.str());
+		}
+	}
+
+	run(start);
+
+	for(std::vector<internal::PoolHost*>::iterator it=_hosts.begin(); it!=_hosts.end(); ++it)
+	{
+		internal::PoolHost* h = *it;
+		if(!h->error.empty())
+		{
+			std::string k = key(h->host, h->port);
+			res.values.erase(k);
+			res.errors[k] = h->error;
+		}
+	}
+
+	return res;
+}
+
+size_t ClientPool::checkHealth()
+{
+	PoolResult<std::set<std::string> > res = getDeviceNames();
+	return res.values.size();
+}
+
+PoolResult<std::set<std::string> > ClientPool::getDeviceNames()
+{
+	return fanOut<std::set<std::string> >([this](internal::PoolHost& host, std::set<std::string>& out)
+	{
+		host.hasDevices = false;
+		std::set<std::string>* pout = &out;
+		withDevices(host, [pout](internal::PoolHost& h) {*pout = h.devices;});
+	});
+}
+
+PoolResult<std::map<std::string,std::vector<std::string> > > ClientPool::getDeviceVariableValue(const std::string& name)
+{
+	typedef std::map<std::string,std::vector<std::string> > Values;
+
+	return fanOut<Values>([this, name](internal::PoolHost& host, Values& out)
+	{
+		Values* pout = &out;
+		withDevices(host, [name, pout](internal::PoolHost& h)
+		{
+			internal::PoolHost* ph = &h;
+			for(std::set<std::string>::const_iterator it=h.devices.begin(); it!=h.devices.end(); ++it)
+			{
+				std::string dev = *it;
+				h.client->getDeviceVariableValue(dev, name, [ph, dev, pout](const std::shared_future<std::vector<std::string> >& res)
+				{
+					try
+					{
+						(*pout)[dev] = res.get();
+					}
+					catch(IOException& ex)
+					{
+						fail(*ph, ex.str());
+					}
+					catch(NutException&)
+					{
+						// Not supported by this device
+					}
+				});
+			}
+		});
+	});
+}
+
+PoolResult<std::map<std::string,std::map<std::string,std::vector<std::string> > > > ClientPool::getDevicesVariableValues()
+{
+	typedef std::map<std::string,std::map<std::string,std::vector<std::string> > > Values;
+
+	return fanOut<Values>([this](internal::PoolHost& host, Values& out)
+	{
+		Values* pout = &out;
+		withDevices(host, [pout](internal::PoolHost& h)
+		{
+			internal::PoolHost* ph = &h;
+			for(std::set<std::string>::const_iterator it=h.devices.begin(); it!=h.devices.end(); ++it)
+			{
+				std::string dev = *it;
+				h.client->getDeviceVariableValues(dev, [ph, dev, pout](const std::shared_future<std::map<std::string,std::vector<std::string> > >& res)
+				{
+					try
+					{
+						(*pout)[dev] = res.get();
+					}
+					catch(IOException& ex)
+					{
+						fail(*ph, ex.str());
+					}
+					catch(NutException&)
+					{
+						// The device went away since it was listed
+					}
+				});
+			}
+		});
+	});
+}
+
+/*
+ *
+ * Caching client implementation
+ *
+ */
+
+CachingClient::CachingClient(Client* client, long ttl):
+Client(),
+_client(client),
+_ttl(ttl),
+_hasDeviceNames(false)
+{
+	// Variables which do not change while the driver runs
+	static const char* const statics[] = {
+		"device.model", "device.mfr", "device.serial", "device.type",
+		"device.description", "device.part", "device.macaddr",
+		"driver.",
+		"ups.mfr", "ups.mfr.date", "ups.model", "ups.serial",
+		"ups.firmware", "ups.firmware.aux", "ups.productid", "ups.vendorid",
+		"battery.mfr.date",
+		NULL
+	};
+
+	for(size_t n=0; statics[n]!=NULL; ++n)
+	{
+		_static.push_back(statics[n]);
+	}
+}
+
+CachingClient::~CachingClient()
+{
+}
+
+Client* CachingClient::getClient()const
+{
+	return _client;
+}
+
+void CachingClient::setTTL(long ttl)
+{
+	_ttl = ttl;
+}
+
+long CachingClient::getTTL()const
+{
+	return _ttl;
+}
+
+void CachingClient::addStaticVariable(const std::string& name)
+{
+	_static.push_back(name);
+}
+
+void CachingClient::invalidate()
+{
+	_deviceDescriptions.clear();
+	_variableDescriptions.clear();
+	_commandDescriptions.clear();
+	_commandNames.clear();
+	_hasDeviceNames = false;
+	_variableNames.clear();
+	_rwVariableNames.clear();
+	_values.clear();
+	_allValues.clear();
+}
+
+void CachingClient::invalidate(const std::string& dev)
+{
+	_deviceDescriptions.erase(dev);
+	for(std::map<std::pair<std::string,std::string>,std::string>::iterator it=_variableDescriptions.begin(); it!=_variableDescriptions.end(); )
+	{
+		if(it->first.first == dev)
+			_variableDescriptions.erase(it++);
+		else
+			++it;
+	}
+	for(std::map<std::pair<std::string,std::string>,std::string>::iterator it=_commandDescriptions.begin(); it!=_commandDescriptions.end(); )
+	{
+		if(it->first.first == dev)
+			_commandDescriptions.erase(it++);
+		else
+			++it;
+	}
+	_commandNames.erase(dev);
+	_variableNames.erase(dev);
+	_rwVariableNames.erase(dev);
+	_values.erase(dev);
+	_allValues.erase(dev);
+}
+
+bool CachingClient::isStatic(const std::string& name)const
+{
+	for(std::vector<std::string>::const_iterator it=_static.begin(); it!=_static.end(); ++it)
+	{
+		const std::string& pattern = *it;
+		if(pattern.empty())
+			continue;
+		if(pattern[pattern.size()-1] == '.' ? name.compare(0, pattern.size(), pattern) == 0 : name == pattern)
+			return true;
+	}
+	return false;
+}
+
+bool CachingClient::isFresh(const Clock::time_point& when)const
+{
+	return _ttl > 0 && Clock::now() - when < std::chrono::milliseconds(_ttl);
+}
+
+void CachingClient::storeValues(const std::string& dev, const std::map<std::string,std::vector<std::string> >& values)
+{
+	Clock::time_point now = Clock::now();
+
+	// Replace everything: variables which disappeared go away
+	std::map<std::string,Entry<std::vector<std::string> > >& cache = _values[dev];
+	cache.clear();
+	for(std::map<std::string,std::vector<std::string> >::const_iterator it=values.begin(); it!=values.end(); ++it)
 	{
-		query += " " + escape(values[n]);
+		Entry<std::vector<std::string> >& entry = cache[it->first];
+		entry.value = it->second;
+		entry.when = now;
 	}
-	return sendTrackingQuery(query);
+	_allValues[dev] = now;
 }
 
-std::set<std::string> TcpClient::getDeviceCommandNames(const std::string& dev)throw(NutException)
+VariableChanges CachingClient::diff(const std::string& dev, const std::map<std::string,std::vector<std::string> >& values)
 {
-	std::set<std::string> cmds;
+	VariableChanges changes;
+	std::map<std::string,std::vector<std::string> >& previous = _polled[dev];
 
-	std::vector<std::vector<std::string> > res = list("CMD", dev);
-	for(size_t n=0; n<res.size(); ++n)
+	for(std::map<std::string,std::vector<std::string> >::const_iterator it=values.begin(); it!=values.end(); ++it)
 	{
-		cmds.insert(res[n][0]);
+		std::map<std::string,std::vector<std::string> >::const_iterator prev = previous.find(it->first);
+		if(prev == previous.end() || prev->second != it->second)
+			changes.changed[it->first] = it->second;
+	}
+	for(std::map<std::string,std::vector<std::string> >::const_iterator it=previous.begin(); it!=previous.end(); ++it)
+	{
+		if(values.find(it->first) == values.end())
+			changes.removed.insert(it->first);
 	}
 
-	return cmds;
+	previous = values;
+	return changes;
 }
 
-std::string TcpClient::getDeviceCommandDescription(const std::string& dev, const std::string& name)throw(NutException)
+void CachingClient::dropValues(const std::string& dev)
 {
-	return get("CMDDESC", dev + " " + name)[0];
+	_values.erase(dev);
+	_allValues.erase(dev);
 }
 
-TrackingID TcpClient::executeDeviceCommand(const std::string& dev, const std::string& name, const std::string& param)throw(NutException)
+VariableChanges CachingClient::pollChanges(const std::string& dev)throw(NutException)
 {
-	return sendTrackingQuery("INSTCMD " + dev + " " + name + " " + param);
+	std::map<std::string,std::vector<std::string> > values = _client->getDeviceVariableValues(dev);
+	storeValues(dev, values);
+	return diff(dev, values);
 }
 
-void TcpClient::deviceLogin(const std::string& dev)throw(NutException)
+std::map<std::string,VariableChanges> CachingClient::pollChanges(const std::set<std::string>& devs)throw(NutException)
 {
-	detectError(sendQuery("LOGIN " + dev));
-}
+	std::map<std::string,VariableChanges> changes;
 
-void TcpClient::deviceMaster(const std::string& dev)throw(NutException)
-{
-	detectError(sendQuery("MASTER " + dev));
+	std::map<std::string,std::map<std::string,std::vector<std::string> > > values = _client->getDevicesVariableValues(devs);
+	for(std::map<std::string,std::map<std::string,std::vector<std::string> > >::const_iterator it=values.begin(); it!=values.end(); ++it)
+	{
+		storeValues(it->first, it->second);
+		changes[it->first] = diff(it->first, it->second);
+	}
+
+	return changes;
 }
 
-void TcpClient::deviceForcedShutdown(const std::string& dev)throw(NutException)
+void CachingClient::authenticate(const std::string& user, const std::string& passwd)throw(NutException)
 {
-	detectError(sendQuery("FSD " + dev));
+	_client->authenticate(user, passwd);
 }
 
-int TcpClient::deviceGetNumLogins(const std::string& dev)throw(NutException)
+void CachingClient::logout()throw(NutException)
 {
-	std::string num = get("NUMLOGINS", dev)[0];
-	return atoi(num.c_str());
+	_client->logout();
+	invalidate();
 }
 
-TrackingResult TcpClient::getTrackingResult(const TrackingID& id)throw(NutException)
+std::set<std::string> CachingClient::getDeviceNames()throw(NutException)
 {
-	if (id.empty())
+	if(!_hasDeviceNames || !isFresh(_deviceNames.when))
 	{
-		return TrackingResult::SUCCESS;
+		_deviceNames.value = _client->getDeviceNames();
+		_deviceNames.when = Clock::now();
+		_hasDeviceNames = true;
 	}
+	return _deviceNames.value;
+}
 
-	std::string result = sendQuery("GET TRACKING " + id);
-
-	if (result == "PENDING")
-	{
-		return TrackingResult::PENDING;
-	}
-	else if (result == "SUCCESS")
-	{
-		return TrackingResult::SUCCESS;
-	}
-	else if (result == "ERR UNKNOWN")
-	{
-		return TrackingResult::UNKNOWN;
-	}
-	else if (result == "ERR INVALID-ARGUMENT")
-	{
-		return TrackingResult::INVALID_ARGUMENT;
-	}
-	else
+std::string CachingClient::getDeviceDescription(const std::string& name)throw(NutException)
+{
+	std::map<std::string,std::string>::iterator it = _deviceDescriptions.find(name);
+	if(it == _deviceDescriptions.end())
 	{
-		return TrackingResult::FAILURE;
+		it = _deviceDescriptions.insert(std::make_pair(name, _client->getDeviceDescription(name))).first;
 	}
+	return it->second;
 }
 
-bool TcpClient::isFeatureEnabled(const Feature& feature)throw(NutException)
+std::set<std::string> CachingClient::getDeviceVariableNames(const std::string& dev)throw(NutException)
 {
-	std::string result = sendQuery("GET " + feature);
-	detectError(result);
-
-	if (result == "ON")
-	{
-		return true;
-	}
-	else if (result == "OFF")
+	std::map<std::string,Entry<std::set<std::string> > >::iterator it = _variableNames.find(dev);
+	if(it == _variableNames.end() || !isFresh(it->second.when))
 	{
-		return false;
+		Entry<std::set<std::string> >& entry = _variableNames[dev];
+		entry.value = _client->getDeviceVariableNames(dev);
+		entry.when = Clock::now();
+		return entry.value;
 	}
-	else
+	return it->second.value;
+}
+
+std::set<std::string> CachingClient::getDeviceRWVariableNames(const std::string& dev)throw(NutException)
+{
+	std::map<std::string,Entry<std::set<std::string> > >::iterator it = _rwVariableNames.find(dev);
+	if(it == _rwVariableNames.end() || !isFresh(it->second.when))
 	{
-		throw NutException("Unknown feature result " + result);
+		Entry<std::set<std::string> >& entry = _rwVariableNames[dev];
+		entry.value = _client->getDeviceRWVariableNames(dev);
+		entry.when = Clock::now();
+		return entry.value;
 	}
+	return it->second.value;
 }
-void TcpClient::setFeature(const Feature& feature, bool status)throw(NutException)
+
+std::string CachingClient::getDeviceVariableDescription(const std::string& dev, const std::string& name)throw(NutException)
 {
-	std::string result = sendQuery("SET " + feature + " " + (status ? "ON" : "OFF"));
-	detectError(result);
+	std::pair<std::string,std::string> key(dev, name);
+	std::map<std::pair<std::string,std::string>,std::string>::iterator it = _variableDescriptions.find(key);
+	if(it == _variableDescriptions.end())
+	{
+		it = _variableDescriptions.insert(std::make_pair(key, _client->getDeviceVariableDescription(dev, name))).first;
+	}
+	return it->second;
 }
 
-std::vector<std::string> TcpClient::get
-	(const std::string& subcmd, const std::string& params) throw(NutException)
+std::vector<std::string> CachingClient::getDeviceVariableValue(const std::string& dev, const std::string& name)throw(NutException)
 {
-	std::string req = subcmd;
-	if(!params.empty())
+	bool stat = isStatic(name);
+
+	std::map<std::string,std::map<std::string,Entry<std::vector<std::string> > > >::iterator dv = _values.find(dev);
+	if(dv != _values.end())
 	{
-		req += " " + params;
+		std::map<std::string,Entry<std::vector<std::string> > >::iterator it = dv->second.find(name);
+		if(it != dv->second.end() && (stat || isFresh(it->second.when)))
+		{
+			return it->second.value;
+		}
 	}
-	std::string res = sendQuery("GET " + req);
-	detectError(res);
-	if(res.substr(0, req.size()) != req)
+
+	std::vector<std::string> value = _client->getDeviceVariableValue(dev, name);
+	if(stat || _ttl > 0)
 	{
-		throw NutException("Invalid response");
+		Entry<std::vector<std::string> >& entry = _values[dev][name];
+		entry.value = value;
+		entry.when = Clock::now();
 	}
-	
-	return explode(res, req.size());
+	return value;
 }
 
-std::vector<std::vector<std::string> > TcpClient::list
-	(const std::string& subcmd, const std::string& params) throw(NutException)
+std::map<std::string,std::vector<std::string> > CachingClient::getDeviceVariableValues(const std::string& dev)throw(NutException)
 {
-	std::string req = subcmd;
-	if(!params.empty())
+	std::map<std::string,std::vector<std::string> > values;
+
+	std::map<std::string,Clock::time_point>::iterator all = _allValues.find(dev);
+	if(all != _allValues.end() && isFresh(all->second))
 	{
-		req += " " + params;
+		std::map<std::string,Entry<std::vector<std::string> > >& cache = _values[dev];
+		for(std::map<std::string,Entry<std::vector<std::string> > >::iterator it=cache.begin(); it!=cache.end(); ++it)
+		{
+			values[it->first] = it->second.value;
+		}
+		return values;
 	}
-	std::vector<std::string> query;
-	query.push_back("LIST " + req);
-	sendAsyncQueries(query);
-	return parseList(req);
+
+	values = _client->getDeviceVariableValues(dev);
+	storeValues(dev, values);
+	return values;
 }
 
-std::vector<std::vector<std::string> > TcpClient::parseList
-	(const std::string& req) throw(NutException)
+std::map<std::string,std::map<std::string,std::vector<std::string> > > CachingClient::getDevicesVariableValues(const std::set<std::string>& devs)throw(NutException)
 {
-	std::string res = _socket->read();
-	detectError(res);
-	if(res != ("BEGIN LIST " + req))
+	std::map<std::string,std::map<std::string,std::vector<std::string> > > res;
+	std::set<std::string> missing;
+
+	for(std::set<std::string>::const_iterator it=devs.begin(); it!=devs.end(); ++it)
 	{
-		throw NutException("Invalid response");
+		std::map<std::string,Clock::time_point>::iterator all = _allValues.find(*it);
+		if(all != _allValues.end() && isFresh(all->second))
+			res[*it] = getDeviceVariableValues(*it);
+		else
+			missing.insert(*it);
 	}
 
-	std::vector<std::vector<std::string> > arr;
-	while(true)
+	if(!missing.empty())
 	{
-		res = _socket->read();
-		detectError(res);
-		if(res == ("END LIST " + req))
-		{
-			return arr;
-		}
-		if(res.substr(0, req.size()) == req)
-		{
-			arr.push_back(explode(res, req.size()));
-		}
-		else
+		// Fetch the others at once
+		std::map<std::string,std::map<std::string,std::vector<std::string> > > values = _client->getDevicesVariableValues(missing);
+		for(std::map<std::string,std::map<std::string,std::vector<std::string> > >::const_iterator it=values.begin(); it!=values.end(); ++it)
 		{
-			throw NutException("Invalid response");
+			storeValues(it->first, it->second);
+			res[it->first] = it->second;
 		}
 	}
+
+	return res;
 }
 
-std::string TcpClient::sendQuery(const std::string& req)throw(IOException)
+TrackingID CachingClient::setDeviceVariable(const std::string& dev, const std::string& name, const std::string& value)throw(NutException)
 {
-	_socket->write(req);
-	return _socket->read();
+	dropValues(dev);
+	return _client->setDeviceVariable(dev, name, value);
 }
 
-void TcpClient::sendAsyncQueries(const std::vector<std::string>& req)throw(IOException)
+TrackingID CachingClient::setDeviceVariable(const std::string& dev, const std::string& name, const std::vector<std::string>& values)throw(NutException)
+{
+	dropValues(dev);
+	return _client->setDeviceVariable(dev, name, values);
+}
+
+std::set<std::string> CachingClient::getDeviceCommandNames(const std::string& dev)throw(NutException)
 {
-	for (std::vector<std::string>::const_iterator it = req.cbegin(); it != req.cend(); it++)
+	std::map<std::string,std::set<std::string> >::iterator it = _commandNames.find(dev);
+	if(it == _commandNames.end())
 	{
-		_socket->write(*it);
+		it = _commandNames.insert(std::make_pair(dev, _client->getDeviceCommandNames(dev))).first;
 	}
+	return it->second;
 }
 
-void TcpClient::detectError(const std::string& req)throw(NutException)
+std::string CachingClient::getDeviceCommandDescription(const std::string& dev, const std::string& name)throw(NutException)
 {
-	if(req.substr(0,3)=="ERR")
+	std::pair<std::string,std::string> key(dev, name);
+	std::map<std::pair<std::string,std::string>,std::string>::iterator it = _commandDescriptions.find(key);
+	if(it == _commandDescriptions.end())
 	{
-		throw NutException(req.substr(4));
+		it = _commandDescriptions.insert(std::make_pair(key, _client->getDeviceCommandDescription(dev, name))).first;
 	}
+	return it->second;
 }
 
-std::vector<std::string> TcpClient::explode(const std::string& str, size_t begin)
+TrackingID CachingClient::executeDeviceCommand(const std::string& dev, const std::string& name, const std::string& param)throw(NutException)
 {
-	std::vector<std::string> res;
-	std::string temp;
-
-	enum STATE {
-		INIT,
-		SIMPLE_STRING,
-		QUOTED_STRING,
-		SIMPLE_ESCAPE,
-		QUOTED_ESCAPE
-	} state = INIT;
+	dropValues(dev);
+	return _client->executeDeviceCommand(dev, name, param);
+}
 
-	for(size_t idx=begin; idx<str.size(); ++idx)
-	{
-		char c = str[idx];
-		switch(state)
-		{
-		case INIT:
-			if(c==' ' /* || c=='\t' */)
-			{ /* Do nothing */ }
-			else if(c=='"')
-			{
-				state = QUOTED_STRING;
-			}
-			else if(c=='\\')
-			{
-				state = SIMPLE_ESCAPE;
-			}
-			/* What about bad characters ? */
-			else
-			{
-				temp += c;
-				state = SIMPLE_STRING;
-			}
-			break;
-		case SIMPLE_STRING:
-			if(c==' ' /* || c=='\t' */)
-			{
-				/* if(!temp.empty()) : Must not occur */
-					res.push_back(temp);
-				temp.clear();
-				state = INIT;
-			}
-			else if(c=='\\')
-			{
-				state = SIMPLE_ESCAPE;
-			}
-			else if(c=='"')
-			{
-				/* if(!temp.empty()) : Must not occur */
-					res.push_back(temp);
-				temp.clear();
-				state = QUOTED_STRING;
-			}
-			/* What about bad characters ? */
-			else
-			{
-				temp += c;
-			}		
-			break;
-		case QUOTED_STRING:
-			if(c=='\\')
-			{
-				state = QUOTED_ESCAPE;
-			}
-			else if(c=='"')
-			{
-				res.push_back(temp);
-				temp.clear();
-				state = INIT;
-			}
-			/* What about bad characters ? */
-			else
-			{
-				temp += c;
-			}
-			break;
-		case SIMPLE_ESCAPE:
-			if(c=='\\' || c=='"' || c==' ' /* || c=='\t'*/)
-			{
-				temp += c;
-			}
-			else
-			{
-				temp += '\\' + c; // Really do this ?
-			}
-			state = SIMPLE_STRING;
-			break;
-		case QUOTED_ESCAPE:
-			if(c=='\\' || c=='"')
-			{
-				temp += c;
-			}
-			else
-			{
-				temp += '\\' + c; // Really do this ?
-			}
-			state = QUOTED_STRING;
-			break;
-		}
-	}
+void CachingClient::deviceLogin(const std::string& dev)throw(NutException)
+{
+	_client->deviceLogin(dev);
+}
 
-	if(!temp.empty())
-	{
-		res.push_back(temp);
-	}
+void CachingClient::deviceMaster(const std::string& dev)throw(NutException)
+{
+	_client->deviceMaster(dev);
+}
 
-	return res;
+void CachingClient::deviceForcedShutdown(const std::string& dev)throw(NutException)
+{
+	dropValues(dev);
+	_client->deviceForcedShutdown(dev);
 }
 
-std::string TcpClient::escape(const std::string& str)
+int CachingClient::deviceGetNumLogins(const std::string& dev)throw(NutException)
 {
-	std::string res = "\"";
-	
-	for(size_t n=0; n<str.size(); n++)
-	{
-		char c = str[n];
-		if(c=='"')
-			res += "\\\"";
-		else if(c=='\\')
-			res += "\\\\";
-		else
-			res += c;
-	}
+	return _client->deviceGetNumLogins(dev);
+}
 
-	res += '"';
-	return res; 
+TrackingResult CachingClient::getTrackingResult(const TrackingID& id)throw(NutException)
+{
+	return _client->getTrackingResult(id);
 }
 
-TrackingID TcpClient::sendTrackingQuery(const std::string& req)throw(NutException)
+bool CachingClient::isFeatureEnabled(const Feature& feature)throw(NutException)
 {
-	std::string reply = sendQuery(req);
-	detectError(reply);
-	std::vector<std::string> res = explode(reply);
+	return _client->isFeatureEnabled(feature);
+}
 
-	if (res.size() == 1 && res[0] == "OK")
-	{
-		return TrackingID("");
-	}
-	else if (res.size() == 3 && res[0] == "OK" && res[1] == "TRACKING")
-	{
-		return TrackingID(res[2]);
-	}
-	else
-	{
-		throw NutException("Unknown query result");
-	}
+void CachingClient::setFeature(const Feature& feature, bool status)throw(NutException)
+{
+	_client->setFeature(feature, status);
 }
 
 /*
@@ -1327,6 +3791,11 @@ std::vector<std::string> Variable::getValue()throw(NutException)
   return getDevice()->getClient()->getDeviceVariableValue(getDevice()->getName(), getName());
 }
 
+double Variable::getNumber()throw(NutException)
+{
+  return getDevice()->getClient()->getDeviceVariableNumber(getDevice()->getName(), getName());
+}
+
 std::string Variable::getDescription()throw(NutException)
 {
   return getDevice()->getClient()->getDeviceVariableDescription(getDevice()->getName(), getName());
@@ -27,7 +27,15 @@
 #include <vector>
 #include <map>
 #include <set>
+#include <deque>
+#include <chrono>
 #include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
 
 namespace nut
 {
@@ -35,11 +43,21 @@ namespace nut
 namespace internal
 {
 class Socket;
+class LineBuffer;
+struct AsyncRequest;
+struct PoolHost;
+struct SharedRequest;
 } /* namespace internal */
 
 
 class Client;
 class TcpClient;
+class UnixClient;
+class AsyncClient;
+class AsyncLoop;
+class SharedClient;
+class CachingClient;
+class ClientPool;
 class Device;
 class Variable;
 class Command;
@@ -233,6 +251,14 @@ public:
 	 * \return Variable values (usually one) if available.
 	 */
 	virtual std::vector<std::string> getDeviceVariableValue(const std::string& dev, const std::string& name)throw(NutException)=0;
+	/**
+	 * Retrieve the numeric value of a variable.
+	 * \param dev Device name
+	 * \param name Variable name
+	 * \return Variable value as a number.
+	 * \throw NutException if the variable is not numeric.
+	 */
+	virtual double getDeviceVariableNumber(const std::string& dev, const std::string& name)throw(NutException);
 	/**
 	 * Retrieve values of all variables of a device.
 	 * \param dev Device name
@@ -335,6 +361,8 @@ protected:
  */
 class TcpClient : public Client
 {
+	friend class AsyncClient;
+	friend class SharedClient;
 public:
 	/**
 	 * Construct a nut TcpClient object.
@@ -344,7 +372,8 @@ public:
 
 	/**
 	 * Construct a nut TcpClient object then connect it to the specified server.
-	 * \param host Server host name.
+	 * \param host Server host name, or "unix:" followed by the name of the
+	 * Unix socket of a local server.
 	 * \param port Server port.
 	 */
 	TcpClient(const std::string& host, int port = 3493)throw(nut::IOException);
@@ -407,6 +436,7 @@ public:
 	virtual std::set<std::string> getDeviceRWVariableNames(const std::string& dev)throw(NutException);
 	virtual std::string getDeviceVariableDescription(const std::string& dev, const std::string& name)throw(NutException);
 	virtual std::vector<std::string> getDeviceVariableValue(const std::string& dev, const std::string& name)throw(NutException);
+	virtual double getDeviceVariableNumber(const std::string& dev, const std::string& name)throw(NutException);
 	virtual std::map<std::string,std::vector<std::string> > getDeviceVariableValues(const std::string& dev)throw(NutException);
 	virtual std::map<std::string,std::map<std::string,std::vector<std::string> > > getDevicesVariableValues(const std::set<std::string>& devs)throw(NutException);
 	virtual TrackingID setDeviceVariable(const std::string& dev, const std::string& name, const std::string& value)throw(NutException);
@@ -441,6 +471,9 @@ protected:
 	std::vector<std::vector<std::string> > parseList(const std::string& req)
 		throw(nut::NutException);
 
+	std::map<std::string,std::vector<std::string> > parseListValues(const std::string& req)
+		throw(nut::NutException);
+
 	static std::vector<std::string> explode(const std::string& str, size_t begin=0);
 	static std::string escape(const std::string& str);
 
@@ -451,6 +484,595 @@ private:
 	internal::Socket* _socket;
 };
 
+/**
+ * Local NUTD client.
+ * It connects to NUTD through its Unix socket, which is cheaper than the
+ * TCP loopback for programs running on the same host.
+ */
+class UnixClient : public TcpClient
+{
+public:
+	/**
+	 * Construct a nut UnixClient object then connect it to the specified socket.
+	 * \param path Name of the Unix socket of the server.
+	 */
+	UnixClient(const std::string& path)throw(nut::IOException);
+
+	/**
+	 * Retrieve the name of the Unix socket.
+	 */
+	std::string getPath()const;
+};
+
+
+/**
+ * Callback invoked by the event loop when an asynchronous request completes.
+ * The future is ready: get() returns the result or rethrows the NutException.
+ */
+template<typename T>
+using AsyncCallback = std::function<void(const std::shared_future<T>&)>;
+
+/**
+ * Event loop driving a set of AsyncClient connections.
+ * Nothing is sent nor received outside of runOnce() and run(), which must
+ * be called from a single thread; callbacks are invoked from there.
+ */
+class AsyncLoop
+{
+	friend class AsyncClient;
+public:
+	AsyncLoop();
+	~AsyncLoop();
+
+	/**
+	 * Wait for I/O on the attached clients, and process it.
+	 * \param timeout Maximum time to wait in milliseconds, negative to block
+	 * until something happens.
+	 * \return Number of requests completed (successfully or not).
+	 */
+	size_t runOnce(long timeout = -1);
+
+	/**
+	 * Process I/O until no more request is pending.
+	 * \param timeout Maximum time to run in milliseconds, negative for no limit.
+	 * \return true if all the requests completed, false on timeout.
+	 */
+	bool run(long timeout = -1);
+
+	/**
+	 * Retrieve the number of requests not completed yet, on all clients.
+	 */
+	size_t pending()const;
+
+private:
+	AsyncLoop(const AsyncLoop&);
+	AsyncLoop& operator=(const AsyncLoop&);
+
+	void attach(AsyncClient* client);
+	void detach(AsyncClient* client);
+
+	std::vector<AsyncClient*> _clients;
+};
+
+/**
+ * Asynchronous NUTD client.
+ * Requests are sent as soon as they are issued, without waiting for the
+ * answers to the previous ones (upsd answers them in order), so many of
+ * them can be outstanding on a single connection.
+ * Each request returns a future, and may also be given a callback; both are
+ * completed by the AsyncLoop the client is attached to.
+ */
+class AsyncClient
+{
+	friend class AsyncLoop;
+	friend class SharedClient;
+public:
+	/**
+	 * Construct an AsyncClient attached to an event loop.
+	 * You must call AsyncClient::connect() after.
+	 */
+	AsyncClient(AsyncLoop& loop);
+	/**
+	 * Destroy the client. Pending requests fail with NotConnectedException.
+	 * This may be done from a completion callback, even one of this client.
+	 */
+	~AsyncClient();
+
+	/**
+	 * Connect to the specified server.
+	 * The connection itself is synchronous (and honors the timeout).
+	 * \param host Server host name.
+	 * \param port Server port.
+	 */
+	void connect(const std::string& host, int port = 3493)throw(nut::IOException);
+
+	/**
+	 * Test if the connection is active.
+	 */
+	bool isConnected()const;
+	/**
+	 * Force the deconnection. Pending requests fail with NotConnectedException.
+	 */
+	void disconnect();
+
+	/**
+	 * Set the timeout in seconds, for connection and for each request.
+	 * When a request times out, the connection is dropped, since the
+	 * following answers could not be correlated any more.
+	 * \param timeout Timeout in seconds, negative for no timeout.
+	 */
+	void setTimeout(long timeout);
+	/**
+	 * Retrieve the timeout.
+	 * \returns Current timeout in seconds.
+	 */
+	long getTimeout()const;
+
+	/**
+	 * Retrieve the number of requests waiting for their answer.
+	 */
+	size_t pending()const;
+
+	std::shared_future<void> authenticate(const std::string& user, const std::string& passwd,
+		const AsyncCallback<void>& cb = AsyncCallback<void>())throw(NutException);
+	std::shared_future<void> logout(const AsyncCallback<void>& cb = AsyncCallback<void>())throw(NutException);
+
+	std::shared_future<std::set<std::string> > getDeviceNames(
+		const AsyncCallback<std::set<std::string> >& cb = AsyncCallback<std::set<std::string> >())throw(NutException);
+	std::shared_future<std::string> getDeviceDescription(const std::string& name,
+		const AsyncCallback<std::string>& cb = AsyncCallback<std::string>())throw(NutException);
+
+	std::shared_future<std::set<std::string> > getDeviceVariableNames(const std::string& dev,
+		const AsyncCallback<std::set<std::string> >& cb = AsyncCallback<std::set<std::string> >())throw(NutException);
+	std::shared_future<std::set<std::string> > getDeviceRWVariableNames(const std::string& dev,
+		const AsyncCallback<std::set<std::string> >& cb = AsyncCallback<std::set<std::string> >())throw(NutException);
+	std::shared_future<std::string> getDeviceVariableDescription(const std::string& dev, const std::string& name,
+		const AsyncCallback<std::string>& cb = AsyncCallback<std::string>())throw(NutException);
+	std::shared_future<std::vector<std::string> > getDeviceVariableValue(const std::string& dev, const std::string& name,
+		const AsyncCallback<std::vector<std::string> >& cb = AsyncCallback<std::vector<std::string> >())throw(NutException);
+	std::shared_future<std::map<std::string,std::vector<std::string> > > getDeviceVariableValues(const std::string& dev,
+		const AsyncCallback<std::map<std::string,std::vector<std::string> > >& cb = AsyncCallback<std::map<std::string,std::vector<std::string> > >())throw(NutException);
+	std::shared_future<TrackingID> setDeviceVariable(const std::string& dev, const std::string& name, const std::string& value,
+		const AsyncCallback<TrackingID>& cb = AsyncCallback<TrackingID>())throw(NutException);
+
+	std::shared_future<std::set<std::string> > getDeviceCommandNames(const std::string& dev,
+		const AsyncCallback<std::set<std::string> >& cb = AsyncCallback<std::set<std::string> >())throw(NutException);
+	std::shared_future<std::string> getDeviceCommandDescription(const std::string& dev, const std::string& name,
+		const AsyncCallback<std::string>& cb = AsyncCallback<std::string>())throw(NutException);
+	std::shared_future<TrackingID> executeDeviceCommand(const std::string& dev, const std::string& name, const std::string& param = "",
+		const AsyncCallback<TrackingID>& cb = AsyncCallback<TrackingID>())throw(NutException);
+
+	std::shared_future<void> deviceLogin(const std::string& dev, const AsyncCallback<void>& cb = AsyncCallback<void>())throw(NutException);
+	std::shared_future<void> deviceMaster(const std::string& dev, const AsyncCallback<void>& cb = AsyncCallback<void>())throw(NutException);
+	std::shared_future<void> deviceForcedShutdown(const std::string& dev, const AsyncCallback<void>& cb = AsyncCallback<void>())throw(NutException);
+	std::shared_future<int> deviceGetNumLogins(const std::string& dev, const AsyncCallback<int>& cb = AsyncCallback<int>())throw(NutException);
+
+	std::shared_future<TrackingResult> getTrackingResult(const TrackingID& id,
+		const AsyncCallback<TrackingResult>& cb = AsyncCallback<TrackingResult>())throw(NutException);
+
+private:
+	AsyncClient(const AsyncClient&);
+	AsyncClient& operator=(const AsyncClient&);
+
+	template<typename T>
+	std::shared_future<T> submit(const std::string& query, const std::string& req, bool list,
+		const std::function<T(const std::vector<std::string>&)>& parse, const AsyncCallback<T>& cb);
+
+	static std::vector<std::string> parseGet(const std::string& req, const std::vector<std::string>& lines)
+		throw(nut::NutException);
+	static std::vector<std::vector<std::string> > parseList(const std::string& req, const std::vector<std::string>& lines)
+		throw(nut::NutException);
+	static std::set<std::string> parseNames(const std::string& req, const std::vector<std::string>& lines)
+		throw(nut::NutException);
+	static TrackingID parseTracking(const std::vector<std::string>& lines)throw(nut::NutException);
+
+	bool wantWrite()const;
+	size_t onReadable();
+	void onWritable();
+	size_t onTimeout(const std::chrono::steady_clock::time_point& now);
+	bool nextDeadline(std::chrono::steady_clock::time_point& deadline)const;
+	size_t processLine(const std::string& line);
+	size_t complete(std::exception_ptr err);
+	size_t drop(std::exception_ptr err);
+
+	AsyncLoop* _loop; /* NULL once the loop is gone. */
+	std::shared_ptr<bool> _alive; /* Cleared by the destructor: callbacks may delete the client. */
+	long _timeout;
+	internal::Socket* _socket;
+	std::deque<internal::AsyncRequest*> _pending;
+	std::string _out; /* Requests not sent yet. */
+	internal::LineBuffer* _in; /* Received data not processed yet. */
+	unsigned long _generation; /* Incremented each time the connection is dropped. */
+};
+
+/**
+ * Thread-safe NUTD client.
+ * Any number of threads may call a SharedClient concurrently: their requests
+ * are multiplexed on a single connection, so the program uses one upsd
+ * client slot (see MAXCONN) instead of one per thread.
+ * Callers queue their requests without locking; the first one to find the
+ * connection idle sends everything queued so far and reads the answers,
+ * handing each to the thread waiting for it, until its own has arrived.
+ * The next waiting caller then takes over.
+ * Authentication and device logins apply to the connection, hence to all
+ * the threads sharing it.
+ */
+class SharedClient : public Client
+{
+public:
+	/**
+	 * Construct a nut SharedClient object.
+	 * You must call one of SharedClient::connect() after.
+	 */
+	SharedClient();
+	/**
+	 * Construct a nut SharedClient object then connect it to the specified server.
+	 * \param host Server host name, or "unix:" followed by the name of the
+	 * Unix socket of a local server.
+	 * \param port Server port.
+	 */
+	SharedClient(const std::string& host, int port = 3493)throw(nut::IOException);
+	~SharedClient();
+
+	/**
+	 * Connect it to the specified server.
+	 * Requests pending on a previous connection fail with NotConnectedException.
+	 * \param host Server host name.
+	 * \param port Server port.
+	 */
+	void connect(const std::string& host, int port = 3493)throw(nut::IOException);
+	/**
+	 * Connect to the server.
+	 * Host name and ports must have already set (usefull for reconnection).
+	 */
+	void connect()throw(nut::IOException);
+
+	/**
+	 * Test if the connection is active.
+	 * Not const: the check waits for the connection like a request.
+	 */
+	bool isConnected();
+	/**
+	 * Force the deconnection. Pending requests fail with NotConnectedException.
+	 */
+	void disconnect();
+
+	/**
+	 * Set the timeout in seconds, for connection and for each request.
+	 * \param timeout Timeout in seconds, negative to block operations.
+	 */
+	void setTimeout(long timeout);
+	/**
+	 * Retrieve the timeout.
+	 * \returns Current timeout in seconds.
+	 */
+	long getTimeout()const;
+
+	/**
+	 * Retrieve the host name of the server the client is connected to.
+	 */
+	std::string getHost()const;
+	/**
+	 * Retrieve the port of the server the client is connected to.
+	 */
+	int getPort()const;
+
+	virtual void authenticate(const std::string& user, const std::string& passwd)throw(NutException);
+	virtual void logout()throw(NutException);
+
+	virtual Device getDevice(const std::string& name)throw(NutException);
+	virtual std::set<std::string> getDeviceNames()throw(NutException);
+	virtual std::string getDeviceDescription(const std::string& name)throw(NutException);
+
+	virtual std::set<std::string> getDeviceVariableNames(const std::string& dev)throw(NutException);
+	virtual std::set<std::string> getDeviceRWVariableNames(const std::string& dev)throw(NutException);
+	virtual std::string getDeviceVariableDescription(const std::string& dev, const std::string& name)throw(NutException);
+	virtual std::vector<std::string> getDeviceVariableValue(const std::string& dev, const std::string& name)throw(NutException);
+	virtual double getDeviceVariableNumber(const std::string& dev, const std::string& name)throw(NutException);
+	virtual std::map<std::string,std::vector<std::string> > getDeviceVariableValues(const std::string& dev)throw(NutException);
+	virtual std::map<std::string,std::map<std::string,std::vector<std::string> > > getDevicesVariableValues(const std::set<std::string>& devs)throw(NutException);
+	virtual TrackingID setDeviceVariable(const std::string& dev, const std::string& name, const std::string& value)throw(NutException);
+	virtual TrackingID setDeviceVariable(const std::string& dev, const std::string& name, const std::vector<std::string>& values)throw(NutException);
+
+	virtual std::set<std::string> getDeviceCommandNames(const std::string& dev)throw(NutException);
+	virtual std::string getDeviceCommandDescription(const std::string& dev, const std::string& name)throw(NutException);
+	virtual TrackingID executeDeviceCommand(const std::string& dev, const std::string& name, const std::string& param="")throw(NutException);
+
+	virtual void deviceLogin(const std::string& dev)throw(NutException);
+	virtual void deviceMaster(const std::string& dev)throw(NutException);
+	virtual void deviceForcedShutdown(const std::string& dev)throw(NutException);
+	virtual int deviceGetNumLogins(const std::string& dev)throw(NutException);
+
+	virtual TrackingResult getTrackingResult(const TrackingID& id)throw(NutException);
+
+	virtual bool isFeatureEnabled(const Feature& feature)throw(NutException);
+	virtual void setFeature(const Feature& feature, bool status)throw(NutException);
+
+private:
+	SharedClient(const SharedClient&);
+	SharedClient& operator=(const SharedClient&);
+
+	template<typename T>
+	T call(const std::function<std::shared_future<T>(AsyncClient&)>& submit)throw(NutException);
+	void control(const std::function<void(AsyncClient&)>& action)throw(NutException);
+	void execute(internal::SharedRequest& request)throw(NutException);
+	void lead(internal::SharedRequest& own);
+
+	AsyncLoop _loop;
+	AsyncClient _client;
+	std::string _host;
+	int _port;
+	long _timeout;
+	std::atomic<internal::SharedRequest*> _queue; /* Submitted requests, newest first. */
+	std::atomic<bool> _leading; /* Some caller is doing the I/O. */
+	mutable std::mutex _mutex; /* Guards _host, _port and _timeout, and sleeping on _cond. */
+	std::condition_variable _cond;
+	std::vector<internal::SharedRequest*> _inflight; /* Sent, waiting for their answer; leader only. */
+};
+
+/**
+ * Result of a query sent to all the hosts of a ClientPool.
+ * Hosts are identified by "host:port".
+ */
+template<typename T>
+struct PoolResult
+{
+	/** Answers of the hosts which replied in time. */
+	std::map<std::string,T> values;
+	/** Error message of the hosts which could not answer. */
+	std::map<std::string,std::string> errors;
+};
+
+/**
+ * Pool of persistent connections to several NUTD servers.
+ * Queries are sent to all the hosts at once and pipelined on each
+ * connection; every host has its own deadline, so a slow or unreachable
+ * server only delays the result up to that deadline, and shows up in
+ * PoolResult::errors.
+ * Broken connections are reopened (in parallel) before the next query.
+ */
+class ClientPool
+{
+public:
+	/**
+	 * Construct an empty pool.
+	 * \param timeout Default per-host deadline in milliseconds.
+	 */
+	ClientPool(long timeout = 5000);
+	~ClientPool();
+
+	/**
+	 * Add a server to the pool. The connection is opened by the next query.
+	 * \param host Server host name.
+	 * \param port Server port.
+	 * \param timeout Deadline for this host in milliseconds, negative to
+	 * use the pool one.
+	 */
+	void addHost(const std::string& host, int port = 3493, long timeout = -1);
+	/**
+	 * Remove a server from the pool, and close its connection.
+	 */
+	void removeHost(const std::string& host, int port = 3493);
+	/**
+	 * Retrieve the servers of the pool, as "host:port".
+	 */
+	std::vector<std::string> getHosts()const;
+
+	/**
+	 * Set the default per-host deadline in milliseconds.
+	 */
+	void setTimeout(long timeout);
+	long getTimeout()const;
+
+	/**
+	 * Authenticate on every connection, each time it is (re)opened.
+	 */
+	void setCredentials(const std::string& user, const std::string& passwd);
+
+	/**
+	 * Set how long the device list of a host is trusted, in milliseconds.
+	 * Listing the devices also checks that an idle connection still works.
+	 */
+	void setRefreshInterval(long interval);
+	long getRefreshInterval()const;
+
+	/**
+	 * Reopen the broken connections and refresh the device lists now.
+	 * \return Number of hosts which answered.
+	 */
+	size_t checkHealth();
+
+	/**
+	 * Test if the connection to a server is currently open.
+	 */
+	bool isConnected(const std::string& host, int port = 3493)const;
+
+	/**
+	 * Retrieve the device names of all the hosts.
+	 */
+	PoolResult<std::set<std::string> > getDeviceNames();
+	/**
+	 * Retrieve a variable of all the devices of all the hosts, by host then
+	 * by device. Devices which do not support it are left out.
+	 */
+	PoolResult<std::map<std::string,std::vector<std::string> > > getDeviceVariableValue(const std::string& name);
+	/**
+	 * Retrieve all the variables of all the devices of all the hosts, by
+	 * host then by device.
+	 */
+	PoolResult<std::map<std::string,std::map<std::string,std::vector<std::string> > > > getDevicesVariableValues();
+
+private:
+	ClientPool(const ClientPool&);
+	ClientPool& operator=(const ClientPool&);
+
+	static std::string key(const std::string& host, int port);
+	long deadline(const internal::PoolHost& host)const;
+	void connect();
+	template<typename T>
+	PoolResult<T> fanOut(const std::function<void(internal::PoolHost&, T&)>& query);
+	void run(const std::chrono::steady_clock::time_point& start);
+	void withDevices(internal::PoolHost& host, const std::function<void(internal::PoolHost&)>& next);
+	static void fail(internal::PoolHost& host, const std::string& msg);
+
+	AsyncLoop _loop;
+	long _timeout;
+	long _refresh;
+	std::string _user, _passwd;
+	std::vector<internal::PoolHost*> _hosts;
+};
+
+/**
+ * Variables of a device that changed between two polls.
+ * \see CachingClient::pollChanges()
+ */
+struct VariableChanges
+{
+	/** New values of the variables that appeared or changed. */
+	std::map<std::string,std::vector<std::string> > changed;
+	/** Names of the variables that disappeared. */
+	std::set<std::string> removed;
+
+	bool empty()const{return changed.empty() && removed.empty();}
+};
+
+/**
+ * Caching NUTD client.
+ * Decorates another client, and answers from its cache when possible:
+ * descriptions, command names and static variables (device.model, driver.*,
+ * ...) are kept until invalidated, other data for a configurable time.
+ * Writing a variable or running a command invalidates the cached values of
+ * the device.
+ */
+class CachingClient : public Client
+{
+public:
+	/**
+	 * Construct a caching client.
+	 * \param client Client to decorate, not owned: it must outlive the cache.
+	 * \param ttl Time to live of dynamic data in milliseconds (0 to never
+	 * cache it).
+	 */
+	CachingClient(Client* client, long ttl = 1000);
+	~CachingClient();
+
+	/**
+	 * Retrieve the decorated client.
+	 */
+	Client* getClient()const;
+
+	/**
+	 * Set the time to live of dynamic data.
+	 * \param ttl Time to live in milliseconds (0 to never cache it).
+	 */
+	void setTTL(long ttl);
+	/**
+	 * Retrieve the time to live of dynamic data, in milliseconds.
+	 */
+	long getTTL()const;
+
+	/**
+	 * Declare a variable as static: its value is cached until invalidated.
+	 * \param name Variable name, or prefix of variable names if ending with '.'.
+	 */
+	void addStaticVariable(const std::string& name);
+
+	/**
+	 * Drop everything from the cache.
+	 */
+	void invalidate();
+	/**
+	 * Drop everything about a device from the cache.
+	 * \param dev Device name.
+	 */
+	void invalidate(const std::string& dev);
+
+	/**
+	 * Fetch all variables of a device, and tell what changed since the
+	 * previous call for this device (everything, the first time).
+	 * The cache is refreshed along.
+	 * \param dev Device name.
+	 * \return Changed and removed variables.
+	 */
+	VariableChanges pollChanges(const std::string& dev)throw(NutException);
+	/**
+	 * Fetch all variables of a set of devices at once, and tell what
+	 * changed for each since the previous poll.
+	 * \param devs Device names.
+	 * \return Changed and removed variables, indexed by device names (devices
+	 * which failed are omitted).
+	 */
+	std::map<std::string,VariableChanges> pollChanges(const std::set<std::string>& devs)throw(NutException);
+
+	virtual void authenticate(const std::string& user, const std::string& passwd)throw(NutException);
+	virtual void logout()throw(NutException);
+
+	virtual std::set<std::string> getDeviceNames()throw(NutException);
+	virtual std::string getDeviceDescription(const std::string& name)throw(NutException);
+
+	virtual std::set<std::string> getDeviceVariableNames(const std::string& dev)throw(NutException);
+	virtual std::set<std::string> getDeviceRWVariableNames(const std::string& dev)throw(NutException);
+	virtual std::string getDeviceVariableDescription(const std::string& dev, const std::string& name)throw(NutException);
+	virtual std::vector<std::string> getDeviceVariableValue(const std::string& dev, const std::string& name)throw(NutException);
+	virtual std::map<std::string,std::vector<std::string> > getDeviceVariableValues(const std::string& dev)throw(NutException);
+	virtual std::map<std::string,std::map<std::string,std::vector<std::string> > > getDevicesVariableValues(const std::set<std::string>& devs)throw(NutException);
+	virtual TrackingID setDeviceVariable(const std::string& dev, const std::string& name, const std::string& value)throw(NutException);
+	virtual TrackingID setDeviceVariable(const std::string& dev, const std::string& name, const std::vector<std::string>& values)throw(NutException);
+
+	virtual std::set<std::string> getDeviceCommandNames(const std::string& dev)throw(NutException);
+	virtual std::string getDeviceCommandDescription(const std::string& dev, const std::string& name)throw(NutException);
+	virtual TrackingID executeDeviceCommand(const std::string& dev, const std::string& name, const std::string& param="")throw(NutException);
+
+	virtual void deviceLogin(const std::string& dev)throw(NutException);
+	virtual void deviceMaster(const std::string& dev)throw(NutException);
+	virtual void deviceForcedShutdown(const std::string& dev)throw(NutException);
+	virtual int deviceGetNumLogins(const std::string& dev)throw(NutException);
+
+	virtual TrackingResult getTrackingResult(const TrackingID& id)throw(NutException);
+
+	virtual bool isFeatureEnabled(const Feature& feature)throw(NutException);
+	virtual void setFeature(const Feature& feature, bool status)throw(NutException);
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	template<typename T>
+	struct Entry
+	{
+		T value;
+		Clock::time_point when;
+	};
+
+	CachingClient(const CachingClient&);
+	CachingClient& operator=(const CachingClient&);
+
+	bool isStatic(const std::string& name)const;
+	bool isFresh(const Clock::time_point& when)const;
+	void storeValues(const std::string& dev, const std::map<std::string,std::vector<std::string> >& values);
+	VariableChanges diff(const std::string& dev, const std::map<std::string,std::vector<std::string> >& values);
+	void dropValues(const std::string& dev);
+
+	Client* _client;
+	long _ttl;
+	std::vector<std::string> _static;
+
+	/* Kept until invalidated */
+	std::map<std::string,std::string> _deviceDescriptions;
+	std::map<std::pair<std::string,std::string>,std::string> _variableDescriptions;
+	std::map<std::pair<std::string,std::string>,std::string> _commandDescriptions;
+	std::map<std::string,std::set<std::string> > _commandNames;
+
+	/* Kept for the time to live (static variables excepted) */
+	bool _hasDeviceNames;
+	Entry<std::set<std::string> > _deviceNames;
+	std::map<std::string,Entry<std::set<std::string> > > _variableNames;
+	std::map<std::string,Entry<std::set<std::string> > > _rwVariableNames;
+	std::map<std::string,std::map<std::string,Entry<std::vector<std::string> > > > _values;
+	std::map<std::string,Clock::time_point> _allValues; /* When all values of a device were fetched */
+
+	/* Values seen by the last pollChanges() */
+	std::map<std::string,std::map<std::string,std::vector<std::string> > > _polled;
+};
 
 /**
  * Device attached to a client.
@@ -460,6 +1082,7 @@ class Device
 {
 	friend class Client;
 	friend class TcpClient;
+	friend class SharedClient;
 public:
 	~Device();
 	Device(const Device& dev);
@@ -654,6 +1277,11 @@ public:
 	 * \return Value of the variable.
 	 */
 	std::vector<std::string> getValue()throw(NutException);
+	/**
+	 * Intend to retrieve variable value as a number.
+	 * \return Numeric value of the variable.
+	 */
+	double getNumber()throw(NutException);
 	/**
 	 * Intend to retireve variable description.
 	 * \return Variable description if provided.
@@ -0,0 +1,514 @@
+/* schedlib.c - upssched.conf rules and timers, for upssched and upsmon
+
+   Copyright (C) 2000  Russell Kroll <rkroll@exploits.org>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/* upssched runs this in its timer daemon, with a new process parsing the
+ * config for every event; upsmon can have it in-process instead, where
+ * the config is parsed once and events never leave memory */
+
+#include "common.h"
+
+#include <parseconf.h>
+
+#include "schedlib.h"
+#include "timehead.h"
+
+/* timers are kept in a binary min-heap on their deadline, and can be
+ * looked up by name through a hash table */
+typedef struct ttype_s {
+	char	*name;
+	char	*upsname;		/* of the event that started it */
+	char	*ntype;
+	struct timeval	etime;		/* from monotonic_time() */
+	size_t	pos;			/* in theap */
+	struct ttype_s	*next;		/* same thash bucket, oldest first */
+} ttype_t;
+
+#define THASH_SIZE		256
+
+	static	ttype_t	**theap = NULL, *thash[THASH_SIZE];
+	static	size_t	tcount = 0, tsize = 0;
+
+	sched_conf_t	*sched_conf = NULL;
+	int	sched_verbose = 0;
+	void	(*sched_exec)(const char *arg, const char *upsname,
+			const char *ntype) = NULL;
+
+static void sched_log(const char *fmt, ...)
+	__attribute__ ((__format__ (__printf__, 1, 2)));
+
+static void sched_log(const char *fmt, ...)
+{
+	va_list	ap;
+	char	msg[LARGEBUF];
+
+	va_start(ap, fmt);
+	vsnprintf(msg, sizeof(msg), fmt, ap);
+	va_end(ap);
+
+	if (sched_verbose)
+		upslogx(LOG_INFO, "%s", msg);
+	else
+		upsdebugx(2, "%s", msg);
+}
+
+/* --- config --- */
+
+static void free_conf(sched_conf_t *conf)
+{
+	sched_at_t	*at, *next;
+
+	if (!conf)
+		return;
+
+	for (at = conf->at; at != NULL; at = next) {
+		next = at->next;
+
+		free(at->ntype);
+		free(at->upsname);
+		free(at->arg1);
+		free(at->arg2);
+		free(at);
+	}
+
+	free(conf->cmdscript);
+	free(conf->pipefn);
+	free(conf->lockfn);
+	free(conf);
+}
+
+static int add_at(sched_at_t ***last, int numargs, char **arg)
+{
+	sched_at_t	*at;
+	int	cmd;
+
+	if (!strcmp(arg[3], "START-TIMER")) {
+		if (numargs < 6)
+			return 0;
+
+		cmd = SCHED_START;
+	} else if (!strcmp(arg[3], "CANCEL-TIMER")) {
+		cmd = SCHED_CANCEL;
+	} else if (!strcmp(arg[3], "EXECUTE")) {
+		if (arg[4][0] == '\0') {
+			upslogx(LOG_ERR, "Empty EXECUTE command argument");
+			return 1;
+		}
+
+		cmd = SCHED_EXECUTE;
+	} else {
+		upslogx(LOG_ERR, "Invalid command: %s", arg[3]);
+		return 1;
+	}
+
+	at = xcalloc(1, sizeof(*at));
+	at->ntype = xstrdup(arg[1]);
+	at->upsname = xstrdup(arg[2]);
+	at->cmd = cmd;
+	at->arg1 = xstrdup(arg[4]);
+	at->arg2 = (numargs > 5) ? xstrdup(arg[5]) : NULL;
+
+	**last = at;
+	*last = &at->next;
+
+	return 1;
+}
+
+static int conf_arg(sched_conf_t *conf, sched_at_t ***last, int numargs,
+		char **arg)
+{
+	if (numargs < 2)
+		return 0;
+
+	/* CMDSCRIPT <scriptname> */
+	if (!strcmp(arg[0], "CMDSCRIPT")) {
+		free(conf->cmdscript);
+		conf->cmdscript = xstrdup(arg[1]);
+		return 1;
+	}
+
+	/* PIPEFN <pipename> */
+	if (!strcmp(arg[0], "PIPEFN")) {
+		free(conf->pipefn);
+		conf->pipefn = xstrdup(arg[1]);
+		return 1;
+	}
+
+	/* LOCKFN <filename> */
+	if (!strcmp(arg[0], "LOCKFN")) {
+		free(conf->lockfn);
+		conf->lockfn = xstrdup(arg[1]);
+		return 1;
+	}
+
+	if (numargs < 5)
+		return 0;
+
+	/* AT <notifytype> <upsname> <command> <cmdarg1> [<cmdarg2>] */
+	if (!strcmp(arg[0], "AT")) {
+		if (!conf->cmdscript) {
+			upslogx(LOG_ERR, "CMDSCRIPT must be set before any ATs "
+				"in the config file!");
+			return -1;
+		}
+
+		return add_at(last, numargs, arg);
+	}
+
+	return 0;
+}
+
+/* called for fatal errors in parseconf like malloc failures */
+static void sched_err(const char *errmsg)
+{
+	upslogx(LOG_ERR, "Fatal error in parseconf(upssched.conf): %s", errmsg);
+}
+
+/* read upssched.conf into sched_conf, replacing what was there
+ * returns 1 on success, 0 on failure with the old one left in place */
+int sched_readconf(const char *fn)
+{
+	PCONF_CTX_t	ctx;
+	sched_conf_t	*conf;
+	sched_at_t	**last;
+	int	ret;
+
+	pconf_init(&ctx, sched_err);
+
+	if (!pconf_file_begin(&ctx, fn)) {
+		upslogx(LOG_ERR, "%s", ctx.errmsg);
+		pconf_finish(&ctx);
+		return 0;
+	}
+
+	conf = xcalloc(1, sizeof(*conf));
+	last = &conf->at;
+
+	while (pconf_file_next(&ctx)) {
+		if (pconf_parse_error(&ctx)) {
+			upslogx(LOG_ERR, "Parse error: %s:%d: %s",
+				fn, ctx.linenum, ctx.errmsg);
+			continue;
+		}
+
+		if (ctx.numargs < 1)
+			continue;
+
+		ret = conf_arg(conf, &last, ctx.numargs, ctx.arglist);
+
+		if (ret < 0) {
+			pconf_finish(&ctx);
+			free_conf(conf);
+			return 0;
+		}
+
+		if (ret == 0) {
+			unsigned int	i;
+			char	errmsg[SMALLBUF];
+
+			snprintf(errmsg, sizeof(errmsg),
+				"upssched.conf: invalid directive");
+
+			for (i = 0; i < ctx.numargs; i++)
+				snprintfcat(errmsg, sizeof(errmsg), " %s",
+					ctx.arglist[i]);
+
+			upslogx(LOG_WARNING, "%s", errmsg);
+		}
+	}
+
+	pconf_finish(&ctx);
+
+	free_conf(sched_conf);
+	sched_conf = conf;
+
+	return 1;
+}
+
+void sched_freeconf(void)
+{
+	free_conf(sched_conf);
+	sched_conf = NULL;
+}
+
+/* --- events --- */
+
+/* run action for each AT rule matching ntype on upsname, in file order;
+ * sched_action is used if action is NULL */
+void sched_event(const char *upsname, const char *ntype, sched_action_t action)
+{
+	sched_at_t	*at;
+
+	if (!sched_conf)
+		return;
+
+	if (!action)
+		action = sched_action;
+
+	for (at = sched_conf->at; at != NULL; at = at->next) {
+
+		/* check upsname: does this apply to us? */
+		if (strcmp(upsname, at->upsname) != 0)
+			if (strcmp(at->upsname, "*") != 0)
+				continue;	/* not for us, and not the wildcard */
+
+		/* see if the current notify type matches the one from the .conf */
+		if (strcasecmp(ntype, at->ntype) != 0)
+			continue;
+
+		action(at, upsname, ntype);
+	}
+}
+
+/* carry out an AT rule here, with the timers in this process */
+void sched_action(const sched_at_t *at, const char *upsname, const char *ntype)
+{
+	switch (at->cmd)
+	{
+	case SCHED_START:
+		sched_start_timer(at->arg1, at->arg2, upsname, ntype);
+		break;
+
+	case SCHED_CANCEL:
+		sched_cancel_timer(at->arg1, at->arg2, upsname, ntype);
+		break;
+
+	case SCHED_EXECUTE:
+		sched_log("Executing command: %s", at->arg1);
+		sched_exec(at->arg1, upsname, ntype);
+		break;
+	}
+}
+
+/* --- timers --- */
+
+static unsigned int timer_hash(const char *name)
+{
+	unsigned int	h = 5381;
+
+	while (*name)
+		h = h * 33 + (unsigned char)*name++;
+
+	return h % THASH_SIZE;
+}
+
+/* milliseconds from now until tv, negative once it has passed */
+static long timer_left(const struct timeval *tv)
+{
+	struct timeval	now;
+
+	monotonic_time(&now);
+
+	return (tv->tv_sec - now.tv_sec) * 1000 +
+		(tv->tv_usec - now.tv_usec) / 1000;
+}
+
+static int timer_before(const ttype_t *a, const ttype_t *b)
+{
+	if (a->etime.tv_sec != b->etime.tv_sec)
+		return a->etime.tv_sec < b->etime.tv_sec;
+
+	return a->etime.tv_usec < b->etime.tv_usec;
+}
+
+static void heap_set(size_t pos, ttype_t *tmp)
+{
+	theap[pos] = tmp;
+	tmp->pos = pos;
+}
+
+/* move the timer at pos up or down to where it belongs */
+static void heap_fix(size_t pos)
+{
+	ttype_t	*tmp = theap[pos];
+	size_t	child;
+
+	while ((pos > 0) && timer_before(tmp, theap[(pos - 1) / 2])) {
+		heap_set(pos, theap[(pos - 1) / 2]);
+		pos = (pos - 1) / 2;
+	}
+
+	for (;;) {
+		child = 2 * pos + 1;
+
+		if (child >= tcount)
+			break;
+
+		if ((child + 1 < tcount) && timer_before(theap[child + 1], theap[child]))
+			child++;
+
+		if (!timer_before(theap[child], tmp))
+			break;
+
+		heap_set(pos, theap[child]);
+		pos = child;
+	}
+
+	heap_set(pos, tmp);
+}
+
+static void removetimer(ttype_t *tfind)
+{
+	ttype_t	**tp;
+	size_t	pos = tfind->pos;
+
+	for (tp = &thash[timer_hash(tfind->name)]; *tp != NULL; tp = &(*tp)->next) {
+		if (*tp == tfind) {
+			*tp = tfind->next;
+			break;
+		}
+	}
+
+	if ((pos >= tcount) || (theap[pos] != tfind)) {
+		/* this one should never happen */
+		upslogx(LOG_ERR, "removetimer: failed to locate target at %p", (void *)tfind);
+		return;
+	}
+
+	tcount--;
+
+	if (pos < tcount) {
+		heap_set(pos, theap[tcount]);
+		heap_fix(pos);
+	}
+
+	free(tfind->name);
+	free(tfind->upsname);
+	free(tfind->ntype);
+	free(tfind);
+}
+
+void sched_start_timer(const char *name, const char *ofsstr,
+			const char *upsname, const char *ntype)
+{
+	double	ofs;
+	long	msec;
+	char	*end;
+	ttype_t	*tmp, **tp;
+
+	/* add an event for <now> + <time>, in seconds with up to 3 decimals */
+	ofs = strtod(ofsstr, &end);
+
+	if ((end == ofsstr) || (ofs < 0) || (ofs > 86400 * 365)) {
+		upslogx(LOG_INFO, "bogus offset for timer, ignoring");
+		return;
+	}
+
+	sched_log("New timer: %s (%g seconds)", name, ofs);
+
+	msec = (long) (ofs * 1000 + 0.5);
+
+	tmp = xcalloc(1, sizeof(ttype_t));
+	tmp->name = xstrdup(name);
+	tmp->upsname = xstrdup(upsname);
+	tmp->ntype = xstrdup(ntype);
+
+	monotonic_time(&tmp->etime);
+	tmp->etime.tv_sec += msec / 1000;
+	tmp->etime.tv_usec += (msec % 1000) * 1000;
+
+	if (tmp->etime.tv_usec >= 1000000) {
+		tmp->etime.tv_sec++;
+		tmp->etime.tv_usec -= 1000000;
+	}
+
+	/* now add to the queue */
+	if (tcount == tsize) {
+		tsize = tsize ? tsize * 2 : 16;
+		theap = xrealloc(theap, tsize * sizeof(*theap));
+	}
+
+	heap_set(tcount++, tmp);
+	heap_fix(tmp->pos);
+
+	/* and to the end of its bucket, where sched_cancel_timer() looks last */
+	for (tp = &thash[timer_hash(name)]; *tp != NULL; tp = &(*tp)->next)
+		;
+
+	*tp = tmp;
+}
+
+void sched_cancel_timer(const char *name, const char *cname,
+			const char *upsname, const char *ntype)
+{
+	ttype_t	*tmp;
+
+	for (tmp = thash[timer_hash(name)]; tmp != NULL; tmp = tmp->next) {
+		if (!strcmp(tmp->name, name)) {		/* match */
+			sched_log("Cancelling timer: %s", name);
+			removetimer(tmp);
+			return;
+		}
+	}
+
+	/* this is not necessarily an error */
+	if (cname && cname[0]) {
+		sched_log("Cancel %s, event: %s", name, cname);
+		sched_exec(cname, upsname, ntype);
+	}
+}
+
+/* run the timers that are due
+ * returns the milliseconds until the next one, -1 if there are none */
+long sched_checktimers(void)
+{
+	ttype_t	*tmp;
+	long	left;
+
+	while (tcount > 0) {
+		tmp = theap[0];
+		left = timer_left(&tmp->etime);
+
+		if (left > 0)
+			return left;
+
+		sched_log("Event: %s ", tmp->name);
+
+		sched_exec(tmp->name, tmp->upsname, tmp->ntype);
+
+		/* delete from queue */
+		removetimer(tmp);
+	}
+
+	return -1;
+}
+
+/* milliseconds until the next timer is due, -1 if there are none */
+long sched_timeleft(void)
+{
+	long	left;
+
+	if (tcount == 0)
+		return -1;
+
+	left = timer_left(&theap[0]->etime);
+
+	return (left > 0) ? left : 0;
+}
+
+void sched_cleanup(void)
+{
+	while (tcount > 0)
+		removetimer(theap[tcount - 1]);
+
+	free(theap);
+	theap = NULL;
+	tsize = 0;
+
+	sched_freeconf();
+}
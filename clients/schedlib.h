@@ -0,0 +1,67 @@
+/* schedlib.h - upssched.conf rules and timers, for upssched and upsmon */
+
+#ifndef SCHEDLIB_H_SEEN
+#define SCHEDLIB_H_SEEN
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+extern "C" {
+/* *INDENT-ON* */
+#endif
+
+#define SCHED_START	1	/* START-TIMER <name> <interval>	*/
+#define SCHED_CANCEL	2	/* CANCEL-TIMER <name> [<cmd>]		*/
+#define SCHED_EXECUTE	3	/* EXECUTE <cmd>			*/
+
+/* AT <notifytype> <upsname> <command> <cmdarg1> [<cmdarg2>] */
+typedef struct sched_at_s {
+	char	*ntype;
+	char	*upsname;
+	int	cmd;
+	char	*arg1;
+	char	*arg2;			/* NULL if not given */
+	struct sched_at_s	*next;
+} sched_at_t;
+
+typedef struct {
+	char	*cmdscript;
+	char	*pipefn;
+	char	*lockfn;
+	sched_at_t	*at;		/* in the order of the file */
+} sched_conf_t;
+
+/* what's been loaded by sched_readconf, NULL until then */
+extern	sched_conf_t	*sched_conf;
+
+/* log timers and commands as they go, instead of debugging only */
+extern	int	sched_verbose;
+
+/* runs CMDSCRIPT <arg> for an event on upsname, set by the program */
+extern	void	(*sched_exec)(const char *arg, const char *upsname,
+			const char *ntype);
+
+/* handles one matching AT rule */
+typedef void (*sched_action_t)(const sched_at_t *at, const char *upsname,
+			const char *ntype);
+
+int sched_readconf(const char *fn);
+void sched_freeconf(void);
+
+void sched_event(const char *upsname, const char *ntype, sched_action_t action);
+void sched_action(const sched_at_t *at, const char *upsname, const char *ntype);
+
+void sched_start_timer(const char *name, const char *ofsstr,
+			const char *upsname, const char *ntype);
+void sched_cancel_timer(const char *name, const char *cname,
+			const char *upsname, const char *ntype);
+long sched_checktimers(void);
+long sched_timeleft(void);
+void sched_cleanup(void);
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+}
+/* *INDENT-ON* */
+#endif
+
+#endif	/* SCHEDLIB_H_SEEN */
@@ -34,9 +34,12 @@
 #include <string.h>
 #include <unistd.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <fcntl.h>
+#include <sys/uio.h>
 
 #include "upsclient.h"
 #include "common.h"
@@ -141,6 +144,20 @@ static int upscli_initialized = 0;
 
 #ifdef WITH_OPENSSL
 static SSL_CTX	*ssl_ctx;
+
+/* last session given by each server, to resume it when reconnecting
+ * rather than going through a full handshake */
+typedef struct ssl_session_s {
+	char	*host;
+	int	port;
+	SSL_SESSION	*session;
+	struct ssl_session_s	*next;
+} SSL_SESSION_CACHE_t;
+
+static SSL_SESSION_CACHE_t	*first_ssl_session = NULL;
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t	ssl_session_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
 #elif defined(WITH_NSS) /* WITH_OPENSLL */
 static int verify_certificate = 1;
 static HOST_CERT_t *first_host_cert = NULL;
@@ -194,6 +211,103 @@ static int ssl_error(SSL *ssl, int ret)
 	return -1;
 }
 
+static void ssl_session_lock_cache(int lock)
+{
+#ifdef HAVE_PTHREAD
+	if (lock) {
+		pthread_mutex_lock(&ssl_session_lock);
+	} else {
+		pthread_mutex_unlock(&ssl_session_lock);
+	}
+#endif
+}
+
+/* must be called with the cache locked */
+static SSL_SESSION_CACHE_t *ssl_session_find(const char *host, int port)
+{
+	SSL_SESSION_CACHE_t	*entry;
+
+	for (entry = first_ssl_session; entry; entry = entry->next) {
+		if ((entry->port == port) && !strcmp(entry->host, host)) {
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+/* called by OpenSSL each time a server hands out a new session (ticket) */
+static int ssl_session_new(SSL *ssl, SSL_SESSION *session)
+{
+	UPSCONN_t	*ups = SSL_get_app_data(ssl);
+	SSL_SESSION_CACHE_t	*entry;
+
+	if (!ups || !ups->host) {
+		return 0;
+	}
+
+	ssl_session_lock_cache(1);
+
+	entry = ssl_session_find(ups->host, ups->port);
+
+	if (!entry) {
+		entry = xcalloc(1, sizeof(*entry));
+		entry->host = xstrdup(ups->host);
+		entry->port = ups->port;
+		entry->next = first_ssl_session;
+		first_ssl_session = entry;
+	}
+
+	if (entry->session) {
+		SSL_SESSION_free(entry->session);
+	}
+
+	entry->session = session;
+
+	ssl_session_lock_cache(0);
+
+	/* we keep the reference */
+	return 1;
+}
+
+/* offer the last session of this server, if any */
+static void ssl_session_resume(UPSCONN_t *ups)
+{
+	SSL_SESSION_CACHE_t	*entry;
+
+	ssl_session_lock_cache(1);
+
+	entry = ssl_session_find(ups->host, ups->port);
+
+	if (entry && entry->session) {
+		SSL_set_session(ups->ssl, entry->session);
+	}
+
+	ssl_session_lock_cache(0);
+}
+
+static void ssl_session_cleanup(void)
+{
+	SSL_SESSION_CACHE_t	*entry, *next;
+
+	ssl_session_lock_cache(1);
+
+	for (entry = first_ssl_session; entry; entry = next) {
+		next = entry->next;
+
+		if (entry->session) {
+			SSL_SESSION_free(entry->session);
+		}
+
+		free(entry->host);
+		free(entry);
+	}
+
+	first_ssl_session = NULL;
+
+	ssl_session_lock_cache(0);
+}
+
 #elif defined(WITH_NSS) /* WITH_OPENSSL */
 
 static char *nss_password_callback(PK11SlotInfo *slot, PRBool retry, 
@@ -360,6 +474,12 @@ int upscli_init(int certverify, const char *certpath,
 
 		SSL_CTX_set_verify(ssl_ctx, ssl_mode, NULL);		
 	}
+
+	/* keep the sessions ourselves, by server, so that reconnections
+	 * (e.g. of upsmon after an upsd restart) can resume them */
+	SSL_CTX_set_session_cache_mode(ssl_ctx,
+		SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+	SSL_CTX_sess_set_new_cb(ssl_ctx, ssl_session_new);
 #elif defined(WITH_NSS) /* WITH_OPENSSL */
 	PR_Init(PR_USER_THREAD, PR_PRIORITY_NORMAL, 0);
 	
@@ -405,6 +525,13 @@ int upscli_init(int certverify, const char *certpath,
 		nss_error("upscli_init / SSL_OptionSetDefault(SSL_V2_COMPATIBLE_HELLO)");
 		return -1;
 	}
+	/* sessions are cached by server anyway, tickets let them be
+	 * resumed even if the server does not keep them */
+	status = SSL_OptionSetDefault(SSL_ENABLE_SESSION_TICKETS, PR_TRUE);
+	if (status != SECSuccess) {
+		upslogx(LOG_NOTICE, "Can not enable session tickets");
+		nss_error("upscli_init / SSL_OptionSetDefault(SSL_ENABLE_SESSION_TICKETS)");
+	}
 	if (certname) {
 		nsscertname = xstrdup(certname);
 	}
@@ -450,6 +577,8 @@ static HOST_CERT_t* upscli_find_host_cert(const char* hostname)
 int upscli_cleanup(void)
 {
 #ifdef WITH_OPENSSL
+	ssl_session_cleanup();
+
 	if (ssl_ctx) {
 		SSL_CTX_free(ssl_ctx);
 		ssl_ctx = NULL;
@@ -629,7 +758,12 @@ static int upscli_select_write(const int fd, const void *buf, const size_t bufle
 		return ret;
 	}
 
+#ifdef MSG_NOSIGNAL
+	/* a Unix socket whose peer is gone raises SIGPIPE on the first write */
+	return send(fd, buf, buflen, MSG_NOSIGNAL);
+#else
 	return write(fd, buf, buflen);
+#endif
 }
 
 /* internal: abstract the SSL calls for the other functions */
@@ -670,6 +804,136 @@ static int net_write(UPSCONN_t *ups, const char *buf, size_t buflen, unsigned in
 }
 
 
+/* Write the iovcnt buffers of iov to fd with a single system call, and
+   return the number of bytes written. If fd can't be written to within
+   d_sec + d_usec, return 0.
+   On error, a value < 0 is returned (errno indicates error). */
+static int upscli_select_writev(const int fd, const struct iovec *iov, const int iovcnt, const long d_sec, const long d_usec)
+{
+	int		ret;
+	fd_set		fds;
+	struct timeval	tv;
+
+	FD_ZERO(&fds);
+	FD_SET(fd, &fds);
+
+	tv.tv_sec = d_sec;
+	tv.tv_usec = d_usec;
+
+	ret = select(fd + 1, NULL, &fds, NULL, &tv);
+
+	if (ret < 1) {
+		return ret;
+	}
+
+	return writev(fd, iov, iovcnt);
+}
+
+/* internal: append to the lines waiting to be sent */
+static int net_queue(UPSCONN_t *ups, const char *buf, size_t buflen)
+{
+	if (ups->sendlen + buflen > ups->sendsize) {
+		size_t	size = ups->sendsize ? ups->sendsize : UPSCLI_NETBUF_LEN;
+		char	*sendbuf;
+
+		while (size < ups->sendlen + buflen) {
+			size *= 2;
+		}
+
+		sendbuf = realloc(ups->sendbuf, size);
+
+		if (!sendbuf) {
+			ups->upserror = UPSCLI_ERR_NOMEM;
+			return -1;
+		}
+
+		ups->sendbuf = sendbuf;
+		ups->sendsize = size;
+	}
+
+	memcpy(ups->sendbuf + ups->sendlen, buf, buflen);
+	ups->sendlen += buflen;
+
+	return 0;
+}
+
+/* internal: send the queued lines, followed by buf (if any), with as few
+   system calls (and packets) as possible. Return as net_write() does. */
+static int net_flush(UPSCONN_t *ups, const char *buf, size_t buflen, unsigned int timeout)
+{
+	struct iovec	iov[2], *v = iov;
+	int	iovcnt = 0, ret, sent = 0;
+
+#ifdef WITH_SSL
+	if (ups->ssl) {
+		/* a single record for all of them */
+		if (ups->sendlen > 0 && buf) {
+			if (net_queue(ups, buf, buflen) < 0) {
+				return -1;
+			}
+			buf = NULL;
+		}
+
+		if (ups->sendlen > 0) {
+			ret = net_write(ups, ups->sendbuf, ups->sendlen, timeout);
+			ups->sendlen = 0;
+			return ret;
+		}
+
+		return net_write(ups, buf, buflen, timeout);
+	}
+#endif
+
+	if (ups->sendlen > 0) {
+		iov[iovcnt].iov_base = ups->sendbuf;
+		iov[iovcnt].iov_len = ups->sendlen;
+		iovcnt++;
+	}
+
+	if (buf) {
+		iov[iovcnt].iov_base = (char *)buf;
+		iov[iovcnt].iov_len = buflen;
+		iovcnt++;
+	}
+
+	ups->sendlen = 0;
+
+	while (iovcnt > 0) {
+
+		ret = upscli_select_writev(ups->fd, v, iovcnt, timeout, 0);
+
+		/* error writing data, server disconnected? */
+		if (ret < 0) {
+			ups->upserror = UPSCLI_ERR_WRITE;
+			ups->syserrno = errno;
+			return ret;
+		}
+
+		/* not ready for writing, server disconnected? */
+		if (ret == 0) {
+			ups->upserror = UPSCLI_ERR_SRVDISC;
+			return ret;
+		}
+
+		sent += ret;
+
+		/* partial write: skip what was sent */
+		while (iovcnt > 0 && (size_t)ret >= v->iov_len) {
+			ret -= v->iov_len;
+			v++;
+			iovcnt--;
+		}
+
+		if (iovcnt > 0) {
+			v->iov_base = (char *)v->iov_base + ret;
+			v->iov_len -= ret;
+		}
+	}
+
+	return sent;
+}
+
+
 #ifdef WITH_SSL
 
 /*
@@ -738,11 +1002,15 @@ static int upscli_sslinit(UPSCONN_t *ups, int verifycert)
 		SSL_set_verify(ups->ssl, SSL_VERIFY_NONE, NULL);
 	}
 
+	SSL_set_app_data(ups->ssl, ups);
+	ssl_session_resume(ups);
+
 	res = SSL_connect(ups->ssl);
 	switch(res)
 	{
 	case 1:
-		upsdebugx(3, "SSL connected (%s)", SSL_get_version(ups->ssl));
+		upsdebugx(3, "SSL connected (%s, %s session)", SSL_get_version(ups->ssl),
+			SSL_session_reused(ups->ssl) ? "resumed" : "new");
 		break;
 	case 0:
 		upslog_with_errno(1, "SSL_connect do not accept handshake.");
@@ -850,31 +1118,18 @@ static int upscli_sslinit(UPSCONN_t *ups, int verifycert)
 
 #endif /* WITH_SSL */
 
-int upscli_tryconnect(UPSCONN_t *ups, const char *host, int port, int flags,struct timeval * timeout)
+/* connection being opened, see upscli_connect_start() */
+typedef struct {
+	struct addrinfo	*res;	/* all the addresses of the host (TCP only) */
+	struct addrinfo	*ai;	/* the one being tried */
+	int	flags;
+}	UPSCLI_CONNECTING_t;
+
+static int upscli_resolve(UPSCONN_t *ups, const char *host, int port, int flags, struct addrinfo **res)
 {
-	int				sock_fd;
-	struct addrinfo	hints, *res, *ai;
+	struct addrinfo	hints;
 	char			sport[NI_MAXSERV];
-	int				v, certverify, tryssl, forcessl, ret;
-	HOST_CERT_t*	hostcert;
-	fd_set 			wfds;
-	int			error;
-	socklen_t		error_size;
-	long			fd_flags;
-
-	if (!ups) {
-		return -1;
-	}
-
-	/* clear out any lingering junk */
-	memset(ups, 0, sizeof(*ups));
-	ups->upsclient_magic = UPSCLIENT_MAGIC;
-	ups->fd = -1;
-
-	if (!host) {
-		ups->upserror = UPSCLI_ERR_NOSUCHHOST;
-		return -1;
-	}
+	int				v;
 
 	snprintf(sport, sizeof(sport), "%hu", (unsigned short int)port);
 
@@ -891,7 +1146,7 @@ int upscli_tryconnect(UPSCONN_t *ups, const char *host, int port, int flags,stru
 	hints.ai_socktype = SOCK_STREAM;
 	hints.ai_protocol = IPPROTO_TCP;
 
-	while ((v = getaddrinfo(host, sport, &hints, &res)) != 0) {
+	while ((v = getaddrinfo(host, sport, &hints, res)) != 0) {
 		switch (v)
 		{
 		case EAI_AGAIN:
@@ -911,7 +1166,21 @@ int upscli_tryconnect(UPSCONN_t *ups, const char *host, int port, int flags,stru
 		return -1;
 	}
 
-	for (ai = res; ai != NULL; ai = ai->ai_next) {
+	return 0;
+}
+
+/* start a non blocking connection to the current address, or to the
+ * following ones if it fails at once
+ * returns 1 if in progress, 0 if connected, -1 if no address is left */
+static int upscli_tcp_next(UPSCONN_t *ups, UPSCLI_CONNECTING_t *conn)
+{
+	struct addrinfo	*ai;
+	int	sock_fd, v;
+	long	fd_flags;
+
+	for (; conn->ai != NULL; conn->ai = conn->ai->ai_next) {
+
+		ai = conn->ai;
 
 		sock_fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
 
@@ -928,35 +1197,14 @@ int upscli_tryconnect(UPSCONN_t *ups, const char *host, int port, int flags,stru
 			continue;
 		}
 
-		/* non blocking connect */
-		if(timeout != NULL) {
-			fd_flags = fcntl(sock_fd, F_GETFL);
-			fd_flags |= O_NONBLOCK;
-			fcntl(sock_fd, F_SETFL, fd_flags);
-		}
+		fd_flags = fcntl(sock_fd, F_GETFL);
+		fd_flags |= O_NONBLOCK;
+		fcntl(sock_fd, F_SETFL, fd_flags);
 
 		while ((v = connect(sock_fd, ai->ai_addr, ai->ai_addrlen)) < 0) {
-			if(errno == EINPROGRESS || SOLARIS_i386_NBCONNECT_ENOENT(errno) || AIX_NBCONNECT_0(errno)) {
-				FD_ZERO(&wfds);
-				FD_SET(sock_fd, &wfds);
-				select(sock_fd+1,NULL,&wfds,NULL,
-						timeout);
-				if (FD_ISSET(sock_fd, &wfds)) {
-					error_size = sizeof(error);
-					getsockopt(sock_fd,SOL_SOCKET,SO_ERROR,
-							&error,&error_size);
-					if( error == 0) {
-						/* connect successful */
-						v = 0;
-						break;
-					}
-					errno = error;
-				}
-				else {
-					/* Timeout */
-					v = -1;
-					break;
-				}
+			if (errno == EINPROGRESS || SOLARIS_i386_NBCONNECT_ENOENT(errno) || AIX_NBCONNECT_0(errno)) {
+				ups->fd = sock_fd;
+				return 1;
 			}
 
 			switch (errno)
@@ -973,41 +1221,90 @@ int upscli_tryconnect(UPSCONN_t *ups, const char *host, int port, int flags,stru
 			break;
 		}
 
-		if (v < 0) {
-			close(sock_fd);
-			continue;
+		if (v == 0) {
+			ups->fd = sock_fd;
+			return 0;
 		}
 
-		/* switch back to blocking operation */
-		if(timeout != NULL) {
-			fd_flags = fcntl(sock_fd, F_GETFL);
-			fd_flags &= ~O_NONBLOCK;
-			fcntl(sock_fd, F_SETFL, fd_flags);
-		}
+		close(sock_fd);
+	}
 
-		ups->fd = sock_fd;
-		ups->upserror = 0;
-		ups->syserrno = 0;
-		break;
+	return -1;
+}
+
+/* give up on the address being tried, and start with the next one */
+static int upscli_connect_next(UPSCONN_t *ups, UPSCLI_CONNECTING_t *conn)
+{
+	close(ups->fd);
+	ups->fd = -1;
+
+	if (conn->ai == NULL) {
+		return -1;
 	}
 
-	freeaddrinfo(res);
+	conn->ai = conn->ai->ai_next;
 
-	if (ups->fd < 0) {
+	return upscli_tcp_next(ups, conn);
+}
+
+static void upscli_connect_free(UPSCONN_t *ups)
+{
+	UPSCLI_CONNECTING_t	*conn = ups->connecting;
+
+	if (conn->res) {
+		freeaddrinfo(conn->res);
+	}
+
+	free(conn);
+	ups->connecting = NULL;
+}
+
+/* connect to a local upsd through its Unix socket */
+static int upscli_unix_connect(UPSCONN_t *ups, const char *path)
+{
+	struct sockaddr_un	sa;
+	int	sock_fd;
+
+	if ((*path == '\0') || (strlen(path) >= sizeof(sa.sun_path))) {
+		ups->upserror = UPSCLI_ERR_NOSUCHHOST;
 		return -1;
 	}
 
-	pconf_init(&ups->pc_ctx, NULL);
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	snprintf(sa.sun_path, sizeof(sa.sun_path), "%s", path);
 
-	ups->host = strdup(host);
+	if ((sock_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+		ups->upserror = UPSCLI_ERR_SOCKFAILURE;
+		ups->syserrno = errno;
+		return -1;
+	}
 
-	if (!ups->host) {
-		ups->upserror = UPSCLI_ERR_NOMEM;
-		upscli_disconnect(ups);
+	/* local connections complete (or fail) at once: no timeout needed */
+	while (connect(sock_fd, (struct sockaddr *) &sa, sizeof(sa)) < 0) {
+		if (errno == EINTR) {
+			continue;
+		}
+
+		ups->upserror = UPSCLI_ERR_CONNFAILURE;
+		ups->syserrno = errno;
+		close(sock_fd);
 		return -1;
 	}
 
-	ups->port = port;
+	ups->fd = sock_fd;
+	return 0;
+}
+
+/* STARTTLS negotiation of a new connection, as requested by flags */
+static int upscli_sslsetup(UPSCONN_t *ups, int flags)
+{
+	int				certverify, tryssl, forcessl, ret;
+	HOST_CERT_t*	hostcert;
+	char			host[UPSCLI_NETBUF_LEN];
+
+	/* upscli_sslinit() may disconnect, and free ups->host with it */
+	snprintf(host, sizeof(host), "%s", ups->host);
 
 	hostcert = upscli_find_host_cert(host);
 	
@@ -1052,6 +1349,179 @@ int upscli_tryconnect(UPSCONN_t *ups, const char *host, int port, int flags,stru
 	return 0;
 }
 
+int upscli_connect_start(UPSCONN_t *ups, const char *host, int port, int flags)
+{
+	UPSCLI_CONNECTING_t	*conn;
+	int	ret;
+
+	if (!ups) {
+		return -1;
+	}
+
+	/* clear out any lingering junk */
+	memset(ups, 0, sizeof(*ups));
+	ups->upsclient_magic = UPSCLIENT_MAGIC;
+	ups->fd = -1;
+
+	if (!host) {
+		ups->upserror = UPSCLI_ERR_NOSUCHHOST;
+		return -1;
+	}
+
+	conn = calloc(1, sizeof(*conn));
+
+	if (!conn) {
+		ups->upserror = UPSCLI_ERR_NOMEM;
+		return -1;
+	}
+
+	conn->flags = flags;
+	ups->connecting = conn;
+
+	if (!strncmp(host, UPSCLI_UNIX_PREFIX, strlen(UPSCLI_UNIX_PREFIX))) {
+		ret = upscli_unix_connect(ups, host + strlen(UPSCLI_UNIX_PREFIX));
+	} else if ((ret = upscli_resolve(ups, host, port, flags, &conn->res)) == 0) {
+		conn->ai = conn->res;
+		ret = upscli_tcp_next(ups, conn);
+	}
+
+	if (ret < 0) {
+		upscli_connect_free(ups);
+		return -1;
+	}
+
+	ups->host = strdup(host);
+
+	if (!ups->host) {
+		upscli_disconnect(ups);
+		ups->upserror = UPSCLI_ERR_NOMEM;
+		return -1;
+	}
+
+	ups->port = port;
+
+	return 0;
+}
+
+int upscli_connect_finish(UPSCONN_t *ups)
+{
+	UPSCLI_CONNECTING_t	*conn;
+	fd_set	wfds;
+	struct timeval	tv;
+	int	error, flags, v;
+	socklen_t	error_size;
+	long	fd_flags;
+
+	if (!ups) {
+		return -1;
+	}
+
+	conn = ups->connecting;
+
+	if ((ups->upsclient_magic != UPSCLIENT_MAGIC) || (!conn)) {
+		ups->upserror = UPSCLI_ERR_INVALIDARG;
+		return -1;
+	}
+
+	for (;;) {
+		FD_ZERO(&wfds);
+		FD_SET(ups->fd, &wfds);
+		tv.tv_sec = 0;
+		tv.tv_usec = 0;
+
+		/* still in progress */
+		if (select(ups->fd + 1, NULL, &wfds, NULL, &tv) < 1) {
+			return 1;
+		}
+
+		error_size = sizeof(error);
+
+		if (getsockopt(ups->fd, SOL_SOCKET, SO_ERROR, &error, &error_size) < 0) {
+			error = errno;
+		}
+
+		if (error == 0) {
+			break;
+		}
+
+		ups->upserror = UPSCLI_ERR_CONNFAILURE;
+		ups->syserrno = error;
+
+		v = upscli_connect_next(ups, conn);
+
+		if (v < 0) {
+			upscli_disconnect(ups);
+			return -1;
+		}
+
+		if (v == 1) {
+			return 1;
+		}
+	}
+
+	/* switch back to blocking operation */
+	fd_flags = fcntl(ups->fd, F_GETFL);
+	fd_flags &= ~O_NONBLOCK;
+	fcntl(ups->fd, F_SETFL, fd_flags);
+
+	if (conn->res) {
+		/* commands are small and either wait for their answer or are
+		   sent together: don't let Nagle hold them back */
+		v = 1;
+		setsockopt(ups->fd, IPPROTO_TCP, TCP_NODELAY, &v, sizeof(v));
+	}
+
+	flags = conn->flags;
+	upscli_connect_free(ups);
+
+	ups->upserror = 0;
+	ups->syserrno = 0;
+
+	pconf_init(&ups->pc_ctx, NULL);
+
+	/* upsd handles the TLS handshake right after answering STARTTLS,
+	   without serving other clients: get it over with at once */
+	return upscli_sslsetup(ups, flags);
+}
+
+int upscli_tryconnect(UPSCONN_t *ups, const char *host, int port, int flags,struct timeval * timeout)
+{
+	fd_set	wfds;
+	struct timeval	tv;
+	int	ret;
+
+	if (upscli_connect_start(ups, host, port, flags) < 0) {
+		return -1;
+	}
+
+	/* wait for each address in turn, up to timeout (forever if NULL) */
+	while ((ret = upscli_connect_finish(ups)) == 1) {
+		FD_ZERO(&wfds);
+		FD_SET(ups->fd, &wfds);
+
+		if (timeout != NULL) {
+			tv = *timeout;
+		}
+
+		ret = select(ups->fd + 1, NULL, &wfds, NULL, timeout != NULL ? &tv : NULL);
+
+		if (ret != 0) {
+			continue;
+		}
+
+		/* timeout */
+		ups->upserror = UPSCLI_ERR_CONNFAILURE;
+		ups->syserrno = ETIMEDOUT;
+
+		if (upscli_connect_next(ups, ups->connecting) < 0) {
+			upscli_disconnect(ups);
+			return -1;
+		}
+	}
+
+	return ret;
+}
+
 int upscli_connect(UPSCONN_t *ups, const char *host, int port, int flags)
 {
 	return upscli_tryconnect(ups,host,port,flags,NULL);
@@ -1174,7 +1644,16 @@ static int verify_resp(int num, const char **q, char **a)
 int upscli_get(UPSCONN_t *ups, unsigned int numq, const char **query, 
 		unsigned int *numa, char ***answer)
 {
-	char	cmd[UPSCLI_NETBUF_LEN], tmp[UPSCLI_NETBUF_LEN];
+	if (upscli_get_start(ups, numq, query) != 0) {
+		return -1;
+	}
+
+	return upscli_get_finish(ups, numq, query, numa, answer, DEFAULT_NETWORK_TIMEOUT);
+}
+
+int upscli_get_start(UPSCONN_t *ups, unsigned int numq, const char **query)
+{
+	char	cmd[UPSCLI_NETBUF_LEN];
 	
 	if (!ups) {
 		return -1;
@@ -1188,11 +1667,24 @@ int upscli_get(UPSCONN_t *ups, unsigned int numq, const char **query,
 	/* create the string to send to upsd */
 	build_cmd(cmd, sizeof(cmd), "GET", numq, query);
 
-	if (upscli_sendline(ups, cmd, strlen(cmd)) != 0) {
+	return upscli_sendline(ups, cmd, strlen(cmd));
+}
+
+int upscli_get_finish(UPSCONN_t *ups, unsigned int numq, const char **query,
+		unsigned int *numa, char ***answer, unsigned int timeout)
+{
+	char	tmp[UPSCLI_NETBUF_LEN];
+
+	if (!ups) {
 		return -1;
 	}
 
-	if (upscli_readline(ups, tmp, sizeof(tmp)) != 0) {
+	if (numq < 1) {
+		ups->upserror = UPSCLI_ERR_INVALIDARG;
+		return -1;
+	}
+
+	if (upscli_readline_timeout(ups, tmp, sizeof(tmp), timeout) != 0) {
 		return -1;
 	}
 
@@ -1354,7 +1846,8 @@ int upscli_sendline_timeout(UPSCONN_t *ups, const char *buf, size_t buflen, unsi
 		return -1;
 	}
 
-	ret = net_write(ups, buf, buflen, timeout);
+	/* along with the queued lines, if any */
+	ret = net_flush(ups, buf, buflen, timeout);
 
 	if (ret < 1) {
 		upscli_disconnect(ups);
@@ -1369,6 +1862,63 @@ int upscli_sendline(UPSCONN_t *ups, const char *buf, size_t buflen)
 	return upscli_sendline_timeout(ups, buf, buflen, 0);
 }
 
+int upscli_queueline(UPSCONN_t *ups, const char *buf, size_t buflen)
+{
+	if (!ups) {
+		return -1;
+	}
+
+	if (ups->fd < 0) {
+		ups->upserror = UPSCLI_ERR_DRVNOTCONN;
+		return -1;
+	}
+
+	if ((!buf) || (buflen < 1)) {
+		ups->upserror = UPSCLI_ERR_INVALIDARG;
+		return -1;
+	}
+
+	if (ups->upsclient_magic != UPSCLIENT_MAGIC) {
+		ups->upserror = UPSCLI_ERR_INVALIDARG;
+		return -1;
+	}
+
+	return net_queue(ups, buf, buflen);
+}
+
+int upscli_flush_timeout(UPSCONN_t *ups, unsigned int timeout)
+{
+	if (!ups) {
+		return -1;
+	}
+
+	if (ups->fd < 0) {
+		ups->upserror = UPSCLI_ERR_DRVNOTCONN;
+		return -1;
+	}
+
+	if (ups->upsclient_magic != UPSCLIENT_MAGIC) {
+		ups->upserror = UPSCLI_ERR_INVALIDARG;
+		return -1;
+	}
+
+	if (ups->sendlen == 0) {
+		return 0;
+	}
+
+	if (net_flush(ups, NULL, 0, timeout) < 1) {
+		upscli_disconnect(ups);
+		return -1;
+	}
+
+	return 0;
+}
+
+int upscli_flush(UPSCONN_t *ups)
+{
+	return upscli_flush_timeout(ups, 0);
+}
+
 int upscli_readline_timeout(UPSCONN_t *ups, char *buf, size_t buflen, unsigned int timeout)
 {
 	int	ret;
@@ -1475,6 +2025,17 @@ int upscli_splitaddr(const char *buf, char **hostname, int *port)
 		return -1;
 	}
 
+	/* unix:<path> is a local socket: the colon is not a port separator */
+	if (!strncmp(tmp, UPSCLI_UNIX_PREFIX, strlen(UPSCLI_UNIX_PREFIX))) {
+		if ((*hostname = strdup(tmp)) == NULL) {
+			fprintf(stderr, "upscli_splitaddr: strdup failed\n");
+			return -1;
+		}
+
+		*port = PORT;
+		return 0;
+	}
+
 	if (*tmp == '[') {
 		if (strchr(tmp, ']') == NULL) {
 			fprintf(stderr, "upscli_splitaddr: missing closing bracket in [domain literal]\n");
@@ -1529,6 +2090,24 @@ int upscli_disconnect(UPSCONN_t *ups)
 	free(ups->host);
 	ups->host = NULL;
 
+	/* not connected yet: nobody to say LOGOUT to */
+	if (ups->connecting) {
+		upscli_connect_free(ups);
+
+		if (ups->fd >= 0) {
+			close(ups->fd);
+			ups->fd = -1;
+		}
+
+		return 0;
+	}
+
+	/* queued lines are dropped */
+	free(ups->sendbuf);
+	ups->sendbuf = NULL;
+	ups->sendlen = 0;
+	ups->sendsize = 0;
+
 	if (ups->fd < 0) {
 		return 0;
 	}
@@ -1537,6 +2116,9 @@ int upscli_disconnect(UPSCONN_t *ups)
 
 #ifdef WITH_OPENSSL
 	if (ups->ssl) {
+		/* upsd closes after LOGOUT: don't send it a close_notify, which
+		   is a SIGPIPE over a Unix socket. The session stays resumable. */
+		SSL_set_quiet_shutdown(ups->ssl, 1);
 		SSL_shutdown(ups->ssl);
 		SSL_free(ups->ssl);
 		ups->ssl = NULL;
@@ -64,6 +64,12 @@ typedef struct {
 	size_t	readlen;
 	size_t	readidx;
 
+	char	*sendbuf;	/* lines queued by upscli_queueline() */
+	size_t	sendlen;
+	size_t	sendsize;
+
+	void	*connecting;	/* see upscli_connect_start() */
+
 }	UPSCONN_t;
 
 const char *upscli_strerror(UPSCONN_t *ups);
@@ -73,6 +79,8 @@ int upscli_cleanup(void);
 
 int upscli_tryconnect(UPSCONN_t *ups, const char *host, int port, int flags, struct timeval *tv);
 int upscli_connect(UPSCONN_t *ups, const char *host, int port, int flags);
+int upscli_connect_start(UPSCONN_t *ups, const char *host, int port, int flags);
+int upscli_connect_finish(UPSCONN_t *ups);
 
 void upscli_add_host_cert(const char* hostname, const char* certname, int certverify, int forcessl);
 
@@ -80,6 +88,9 @@ void upscli_add_host_cert(const char* hostname, const char* certname, int certve
 
 int upscli_get(UPSCONN_t *ups, unsigned int numq, const char **query, 
 		unsigned int *numa, char ***answer);
+int upscli_get_start(UPSCONN_t *ups, unsigned int numq, const char **query);
+int upscli_get_finish(UPSCONN_t *ups, unsigned int numq, const char **query,
+		unsigned int *numa, char ***answer, unsigned int timeout);
 
 int upscli_list_start(UPSCONN_t *ups, unsigned int numq, const char **query);
 
@@ -89,6 +100,10 @@ int upscli_list_next(UPSCONN_t *ups, unsigned int numq, const char **query,
 int upscli_sendline_timeout(UPSCONN_t *ups, const char *buf, size_t buflen, unsigned int timeout);
 int upscli_sendline(UPSCONN_t *ups, const char *buf, size_t buflen);
 
+int upscli_queueline(UPSCONN_t *ups, const char *buf, size_t buflen);
+int upscli_flush_timeout(UPSCONN_t *ups, unsigned int timeout);
+int upscli_flush(UPSCONN_t *ups);
+
 int upscli_readline_timeout(UPSCONN_t *ups, char *buf, size_t buflen, unsigned int timeout);
 int upscli_readline(UPSCONN_t *ups, char *buf, size_t buflen);
 
@@ -169,6 +184,10 @@ int upscli_ssl(UPSCONN_t *ups);
 #define UPSCLI_CONN_INET6		0x0008	/* IPv6 only */
 #define UPSCLI_CONN_CERTVERIF	0x0010	/* Verify certificates for SSL	*/
 
+/* host name prefix for upscli_connect to use a local Unix socket */
+
+#define UPSCLI_UNIX_PREFIX	"unix:"
+
 #ifdef __cplusplus
 /* *INDENT-OFF* */
 }
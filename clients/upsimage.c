@@ -53,6 +53,30 @@ static	int	port;
 static	char	*upsname, *hostname;
 static	UPSCONN_t	ups;
 
+	/* the upsd that ups is connected to, kept for the next FastCGI request */
+static	char	*connhost = NULL;
+static	int	connport = -1;
+
+	/* the upsimagearg.h defaults, before the URL changed them */
+static	int	*imgarg_def = NULL;
+
+	/* what the image being drawn depends on, and its ETag */
+static	char	*imgkey = NULL;
+static	char	imgetag[24];
+
+#define IMGCACHE_SIZE	64
+
+	/* images already drawn, kept across FastCGI requests */
+typedef struct {
+	char	*key;
+	void	*png;
+	int	size;
+	unsigned long	lastuse;
+} imgcache_t;
+
+static	imgcache_t	imgcache[IMGCACHE_SIZE];
+static	unsigned long	imgcache_use = 0;
+
 #define RED(x)		((x >> 16) & 0xff)
 #define GREEN(x)	((x >> 8)  & 0xff)
 #define BLUE(x)		(x & 0xff)
@@ -110,18 +134,73 @@ static int get_imgarg(const char *name)
 	return -1;
 }
 
-/* write the HTML header then have gd dump the image */
-static void drawimage(gdImagePtr im)
+static imgcache_t *cache_find(const char *key)
+{
+	int	i;
+
+	for (i = 0; i < IMGCACHE_SIZE; i++) {
+		if ((imgcache[i].key) && (!strcmp(imgcache[i].key, key))) {
+			imgcache[i].lastuse = ++imgcache_use;
+			return &imgcache[i];
+		}
+	}
+
+	return NULL;
+}
+
+/* keep a copy of the image, in place of the one unused the longest */
+static void cache_add(const char *key, const void *png, int size)
+{
+	imgcache_t	*ic = &imgcache[0];
+	int	i;
+
+	for (i = 1; i < IMGCACHE_SIZE; i++) {
+		if (imgcache[i].lastuse < ic->lastuse)
+			ic = &imgcache[i];
+	}
+
+	free(ic->key);
+	free(ic->png);
+
+	ic->key = xstrdup(key);
+	ic->png = xmalloc(size);
+	memcpy(ic->png, png, size);
+	ic->size = size;
+	ic->lastuse = ++imgcache_use;
+}
+
+static void sendimage(const void *png, int size)
 {
 	printf("Pragma: no-cache\n");
+
+	/* the browser checks with us before using its copy */
+	if (imgkey)
+		printf("ETag: %s\n", imgetag);
+
 	printf("Content-type: image/png\n\n");
 
-	gdImagePng(im, stdout);
+	fwrite(png, 1, size, stdout);
+}
+
+/* write the HTML header then have gd dump the image */
+static void drawimage(gdImagePtr im)
+{
+	void	*png;
+	int	size;
+
+	png = gdImagePngPtr(im, &size);
 	gdImageDestroy(im);
 
-	upscli_disconnect(&ups);
+	if (!png)
+		cgi_exit(EXIT_FAILURE);
+
+	if (imgkey)
+		cache_add(imgkey, png, size);
+
+	sendimage(png, size);
+	gdFree(png);
 
-	exit(EXIT_SUCCESS);
+	cgi_exit(EXIT_SUCCESS);
 }
 
 /* helper function to allocate color in the image */
@@ -493,6 +572,79 @@ static void draw_humidity(double var, int min, int nom, int max,
 	drawbar(0, 100, 2, 10, 20, 0, min, max, 100, -1, -1, var, format);
 }
 
+/* the image is all in the key, so it's the same if the key is */
+static void set_imgkey(const char *name, const char *text, int min, int nom, int max)
+{
+	char	key[LARGEBUF];
+	const	char	*p;
+	unsigned long long	hash = 14695981039346656037ULL;
+	int	i;
+
+	snprintf(key, sizeof(key), "%s %s %s %d %d %d", UPS_VERSION, name, text,
+		min, nom, max);
+
+	for (i = 0; imgarg[i].name != NULL; i++)
+		snprintfcat(key, sizeof(key), " %d", imgarg[i].val);
+
+	/* FNV-1a */
+	for (p = key; *p != '\0'; p++) {
+		hash ^= (unsigned char) *p;
+		hash *= 1099511628211ULL;
+	}
+
+	imgkey = xstrdup(key);
+	snprintf(imgetag, sizeof(imgetag), "\"%016llx\"", hash);
+}
+
+/* see if the browser already has this image */
+static int etag_match(void)
+{
+	const	char	*inm = getenv("HTTP_IF_NONE_MATCH");
+
+	if ((!inm) || (!imgkey))
+		return 0;
+
+	return (!strcmp(inm, "*")) || (strstr(inm, imgetag) != NULL);
+}
+
+/* upsd went away since the connection was made */
+static int conn_lost(void)
+{
+	switch (upscli_upserror(&ups))
+	{
+	case UPSCLI_ERR_READ:
+	case UPSCLI_ERR_WRITE:
+	case UPSCLI_ERR_SRVDISC:
+	case UPSCLI_ERR_SSLERR:
+		return 1;
+
+	default:
+		return 0;
+	}
+}
+
+/* connect to upsd, unless still connected from an earlier request
+ * returns 1 for an old connection, 0 for a new one and -1 on failure */
+static int ups_connect(void)
+{
+	if ((upscli_fd(&ups) != -1) && (!conn_lost()) && (connhost)
+		&& (!strcmp(connhost, hostname)) && (connport == port))
+		return 1;
+
+	upscli_disconnect(&ups);
+
+	free(connhost);
+	connhost = NULL;
+
+	if (upscli_connect(&ups, hostname, port, 0) < 0)
+		return -1;
+
+	connhost = xstrdup(hostname);
+	connport = port;
+
+	return 0;
+}
+
 static int get_var(const char *var, char *buf, size_t buflen)
 {
 	int	ret;
@@ -518,11 +670,35 @@ static int get_var(const char *var, char *buf, size_t buflen)
 	return 1;
 }
 
-int main(int argc, char **argv)
+/* forget what the request set - also run by cgilib after each FastCGI
+ * request, even one that ended in cgi_exit() */
+static void reset_request(void)
+{
+	int	i;
+
+	free(monhost);
+	free(cmd);
+	monhost = cmd = NULL;
+
+	free(upsname);
+	free(hostname);
+	upsname = hostname = NULL;
+
+	free(imgkey);
+	imgkey = NULL;
+
+	for (i = 0; imgarg[i].name != NULL; i++)
+		imgarg[i].val = imgarg_def[i];
+}
+
+static void upsimage(void)
 {
 	char	str[SMALLBUF];
-	int	i, min, nom, max;
+	int	i, min, nom, max, reused;
 	double	var = 0;
+	imgcache_t	*ic;
+
+	reset_request();
 
 	extractcgiargs();
 
@@ -533,17 +709,17 @@ int main(int argc, char **argv)
 	if (!checkhost(monhost, NULL))
 		noimage("Access denied");
 
-	upsname = hostname = NULL;
-
 	if (upscli_splitname(monhost, &upsname, &hostname, &port) != 0) {
 		noimage("Invalid UPS definition (upsname[@hostname[:port]])\n");
-		exit(EXIT_FAILURE);
+		cgi_exit(EXIT_FAILURE);
 	}
 
-	if (upscli_connect(&ups, hostname, port, 0) < 0) {
+	reused = ups_connect();
+
+	if (reused < 0) {
 		noimage("Can't connect to server:\n%s\n",
 			upscli_strerror(&ups));
-		exit(EXIT_FAILURE);
+		cgi_exit(EXIT_FAILURE);
 	}
 
 	for (i = 0; imgvar[i].name; i++)
@@ -553,18 +729,20 @@ int main(int argc, char **argv)
 			   registered with this variable */
 			if (!imgvar[i].drawfunc) {
 				noimage("Draw function N/A");
-				exit(EXIT_FAILURE);
+				cgi_exit(EXIT_FAILURE);
 			}
 
 			/* get the variable value */
-			if (get_var(imgvar[i].name, str, sizeof(str)) == 1) {
+			if ((get_var(imgvar[i].name, str, sizeof(str)) == 1)
+				|| ((reused) && (conn_lost()) && (ups_connect() == 0)
+				&& (get_var(imgvar[i].name, str, sizeof(str)) == 1))) {
 				var = strtod(str, NULL);
 			} else {
 				/* no value, no fun */
 				snprintf(str, sizeof(str), "%s N/A",
 					imgvar[i].name);
 				noimage(str);
-				exit(EXIT_FAILURE);
+				cgi_exit(EXIT_FAILURE);
 			}
 
 			/* when getting minimum, nominal and maximum values,
@@ -611,13 +789,49 @@ int main(int argc, char **argv)
 				max = -1;
 			}
 
+			/* draw the value no finer than the image prints it,
+			   so that the image only changes along with the text */
+			snprintf(str, sizeof(str), imgvar[i].format, var);
+			var = strtod(str, NULL);
+
+			set_imgkey(imgvar[i].name, str, min, nom, max);
+
+			if (etag_match()) {
+				printf("Status: 304 Not Modified\n");
+				printf("ETag: %s\n\n", imgetag);
+				cgi_exit(EXIT_SUCCESS);
+			}
+
+			ic = cache_find(imgkey);
+
+			if (ic) {
+				sendimage(ic->png, ic->size);
+				cgi_exit(EXIT_SUCCESS);
+			}
+
 			imgvar[i].drawfunc(var, min, nom, max,
 				imgvar[i].deviation, imgvar[i].format);
-			exit(EXIT_SUCCESS);
+			cgi_exit(EXIT_SUCCESS);
 		}
 
 	noimage("Unknown display");
-	exit(EXIT_FAILURE);
+	cgi_exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	int	i;
+
+	for (i = 0; imgarg[i].name != NULL; i++) {
+		imgarg_def = xrealloc(imgarg_def, (i + 1) * sizeof(*imgarg_def));
+		imgarg_def[i] = imgarg[i].val;
+	}
+
+	cgi_main(upsimage, reset_request);
+
+	upscli_disconnect(&ups);
+
+	return 0;
 }
 
 imgvar_t imgvar[] = {
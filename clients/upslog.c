@@ -29,6 +29,10 @@
  * That means the main loop just has to run the linked list and call
  * anything it finds in there.  Everything happens from there, and we
  * don't have to pointlessly reparse the string every time around.
+ *
+ * Any number of UPSes can be logged by one process.  The VARs that the
+ * format needs are fetched for each UPS with a single LIST VAR, and
+ * the list is then run against those values.
  */
 
 #include "common.h"
@@ -37,34 +41,42 @@
 
 #include "config.h"
 #include "timehead.h"
+#include "upslogbin.h"
 #include "upslog.h"
 
-	static	int	port, reopen_flag = 0, exit_flag = 0;
-	static	char	*upsname, *hostname;
-	static	UPSCONN_t	ups;
+	static	int	reopen_flag = 0, exit_flag = 0, binary = 0;
+	static	int	interval = 30;
 
-	static	FILE	*logfile;
-	static	const	char *logfn, *monhost;
+	static	monhost_t	*monhead = NULL, *curmon = NULL;
+	static	logfile_t	*loghead = NULL;
 	static	sigset_t	nut_upslog_sigmask;
 	static	char	logbuffer[LARGEBUF], *logformat;
 
 	static	flist_t	*fhead = NULL;
 
+	/* the VARs in the format, where monhost_t.val has their values */
+	static	char	**varname = NULL;
+	static	size_t	numvars = 0;
+
 #define DEFAULT_LOGFORMAT "%TIME @Y@m@d @H@M@S% %VAR battery.charge% " \
 		"%VAR input.voltage% %VAR ups.load% [%VAR ups.status%] " \
 		"%VAR ups.temperature% %VAR input.frequency%"
 
 static void reopen_log(void)
 {
-	if (logfile == stdout) {
-		upslogx(LOG_INFO, "logging to stdout");
-		return;
-	}
+	logfile_t	*log;
 
-	fclose(logfile);
-	logfile = fopen(logfn, "a");
-	if (logfile == NULL)
-		fatal_with_errno(EXIT_FAILURE, "could not reopen logfile %s", logfn);
+	for (log = loghead; log != NULL; log = log->next) {
+		if (log->f == stdout) {
+			upslogx(LOG_INFO, "logging to stdout");
+			continue;
+		}
+
+		fclose(log->f);
+		log->f = fopen(log->fn, binary ? "a+" : "a");
+		if (log->f == NULL)
+			fatal_with_errno(EXIT_FAILURE, "could not reopen logfile %s", log->fn);
+	}
 }
 
 static void set_reopen_flag(int sig)
@@ -115,13 +127,16 @@ static void help(const char *prog)
 	printf("\nusage: %s [OPTIONS]\n", prog);
 	printf("\n");
 
+	printf("  -b		- Write binary logs, for upslogdump\n");
 	printf("  -f <format>	- Log format.  See below for details.\n");
 	printf("		- Use -f \"<format>\" so your shell doesn't break it up.\n");
 	printf("  -i <interval>	- Time between updates, in seconds\n");
 	printf("  -l <logfile>	- Log file name, or - for stdout\n");
+	printf("  -m <ups,logfile>	- Monitor UPS <ups> to <logfile>, may be repeated\n");
 	printf("  -p <pidbase>  - Base name for PID file (defaults to \"%s\")\n", prog);
 	printf("  -s <ups>	- Monitor UPS <ups> - <upsname>@<host>[:<port>]\n");
 	printf("        	- Example: -s myups@server\n");
+	printf("		- Example: -m myups@server,/var/log/myups.log\n");
 	printf("  -u <user>	- Switch to <user> if started as root\n");
 
 	printf("\n");
@@ -159,7 +174,7 @@ static void do_host(const char *arg)
 
 static void do_upshost(const char *arg)
 {
-	snprintfcat(logbuffer, sizeof(logbuffer), "%s", monhost);
+	snprintfcat(logbuffer, sizeof(logbuffer), "%s", curmon->monhost);
 }
 
 static void do_pid(const char *arg)
@@ -190,24 +205,19 @@ static void do_time(const char *arg)
 
 static void getvar(const char *var)
 {
-	int	ret;
-	unsigned int	numq, numa;
-	const	char	*query[4];
-	char	**answer;
-
-	query[0] = "VAR";
-	query[1] = upsname;
-	query[2] = var;
-	numq = 3;
+	size_t	i;
 
-	ret = upscli_get(&ups, numq, query, &numa, &answer);
+	for (i = 0; i < numvars; i++) {
+		if (!strcmp(varname[i], var))
+			break;
+	}
 
-	if ((ret < 0) || (numa < numq)) {
+	if ((i == numvars) || (!curmon->val[i])) {
 		snprintfcat(logbuffer, sizeof(logbuffer), "NA");
 		return;
 	}
 
-	snprintfcat(logbuffer, sizeof(logbuffer), "%s", answer[3]);
+	snprintfcat(logbuffer, sizeof(logbuffer), "%s", curmon->val[i]);
 }
 
 static void do_var(const char *arg)
@@ -224,7 +234,7 @@ static void do_var(const char *arg)
 	}
 
 	/* a UPS name is now required */
-	if (!upsname) {
+	if (!curmon->upsname) {
 		snprintfcat(logbuffer, sizeof(logbuffer), "INVALID");
 		return;
 	}
@@ -272,6 +282,19 @@ static void add_call(void (*fptr)(const char *arg), const char *arg)
 		last->next = tmp;	
 	else
 		fhead = tmp;
+
+	/* and remember which values will need fetching */
+	if ((fptr == do_var) && (arg) && (strchr(arg, '.'))) {
+		size_t	i;
+
+		for (i = 0; i < numvars; i++) {
+			if (!strcmp(varname[i], arg))
+				return;
+		}
+
+		varname = xrealloc(varname, (numvars + 1) * sizeof(*varname));
+		varname[numvars++] = xstrdup(arg);
+	}
 }
 
 /* turn the format string into a list of function calls with args */
@@ -350,11 +373,136 @@ static void compile_format(void)
 	} /* for (i = 0; i < strlen(logformat); i++) */
 }
 
+/* (re)connect all the UPSes that aren't connected at the same time, and
+ * call ready() for each once it is connected or has failed, so that an
+ * unreachable upsd doesn't hold up the others.  After wait seconds, the
+ * UPSes that are still connecting get ready() called as well, and their
+ * connect goes on in the next call.  Connects that take more than the
+ * network timeout are given up on. */
+static void connect_all(int flags, int wait, void (*ready)(monhost_t *mon))
+{
+	monhost_t	*mon;
+	fd_set	wfds;
+	struct timeval	tv;
+	time_t	start, now;
+	int	ret, maxfd, left;
+
+	time(&start);
+
+	for (mon = monhead; mon != NULL; mon = mon->next) {
+		if ((upscli_fd(&mon->ups) < 0) &&
+			(upscli_connect_start(&mon->ups, mon->hostname, mon->port, flags) == 0)) {
+			mon->connecting = 1;
+			mon->connstart = start;
+			continue;
+		}
+
+		if ((!mon->connecting) && (ready))
+			ready(mon);
+	}
+
+	for (;;) {
+		FD_ZERO(&wfds);
+		maxfd = -1;
+		time(&now);
+
+		for (mon = monhead; mon != NULL; mon = mon->next) {
+			if (!mon->connecting)
+				continue;
+
+			ret = upscli_connect_finish(&mon->ups);
+
+			if ((ret == 1) && (difftime(now, mon->connstart) >= DEFAULT_NETWORK_TIMEOUT)) {
+				upscli_disconnect(&mon->ups);
+				mon->ups.upserror = UPSCLI_ERR_CONNFAILURE;
+				mon->ups.syserrno = ETIMEDOUT;
+				ret = -1;
+			}
+
+			if (ret == 1) {
+				FD_SET(upscli_fd(&mon->ups), &wfds);
+				if (upscli_fd(&mon->ups) > maxfd)
+					maxfd = upscli_fd(&mon->ups);
+				continue;
+			}
+
+			mon->connecting = 0;
+
+			if (ready)
+				ready(mon);
+		}
+
+		if (maxfd < 0)
+			return;
+
+		left = wait - (int)difftime(now, start);
+
+		if (left <= 0)
+			break;
+
+		tv.tv_sec = (left < DEFAULT_NETWORK_TIMEOUT) ? left : DEFAULT_NETWORK_TIMEOUT;
+		tv.tv_usec = 0;
+
+		if ((select(maxfd + 1, NULL, &wfds, NULL, &tv) < 0) && (errno != EINTR))
+			break;
+	}
+
+	/* log these without their values this time */
+	for (mon = monhead; mon != NULL; mon = mon->next) {
+		if ((mon->connecting) && (ready))
+			ready(mon);
+	}
+}
+
+/* fetch the values of all the VARs in the format in one go */
+static void getvars(monhost_t *mon)
+{
+	int	ret;
+	size_t	i;
+	unsigned int	numa;
+	const	char	*query[2];
+	char	**answer;
+
+	for (i = 0; i < numvars; i++) {
+		free(mon->val[i]);
+		mon->val[i] = NULL;
+	}
+
+	if ((numvars == 0) || (!mon->upsname) || (mon->connecting) ||
+		(upscli_fd(&mon->ups) < 0))
+		return;
+
+	query[0] = "VAR";
+	query[1] = mon->upsname;
+
+	if (upscli_list_start(&mon->ups, 2, query) < 0)
+		return;
+
+	while ((ret = upscli_list_next(&mon->ups, 2, query, &numa, &answer)) == 1) {
+
+		/* VAR <upsname> <varname> <val> */
+		if (numa < 4)
+			continue;
+
+		for (i = 0; i < numvars; i++) {
+			if (!strcmp(varname[i], answer[2])) {
+				mon->val[i] = xstrdup(answer[3]);
+				break;
+			}
+		}
+	}
+
+	/* don't leave the rest of the list to confuse the next query */
+	if (ret < 0)
+		upscli_disconnect(&mon->ups);
+}
+
 /* go through the list of functions and call them in order */
-static void run_flist(void)
+static void run_flist(monhost_t *mon)
 {
 	flist_t	*tmp;
 
+	curmon = mon;
 	tmp = fhead;
 
 	memset(logbuffer, 0, sizeof(logbuffer));
@@ -365,12 +513,136 @@ static void run_flist(void)
 		tmp = tmp->next;
 	}
 
-	fprintf(logfile, "%s\n", logbuffer);
-	fflush(logfile);
+	fprintf(mon->log->f, "%s\n", logbuffer);
+}
+
+/* in binary logs, (re)declare the UPSes that each one has, as after
+ * a reopen it may well be a new file */
+static void start_binlog(void)
+{
+	monhost_t	*mon, *tmp;
+	logfile_t	*log;
+	unsigned int	id;
+	long	cut;
+
+	for (log = loghead; log != NULL; log = log->next) {
+		cut = binlog_header(log->f);
+
+		/* binary records after text would spoil both */
+		if (cut == BINLOG_NOTBIN)
+			fatalx(EXIT_FAILURE, "%s is not a binary log, choose another file",
+				log->fn);
+
+		if (cut == BINLOG_IOERR)
+			fatal_with_errno(EXIT_FAILURE, "Can't check the end of %s",
+				log->fn);
+
+		if (cut > 0)
+			upslogx(LOG_WARNING, "%s: cut off %ld bytes of an unfinished record",
+				log->fn, cut);
+	}
+
+	for (mon = monhead; mon != NULL; mon = mon->next) {
+
+		/* numbered within their file */
+		for (id = 0, tmp = monhead; tmp != mon; tmp = tmp->next) {
+			if (tmp->log == mon->log)
+				id++;
+		}
+
+		binlog_schema(mon->log->f, &mon->bin, id, mon->monhost,
+			numvars, varname);
+	}
+}
+
+/* log the VARs of the format, stamped with the time in ms */
+static void run_binlog(monhost_t *mon)
+{
+	struct timeval	now;
+
+	gettimeofday(&now, NULL);
+
+	binlog_sample(mon->log->f, &mon->bin,
+		(long long) now.tv_sec * 1000 + now.tv_usec / 1000, mon->val);
+}
+
+/* log one UPS, once connect_all() is done with its connection */
+static void log_ups(monhost_t *mon)
+{
+	if (mon->connecting)
+		upsdebugx(1, "still connecting to %s", mon->monhost);
+	else if (upscli_fd(&mon->ups) < 0)
+		upsdebugx(1, "connect to %s failed: %s", mon->monhost,
+			upscli_strerror(&mon->ups));
+
+	getvars(mon);
+
+	if (binary)
+		run_binlog(mon);
+	else
+		run_flist(mon);
+
+	/* don't keep connection open if we don't intend to use it shortly */
+	if (interval > 30) {
+		upscli_disconnect(&mon->ups);
+	}
+}
+
+/* add a UPS to log to logfn */
+static void add_monhost(const char *monhost, const char *logfn)
+{
+	monhost_t	*mon, **last;
+	logfile_t	*log;
+
+	mon = xcalloc(1, sizeof(*mon));
+	mon->monhost = xstrdup(monhost);
+
+	if (upscli_splitname(monhost, &mon->upsname, &mon->hostname, &mon->port) != 0) {
+		fatalx(EXIT_FAILURE, "Error: invalid UPS definition.  Required format: upsname[@hostname[:port]]\n");
+	}
+
+	/* UPSes logging to the same file share it */
+	for (log = loghead; log != NULL; log = log->next) {
+		if (!strcmp(log->fn, logfn))
+			break;
+	}
+
+	if (!log) {
+		log = xcalloc(1, sizeof(*log));
+		log->fn = xstrdup(logfn);
+		log->next = loghead;
+		loghead = log;
+	}
+
+	mon->log = log;
+
+	for (last = &monhead; *last != NULL; last = &(*last)->next)
+		;
+
+	*last = mon;
+}
+
+/* -m <ups>,<logfile> */
+static void add_tuple(const char *arg)
+{
+	char	*monhost, *logfn;
+
+	monhost = xstrdup(arg);
+	logfn = strchr(monhost, ',');
+
+	if (!logfn)
+		fatalx(EXIT_FAILURE, "Error: invalid -m argument %s.  Required format: <ups>,<logfile>", arg);
+
+	*logfn++ = '\0';
+
+	add_monhost(monhost, logfn);
+
+	free(monhost);
 }
 
 	/* -s <monhost>
 	 * -l <log file>
+	 * -m <monhost>,<log file>
 	 * -i <interval>
 	 * -f <format>
 	 * -u <username>
@@ -378,24 +650,32 @@ static void run_flist(void)
 
 int main(int argc, char **argv)
 {
-	int	interval = 30, i;
+	int	i;
 	const char	*prog = xbasename(argv[0]);
 	time_t	now, nextpoll = 0;
 	const char	*user = NULL;
 	struct passwd	*new_uid = NULL;
 	const char	*pidfilebase = prog;
+	const char	*monhost = NULL, *logfn = NULL;
+	monhost_t	*mon;
+	logfile_t	*log;
+	int	use_stdout = 0;
 
 	logformat = DEFAULT_LOGFORMAT;
 	user = RUN_AS_USER;
 
 	printf("Network UPS Tools %s %s\n", prog, UPS_VERSION);
 
-	 while ((i = getopt(argc, argv, "+hs:l:i:f:u:Vp:")) != -1) {
+	 while ((i = getopt(argc, argv, "+hbs:l:m:i:f:u:Vp:")) != -1) {
 		switch(i) {
 			case 'h':
 				help(prog);
 				break;
 
+			case 'b':
+				binary = 1;
+				break;
+
 			case 's':
 				monhost = optarg;
 				break;
@@ -404,6 +684,10 @@ int main(int argc, char **argv)
 				logfn = optarg;
 				break;
 
+			case 'm':
+				add_tuple(optarg);
+				break;
+
 			case 'i':
 				interval = atoi(optarg);
 				break;
@@ -452,41 +736,50 @@ int main(int argc, char **argv)
 			snprintfcat(logformat, LARGEBUF, "%s ", argv[i]);
 	}
 
-	if (!monhost)
-		fatalx(EXIT_FAILURE, "No UPS defined for monitoring - use -s <system>");
+	if ((monhost) || (logfn) || (!monhead)) {
+		if (!monhost)
+			fatalx(EXIT_FAILURE, "No UPS defined for monitoring - use -s <system>");
 
-	if (!logfn)
-		fatalx(EXIT_FAILURE, "No filename defined for logging - use -l <file>");
+		if (!logfn)
+			fatalx(EXIT_FAILURE, "No filename defined for logging - use -l <file>");
+
+		add_monhost(monhost, logfn);
+	}
 
 	/* shouldn't happen */
 	if (!logformat)
 		fatalx(EXIT_FAILURE, "No format defined - but this should be impossible");
 
-	printf("logging status of %s to %s (%is intervals)\n", 
-		monhost, logfn, interval);
+	connect_all(UPSCLI_CONN_TRYSSL, DEFAULT_NETWORK_TIMEOUT, NULL);
 
-	if (upscli_splitname(monhost, &upsname, &hostname, &port) != 0) {
-		fatalx(EXIT_FAILURE, "Error: invalid UPS definition.  Required format: upsname[@hostname[:port]]\n");
-	}
+	for (mon = monhead; mon != NULL; mon = mon->next) {
+		printf("logging status of %s to %s (%is intervals)\n", 
+			mon->monhost, mon->log->fn, interval);
 
-	if (upscli_connect(&ups, hostname, port, UPSCLI_CONN_TRYSSL) < 0)
-		fprintf(stderr, "Warning: initial connect failed: %s\n", 
-			upscli_strerror(&ups));
+		if (upscli_fd(&mon->ups) < 0)
+			fprintf(stderr, "Warning: initial connect to %s failed: %s\n", 
+				mon->monhost, upscli_strerror(&mon->ups));
+	}
 
-	if (strcmp(logfn, "-") == 0)
-		logfile = stdout;
-	else
-		logfile = fopen(logfn, "a");
+	for (log = loghead; log != NULL; log = log->next) {
+		if (strcmp(log->fn, "-") == 0) {
+			log->f = stdout;
+			use_stdout = 1;
+		} else {
+			/* a binary log is read back to see where it ends */
+			log->f = fopen(log->fn, binary ? "a+" : "a");
+		}
 
-	if (logfile == NULL)
-		fatal_with_errno(EXIT_FAILURE, "could not open logfile %s", logfn);
+		if (log->f == NULL)
+			fatal_with_errno(EXIT_FAILURE, "could not open logfile %s", log->fn);
+	}
 
 	/* now drop root if we have it */
 	new_uid = get_user_pwent(user);
 
 	open_syslog(prog); 
 
-	if (logfile != stdout)
+	if (!use_stdout)
 		background();
 
 	setup_signals();
@@ -497,6 +790,16 @@ int main(int argc, char **argv)
 
 	compile_format();
 
+	for (mon = monhead; mon != NULL; mon = mon->next)
+		mon->val = xcalloc(numvars ? numvars : 1, sizeof(*mon->val));
+
+	if (binary) {
+		if (numvars == 0)
+			fatalx(EXIT_FAILURE, "Binary logs need a %%VAR%% in the format");
+
+		start_binlog();
+	}
+
 	while (exit_flag == 0) {
 		time(&now);
 
@@ -514,27 +817,28 @@ int main(int argc, char **argv)
 				reopen_flag);
 			reopen_log();
 			reopen_flag = 0;
-		}
 
-		/* reconnect if necessary */
-		if (upscli_fd(&ups) < 0) {
-			upscli_connect(&ups, hostname, port, 0);
+			if (binary)
+				start_binlog();
 		}
 
-		run_flist();
+		/* reconnect if necessary, but don't let that run into the next poll */
+		connect_all(0, (interval < DEFAULT_NETWORK_TIMEOUT) ? interval : DEFAULT_NETWORK_TIMEOUT,
+			log_ups);
 
-		/* don't keep connection open if we don't intend to use it shortly */
-		if (interval > 30) {
-			upscli_disconnect(&ups);
-		}
+		for (log = loghead; log != NULL; log = log->next)
+			fflush(log->f);
 	}
 
 	upslogx(LOG_INFO, "Signal %d: exiting", exit_flag);
 
-	if (logfile != stdout)
-		fclose(logfile);
+	for (log = loghead; log != NULL; log = log->next) {
+		if (log->f != stdout)
+			fclose(log->f);
+	}
 
-	upscli_disconnect(&ups);
+	for (mon = monhead; mon != NULL; mon = mon->next)
+		upscli_disconnect(&mon->ups);
 	
 	exit(EXIT_SUCCESS);
 }
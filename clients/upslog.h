@@ -13,6 +13,28 @@ typedef struct flist_s {
 	struct flist_s	*next;
 } flist_t;
 
+/* log file, shared by the UPSes that are logged to it */
+typedef struct logfile_s {
+	char	*fn;
+	FILE	*f;
+	struct logfile_s	*next;
+} logfile_t;
+
+/* a UPS to log, from -s/-l or -m */
+typedef struct monhost_s {
+	char	*monhost;
+	char	*upsname;
+	char	*hostname;
+	int	port;
+	UPSCONN_t	ups;
+	int	connecting;	/* upscli_connect_finish() still to call */
+	time_t	connstart;	/* since when */
+	logfile_t	*log;
+	char	**val;		/* last values of the VARs in the format */
+	binstream_t	bin;		/* for -b */
+	struct monhost_s	*next;
+} monhost_t;
+
 static void do_host(const char *arg);
 static void do_upshost(const char *arg);
 static void do_pid(const char *arg);
@@ -0,0 +1,607 @@
+/* upslogbin.c - binary time-series logs for upslog and upslogdump
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include "common.h"
+
+#include <ctype.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#include "upslogbin.h"
+
+/* --- encoding --- */
+
+static void put_varint(FILE *f, unsigned long long n)
+{
+	while (n >= 0x80) {
+		putc((int) (n & 0x7f) | 0x80, f);
+		n >>= 7;
+	}
+
+	putc((int) n, f);
+}
+
+static void put_zigzag(FILE *f, long long n)
+{
+	put_varint(f, ((unsigned long long) n << 1) ^ (unsigned long long) (n >> 63));
+}
+
+static void put_string(FILE *f, const char *str)
+{
+	size_t	len = strlen(str);
+
+	put_varint(f, len);
+	fwrite(str, 1, len, f);
+}
+
+/* see if str is a decimal number that can be written back the same */
+static int parse_num(const char *str, long long *mant, int *dec)
+{
+	const	char	*p = str;
+	long long	m = 0;
+	int	digits = 0, d = -1;
+
+	if (*p == '-')
+		p++;
+
+	/* no leading zeros */
+	if ((p[0] == '0') && (isdigit((unsigned char) p[1])))
+		return 0;
+
+	for (; *p != '\0'; p++) {
+		if ((*p == '.') && (d < 0) && (digits > 0)) {
+			d = 0;
+			continue;
+		}
+
+		if ((!isdigit((unsigned char) *p)) || (++digits > 18))
+			return 0;
+
+		m = m * 10 + (*p - '0');
+
+		if (d >= 0)
+			d++;
+	}
+
+	/* nothing, "1." or too precise */
+	if ((digits == 0) || (d == 0) || (d > 7))
+		return 0;
+
+	/* and no "-0" */
+	if ((str[0] == '-') && (m == 0))
+		return 0;
+
+	*mant = (str[0] == '-') ? -m : m;
+	*dec = (d < 0) ? 0 : d;
+
+	return 1;
+}
+
+static void set_val(binval_t *val, const char *str)
+{
+	free(val->str);
+	val->str = NULL;
+
+	if (!str) {
+		val->type = BINVAL_NA;
+		return;
+	}
+
+	if (parse_num(str, &val->mant, &val->dec)) {
+		val->type = BINVAL_NUM;
+		return;
+	}
+
+	val->type = BINVAL_STR;
+	val->str = xstrdup(str);
+}
+
+static int same_val(const binval_t *a, const binval_t *b)
+{
+	if (a->type != b->type)
+		return 0;
+
+	if (a->type == BINVAL_NUM)
+		return (a->mant == b->mant) && (a->dec == b->dec);
+
+	if (a->type == BINVAL_STR)
+		return !strcmp(a->str, b->str);
+
+	return 1;
+}
+
+/* map the first len bytes of fd, or read them if it can't be mapped */
+static unsigned char *load_log(int fd, size_t len, int *mapped)
+{
+	unsigned char	*buf;
+	size_t	done;
+	ssize_t	ret;
+
+	*mapped = 0;
+
+#if (defined HAVE_MMAP) && (defined HAVE_SYS_MMAN_H)
+	buf = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	if (buf != MAP_FAILED) {
+		*mapped = 1;
+		return buf;
+	}
+#endif
+
+	buf = xmalloc(len);
+
+	for (done = 0; done < len; done += ret) {
+		ret = read(fd, buf + done, len - done);
+
+		if (ret <= 0) {
+			free(buf);
+			return NULL;
+		}
+	}
+
+	return buf;
+}
+
+static void unload_log(unsigned char *buf, size_t len, int mapped)
+{
+#if (defined HAVE_MMAP) && (defined HAVE_SYS_MMAN_H)
+	if (mapped) {
+		munmap(buf, len);
+		return;
+	}
+#endif
+
+	free(buf);
+}
+
+/* start a new log with the magic, or carry on with an existing one
+ * after cutting off what a crash may have left of its last record, as
+ * anything written after that would be out of step and unreadable.
+ * f must be open for reading as well.  Returns how much was cut off,
+ * BINLOG_NOTBIN if f has something else than a binary log in it, or
+ * BINLOG_IOERR (with errno set) if it can't be read or cut. */
+long binlog_header(FILE *f)
+{
+	binreader_t	br;
+	binstream_t	*bs;
+	struct stat	st;
+	unsigned char	*buf;
+	const	unsigned char	*pos, *end;
+	size_t	len;
+	long	cut;
+	int	fd = fileno(f), mapped;
+
+	fflush(f);
+
+	/* a pipe is always new, and so is a file we can't read back */
+	if ((fstat(fd, &st) != 0) || (!S_ISREG(st.st_mode)) ||
+		(lseek(fd, 0, SEEK_SET) != 0)) {
+		fwrite(BINLOG_MAGIC, 1, BINLOG_MAGICLEN, f);
+		return 0;
+	}
+
+	len = st.st_size;
+
+	if (len == 0) {
+		fseek(f, 0, SEEK_END);
+		fwrite(BINLOG_MAGIC, 1, BINLOG_MAGICLEN, f);
+		return 0;
+	}
+
+	/* the records can only be told apart from the start, but mapped
+	 * the log is only paged through, not copied */
+	buf = load_log(fd, len, &mapped);
+
+	if (!buf) {
+		fseek(f, 0, SEEK_END);
+		return BINLOG_IOERR;
+	}
+
+	/* cut short while writing the magic counts as empty */
+	if ((len < BINLOG_MAGICLEN) && (memcmp(buf, BINLOG_MAGIC, len) == 0)) {
+		unload_log(buf, len, mapped);
+
+		if (ftruncate(fd, 0) != 0) {
+			fseek(f, 0, SEEK_END);
+			return BINLOG_IOERR;
+		}
+
+		fseek(f, 0, SEEK_END);
+		fwrite(BINLOG_MAGIC, 1, BINLOG_MAGICLEN, f);
+		return len;
+	}
+
+	if (!binlog_check(buf, len)) {
+		unload_log(buf, len, mapped);
+		fseek(f, 0, SEEK_END);
+		return BINLOG_NOTBIN;
+	}
+
+	memset(&br, 0, sizeof(br));
+
+	pos = buf + BINLOG_MAGICLEN;
+	end = buf + len;
+
+	while (binlog_next(&br, &pos, end, &bs) > 0)
+		;
+
+	binreader_free(&br);
+
+	cut = end - pos;
+	len = pos - buf;
+
+	unload_log(buf, end - buf, mapped);
+
+	if ((cut > 0) && (ftruncate(fd, len) != 0))
+		cut = BINLOG_IOERR;
+
+	fseek(f, 0, SEEK_END);
+
+	return cut;
+}
+
+/* declare stream id, with its columns, and reset it */
+void binlog_schema(FILE *f, binstream_t *bs, unsigned int id,
+		const char *upsname, size_t ncols, char **colname)
+{
+	size_t	i;
+
+	binstream_free(bs);
+
+	bs->id = id;
+	bs->upsname = xstrdup(upsname);
+	bs->ncols = ncols;
+	bs->colname = xcalloc(ncols ? ncols : 1, sizeof(*bs->colname));
+	bs->val = xcalloc(ncols ? ncols : 1, sizeof(*bs->val));
+
+	putc('S', f);
+	put_varint(f, id);
+	put_string(f, upsname);
+	put_varint(f, ncols);
+
+	for (i = 0; i < ncols; i++) {
+		bs->colname[i] = xstrdup(colname[i]);
+		put_string(f, colname[i]);
+	}
+}
+
+/* add a sample of the stream's columns, NULL for the ones unavailable */
+void binlog_sample(FILE *f, binstream_t *bs, long long time, char **val)
+{
+	binval_t	cur;
+	long long	base;
+	size_t	i;
+
+	putc('D', f);
+	put_varint(f, bs->id);
+	put_zigzag(f, time - bs->time);
+
+	bs->time = time;
+
+	memset(&cur, 0, sizeof(cur));
+
+	for (i = 0; i < bs->ncols; i++) {
+		set_val(&cur, val[i]);
+
+		if (same_val(&cur, &bs->val[i])) {
+			putc(BINVAL_SAME, f);
+			continue;
+		}
+
+		switch (cur.type)
+		{
+		case BINVAL_NA:
+			putc(BINVAL_NA, f);
+			break;
+
+		case BINVAL_STR:
+			putc(BINVAL_STR, f);
+			put_string(f, cur.str);
+			break;
+
+		case BINVAL_NUM:
+			base = (bs->val[i].type == BINVAL_NUM) ? bs->val[i].mant : 0;
+
+			putc(BINVAL_NUM | cur.dec, f);
+			put_zigzag(f, cur.mant - base);
+			break;
+		}
+
+		set_val(&bs->val[i], val[i]);
+	}
+
+	free(cur.str);
+}
+
+/* --- decoding --- */
+
+static int get_varint(const unsigned char **pos, const unsigned char *end,
+		unsigned long long *n)
+{
+	const	unsigned char	*p = *pos;
+	int	shift;
+
+	*n = 0;
+
+	for (shift = 0; (p < end) && (shift < 64); shift += 7) {
+		*n |= (unsigned long long) (*p & 0x7f) << shift;
+
+		if ((*p++ & 0x80) == 0) {
+			*pos = p;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static int get_zigzag(const unsigned char **pos, const unsigned char *end,
+		long long *n)
+{
+	unsigned long long	u;
+
+	if (!get_varint(pos, end, &u))
+		return 0;
+
+	*n = (long long) (u >> 1) ^ -(long long) (u & 1);
+
+	return 1;
+}
+
+static int get_string(const unsigned char **pos, const unsigned char *end,
+		char **str)
+{
+	unsigned long long	len;
+
+	if ((!get_varint(pos, end, &len)) || (len > (unsigned long long) (end - *pos)))
+		return 0;
+
+	*str = xmalloc(len + 1);
+	memcpy(*str, *pos, len);
+	(*str)[len] = '\0';
+
+	*pos += len;
+
+	return 1;
+}
+
+/* see if buf starts like a binary log, returns its header length or 0 */
+int binlog_check(const unsigned char *buf, size_t len)
+{
+	if ((len < BINLOG_MAGICLEN) || (memcmp(buf, BINLOG_MAGIC, BINLOG_MAGICLEN) != 0))
+		return 0;
+
+	return BINLOG_MAGICLEN;
+}
+
+static int read_schema(binreader_t *br, const unsigned char **pos,
+		const unsigned char *end, unsigned long long id, binstream_t **bsp)
+{
+	binstream_t	*bs;
+	unsigned long long	ncols;
+	size_t	i;
+
+	/* one per UPS, so this can't be right */
+	if (id > 65535)
+		return -1;
+
+	if (id >= br->nstreams) {
+		br->stream = xrealloc(br->stream, (id + 1) * sizeof(*br->stream));
+		memset(br->stream + br->nstreams, 0,
+			(id + 1 - br->nstreams) * sizeof(*br->stream));
+		br->nstreams = id + 1;
+	}
+
+	bs = &br->stream[id];
+	binstream_free(bs);
+	bs->id = id;
+
+	if (!get_string(pos, end, &bs->upsname))
+		return -1;
+
+	/* a column name takes a byte at least */
+	if ((!get_varint(pos, end, &ncols)) || (ncols > (unsigned long long) (end - *pos)))
+		return -1;
+
+	bs->ncols = ncols;
+	bs->colname = xcalloc(ncols ? ncols : 1, sizeof(*bs->colname));
+	bs->val = xcalloc(ncols ? ncols : 1, sizeof(*bs->val));
+
+	for (i = 0; i < ncols; i++) {
+		if (!get_string(pos, end, &bs->colname[i]))
+			return -1;
+	}
+
+	*bsp = bs;
+
+	return BINLOG_SCHEMA;
+}
+
+static int read_sample(binreader_t *br, const unsigned char **pos,
+		const unsigned char *end, unsigned long long id, binstream_t **bsp)
+{
+	binstream_t	*bs;
+	binval_t	*val;
+	long long	delta;
+	size_t	i;
+	int	tag;
+
+	if ((id >= br->nstreams) || (!br->stream[id].upsname))
+		return -1;
+
+	bs = &br->stream[id];
+
+	if (!get_zigzag(pos, end, &delta))
+		return -1;
+
+	bs->time += delta;
+
+	for (i = 0; i < bs->ncols; i++) {
+		val = &bs->val[i];
+
+		if (*pos >= end)
+			return -1;
+
+		tag = *(*pos)++;
+
+		if (tag == BINVAL_SAME)
+			continue;
+
+		if (tag == BINVAL_NA) {
+			free(val->str);
+			val->str = NULL;
+			val->type = BINVAL_NA;
+			continue;
+		}
+
+		if (tag == BINVAL_STR) {
+			free(val->str);
+			val->str = NULL;
+			val->type = BINVAL_STR;
+
+			if (!get_string(pos, end, &val->str)) {
+				val->type = BINVAL_NA;
+				return -1;
+			}
+
+			continue;
+		}
+
+		if ((tag & ~7) != BINVAL_NUM)
+			return -1;
+
+		if (!get_zigzag(pos, end, &delta))
+			return -1;
+
+		if (val->type != BINVAL_NUM)
+			val->mant = 0;
+
+		free(val->str);
+		val->str = NULL;
+		val->type = BINVAL_NUM;
+		val->mant += delta;
+		val->dec = tag & 7;
+	}
+
+	*bsp = bs;
+
+	return BINLOG_SAMPLE;
+}
+
+/* decode the record at *pos, and move on past it
+ * returns BINLOG_SCHEMA or BINLOG_SAMPLE with the stream in *bs,
+ * 0 at the end, or -1 if the rest can't be read */
+int binlog_next(binreader_t *br, const unsigned char **pos,
+		const unsigned char *end, binstream_t **bs)
+{
+	const	unsigned char	*p = *pos;
+	unsigned long long	id;
+	int	type, ret;
+
+	if (p >= end)
+		return 0;
+
+	type = *p++;
+
+	if (!get_varint(&p, end, &id))
+		return -1;
+
+	switch (type)
+	{
+	case 'S':
+		ret = read_schema(br, &p, end, id, bs);
+		break;
+
+	case 'D':
+		ret = read_sample(br, &p, end, id, bs);
+		break;
+
+	default:
+		return -1;
+	}
+
+	if (ret > 0)
+		*pos = p;
+
+	return ret;
+}
+
+/* write out a value the way upsd had it */
+void binlog_format(const binval_t *val, char *buf, size_t buflen)
+{
+	char	digits[32];
+	unsigned long long	m;
+	size_t	len;
+
+	switch (val->type)
+	{
+	case BINVAL_STR:
+		snprintf(buf, buflen, "%s", val->str);
+		return;
+
+	case BINVAL_NUM:
+		m = (val->mant < 0) ? -(unsigned long long) val->mant : (unsigned long long) val->mant;
+
+		/* enough digits for the decimals and a 0 before them */
+		snprintf(digits, sizeof(digits), "%0*llu", (val->dec & 7) + 1, m);
+		len = strlen(digits);
+
+		if (val->dec > 0)
+			snprintf(buf, buflen, "%s%.*s.%s", (val->mant < 0) ? "-" : "",
+				(int) (len - val->dec), digits, digits + len - val->dec);
+		else
+			snprintf(buf, buflen, "%s%s", (val->mant < 0) ? "-" : "", digits);
+
+		return;
+
+	default:
+		snprintf(buf, buflen, "NA");
+		return;
+	}
+}
+
+void binstream_free(binstream_t *bs)
+{
+	size_t	i;
+
+	for (i = 0; i < bs->ncols; i++) {
+		free(bs->colname[i]);
+		free(bs->val[i].str);
+	}
+
+	free(bs->upsname);
+	free(bs->colname);
+	free(bs->val);
+
+	memset(bs, 0, sizeof(*bs));
+}
+
+void binreader_free(binreader_t *br)
+{
+	size_t	i;
+
+	for (i = 0; i < br->nstreams; i++)
+		binstream_free(&br->stream[i]);
+
+	free(br->stream);
+
+	br->stream = NULL;
+	br->nstreams = 0;
+}
@@ -0,0 +1,94 @@
+/* upslogbin.h - binary time-series logs for upslog and upslogdump
+
+   A binary log starts with BINLOG_MAGIC, followed by records:
+
+   'S' <id> <upsname> <ncols> <colname>...	schema of a stream
+   'D' <id> <time delta> <value>...		sample, one value per column
+
+   Numbers are varints (7 bits per byte, low bits first), zigzag encoded
+   if they can be negative, and strings a varint length then the bytes.
+   Every upslog run or reopen (re)declares its streams, one per UPS,
+   which resets their state.  A record left unfinished by a crash is cut
+   off before the next run appends to the log.
+
+   The time is in milliseconds since the epoch, as a zigzag delta from
+   the previous sample of the stream.  Each value starts with a tag:
+
+   BINVAL_NA					not available
+   BINVAL_SAME					as in the previous sample
+   BINVAL_STR <string>
+   BINVAL_NUM + <decimals> <zigzag delta>	decimal number, with its
+						digits as a delta from the
+						previous one of the column
+*/
+
+#ifndef UPSLOGBIN_H_SEEN
+#define UPSLOGBIN_H_SEEN
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+extern "C" {
+/* *INDENT-ON* */
+#endif
+
+#define BINLOG_MAGIC	"NUTLOG\001\n"
+#define BINLOG_MAGICLEN	8
+
+#define BINVAL_NA	0
+#define BINVAL_SAME	1
+#define BINVAL_STR	2
+#define BINVAL_NUM	0x10	/* | number of decimals, up to 7 */
+
+/* returned by binlog_next */
+#define BINLOG_SCHEMA	1
+#define BINLOG_SAMPLE	2
+
+/* returned by binlog_header */
+#define BINLOG_NOTBIN	-1	/* not a binary log */
+#define BINLOG_IOERR	-2	/* can't read or cut it, see errno */
+
+/* a column's current value */
+typedef struct {
+	int	type;		/* BINVAL_NA, BINVAL_STR or BINVAL_NUM */
+	long long	mant;	/* BINVAL_NUM: the digits... */
+	int	dec;		/* ...and how many are decimals */
+	char	*str;		/* BINVAL_STR */
+} binval_t;
+
+/* one UPS in a log, as written or read */
+typedef struct {
+	unsigned int	id;
+	char	*upsname;
+	size_t	ncols;
+	char	**colname;
+	long long	time;		/* of the last sample, ms */
+	binval_t	*val;		/* in the last sample */
+} binstream_t;
+
+/* the streams of a log being read, by id */
+typedef struct {
+	binstream_t	*stream;
+	size_t	nstreams;
+} binreader_t;
+
+/* writing */
+long binlog_header(FILE *f);
+void binlog_schema(FILE *f, binstream_t *bs, unsigned int id,
+		const char *upsname, size_t ncols, char **colname);
+void binlog_sample(FILE *f, binstream_t *bs, long long time, char **val);
+
+/* reading */
+int binlog_check(const unsigned char *buf, size_t len);
+int binlog_next(binreader_t *br, const unsigned char **pos,
+		const unsigned char *end, binstream_t **bs);
+void binlog_format(const binval_t *val, char *buf, size_t buflen);
+void binstream_free(binstream_t *bs);
+void binreader_free(binreader_t *br);
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+}
+/* *INDENT-ON* */
+#endif
+
+#endif	/* UPSLOGBIN_H_SEEN */
@@ -0,0 +1,372 @@
+/* upslogdump - export binary upslog logs as CSV
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include "common.h"
+#include "nut_platform.h"
+
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#include "timehead.h"
+#include "upslogbin.h"
+
+	static	long long	start_ms = 0, end_ms = -1;
+	static	const	char	*upsfilter = NULL;
+	static	int	epoch = 0;
+
+	/* the CSV columns, after time and ups */
+	static	char	**column = NULL;
+	static	size_t	numcols = 0;
+
+	/* for each stream id, where the columns are in it */
+	static	long	**colmap = NULL;
+	static	size_t	numcolmaps = 0;
+
+static void help(const char *prog)
+{
+	printf("Export binary upslog logs as CSV.\n");
+
+	printf("\nusage: %s [OPTIONS] <logfile> [<logfile> ...]\n", prog);
+	printf("\n");
+
+	printf("  -s <start>	- Only samples from this time on\n");
+	printf("  -e <end>	- Only samples before this time\n");
+	printf("		- Times are YYYY-MM-DD[ HH:MM[:SS]] or seconds since the epoch\n");
+	printf("  -u <ups>	- Only samples of this UPS, as given to upslog\n");
+	printf("  -c <vars>	- Comma separated columns, default: those of the first UPS\n");
+	printf("  -E		- Print times as seconds since the epoch\n");
+
+	exit(EXIT_SUCCESS);
+}
+
+/* returns ms since the epoch */
+static long long parse_time(const char *str)
+{
+	struct tm	tm;
+	time_t	t;
+	char	*end;
+	long long	sec;
+	int	ret;
+
+	sec = strtoll(str, &end, 10);
+
+	if ((end != str) && (*end == '\0'))
+		return sec * 1000;
+
+	memset(&tm, 0, sizeof(tm));
+
+	ret = sscanf(str, "%d-%d-%d%*c%d:%d:%d", &tm.tm_year, &tm.tm_mon,
+		&tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec);
+
+	if ((ret != 3) && (ret < 5))
+		fatalx(EXIT_FAILURE, "Invalid time %s, use YYYY-MM-DD[ HH:MM[:SS]]", str);
+
+	tm.tm_year -= 1900;
+	tm.tm_mon--;
+	tm.tm_isdst = -1;
+
+	t = mktime(&tm);
+
+	if (t == (time_t) -1)
+		fatalx(EXIT_FAILURE, "Invalid time %s", str);
+
+	return (long long) t * 1000;
+}
+
+static void set_columns(const char *list)
+{
+	char	*tmp, *name, *last;
+
+	tmp = xstrdup(list);
+
+	for (name = strtok_r(tmp, ",", &last); name != NULL;
+		name = strtok_r(NULL, ",", &last)) {
+
+		column = xrealloc(column, (numcols + 1) * sizeof(*column));
+		column[numcols++] = xstrdup(name);
+	}
+
+	free(tmp);
+}
+
+static void print_csv(const char *str)
+{
+	if (!strpbrk(str, ",\"\r\n")) {
+		fputs(str, stdout);
+		return;
+	}
+
+	putchar('"');
+
+	for (; *str != '\0'; str++) {
+		if (*str == '"')
+			putchar('"');
+
+		putchar(*str);
+	}
+
+	putchar('"');
+}
+
+static void print_header(void)
+{
+	size_t	i;
+
+	printf("time,ups");
+
+	for (i = 0; i < numcols; i++) {
+		putchar(',');
+		print_csv(column[i]);
+	}
+
+	putchar('\n');
+}
+
+/* a stream was (re)declared: find our columns in it */
+static void map_columns(const binstream_t *bs)
+{
+	size_t	i, j;
+
+	/* the first UPS we're after sets the columns, unless -c did */
+	if (!column) {
+		for (i = 0; i < bs->ncols; i++) {
+			column = xrealloc(column, (numcols + 1) * sizeof(*column));
+			column[numcols++] = xstrdup(bs->colname[i]);
+		}
+
+		print_header();
+	}
+
+	if (bs->id >= numcolmaps) {
+		colmap = xrealloc(colmap, (bs->id + 1) * sizeof(*colmap));
+		memset(colmap + numcolmaps, 0, (bs->id + 1 - numcolmaps) * sizeof(*colmap));
+		numcolmaps = bs->id + 1;
+	}
+
+	free(colmap[bs->id]);
+	colmap[bs->id] = xcalloc(numcols ? numcols : 1, sizeof(**colmap));
+
+	for (i = 0; i < numcols; i++) {
+		colmap[bs->id][i] = -1;
+
+		for (j = 0; j < bs->ncols; j++) {
+			if (!strcmp(column[i], bs->colname[j])) {
+				colmap[bs->id][i] = j;
+				break;
+			}
+		}
+	}
+}
+
+static void print_sample(const binstream_t *bs)
+{
+	char	buf[LARGEBUF];
+	time_t	t;
+	size_t	i;
+
+	if (epoch) {
+		printf("%lld.%03lld", bs->time / 1000, bs->time % 1000);
+	} else {
+		t = (time_t) (bs->time / 1000);
+		strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", localtime(&t));
+		fputs(buf, stdout);
+	}
+
+	putchar(',');
+	print_csv(bs->upsname);
+
+	for (i = 0; i < numcols; i++) {
+		putchar(',');
+
+		if (colmap[bs->id][i] < 0)
+			continue;
+
+		binlog_format(&bs->val[colmap[bs->id][i]], buf, sizeof(buf));
+		print_csv(buf);
+	}
+
+	putchar('\n');
+}
+
+/* read the whole log, in place if we can */
+static unsigned char *load_file(const char *fn, int fd, size_t *len, int *mapped)
+{
+	struct stat	st;
+	unsigned char	*buf;
+	size_t	pos;
+	ssize_t	ret;
+
+	if (fstat(fd, &st) != 0)
+		fatal_with_errno(EXIT_FAILURE, "Can't stat %s", fn);
+
+	*len = st.st_size;
+	*mapped = 0;
+
+	if (*len == 0)
+		return NULL;
+
+#if (defined HAVE_MMAP) && (defined HAVE_SYS_MMAN_H)
+	buf = mmap(NULL, *len, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	if (buf != MAP_FAILED) {
+		*mapped = 1;
+		return buf;
+	}
+#endif
+
+	buf = xmalloc(*len);
+
+	for (pos = 0; pos < *len; pos += ret) {
+		ret = read(fd, buf + pos, *len - pos);
+
+		if (ret <= 0)
+			fatal_with_errno(EXIT_FAILURE, "Can't read %s", fn);
+	}
+
+	return buf;
+}
+
+static void dump_file(const char *fn)
+{
+	binreader_t	br;
+	binstream_t	*bs;
+	const	unsigned char	*pos, *end;
+	unsigned char	*buf;
+	size_t	len;
+	int	fd, mapped, ret, skip;
+
+	fd = open(fn, O_RDONLY);
+
+	if (fd < 0)
+		fatal_with_errno(EXIT_FAILURE, "Can't open %s", fn);
+
+	buf = load_file(fn, fd, &len, &mapped);
+
+	close(fd);
+
+	if (!buf)
+		return;
+
+	skip = binlog_check(buf, len);
+
+	if (!skip) {
+		upslogx(LOG_WARNING, "%s is not a binary upslog log", fn);
+		goto out;
+	}
+
+	memset(&br, 0, sizeof(br));
+
+	pos = buf + skip;
+	end = buf + len;
+
+	while ((ret = binlog_next(&br, &pos, end, &bs)) > 0) {
+
+		if ((upsfilter) && (strcmp(upsfilter, bs->upsname) != 0))
+			continue;
+
+		if (ret == BINLOG_SCHEMA) {
+			map_columns(bs);
+			continue;
+		}
+
+		if ((bs->time < start_ms) || ((end_ms >= 0) && (bs->time >= end_ms)))
+			continue;
+
+		print_sample(bs);
+	}
+
+	/* most likely cut short while upslog was writing it */
+	if (ret < 0)
+		upslogx(LOG_WARNING, "%s: can't read past offset %ld", fn,
+			(long) (pos - buf));
+
+	binreader_free(&br);
+
+out:
+#if (defined HAVE_MMAP) && (defined HAVE_SYS_MMAN_H)
+	if (mapped) {
+		munmap(buf, len);
+		return;
+	}
+#endif
+
+	free(buf);
+}
+
+int main(int argc, char **argv)
+{
+	const char	*prog = xbasename(argv[0]);
+	int	i;
+
+	while ((i = getopt(argc, argv, "+hs:e:u:c:EV")) != -1) {
+		switch (i)
+		{
+		case 's':
+			start_ms = parse_time(optarg);
+			break;
+
+		case 'e':
+			end_ms = parse_time(optarg);
+			break;
+
+		case 'u':
+			upsfilter = optarg;
+			break;
+
+		case 'c':
+			set_columns(optarg);
+			break;
+
+		case 'E':
+			epoch = 1;
+			break;
+
+		case 'V':
+			fatalx(EXIT_SUCCESS, "Network UPS Tools upslogdump %s", UPS_VERSION);
+
+		case 'h':
+		default:
+			help(prog);
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (argc < 1)
+		help(prog);
+
+	if (column)
+		print_header();
+
+	for (i = 0; i < argc; i++)
+		dump_file(argv[i]);
+
+	exit(EXIT_SUCCESS);
+}
+
+
+/* Formal do_upsconf_args implementation to satisfy linker on AIX */
+#if (defined NUT_PLATFORM_AIX)
+void do_upsconf_args(char *upsname, char *var, char *val) {
+        fatalx(EXIT_FAILURE, "INTERNAL ERROR: formal do_upsconf_args called");
+}
+#endif  /* end of #if (defined NUT_PLATFORM_AIX) */
@@ -26,9 +26,12 @@
 #include <sys/socket.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
 
 #include "upsclient.h"
 #include "upsmon.h"
+#include "schedlib.h"
 #include "parseconf.h"
 #include "timehead.h"
 
@@ -37,12 +40,12 @@
 #endif
 
 static	char	*shutdowncmd = NULL, *notifycmd = NULL;
-static	char	*powerdownflag = NULL, *configfile = NULL;
+static	char	*powerdownflag = NULL, *configfile = NULL, *schedconf = NULL;
 
-static	int	minsupplies = 1, sleepval = 5, deadtime = 15;
+static	int	minsupplies = 1, deadtime = 15;
 
 	/* default polling interval = 5 sec */
-static	int	pollfreq = 5, pollfreqalert = 5;
+static	int	pollfreq = 5000, pollfreqalert = 5000;	/* milliseconds */
 
 	/* slave hosts are given 15 sec by default to logout from upsd */
 static	int	hostsync = 15;  
@@ -62,6 +65,10 @@ static	int	finaldelay = 5;
 	/* set by SIGHUP handler, cleared after reload finishes */
 static	int	reload_flag = 0;
 
+/* see recalc() */
+static	int	val_ol = 0, recalc_all = 1;
+static	time_t	recalc_next = 0;
+
 	/* set after SIGINT, SIGQUIT, or SIGTERM */
 static	int	exit_flag = 0;
 
@@ -115,19 +122,443 @@ static void wall(const char *text)
 	pclose(wf);
 } 
 
-static void notify(const char *notice, int flags, const char *ntype, 
-			const char *upsname)
+/* run NOTIFYCMD for a notice from a child process, directly if it's just
+ * a program and its arguments, through the shell otherwise.  upssched's
+ * CMDSCRIPT (script set) gets its argument the way upssched passes it. */
+static void notify_exec(const char *cmd, const char *notice, const char *ntype,
+			const char *upsname, int script)
 {
-	char	exec[LARGEBUF];
-	int	ret;
+	char	exec[LARGEBUF], *argv[32], *word, *last;
+	int	argc = 0;
 
-	if (flag_isset(flags, NOTIFY_IGNORE))
+	/* undo what the notifier ignores */
+	signal(SIGHUP, SIG_DFL);
+	signal(SIGINT, SIG_DFL);
+	signal(SIGPIPE, SIG_DFL);
+	signal(SIGUSR1, SIG_DFL);
+	signal(SIGUSR2, SIG_DFL);
+
+	setenv("UPSNAME", upsname ? upsname : "", 1);
+	setenv("NOTIFYTYPE", ntype, 1);
+
+	if (script) {
+		snprintf(exec, sizeof(exec), "%s %s", cmd, notice);
+
+		execl("/bin/sh", "sh", "-c", exec, (char *) NULL);
+		upslog_with_errno(LOG_ERR, "Can't run CMDSCRIPT through /bin/sh");
+		_exit(EXIT_FAILURE);
+	}
+
+	if (!strpbrk(cmd, "|&;<>()$`\\\"'*?[]{}~#=%!\n")) {
+		snprintf(exec, sizeof(exec), "%s", cmd);
+
+		for (word = strtok_r(exec, " \t", &last); word != NULL;
+			word = strtok_r(NULL, " \t", &last)) {
+
+			if (argc >= (int) (sizeof(argv) / sizeof(argv[0])) - 2)
+				break;
+
+			argv[argc++] = word;
+		}
+
+		if ((argc > 0) && (word == NULL)) {
+			argv[argc++] = (char *) notice;
+			argv[argc] = NULL;
+
+			execvp(argv[0], argv);
+			upslog_with_errno(LOG_ERR, "Can't run NOTIFYCMD %s", argv[0]);
+			_exit(EXIT_FAILURE);
+		}
+	}
+
+	snprintf(exec, sizeof(exec), "%s \"%s\"", cmd, notice);
+
+	execl("/bin/sh", "sh", "-c", exec, (char *) NULL);
+	upslog_with_errno(LOG_ERR, "Can't run NOTIFYCMD through /bin/sh");
+	_exit(EXIT_FAILURE);
+}
+
+/* notifier process side: NOTIFYCMD runs waiting for their turn */
+typedef struct notifyjob_s {
+	char	*str[4];		/* ntype, upsname, notice, command */
+	struct notifyjob_s	*next;
+}	notifyjob_t;
+
+static	notifyjob_t	*job_first = NULL, *job_last = NULL;
+static	int	job_queued = 0, job_running = 0, job_dropped = 0;
+
+/* and the wall messages for the next batch */
+static	char	wall_text[LARGEBUF];
+static	int	wall_lines = 0, wall_more = 0;
+static	struct timeval	wall_last;
+
+static void notifier_free(char **str)
+{
+	free(str[0]);
+	free(str[1]);
+	free(str[2]);
+	free(str[3]);
+}
+
+static void notifier_queue(char **str)
+{
+	notifyjob_t	*job;
+
+	if (job_queued >= NOTIFY_MAXQUEUE) {
+		if (job_dropped++ == 0)
+			upslogx(LOG_WARNING, "Too many notifications for "
+				"NOTIFYCMD, dropping some");
+
+		notifier_free(str);
 		return;
+	}
 
-	if (flag_isset(flags, NOTIFY_SYSLOG))
-		upslogx(LOG_NOTICE, "%s", notice);
+	job = xcalloc(1, sizeof(*job));
+	memcpy(job->str, str, sizeof(job->str));
+
+	if (job_last)
+		job_last->next = job;
+	else
+		job_first = job;
+
+	job_last = job;
+	job_queued++;
+}
+
+/* start what we can of the queued NOTIFYCMDs */
+static void notifier_exec(void)
+{
+	notifyjob_t	*job;
+	const	char	*cmd;
+	pid_t	pid;
+
+	while ((job_first != NULL) && (job_running < NOTIFY_MAXEXEC)) {
+		job = job_first;
+		job_first = job->next;
+
+		if (!job_first)
+			job_last = NULL;
+
+		job_queued--;
+
+		/* NOTIFYCMD, unless it's for upssched's CMDSCRIPT */
+		cmd = (job->str[3][0] != '\0') ? job->str[3] : notifycmd;
+
+		if (cmd) {
+			pid = fork();
+
+			if (pid == 0)
+				notify_exec(cmd, job->str[2], job->str[0],
+					job->str[1], job->str[3][0] != '\0');
+
+			if (pid < 0)
+				upslog_with_errno(LOG_ERR, "Can't fork to notify");
+			else
+				job_running++;
+		}
+
+		notifier_free(job->str);
+		free(job);
+	}
+
+	if ((job_first == NULL) && (job_dropped > 0)) {
+		upslogx(LOG_WARNING, "Dropped %d notifications for NOTIFYCMD",
+			job_dropped);
+		job_dropped = 0;
+	}
+}
+
+/* send the pending wall messages if the last batch is old enough, or
+ * anyway if now is set; returns the milliseconds until the next batch
+ * is due, or -1 if nothing is pending */
+static long notifier_wall(int now)
+{
+	struct timeval	tv;
+	long	wait;
+
+	if ((wall_lines == 0) && (wall_more == 0))
+		return -1;
+
+	monotonic_time(&tv);
+
+	wait = NOTIFY_WALLFREQ - ((tv.tv_sec - wall_last.tv_sec) * 1000 +
+		(tv.tv_usec - wall_last.tv_usec) / 1000);
+
+	if ((wait > 0) && (!now))
+		return wait;
+
+	if (wall_more > 0)
+		snprintfcat(wall_text, sizeof(wall_text),
+			"(and %d more notifications)\n", wall_more);
+
+	/* wall() adds its own */
+	wall_text[strlen(wall_text) - 1] = '\0';
 
-	/* fork here so upsmon doesn't get wedged if the notifier is slow */
+	wall(wall_text);
+
+	wall_text[0] = '\0';
+	wall_lines = wall_more = 0;
+	wall_last = tv;
+
+	return -1;
+}
+
+/* handle the complete records in buf, returns how many bytes they took */
+static size_t notifier_parse(const char *buf, size_t buflen)
+{
+	notifyrec_t	rec;
+	size_t	pos = 0, reclen;
+	char	*str[4];
+	int	i;
+
+	while (buflen - pos >= sizeof(rec)) {
+		memcpy(&rec, buf + pos, sizeof(rec));
+
+		reclen = sizeof(rec) + rec.len[0] + rec.len[1] + rec.len[2] +
+			rec.len[3];
+
+		if (reclen > PIPE_BUF)
+			fatalx(EXIT_FAILURE, "notifier: bogus record");
+
+		if (buflen - pos < reclen)
+			break;
+
+		pos += sizeof(rec);
+
+		for (i = 0; i < 4; i++) {
+			str[i] = xmalloc(rec.len[i] + 1);
+			memcpy(str[i], buf + pos, rec.len[i]);
+			str[i][rec.len[i]] = '\0';
+			pos += rec.len[i];
+		}
+
+		/* reloaded NOTIFYCMD */
+		if (rec.flags == 0) {
+			free(notifycmd);
+			notifycmd = NULL;
+
+			if (rec.len[0] > 0) {
+				notifycmd = str[0];
+				str[0] = NULL;
+			}
+
+			notifier_free(str);
+			continue;
+		}
+
+		if (flag_isset(rec.flags, NOTIFY_WALL)) {
+			if (wall_lines < NOTIFY_WALLMAX) {
+				snprintfcat(wall_text, sizeof(wall_text), "%s\n",
+					str[2]);
+				wall_lines++;
+			} else {
+				wall_more++;
+			}
+		}
+
+		if (flag_isset(rec.flags, NOTIFY_EXEC)) {
+			notifier_queue(str);
+			continue;
+		}
+
+		notifier_free(str);
+	}
+
+	return pos;
+}
+
+/* the notifier process: wall and NOTIFYCMD for upsmon, until it goes away */
+static void notifier_run(int fd)
+{
+	char	buf[2 * PIPE_BUF];
+	size_t	buflen = 0, used;
+	struct pollfd	pfd;
+	long	timeout;
+	ssize_t	ret;
+	int	eof = 0;
+
+	signal(SIGHUP, SIG_IGN);
+	signal(SIGINT, SIG_IGN);
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGUSR1, SIG_IGN);
+	signal(SIGUSR2, SIG_IGN);
+
+	/* not for NOTIFYCMD */
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+	for (;;) {
+		while (waitpid(-1, NULL, WNOHANG) > 0)
+			job_running--;
+
+		notifier_exec();
+
+		/* flush everything once upsmon is gone */
+		timeout = notifier_wall(eof);
+
+		if (eof && (job_first == NULL))
+			break;
+
+		/* look for exited NOTIFYCMDs from time to time */
+		if ((job_running > 0) && ((timeout < 0) || (timeout > 100)))
+			timeout = 100;
+
+		pfd.fd = eof ? -1 : fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+
+		if (poll(&pfd, 1, timeout) < 1)
+			continue;
+
+		ret = read(fd, buf + buflen, sizeof(buf) - buflen);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+
+			upslog_with_errno(LOG_ERR, "notifier: read");
+			ret = 0;
+		}
+
+		if (ret == 0) {
+			eof = 1;
+			continue;
+		}
+
+		buflen += ret;
+
+		used = notifier_parse(buf, buflen);
+		memmove(buf, buf + used, buflen - used);
+		buflen -= used;
+	}
+
+	exit(EXIT_SUCCESS);
+}
+
+/* upsmon side: pipe to the notifier, -1 if there's none running */
+static	int	notifier_fd = -1;
+
+/* fork the notifier process; done early on, while upsmon is still small,
+ * so that this fork is the only one notifications cost */
+static void start_notifier(void)
+{
+	utype_t	*ups;
+	int	fd[2];
+	pid_t	pid;
+	long	fd_flags;
+
+	if (pipe(fd) < 0) {
+		upslog_with_errno(LOG_ERR, "Can't start the notifier: pipe");
+		return;
+	}
+
+	pid = fork();
+
+	if (pid < 0) {
+		upslog_with_errno(LOG_ERR, "Can't start the notifier: fork");
+		close(fd[0]);
+		close(fd[1]);
+		return;
+	}
+
+	if (pid == 0) {
+		close(fd[1]);
+
+		/* let the parent see us die, and upsd see upsmon go */
+		if (use_pipe)
+			close(pipefd[1]);
+
+		for (ups = firstups; ups != NULL; ups = ups->next)
+			if (upscli_fd(&ups->conn) != -1)
+				close(upscli_fd(&ups->conn));
+
+		notifier_run(fd[0]);
+	}
+
+	close(fd[0]);
+
+	fcntl(fd[1], F_SETFD, FD_CLOEXEC);
+
+	/* never wait for the notifier */
+	fd_flags = fcntl(fd[1], F_GETFL);
+	fcntl(fd[1], F_SETFL, fd_flags | O_NONBLOCK);
+
+	notifier_fd = fd[1];
+
+	upsdebugx(1, "Started notifier process [%ld]", (long) pid);
+}
+
+/* hand a record over to the notifier
+ * returns 0 if it's been dealt with, -1 if there's no notifier */
+static int notifier_send(int flags, const char *s0, const char *s1,
+			const char *s2, const char *s3)
+{
+	char	buf[PIPE_BUF];
+	const	char	*str[4];
+	notifyrec_t	rec;
+	size_t	pos;
+	ssize_t	ret;
+	int	i;
+
+	if (notifier_fd < 0)
+		return -1;
+
+	str[0] = s0;
+	str[1] = s1;
+	str[2] = s2;
+	str[3] = s3;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.flags = flags;
+	pos = sizeof(rec);
+
+	for (i = 0; i < 4; i++) {
+		rec.len[i] = str[i] ? strlen(str[i]) : 0;
+
+		/* up to PIPE_BUF, a record can't be split by a full pipe */
+		if (pos + rec.len[i] > sizeof(buf)) {
+			upslogx(LOG_ERR, "Notification too long, not sent");
+			return 0;
+		}
+
+		memcpy(buf + pos, str[i], rec.len[i]);
+		pos += rec.len[i];
+	}
+
+	memcpy(buf, &rec, sizeof(rec));
+
+	ret = write(notifier_fd, buf, pos);
+
+	if (ret == (ssize_t) pos)
+		return 0;
+
+	if ((ret < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+		upslogx(LOG_WARNING, "Notifier is not keeping up, dropping "
+			"a notification");
+		return 0;
+	}
+
+	upslog_with_errno(LOG_ERR, "Lost the notifier process");
+
+	close(notifier_fd);
+	notifier_fd = -1;
+
+	return -1;
+}
+
+/* wall and/or run cmd (NOTIFYCMD if NULL) for a notice, not from here as
+ * it may take a while */
+static void notify_send(int flags, const char *cmd, const char *notice,
+			const char *ntype, const char *upsname)
+{
+	int	ret;
+
+	if (notifier_fd < 0)
+		start_notifier();
+
+	if (notifier_send(flags, ntype, upsname, notice, cmd) == 0)
+		return;
+
+	/* no notifier: fork here so upsmon doesn't get wedged if the notifier is slow */
 	ret = fork();
 
 	if (ret < 0) {
@@ -143,23 +574,41 @@ static void notify(const char *notice, int flags, const char *ntype,
 	if (flag_isset(flags, NOTIFY_WALL))
 		wall(notice);
 
-	if (flag_isset(flags, NOTIFY_EXEC)) {
-		if (notifycmd != NULL) {
-			snprintf(exec, sizeof(exec), "%s \"%s\"", notifycmd, notice);
+	if (flag_isset(flags, NOTIFY_EXEC))
+		notify_exec(cmd ? cmd : notifycmd, notice, ntype, upsname,
+			cmd != NULL);
 
-			if (upsname)
-				setenv("UPSNAME", upsname, 1);
-			else
-				setenv("UPSNAME", "", 1);
+	exit(EXIT_SUCCESS);
+}
 
-			setenv("NOTIFYTYPE", ntype, 1);
-			if (system(exec) == -1) {
-				upslog_with_errno(LOG_ERR, "%s", __func__);
-			}
-		}
-	}
+/* run upssched's CMDSCRIPT for its timers and EXECUTEs */
+static void sched_notify(const char *arg, const char *upsname, const char *ntype)
+{
+	notify_send(NOTIFY_EXEC, sched_conf->cmdscript, arg, ntype, upsname);
+}
 
-	exit(EXIT_SUCCESS);
+static void notify(const char *notice, int flags, const char *ntype, 
+			const char *upsname)
+{
+	if (flag_isset(flags, NOTIFY_IGNORE))
+		return;
+
+	if (flag_isset(flags, NOTIFY_SYSLOG))
+		upslogx(LOG_NOTICE, "%s", notice);
+
+	/* the upssched rules are here already, as if it was NOTIFYCMD */
+	if (flag_isset(flags, NOTIFY_EXEC) && (sched_conf != NULL))
+		sched_event(upsname ? upsname : "", ntype, NULL);
+
+	if (!notifycmd)
+		clearflag(&flags, NOTIFY_EXEC);
+
+	flags &= NOTIFY_WALL | NOTIFY_EXEC;
+
+	if (flags == 0)
+		return;
+
+	notify_send(flags, NULL, notice, ntype, upsname);
 }
 
 static void do_notify(const utype_t *ups, int ntype)
@@ -186,41 +635,54 @@ static void do_notify(const utype_t *ups, int ntype)
 	/* not found ?! */
 }
 
-/* check for master permissions on the server for this ups */
-static int checkmaster(utype_t *ups)
+/* read the answer to a command queued by do_upsd_auth(): once one has
+   failed, the next answers are only read, to keep the stream in step */
+static int auth_reply(utype_t *ups, int ok, const char *what)
 {
 	char	buf[SMALLBUF];
 
-	/* don't bother if we're not configured as a master for this ups */
-	if (!flag_isset(ups->status, ST_MASTER))
-		return 1;
-
-	/* this shouldn't happen (LOGIN checks it earlier) */
-	if ((ups->upsname == NULL) || (strlen(ups->upsname) == 0)) {
-		upslogx(LOG_ERR, "Set master on UPS [%s] failed: empty upsname",
-			ups->sys);
+	if (upscli_readline(&ups->conn, buf, sizeof(buf)) < 0) {
+		if (ok) {
+			upslogx(LOG_ERR, "%s [%s] failed: %s",
+				what, ups->sys, upscli_strerror(&ups->conn));
+		}
 		return 0;
 	}
 
-	snprintf(buf, sizeof(buf), "MASTER %s\n", ups->upsname);
-
-	if (upscli_sendline(&ups->conn, buf, strlen(buf)) < 0) {
-		upslogx(LOG_ALERT, "Can't set master mode on UPS [%s] - %s",
-			ups->sys, upscli_strerror(&ups->conn));
+	/* catch insanity from the server - not ERR and not OK either */
+	if (strncmp(buf, "OK", 2) != 0) {
+		if (ok) {
+			upslogx(LOG_ERR, "%s [%s] failed - got [%s]",
+				what, ups->sys, buf);
+		}
 		return 0;
 	}
 
+	return ok;
+}
+
+/* check for master permissions on the server for this ups */
+static int checkmaster(utype_t *ups, int ok)
+{
+	char	buf[SMALLBUF];
+
+	/* don't bother if we're not configured as a master for this ups */
+	if (!flag_isset(ups->status, ST_MASTER))
+		return ok;
+
 	if (upscli_readline(&ups->conn, buf, sizeof(buf)) == 0) {
 		if (!strncmp(buf, "OK", 2))
-			return 1;
+			return ok;
 
 		/* not ERR, but not caught by readline either? */
 
-		upslogx(LOG_ALERT, "Master privileges unavailable on UPS [%s]", 
-			ups->sys);
-		upslogx(LOG_ALERT, "Response: [%s]", buf);
+		if (ok) {
+			upslogx(LOG_ALERT, "Master privileges unavailable on UPS [%s]", 
+				ups->sys);
+			upslogx(LOG_ALERT, "Response: [%s]", buf);
+		}
 	}
-	else {	/* something caught by readraw's parsing call */
+	else if (ok) {	/* something caught by readraw's parsing call */
 		upslogx(LOG_ALERT, "Master privileges unavailable on UPS [%s]", 
 			ups->sys);
 		upslogx(LOG_ALERT, "Reason: %s", upscli_strerror(&ups->conn));
@@ -233,47 +695,13 @@ static int checkmaster(utype_t *ups)
 static int do_upsd_auth(utype_t *ups)
 {
 	char	buf[SMALLBUF];
+	int	ret, ok;
 
 	if (!ups->un) {
 		upslogx(LOG_ERR, "UPS [%s]: no username defined!", ups->sys);
 		return 0;
 	}
 
-	snprintf(buf, sizeof(buf), "USERNAME %s\n", ups->un);
-	if (upscli_sendline(&ups->conn, buf, strlen(buf)) < 0) {
-		upslogx(LOG_ERR, "Can't set username on [%s]: %s",
-			ups->sys, upscli_strerror(&ups->conn));
-			return 0;
-	}
-
-	if (upscli_readline(&ups->conn, buf, sizeof(buf)) < 0) {
-		upslogx(LOG_ERR, "Set username on [%s] failed: %s",
-			ups->sys, upscli_strerror(&ups->conn));
-		return 0;
-	}
-
-	/* authenticate first */
-	snprintf(buf, sizeof(buf), "PASSWORD %s\n", ups->pw);
-
-	if (upscli_sendline(&ups->conn, buf, strlen(buf)) < 0) {
-		upslogx(LOG_ERR, "Can't set password on [%s]: %s",
-			ups->sys, upscli_strerror(&ups->conn));
-			return 0;
-	}
-
-	if (upscli_readline(&ups->conn, buf, sizeof(buf)) < 0) {
-		upslogx(LOG_ERR, "Set password on [%s] failed: %s",
-			ups->sys, upscli_strerror(&ups->conn));
-		return 0;
-	}
-
-	/* catch insanity from the server - not ERR and not OK either */
-	if (strncmp(buf, "OK", 2) != 0) {
-		upslogx(LOG_ERR, "Set password on [%s] failed - got [%s]",
-			ups->sys, buf);
-		return 0;
-	}
-
 	/* we require a upsname now */
 	if ((ups->upsname == NULL) || (strlen(ups->upsname) == 0)) {
 		upslogx(LOG_ERR, "Login to UPS [%s] failed: empty upsname",
@@ -281,34 +709,43 @@ static int do_upsd_auth(utype_t *ups)
 		return 0;
 	}
 
+	/* upsd answers in order: send everything at once, then read the
+	   answers, instead of waiting for each of them in turn */
+	snprintf(buf, sizeof(buf), "USERNAME %s\n", ups->un);
+	ret = upscli_queueline(&ups->conn, buf, strlen(buf));
+
+	/* authenticate first */
+	snprintf(buf, sizeof(buf), "PASSWORD %s\n", ups->pw);
+	if (ret == 0)
+		ret = upscli_queueline(&ups->conn, buf, strlen(buf));
+
 	/* password is set, let's login */
 	snprintf(buf, sizeof(buf), "LOGIN %s\n", ups->upsname);
+	if (ret == 0)
+		ret = upscli_queueline(&ups->conn, buf, strlen(buf));
 
-	if (upscli_sendline(&ups->conn, buf, strlen(buf)) < 0) {
-		upslogx(LOG_ERR, "Login to UPS [%s] failed: %s",
-			ups->sys, upscli_strerror(&ups->conn));
-		return 0;
-	}
+	/* and test master permissions if we need them */
+	snprintf(buf, sizeof(buf), "MASTER %s\n", ups->upsname);
+	if ((ret == 0) && (flag_isset(ups->status, ST_MASTER)))
+		ret = upscli_queueline(&ups->conn, buf, strlen(buf));
 
-	if (upscli_readline(&ups->conn, buf, sizeof(buf)) < 0) {
-		upslogx(LOG_ERR, "Can't login to UPS [%s]: %s",
+	if ((ret < 0) || (upscli_flush(&ups->conn) < 0)) {
+		upslogx(LOG_ERR, "Can't log in to UPS [%s]: %s",
 			ups->sys, upscli_strerror(&ups->conn));
 		return 0;
 	}
 
-	/* catch insanity from the server - not ERR and not OK either */
-	if (strncmp(buf, "OK", 2) != 0) {
-		upslogx(LOG_ERR, "Login on UPS [%s] failed - got [%s]",
-			ups->sys, buf);
-		return 0;
-	}
+	ok = auth_reply(ups, 1, "Set username on");
+	ok = auth_reply(ups, ok, "Set password on");
+	ok = auth_reply(ups, ok, "Login to UPS");
 
-	/* finally - everything is OK */
-	upsdebugx(1, "Logged into UPS %s", ups->sys);
-	setflag(&ups->status, ST_LOGIN);
+	if (ok) {
+		/* finally - everything is OK */
+		upsdebugx(1, "Logged into UPS %s", ups->sys);
+		setflag(&ups->status, ST_LOGIN);
+	}
 
-	/* now see if we also need to test master permissions */
-	return checkmaster(ups);
+	return checkmaster(ups, ok);
 }
 
 /* set flags and make announcements when a UPS has been checked successfully */
@@ -365,8 +802,6 @@ static void ups_on_batt(utype_t *ups)
 		return;
 	}
 
-	sleepval = pollfreqalert;	/* bump up polling frequency */
-
 	ups->linestate = 0;	
 
 	upsdebugx(3, "%s: %s (first time)", __func__, ups->sys);
@@ -385,8 +820,6 @@ static void ups_on_line(utype_t *ups)
 		return;
 	}
 
-	sleepval = pollfreq;
-
 	upsdebugx(3, "%s: %s (first time)", __func__, ups->sys);
 
 	/* ignore the first OL at startup, otherwise send the notifier */
@@ -505,13 +938,9 @@ static void clear_alarm(void)
 	alarm(0);
 }
 
-static int get_var(utype_t *ups, const char *var, char *buf, size_t bufsize)
+/* build the query for var, returns the number of words or -1 */
+static int get_var_query(utype_t *ups, const char *var, const char **query)
 {
-	int	ret;
-	unsigned int	numq, numa;
-	const	char	*query[4];
-	char	**answer;
-
 	/* this shouldn't happen */
 	if (!ups->upsname) {
 		upslogx(LOG_ERR, "get_var: programming error: no UPS name set [%s]",
@@ -519,29 +948,55 @@ static int get_var(utype_t *ups, const char *var, char *buf, size_t bufsize)
 		return -1;
 	}
 
-	numq = 0;
-
 	if (!strcmp(var, "numlogins")) {
 		query[0] = "NUMLOGINS";
 		query[1] = ups->upsname;
-		numq = 2;
+		return 2;
 	}
 
 	if (!strcmp(var, "status")) {
 		query[0] = "VAR";
 		query[1] = ups->upsname;
 		query[2] = "ups.status";
-		numq = 3;
+		return 3;
 	}
 
-	if (numq == 0) {
-		upslogx(LOG_ERR, "get_var: programming error: var=%s", var);
+	upslogx(LOG_ERR, "get_var: programming error: var=%s", var);
+	return -1;
+}
+
+/* send the query for var without waiting for the answer */
+static int get_var_start(utype_t *ups, const char *var)
+{
+	int	numq;
+	const	char	*query[4];
+
+	numq = get_var_query(ups, var, query);
+
+	if (numq < 0)
 		return -1;
-	}
 
 	upsdebugx(3, "%s: %s / %s", __func__, ups->sys, var);
 
-	ret = upscli_get(&ups->conn, numq, query, &numa, &answer);
+	return upscli_get_start(&ups->conn, numq, query);
+}
+
+/* read the answer to get_var_start() */
+static int get_var_finish(utype_t *ups, const char *var, char *buf,
+	size_t bufsize, unsigned int timeout)
+{
+	int	ret, numq;
+	unsigned int	numa;
+	const	char	*query[4];
+	char	**answer;
+
+	numq = get_var_query(ups, var, query);
+
+	if (numq < 0)
+		return -1;
+
+	ret = upscli_get_finish(&ups->conn, numq, query, &numa, &answer,
+		timeout);
 
 	if (ret < 0) {
 
@@ -557,7 +1012,7 @@ static int get_var(utype_t *ups, const char *var, char *buf, size_t bufsize)
 		return -1;
 	}
 
-	if (numa < numq) {
+	if (numa < (unsigned int)numq) {
 		upslogx(LOG_ERR, "%s: Error: insufficient data "
 			"(got %d args, need at least %d)", 
 			var, numa, numq);
@@ -568,6 +1023,14 @@ static int get_var(utype_t *ups, const char *var, char *buf, size_t bufsize)
 	return 0;
 }
 
+static int get_var(utype_t *ups, const char *var, char *buf, size_t bufsize)
+{
+	if (get_var_start(ups, var) < 0)
+		return -1;
+
+	return get_var_finish(ups, var, buf, bufsize, NET_TIMEOUT);
+}
+
 static void slavesync(void)
 {
 	utype_t	*ups;
@@ -678,16 +1141,57 @@ static int is_ups_critical(utype_t *ups)
 	return 0;
 }
 
-/* recalculate the online power value and see if things are still OK */
+/* when the DEADTIME or HOSTSYNC timers may change what recalc() makes of
+ * this UPS without any news from it, or 0 if they can't */
+static time_t recalc_timer(utype_t *ups)
+{
+	if (!flag_isset(ups->status, ST_ONBATT))
+		return 0;
+
+	/* the dead UPS promotion below */
+	if (!flag_isset(ups->status, ST_LOWBATT))
+		return ups->lastpoll + deadtime + 1;
+
+	/* giving up on the master in is_ups_critical() */
+	if ((ups->critical == 0) && (!flag_isset(ups->status, ST_FSD)) &&
+		(!flag_isset(ups->status, ST_MASTER)))
+		return ups->lastnoncrit + hostsync + 1;
+
+	return 0;
+}
+
+/* recalculate the online power value and see if things are still OK
+ *
+ * val_ol is kept from one call to the next: only the UPSes whose flags
+ * changed are looked at again, unless a timer ran out or the configuration
+ * was reloaded */
 static void recalc(void)
 {
 	utype_t	*ups;
-	int	val_ol = 0;
-	time_t	now;
+	int	all, crit, changed = 0;
+	time_t	now, timer;
 
 	time(&now);
-	ups = firstups;
-	while (ups != NULL) {
+
+	all = recalc_all || ((recalc_next != 0) && (now >= recalc_next));
+
+	if (all)
+		recalc_next = 0;
+
+	if (recalc_all) {
+		val_ol = 0;
+
+		for (ups = firstups; ups != NULL; ups = ups->next)
+			ups->critical = -1;
+
+		recalc_all = 0;
+	}
+
+	for (ups = firstups; ups != NULL; ups = ups->next) {
+
+		if ((!all) && (ups->status == ups->checked))
+			continue;
+
 		/* promote dead UPSes that were last known OB to OB+LB */
 		if ((now - ups->lastpoll) > deadtime)
 			if (flag_isset(ups->status, ST_ONBATT)) {
@@ -701,16 +1205,33 @@ static void recalc(void)
 		 * whether this is really the best thing to do is undecided  */
 
 		/* crit = (FSD) || (OB & LB) > HOSTSYNC seconds */
-		if (is_ups_critical(ups))
+		crit = is_ups_critical(ups);
+
+		if (crit)
 			upsdebugx(1, "Critical UPS: %s", ups->sys);
-		else
-			val_ol += ups->pv;
 
-		ups = ups->next;
+		if (crit != ups->critical) {
+			if (ups->critical == 0)
+				val_ol -= ups->pv;
+			if (crit == 0)
+				val_ol += ups->pv;
+
+			ups->critical = crit;
+			changed = 1;
+		}
+
+		ups->checked = ups->status;
+
+		timer = recalc_timer(ups);
+
+		if ((timer != 0) && ((recalc_next == 0) || (timer < recalc_next)))
+			recalc_next = timer;
 	}
 
-	upsdebugx(3, "Current power value: %d", val_ol);
-	upsdebugx(3, "Minimum power value: %d", minsupplies);
+	if (changed) {
+		upsdebugx(3, "Current power value: %d", val_ol);
+		upsdebugx(3, "Minimum power value: %d", minsupplies);
+	}
 
 	if (val_ol < minsupplies)
 		forceshutdown();
@@ -934,6 +1455,12 @@ static void addups(int reloading, const char *sys, const char *pvs,
 	tmp->lastrbwarn = 0;
 	tmp->lastncwarn = 0;
 
+	tmp->pollstate = POLL_IDLE;
+	timerclear(&tmp->nextpoll);
+
+	tmp->critical = -1;
+	tmp->checked = -1;
+
 	if (!strcasecmp(master, "master"))
 		setflag(&tmp->status, ST_MASTER);
 
@@ -1056,6 +1583,22 @@ static void checkmode(char *cfgentry, char *oldvalue, char *newvalue,
 }
 
 /* returns 1 if used, 0 if not, so we can complain about bogus configs */
+/* POLLFREQ and POLLFREQALERT are in seconds, with up to 3 decimals */
+static void set_pollfreq(int *msec, const char *var, const char *val)
+{
+	char	*end;
+	double	sec;
+
+	sec = strtod(val, &end);
+
+	if ((end == val) || (*end != '\0') || (sec < 0.001) || (sec > 86400)) {
+		upslogx(LOG_WARNING, "Ignoring invalid %s value [%s]", var, val);
+		return;
+	}
+
+	*msec = (int) (sec * 1000 + 0.5);
+}
+
 static int parse_conf_arg(int numargs, char **arg)
 {
 	/* using up to arg[1] below */
@@ -1092,15 +1635,22 @@ static int parse_conf_arg(int numargs, char **arg)
 		return 1;
 	}
 
+	/* UPSSCHED <fn> */
+	if (!strcmp(arg[0], "UPSSCHED")) {
+		free(schedconf);
+		schedconf = xstrdup(arg[1]);
+		return 1;
+	}
+
 	/* POLLFREQ <num> */
 	if (!strcmp(arg[0], "POLLFREQ")) {
-		pollfreq = atoi(arg[1]);
+		set_pollfreq(&pollfreq, arg[0], arg[1]);
 		return 1;
 	}
 
 	/* POLLFREQALERT <num> */
 	if (!strcmp(arg[0], "POLLFREQALERT")) {
-		pollfreqalert = atoi(arg[1]);
+		set_pollfreq(&pollfreqalert, arg[0], arg[1]);
 		return 1;
 	}
 
@@ -1270,6 +1820,14 @@ static void loadconfig(void)
 	}
 
 	pconf_finish(&ctx);		
+
+	/* running timers carry on with the new rules */
+	if (schedconf) {
+		sched_exec = sched_notify;
+
+		if ((!sched_readconf(schedconf)) && (reload_flag != 1))
+			fatalx(EXIT_FAILURE, "Unable to load %s", schedconf);
+	}
 }
 
 /* SIGPIPE handler */
@@ -1311,10 +1869,17 @@ static void upsmon_cleanup(void)
 		utmp = unext;
 	}
 
+	/* the notifier finishes its work, then exits */
+	if (notifier_fd >= 0)
+		close(notifier_fd);
+
 	free(run_as_user);
 	free(shutdowncmd);
 	free(notifycmd);
 	free(powerdownflag);
+	free(schedconf);
+
+	sched_cleanup();
 
 	for (i = 0; notifylist[i].name != NULL; i++) {
 		free(notifylist[i].msg);
@@ -1383,8 +1948,8 @@ static void update_crittimer(utype_t *ups)
 	/* fallthrough: let the timer age */
 }
 
-/* handle connecting to upsd, plus get SSL going too if possible */
-static int try_connect(utype_t *ups)
+/* start connecting to upsd, completed by connect_finish() */
+static int connect_start(utype_t *ups)
 {
 	int	flags = 0, ret;
 
@@ -1422,7 +1987,28 @@ static int try_connect(utype_t *ups)
 		flags |= UPSCLI_CONN_CERTVERIF;
 	}
 
-	ret = upscli_connect(&ups->conn, ups->hostname, ups->port, flags);
+	ret = upscli_connect_start(&ups->conn, ups->hostname, ups->port, flags);
+
+	if (ret < 0) {
+		upslogx(LOG_ERR, "UPS [%s]: connect failed: %s",
+			ups->sys, upscli_strerror(&ups->conn));
+		ups_is_gone(ups);
+		return 0;
+	}
+
+	return 1;
+}
+
+/* see if the connection is up, plus get SSL going too if possible
+ * returns 1 once logged in, 0 on failure, -1 while still connecting */
+static int connect_finish(utype_t *ups)
+{
+	int	ret;
+
+	ret = upscli_connect_finish(&ups->conn);
+
+	if (ret == 1)
+		return -1;
 
 	if (ret < 0) {
 		upslogx(LOG_ERR, "UPS [%s]: connect failed: %s",
@@ -1503,32 +2089,46 @@ static void parse_status(utype_t *ups, char *status)
 	} 
 }
 
-/* see what the status of the UPS is and handle any changes */
-static void pollups(utype_t *ups)
+/* milliseconds left until tv (from monotonic_time), negative once it has passed */
+static long msec_until(const struct timeval *tv)
 {
-	char	status[SMALLBUF];
+	struct timeval	now;
 
-	/* try a reconnect here */
-	if (!flag_isset(ups->status, ST_CONNECTED))
-		if (try_connect(ups) != 1)
-			return;
+	monotonic_time(&now);
 
-	if (upscli_ssl(&ups->conn) == 1)
-		upsdebugx(2, "%s: %s [SSL]", __func__, ups->sys);
-	else
-		upsdebugx(2, "%s: %s", __func__, ups->sys);
+	return (tv->tv_sec - now.tv_sec) * 1000 +
+		(tv->tv_usec - now.tv_usec) / 1000;
+}
 
-	set_alarm();
+/* is this UPS due for polling at now */
+static int poll_due(const utype_t *ups, const struct timeval *now)
+{
+	if (ups->nextpoll.tv_sec != now->tv_sec)
+		return ups->nextpoll.tv_sec < now->tv_sec;
 
-	if (get_var(ups, "status", status, sizeof(status)) == 0) {
-		clear_alarm();
-		parse_status(ups, status);
-		return;
-	}
+	return ups->nextpoll.tv_usec <= now->tv_usec;
+}
 
-	/* fallthrough: no communications */
-	clear_alarm();
+/* poll this UPS again interval milliseconds after start, minus up to a
+ * tenth of that at random, so that the upsmons of a site drift apart
+ * rather than all hitting upsd at the same moment */
+static void poll_schedule(utype_t *ups, const struct timeval *start,
+	long interval)
+{
+	interval -= rand() % (interval / 10 + 1);
+
+	ups->nextpoll.tv_sec = start->tv_sec + interval / 1000;
+	ups->nextpoll.tv_usec = start->tv_usec + (interval % 1000) * 1000;
+
+	if (ups->nextpoll.tv_usec >= 1000000) {
+		ups->nextpoll.tv_sec++;
+		ups->nextpoll.tv_usec -= 1000000;
+	}
+}
 
+/* the status query failed: report it and clean up */
+static void poll_failed(utype_t *ups)
+{
 	/* try to make some of these a little friendlier */
 
 	switch (upscli_upserror(&ups->conn)) {
@@ -1555,6 +2155,233 @@ static void pollups(utype_t *ups)
 	}
 }
 
+/* ask for the status of a connected UPS */
+static void poll_status(utype_t *ups)
+{
+	if (upscli_ssl(&ups->conn) == 1)
+		upsdebugx(2, "%s: %s [SSL]", __func__, ups->sys);
+	else
+		upsdebugx(2, "%s: %s", __func__, ups->sys);
+
+	if (get_var_start(ups, "status") < 0) {
+		poll_failed(ups);
+		return;
+	}
+
+	ups->pollstate = POLL_STATUS;
+}
+
+/* start a polling cycle for this UPS, reconnecting first if needed */
+static void poll_start(utype_t *ups)
+{
+	ups->pollstate = POLL_IDLE;
+
+	/* the connect and the status query share the same NET_TIMEOUT */
+	monotonic_time(&ups->deadline);
+	ups->deadline.tv_sec += NET_TIMEOUT;
+
+	if (flag_isset(ups->status, ST_CONNECTED)) {
+		poll_status(ups);
+		return;
+	}
+
+	/* try a reconnect here */
+	if (connect_start(ups) == 1)
+		ups->pollstate = POLL_CONNECT;
+}
+
+/* the socket of this UPS is ready: move its polling cycle along */
+static void poll_continue(utype_t *ups)
+{
+	char	status[SMALLBUF];
+	long	left;
+	int	ret;
+
+	if (ups->pollstate == POLL_CONNECT) {
+		ret = connect_finish(ups);
+
+		if (ret < 0)
+			return;		/* still going, maybe on another address */
+
+		ups->pollstate = POLL_IDLE;
+
+		if (ret == 1)
+			poll_status(ups);
+
+		return;
+	}
+
+	ups->pollstate = POLL_IDLE;
+
+	/* the answer is normally complete by now, this is just a backstop */
+	left = msec_until(&ups->deadline);
+
+	if (get_var_finish(ups, "status", status, sizeof(status),
+		(left > 1000) ? left / 1000 : 1) == 0) {
+		parse_status(ups, status);
+		return;
+	}
+
+	/* fallthrough: no communications */
+	poll_failed(ups);
+}
+
+/* this UPS ran out of time during its polling cycle */
+static void poll_timeout(utype_t *ups)
+{
+	if (ups->pollstate == POLL_CONNECT) {
+		upslogx(LOG_ERR, "UPS [%s]: connect failed: timeout", ups->sys);
+		ups->pollstate = POLL_IDLE;
+
+		ups_is_gone(ups);
+		upscli_disconnect(&ups->conn);
+		return;
+	}
+
+	upslogx(LOG_ERR, "Poll UPS [%s] failed - timeout", ups->sys);
+	ups->pollstate = POLL_IDLE;
+
+	ups_is_gone(ups);
+
+	/* a late answer can't be told apart from the next one, so start over */
+	drop_connection(ups);
+}
+
+/* see what the status of every UPS due for it is and handle any changes
+ *
+ * All the connects and queries are in flight at once, so a dead or slow
+ * upsd only holds up its own UPSes, and never for more than NET_TIMEOUT */
+static void pollall(void)
+{
+	utype_t	*ups, **waiting;
+	struct pollfd	*fds;
+	struct timeval	start;
+	size_t	i, nfds, maxfds = 0;
+	long	left, timeout, interval;
+	int	ret;
+
+	monotonic_time(&start);
+
+	for (ups = firstups; ups != NULL; ups = ups->next) {
+		if (poll_due(ups, &start)) {
+			poll_start(ups);
+			maxfds++;
+		}
+	}
+
+	if (maxfds == 0)
+		return;
+
+	fds = xcalloc(maxfds, sizeof(*fds));
+	waiting = xcalloc(maxfds, sizeof(*waiting));
+
+	for (;;) {
+		nfds = 0;
+		timeout = -1;
+
+		for (ups = firstups; ups != NULL; ups = ups->next) {
+
+			if (ups->pollstate == POLL_IDLE)
+				continue;
+
+			left = msec_until(&ups->deadline);
+
+			if (left <= 0) {
+				poll_timeout(ups);
+				continue;
+			}
+
+			if ((timeout < 0) || (left < timeout))
+				timeout = left;
+
+			fds[nfds].fd = upscli_fd(&ups->conn);
+			fds[nfds].events =
+				(ups->pollstate == POLL_CONNECT) ? POLLOUT : POLLIN;
+			fds[nfds].revents = 0;
+			waiting[nfds++] = ups;
+		}
+
+		if (nfds == 0)
+			break;
+
+		ret = poll(fds, nfds, timeout);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+
+			upslog_with_errno(LOG_ERR, "poll");
+
+			/* let the deadlines sort it out */
+			usleep(100000);
+			continue;
+		}
+
+		for (i = 0; i < nfds; i++) {
+			if (fds[i].revents != 0)
+				poll_continue(waiting[i]);
+		}
+	}
+
+	free(fds);
+	free(waiting);
+
+	/* poll faster while any UPS is on battery */
+	interval = pollfreq;
+
+	for (ups = firstups; ups != NULL; ups = ups->next) {
+		if (flag_isset(ups->status, ST_ONBATT)) {
+			interval = pollfreqalert;
+			break;
+		}
+	}
+
+	for (ups = firstups; ups != NULL; ups = ups->next) {
+		if (poll_due(ups, &start))
+			poll_schedule(ups, &start, interval);
+	}
+}
+
+/* sleep until the next UPS is due for polling, or a recalc() or upssched
+ * timer runs out, or a signal comes in */
+static void poll_wait(void)
+{
+	utype_t	*ups;
+	struct timeval	tv;
+	long	left, timeout = pollfreq;
+	time_t	now;
+
+	for (ups = firstups; ups != NULL; ups = ups->next) {
+		left = msec_until(&ups->nextpoll);
+
+		if (left < timeout)
+			timeout = left;
+	}
+
+	if (recalc_next != 0) {
+		time(&now);
+		left = (recalc_next - now) * 1000;
+
+		if (left < timeout)
+			timeout = left;
+	}
+
+	left = sched_timeleft();
+
+	if ((left >= 0) && (left < timeout))
+		timeout = left;
+
+	if (timeout <= 0)
+		return;
+
+	upsdebugx(4, "%s: %ld ms", __func__, timeout);
+
+	tv.tv_sec = timeout / 1000;
+	tv.tv_usec = (timeout % 1000) * 1000;
+
+	select(0, NULL, NULL, NULL, &tv);
+}
+
 /* see if the powerdownflag file is there and proper */
 static int pdflag_status(void)
 {
@@ -1825,6 +2652,12 @@ static void reload_conf(void)
 		fatalx(EXIT_FAILURE, "Impossible power configuration, unable to continue");
 	}
 
+	/* the notifier has a copy of the old NOTIFYCMD */
+	notifier_send(0, notifycmd, NULL, NULL, NULL);
+
+	/* the power values may have changed, or UPSes come and gone */
+	recalc_all = 1;
+
 	/* finally clear the flag */
 	reload_flag = 0;
 }
@@ -1993,6 +2826,9 @@ int main(int argc, char *argv[])
 		writepid(prog);
 	}
 	
+	/* before the connections and SSL, to keep it small */
+	start_notifier();
+
 	if (upscli_init(certverify, certpath, certname, certpasswd) < 0) {
 		exit(EXIT_FAILURE);
 	}
@@ -2000,13 +2836,14 @@ int main(int argc, char *argv[])
 	/* prep our signal handlers */
 	setup_signals();
 
+	/* for the jitter in poll_schedule() */
+	srand((unsigned int) (getpid() ^ time(NULL)));
+
 	/* reopen the log for the child process */
 	closelog();
 	open_syslog(prog);
 
 	while (exit_flag == 0) {
-		utype_t	*ups;
-
 		/* check flags from signal handlers */
 		if (userfsd)
 			forceshutdown();
@@ -2014,11 +2851,13 @@ int main(int argc, char *argv[])
 		if (reload_flag)
 			reload_conf();
 
-		for (ups = firstups; ups != NULL; ups = ups->next)
-			pollups(ups);
+		pollall();
 
 		recalc();
 
+		/* and the in-process upssched's timers */
+		sched_checktimers();
+
 		/* make sure the parent hasn't died */
 		if (use_pipe)
 			check_parent();
@@ -2026,7 +2865,7 @@ int main(int argc, char *argv[])
 		/* reap children that have exited */
 		waitpid(-1, NULL, WNOHANG);
 
-		sleep(sleepval);
+		poll_wait();
 	}
 
 	upslogx(LOG_INFO, "Signal %d: exiting", exit_flag);
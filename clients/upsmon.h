@@ -27,6 +27,12 @@
 #define ST_LOGIN       (1 << 5)       /* we are logged into this UPS          */
 #define ST_CONNECTED   (1 << 6)       /* upscli_connect returned OK           */
 
+/* what we are waiting for from this UPS during a polling cycle */
+
+#define POLL_IDLE	0	/* nothing pending			*/
+#define POLL_CONNECT	1	/* upscli_connect_start() in progress	*/
+#define POLL_STATUS	2	/* status query sent, awaiting answer	*/
+
 /* required contents of flag file */
 #define SDMAGIC "upsmon-shutdown-file"  
 
@@ -60,6 +66,14 @@ typedef struct {
 	time_t  lastnoncrit;		/* time of last non-crit poll	*/
 	time_t	lastrbwarn;		/* time of last REPLBATT warning*/
 	time_t	lastncwarn;		/* time of last NOCOMM warning	*/
+
+	int	pollstate;		/* see POLL_* above		*/
+	struct timeval	deadline;	/* end of the pending POLL_*	*/
+	struct timeval	nextpoll;	/* when to poll again		*/
+
+	/* what recalc() made of this UPS */
+	int	critical;		/* 1, 0 (counted as OK) or -1	*/
+	int	checked;		/* status back then		*/
 	void	*next;
 }	utype_t;
 
@@ -83,6 +97,15 @@ typedef struct {
 #define NOTIFY_WALL    (1 << 2)        /* send the msg to all users        */
 #define NOTIFY_EXEC    (1 << 3)        /* send the msg to NOTIFYCMD script */
 
+/* records on the pipe to the notifier process, followed by the strings
+ * they announce, without their terminating NUL */
+
+typedef struct {
+	int	flags;		/* NOTIFY_WALL | NOTIFY_EXEC, 0 for a new NOTIFYCMD */
+	size_t	len[4];		/* ntype, upsname, notice and the command
+				   if not NOTIFYCMD, or just NOTIFYCMD	*/
+}	notifyrec_t;
+
 /* flags are set to NOTIFY_SYSLOG | NOTIFY_WALL at program init	*/
 /* the user can override with NOTIFYFLAGS in the upsmon.conf	*/
 
@@ -117,6 +140,11 @@ struct {
 
 #define NET_TIMEOUT 10		/* wait 10 seconds max for upsd to respond */
 
+#define NOTIFY_MAXEXEC	4	/* NOTIFYCMDs running at once		*/
+#define NOTIFY_MAXQUEUE	1024	/* NOTIFYCMDs waiting, then dropped	*/
+#define NOTIFY_WALLFREQ	1000	/* milliseconds between wall batches	*/
+#define NOTIFY_WALLMAX	20	/* lines per wall batch, then a count	*/
+
 #ifdef __cplusplus
 /* *INDENT-OFF* */
 }
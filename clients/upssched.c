@@ -23,7 +23,9 @@
  * 2. the config file is searched for an AT condition that matches
  * 3. the conditions on any matching lines are parsed
  *
- * starting a timer: the timer is added to the daemon's timer queue
+ * starting a timer: the timer is added to the daemon's timer queue, with
+ * the upsname and notifytype of the event, which CMDSCRIPT gets when the
+ * timer triggers
  * cancelling a timer: the timer is removed from that queue
  * execute a command: the command is passed straight to the cmdscript
  *
@@ -37,6 +39,8 @@
  *
  * the daemon will shut down automatically when no more timers are active
  *
+ * the rules and timers themselves are in schedlib.c, which upsmon can
+ * also run in-process (UPSSCHED in upsmon.conf)
  */
 
 #include "common.h"
@@ -50,18 +54,11 @@
 #include <fcntl.h>
 
 #include "upssched.h"
+#include "schedlib.h"
 #include "timehead.h"
 
-typedef struct ttype_s {
-	char	*name;
-	time_t	etime;
-	struct ttype_s	*next;
-} ttype_t;
-
-	ttype_t	*thead = NULL;
 	static	conn_t	*connhead = NULL;
-	char	*cmdscript = NULL, *pipefn = NULL, *lockfn = NULL;
-	int	verbose = 0;		/* use for debugging */
+	static	struct timeval	tidle;	/* when there were timers last */
 
 
 	/* ups name and notify type (string) as received from upsmon */
@@ -70,19 +67,23 @@ typedef struct ttype_s {
 #define PARENT_STARTED		-2
 #define PARENT_UNNECESSARY	-3
 #define MAX_TRIES 		30
-#define EMPTY_WAIT		15	/* min passes with no timers to exit */
+#define EMPTY_WAIT		15	/* min seconds with no timers to exit */
 #define US_LISTEN_BACKLOG	16
 #define US_SOCK_BUF_LEN		256
 #define US_MAX_READ		128
 
 /* --- server functions --- */
 
-static void exec_cmd(const char *cmd)
+static void exec_cmd(const char *cmd, const char *un, const char *ntype)
 {
 	int	err;
 	char	buf[LARGEBUF];
 
-	snprintf(buf, sizeof(buf), "%s %s", cmdscript, cmd);
+	/* as upsmon does for NOTIFYCMD, and timers keep the ones they had */
+	setenv("UPSNAME", un ? un : "", 1);
+	setenv("NOTIFYTYPE", ntype ? ntype : "", 1);
+
+	snprintf(buf, sizeof(buf), "%s %s", sched_conf->cmdscript, cmd);
 
 	err = system(buf);
 	if (WIFEXITED(err)) {
@@ -100,145 +101,6 @@ static void exec_cmd(const char *cmd)
 	return;
 }
 
-static void removetimer(ttype_t *tfind)
-{
-	ttype_t	*tmp, *last;
-
-	last = NULL;
-	tmp = thead;
-
-	while (tmp) {
-		if (tmp == tfind) {	/* found it */
-			if (last == NULL)	/* deleting first */
-				thead = tmp->next;
-			else
-				last->next = tmp->next;
-
-			free(tmp->name);
-			free(tmp);
-			return;
-		}
-
-		last = tmp;
-		tmp = tmp->next;
-	}
-
-	/* this one should never happen */
-
-	upslogx(LOG_ERR, "removetimer: failed to locate target at %p", (void *)tfind);
-}
-
-static void checktimers(void)
-{
-	ttype_t	*tmp, *tmpnext;
-	time_t	now;
-	static	int	emptyctr = 0;
-
-	/* if the queue is empty we might be ready to exit */
-	if (!thead) {
-
-		emptyctr++;
-
-		/* wait a little while in case someone wants us again */
-		if (emptyctr < EMPTY_WAIT)
-			return;
-
-		if (verbose)
-			upslogx(LOG_INFO, "Timer queue empty, exiting");
-
-#ifdef UPSSCHED_RACE_TEST
-		upslogx(LOG_INFO, "triggering race: sleeping 15 sec before exit");
-		sleep(15);
-#endif
-
-		unlink(pipefn);
-		exit(EXIT_SUCCESS);
-	}
-
-	emptyctr = 0;
-
-	/* flip through LL, look for activity */
-	tmp = thead;
-
-	time(&now);
-	while (tmp) {
-		tmpnext = tmp->next;
-
-		if (now >= tmp->etime) {
-			if (verbose)
-				upslogx(LOG_INFO, "Event: %s ", tmp->name);
-
-			exec_cmd(tmp->name);
-
-			/* delete from queue */
-			removetimer(tmp);
-		}
-
-		tmp = tmpnext;
-	}
-}
-
-static void start_timer(const char *name, const char *ofsstr)
-{
-	time_t	now;
-	int	ofs;
-	ttype_t	*tmp, *last;
-
-	/* get the time */
-	time(&now);
-
-	/* add an event for <now> + <time> */
-	ofs = strtol(ofsstr, (char **) NULL, 10);
-
-	if (ofs < 0) {
-		upslogx(LOG_INFO, "bogus offset for timer, ignoring");
-		return;
-	}
-
-	if (verbose)
-		upslogx(LOG_INFO, "New timer: %s (%d seconds)", name, ofs);
-
-	/* now add to the queue */
-	tmp = last = thead;
-
-	while (tmp) {
-		last = tmp;
-		tmp = tmp->next;
-	}
-
-	tmp = xmalloc(sizeof(ttype_t));
-	tmp->name = xstrdup(name);
-	tmp->etime = now + ofs;
-	tmp->next = NULL;
-
-	if (last)
-		last->next = tmp;
-	else
-		thead = tmp;
-}
-
-static void cancel_timer(const char *name, const char *cname)
-{
-	ttype_t	*tmp;
-
-	for (tmp = thead; tmp != NULL; tmp = tmp->next) {
-		if (!strcmp(tmp->name, name)) {		/* match */
-			if (verbose)
-				upslogx(LOG_INFO, "Cancelling timer: %s", name);
-			removetimer(tmp);
-			return;
-		}
-	}
-
-	/* this is not necessarily an error */
-	if (cname && cname[0]) {
-		if (verbose)
-			upslogx(LOG_INFO, "Cancel %s, event: %s", name, cname);
-
-		exec_cmd(cname);
-	}
-}
-
 static void us_serialize(int op)
 {
 	static	int	pipefd[2];
@@ -278,21 +140,21 @@ static int open_sock(void)
 		fatal_with_errno(EXIT_FAILURE, "Can't create a unix domain socket");
 
 	ssaddr.sun_family = AF_UNIX;
-	snprintf(ssaddr.sun_path, sizeof(ssaddr.sun_path), "%s", pipefn);
+	snprintf(ssaddr.sun_path, sizeof(ssaddr.sun_path), "%s", sched_conf->pipefn);
 
-	unlink(pipefn);
+	unlink(sched_conf->pipefn);
 
 	umask(0007);
 
 	ret = bind(fd, (struct sockaddr *) &ssaddr, sizeof ssaddr);
 
 	if (ret < 0)
-		fatal_with_errno(EXIT_FAILURE, "bind %s failed", pipefn);
+		fatal_with_errno(EXIT_FAILURE, "bind %s failed", sched_conf->pipefn);
 
-	ret = chmod(pipefn, 0660);
+	ret = chmod(sched_conf->pipefn, 0660);
 
 	if (ret < 0)
-		fatal_with_errno(EXIT_FAILURE, "chmod(%s, 0660) failed", pipefn);
+		fatal_with_errno(EXIT_FAILURE, "chmod(%s, 0660) failed", sched_conf->pipefn);
 
 	ret = listen(fd, US_LISTEN_BACKLOG);
 
@@ -367,6 +229,9 @@ static void conn_add(int sockfd)
 	socklen_t	salen;
 #endif
 
+	/* somebody still wants us */
+	monotonic_time(&tidle);
+
 	salen = sizeof(saddr);
 	acc = accept(sockfd, (struct sockaddr *) &saddr, &salen);
 
@@ -419,16 +284,26 @@ static void conn_add(int sockfd)
 
 static int sock_arg(conn_t *conn)
 {
+	const	char	*un = upsname, *ntype = notify_type;
+
 	if (conn->ctx.numargs < 1)
 		return 0;
 
-	/* CANCEL <name> [<cmd>] */
+	/* the event that sent the command follows its second argument */
+	if (conn->ctx.numargs >= 5) {
+		un = conn->ctx.arglist[3];
+		ntype = conn->ctx.arglist[4];
+	}
+
+	/* CANCEL <name> [<cmd> <upsname> <notifytype>] */
 	if (!strcmp(conn->ctx.arglist[0], "CANCEL")) {
 
 		if (conn->ctx.numargs < 3)
-			cancel_timer(conn->ctx.arglist[1], NULL);
+			sched_cancel_timer(conn->ctx.arglist[1], NULL,
+				un, ntype);
 		else
-			cancel_timer(conn->ctx.arglist[1], conn->ctx.arglist[2]);
+			sched_cancel_timer(conn->ctx.arglist[1],
+				conn->ctx.arglist[2], un, ntype);
 
 		send_to_one(conn, "OK\n");
 		return 1;
@@ -437,9 +312,10 @@ static int sock_arg(conn_t *conn)
 	if (conn->ctx.numargs < 3)
 		return 0;
 
-	/* START <name> <length> */
+	/* START <name> <length> [<upsname> <notifytype>] */
 	if (!strcmp(conn->ctx.arglist[0], "START")) {
-		start_timer(conn->ctx.arglist[1], conn->ctx.arglist[2]);
+		sched_start_timer(conn->ctx.arglist[1], conn->ctx.arglist[2],
+			un, ntype);
 		send_to_one(conn, "OK\n");
 		return 1;
 	}
@@ -501,9 +377,37 @@ static int sock_read(conn_t *conn)
 	return 0;	/* fell out without parsing anything */
 }
 
+/* the queue is empty, so we might be ready to exit: but wait a little
+ * while in case someone wants us again; returns how long that is */
+static long idle_wait(void)
+{
+	struct timeval	now;
+	long	left;
+
+	monotonic_time(&now);
+
+	left = EMPTY_WAIT * 1000 - ((now.tv_sec - tidle.tv_sec) * 1000 +
+		(now.tv_usec - tidle.tv_usec) / 1000);
+
+	if (left > 0)
+		return left;
+
+	if (sched_verbose)
+		upslogx(LOG_INFO, "Timer queue empty, exiting");
+
+#ifdef UPSSCHED_RACE_TEST
+	upslogx(LOG_INFO, "triggering race: sleeping 15 sec before exit");
+	sleep(15);
+#endif
+
+	unlink(sched_conf->pipefn);
+	exit(EXIT_SUCCESS);
+}
+
 static void start_daemon(int lockfd)
 {
 	int	maxfd, pid, pipefd, ret;
+	long	timeout;
 	struct	timeval	tv;
 	fd_set	rfds;
 	conn_t	*tmp, *tmpnext;
@@ -539,22 +443,32 @@ static void start_daemon(int lockfd)
 
 	pipefd = open_sock();
 
-	if (verbose)
+	if (sched_verbose)
 		upslogx(LOG_INFO, "Timer daemon started");
 
 	/* release the parent */
 	us_serialize(SERIALIZE_SET);
 
 	/* drop the lock now that the background is running */
-	unlink(lockfn);
+	unlink(sched_conf->lockfn);
 	close(lockfd);
 
+	/* the first command is on its way */
+	monotonic_time(&tidle);
+
 	/* now watch for activity */
 
 	for (;;) {
-		/* wait at most 1s so we can check our timers regularly */
-		tv.tv_sec = 1;
-		tv.tv_usec = 0;
+		/* sleep until the next timer is due, unless a command comes in */
+		timeout = sched_checktimers();
+
+		if (timeout < 0)
+			timeout = idle_wait();
+		else
+			monotonic_time(&tidle);
+
+		tv.tv_sec = timeout / 1000;
+		tv.tv_usec = (timeout % 1000) * 1000;
 
 		FD_ZERO(&rfds);
 		FD_SET(pipefd, &rfds);
@@ -590,8 +504,6 @@ static void start_daemon(int lockfd)
 				tmp = tmpnext;
 			}
 		}
-
-		checktimers();
 	}
 }
 
@@ -604,7 +516,7 @@ static int try_connect(void)
 
 	memset(&saddr, '\0', sizeof(saddr));
 	saddr.sun_family = AF_UNIX;
-	snprintf(saddr.sun_path, sizeof(saddr.sun_path), "%s", pipefn);
+	snprintf(saddr.sun_path, sizeof(saddr.sun_path), "%s", sched_conf->pipefn);
 
 	pipefd = socket(AF_UNIX, SOCK_STREAM, 0);
 
@@ -647,7 +559,7 @@ static int check_parent(const char *cmd, const char *arg2)
 
 		/* we need to start the daemon, so try to get the lock */
 
-		lockfd = get_lock(lockfn);
+		lockfd = get_lock(sched_conf->lockfn);
 
 		if (lockfd != -1) {
 			start_daemon(lockfd);
@@ -657,7 +569,7 @@ static int check_parent(const char *cmd, const char *arg2)
 		/* we didn't get the lock - must be two upsscheds running */
 
 		/* blow this away in case we crashed before */
-		unlink(lockfn);
+		unlink(sched_conf->lockfn);
 
 		/* give the other one a chance to start it, then try again */
 		usleep(250000);
@@ -685,7 +597,8 @@ static void setup_sigalrm(void)
 	sigaction(SIGALRM, &sa, NULL);
 }
 
-static void sendcmd(const char *cmd, const char *arg1, const char *arg2)
+static void sendcmd(const char *cmd, const char *arg1, const char *arg2,
+		const char *un, const char *ntype)
 {
 	int	i, pipefd, ret;
 	char	buf[SMALLBUF], enc[SMALLBUF];
@@ -698,9 +611,15 @@ static void sendcmd(const char *cmd, const char *arg1, const char *arg2)
 	snprintf(buf, sizeof(buf), "%s \"%s\"",
 		cmd, pconf_encode(arg1, enc, sizeof(enc)));
 
-	if (arg2)
+	/* only then can the daemon run CMDSCRIPT for this event */
+	if (arg2) {
 		snprintfcat(buf, sizeof(buf), " \"%s\"",
 			pconf_encode(arg2, enc, sizeof(enc)));
+		snprintfcat(buf, sizeof(buf), " \"%s\"",
+			pconf_encode(un, enc, sizeof(enc)));
+		snprintfcat(buf, sizeof(buf), " \"%s\"",
+			pconf_encode(ntype, enc, sizeof(enc)));
+	}
 
 	snprintf(enc, sizeof(enc), "%s\n", buf);
 
@@ -760,157 +679,56 @@ static void sendcmd(const char *cmd, const char *arg1, const char *arg2)
 	fatalx(EXIT_FAILURE, "Unable to connect to daemon and unable to start daemon");
 }
 
-static void parse_at(const char *ntype, const char *un, const char *cmd,
-		const char *ca1, const char *ca2)
+/* the rules are checked here, but the timers are in the daemon */
+static void client_action(const sched_at_t *at, const char *un,
+		const char *ntype)
 {
-	/* complain both ways in case we don't have a tty */
+	/* send it to the daemon (which may start it) */
 
-	if (!cmdscript) {
-		printf("CMDSCRIPT must be set before any ATs in the config file!\n");
-		fatalx(EXIT_FAILURE, "CMDSCRIPT must be set before any ATs in the config file!");
-	}
-
-	if (!pipefn) {
-		printf("PIPEFN must be set before any ATs in the config file!\n");
-		fatalx(EXIT_FAILURE, "PIPEFN must be set before any ATs in the config file!");
-	}
-
-	if (!lockfn) {
-		printf("LOCKFN must be set before any ATs in the config file!\n");
-		fatalx(EXIT_FAILURE, "LOCKFN must be set before any ATs in the config file!");
-	}
-
-	/* check upsname: does this apply to us? */
-	if (strcmp(upsname, un) != 0)
-		if (strcmp(un, "*") != 0)
-			return;		/* not for us, and not the wildcard */
-
-	/* see if the current notify type matches the one from the .conf */
-	if (strcasecmp(notify_type, ntype) != 0)
-		return;
-
-	/* if command is valid, send it to the daemon (which may start it) */
-
-	if (!strcmp(cmd, "START-TIMER")) {
-		sendcmd("START", ca1, ca2);
+	if (at->cmd == SCHED_START) {
+		sendcmd("START", at->arg1, at->arg2, un, ntype);
 		return;
 	}
 
-	if (!strcmp(cmd, "CANCEL-TIMER")) {
-		sendcmd("CANCEL", ca1, ca2);
+	if (at->cmd == SCHED_CANCEL) {
+		sendcmd("CANCEL", at->arg1, at->arg2, un, ntype);
 		return;
 	}
 
-	if (!strcmp(cmd, "EXECUTE")) {
-		if (ca1[0] == '\0') {
-			upslogx(LOG_ERR, "Empty EXECUTE command argument");
-			return;
-		}
-
-		if (verbose)
-			upslogx(LOG_INFO, "Executing command: %s", ca1);
-
-		exec_cmd(ca1);
-		return;
-	}
-
-	upslogx(LOG_ERR, "Invalid command: %s", cmd);
-}
-
-static int conf_arg(int numargs, char **arg)
-{
-	if (numargs < 2)
-		return 0;
-
-	/* CMDSCRIPT <scriptname> */
-	if (!strcmp(arg[0], "CMDSCRIPT")) {
-		cmdscript = xstrdup(arg[1]);
-		return 1;
-	}
-
-	/* PIPEFN <pipename> */
-	if (!strcmp(arg[0], "PIPEFN")) {
-		pipefn = xstrdup(arg[1]);
-		return 1;
-	}
-
-	/* LOCKFN <filename> */
-	if (!strcmp(arg[0], "LOCKFN")) {
-		lockfn = xstrdup(arg[1]);
-		return 1;
-	}
-
-	if (numargs < 5)
-		return 0;
-
-	/* AT <notifytype> <upsname> <command> <cmdarg1> [<cmdarg2>] */
-	if (!strcmp(arg[0], "AT")) {
-
-		/* don't use arg[5] unless we have it... */
-		if (numargs > 5)
-			parse_at(arg[1], arg[2], arg[3], arg[4], arg[5]);
-		else
-			parse_at(arg[1], arg[2], arg[3], arg[4], NULL);
-
-		return 1;
-	}
-
-	return 0;
-}
-
-/* called for fatal errors in parseconf like malloc failures */
-static void upssched_err(const char *errmsg)
-{
-	upslogx(LOG_ERR, "Fatal error in parseconf(upssched.conf): %s", errmsg);
+	sched_action(at, un, ntype);
 }
 
 static void checkconf(void)
 {
 	char	fn[SMALLBUF];
-	PCONF_CTX_t	ctx;
 
 	snprintf(fn, sizeof(fn), "%s/upssched.conf", confpath());
 
-	pconf_init(&ctx, upssched_err);
-
-	if (!pconf_file_begin(&ctx, fn)) {
-		pconf_finish(&ctx);
-		fatalx(EXIT_FAILURE, "%s", ctx.errmsg);
-	}
+	if (!sched_readconf(fn))
+		fatalx(EXIT_FAILURE, "Unable to load %s", fn);
 
-	while (pconf_file_next(&ctx)) {
-		if (pconf_parse_error(&ctx)) {
-			upslogx(LOG_ERR, "Parse error: %s:%d: %s",
-				fn, ctx.linenum, ctx.errmsg);
-			continue;
-		}
-
-		if (ctx.numargs < 1)
-			continue;
-
-		if (!conf_arg(ctx.numargs, ctx.arglist)) {
-			unsigned int	i;
-			char	errmsg[SMALLBUF];
-
-			snprintf(errmsg, sizeof(errmsg),
-				"upssched.conf: invalid directive");
+	if (!sched_conf->at)
+		return;
 
-			for (i = 0; i < ctx.numargs; i++)
-				snprintfcat(errmsg, sizeof(errmsg), " %s",
-					ctx.arglist[i]);
+	/* complain both ways in case we don't have a tty */
 
-			upslogx(LOG_WARNING, "%s", errmsg);
-		}
+	if (!sched_conf->pipefn) {
+		printf("PIPEFN must be set in the config file!\n");
+		fatalx(EXIT_FAILURE, "PIPEFN must be set in the config file!");
 	}
 
-	pconf_finish(&ctx);
+	if (!sched_conf->lockfn) {
+		printf("LOCKFN must be set in the config file!\n");
+		fatalx(EXIT_FAILURE, "LOCKFN must be set in the config file!");
+	}
 }
 
 int main(int argc, char **argv)
 {
 	const char	*prog = xbasename(argv[0]);
 
-	verbose = 1;		/* TODO: remove when done testing */
+	sched_verbose = 1;	/* TODO: remove when done testing */
+	sched_exec = exec_cmd;
 
 	/* normally we don't have stderr, so get this going to syslog early */
 	open_syslog(prog);
@@ -925,8 +743,10 @@ int main(int argc, char **argv)
 		exit(EXIT_FAILURE);
 	}
 
-	/* see if this matches anything in the config file */
 	checkconf();
 
+	/* see if this matches anything in the config file */
+	sched_event(upsname, notify_type, client_action);
+
 	exit(EXIT_SUCCESS);
 }
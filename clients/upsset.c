@@ -48,6 +48,9 @@ static	int	port;
 static	char	*upsname, *hostname;
 static	UPSCONN_t	ups;
 
+	/* the commands or settings the UPS has, while the page is made */
+static	struct	list_t	*lhead = NULL;
+
 typedef struct {
 	char	*var;
 	char	*value;
@@ -56,11 +59,13 @@ typedef struct {
 
 	uvtype_t	*firstuv = NULL;
 
+	/* how many of them */
+static	int	upsvc = 0;
+
 void parsearg(char *var, char *value)
 {
 	char	*ptr;
 	uvtype_t	*last, *tmp = NULL;
-	static	int upsvc = 0;
 
 	/* store variables from a SET command for the later commit */
 	if (!strncmp(var, "UPSVAR_", 7)) {
@@ -127,6 +132,20 @@ void parsearg(char *var, char *value)
 	}
 }
 
+static void free_list(void)
+{
+	struct	list_t	*ltmp, *lnext;
+
+	for (ltmp = lhead; ltmp != NULL; ltmp = lnext) {
+		lnext = ltmp->next;
+
+		free(ltmp->name);
+		free(ltmp);
+	}
+
+	lhead = NULL;
+}
+
 static void do_header(const char *title)
 {
 	printf("<!DOCTYPE HTML PUBLIC \"-//W3C//DTD HTML 4.0 Transitional//EN\"\n");
@@ -279,7 +298,7 @@ static void error_page(const char *next, const char *title,
 	printf("</BODY></HTML>\n");
 
 	upscli_disconnect(&ups);
-	exit(EXIT_SUCCESS);
+	cgi_exit(EXIT_SUCCESS);
 }
 
 static void loginscreen(void)
@@ -308,7 +327,7 @@ static void loginscreen(void)
 	printf("</BODY></HTML>\n");
 
 	upscli_disconnect(&ups);
-	exit(EXIT_SUCCESS);
+	cgi_exit(EXIT_SUCCESS);
 }
 
 /* try to connect to upsd - generate an error page if it fails */
@@ -357,7 +376,7 @@ static void showcmds(void)
 	unsigned int	numq, numa;
 	const	char	*query[2];
 	char	**answer;
-	struct	list_t	*lhead, *llast, *ltmp, *lnext;
+	struct	list_t	*llast, *ltmp;
 	char	*desc;
 
 	if (!checkhost(monups, &desc))
@@ -366,7 +385,8 @@ static void showcmds(void)
 
 	upsd_connect();
 
-	llast = lhead = NULL;
+	free_list();
+	llast = NULL;
 
 	query[0] = "CMD";
 	query[1] = upsname;
@@ -432,17 +452,10 @@ static void showcmds(void)
 	/* provide a dummy do-nothing default choice */
 	printf("<OPTION VALUE=\"\" SELECTED></OPTION>\n");
 
-	ltmp = lhead;
-
-	while (ltmp) {
-		lnext = ltmp->next;
-
+	for (ltmp = lhead; ltmp != NULL; ltmp = ltmp->next)
 		print_cmd(ltmp->name);
 
-		free(ltmp->name);
-		free(ltmp);
-		ltmp = lnext;
-	}
+	free_list();
 
 	printf("</SELECT>\n");
 	printf("</TD></TR>\n");
@@ -465,7 +478,7 @@ static void showcmds(void)
 	printf("</BODY></HTML>\n");
 
 	upscli_disconnect(&ups);
-	exit(EXIT_SUCCESS);
+	cgi_exit(EXIT_SUCCESS);
 }	
 
 /* handle setting authentication data in the server */
@@ -548,7 +561,7 @@ static void docmd(void)
 		printf("</BODY></HTML>\n");
 
 		upscli_disconnect(&ups);
-		exit(EXIT_SUCCESS);
+		cgi_exit(EXIT_SUCCESS);
 	}
 
 	if (upscli_readline(&ups, buf, sizeof(buf)) < 0) {
@@ -569,7 +582,7 @@ static void docmd(void)
 		printf("</BODY></HTML>\n");
 
 		upscli_disconnect(&ups);
-		exit(EXIT_SUCCESS);
+		cgi_exit(EXIT_SUCCESS);
 	}
 
 	do_header("Issuing command");
@@ -589,7 +602,7 @@ static void docmd(void)
 	printf("</BODY></HTML>\n");
 
 	upscli_disconnect(&ups);
-	exit(EXIT_SUCCESS);
+	cgi_exit(EXIT_SUCCESS);
 }
 
 static const char *get_data(const char *type, const char *varname)
@@ -771,7 +784,7 @@ static void showsettings(void)
 	unsigned int	numq, numa;
 	const	char	*query[2];
 	char	**answer, *desc = NULL;
-	struct	list_t	*lhead, *llast, *ltmp, *lnext;
+	struct	list_t	*llast, *ltmp;
 
 	if (!checkhost(monups, &desc))
 		error_page("showsettings", "Access denied",
@@ -795,7 +808,8 @@ static void showsettings(void)
 		/* NOTREACHED */
 	}
 
-	llast = lhead = NULL;
+	free_list();
+	llast = NULL;
 
 	ret = upscli_list_next(&ups, numq, query, &numa, &answer);
 
@@ -832,17 +846,10 @@ static void showsettings(void)
 
 	/* use the list to get descriptions and types */
 
-	ltmp = lhead;
-
-	while (ltmp) {
-		lnext = ltmp->next;
-
+	for (ltmp = lhead; ltmp != NULL; ltmp = ltmp->next)
 		print_rw(upsname, ltmp->name);
 
-		free(ltmp->name);
-		free(ltmp);
-		ltmp = lnext;
-	}
+	free_list();
 
 	printf("<TR BGCOLOR=\"#60B0B0\">\n");
 	printf("<TD COLSPAN=\"2\" ALIGN=\"CENTER\">\n");
@@ -862,7 +869,7 @@ static void showsettings(void)
 	printf("</BODY></HTML>\n");
 
 	upscli_disconnect(&ups);
-	exit(EXIT_SUCCESS);
+	cgi_exit(EXIT_SUCCESS);
 }
 
 static int setvar(const char *var, const char *val)
@@ -950,7 +957,7 @@ static void savesettings(void)
 	printf("</BODY></HTML>\n");
 
 	upscli_disconnect(&ups);
-	exit(EXIT_SUCCESS);
+	cgi_exit(EXIT_SUCCESS);
 }
 
 static void initial_pickups(void)
@@ -967,7 +974,7 @@ static void initial_pickups(void)
 	printf("</BODY></HTML>\n");
 
 	upscli_disconnect(&ups);
-	exit(EXIT_SUCCESS);
+	cgi_exit(EXIT_SUCCESS);
 }
 
 static void upsset_conf_err(const char *errmsg)
@@ -995,7 +1002,7 @@ static void check_conf(void)
 
 		/* leave something in the httpd log for the admin */
 		fprintf(stderr, "upsset.conf does not exist to permit execution\n");
-		exit(EXIT_FAILURE);
+		cgi_exit(EXIT_FAILURE);
 	}
 
 	while (pconf_file_next(&ctx)) {
@@ -1026,12 +1033,46 @@ static void check_conf(void)
 	/* leave something in the httpd log for the admin */
 	fprintf(stderr, "upsset.conf does not permit execution\n");
 
-	exit(EXIT_FAILURE);
+	cgi_exit(EXIT_FAILURE);
 }	
 
-int main(int argc, char **argv)
+/* forget what the request set, and hang up on its upsd - also run by
+ * cgilib after each FastCGI request, even one that ended in cgi_exit() */
+static void reset_request(void)
 {
-	username = password = function = monups = NULL;
+	uvtype_t	*tmp, *next;
+
+	upscli_disconnect(&ups);
+	free_list();
+
+	free(username);
+	free(password);
+	free(function);
+	free(monups);
+	free(upscommand);
+	username = password = function = monups = upscommand = NULL;
+
+	free(upsname);
+	free(hostname);
+	upsname = hostname = NULL;
+
+	for (tmp = firstuv; tmp != NULL; tmp = next) {
+		next = tmp->next;
+
+		free(tmp->var);
+		free(tmp->value);
+		free(tmp);
+	}
+
+	firstuv = NULL;
+	upsvc = 0;
+
+	magic_string_set = 0;
+}
+
+static void upsset(void)
+{
+	reset_request();
 
 	printf("Content-type: text/html\n\n");
 
@@ -1074,6 +1115,11 @@ int main(int argc, char **argv)
 		docmd();
 
 	printf("Error: Unhandled function name [%s]\n", function);
-	
+}
+
+int main(int argc, char **argv)
+{
+	cgi_main(upsset, reset_request);
+
 	return 0;
 }
@@ -38,16 +38,28 @@ static char	*monhostdesc = NULL;
 
 static int	port;
 static char	*upsname, *hostname;
-static char	*upsimgpath="upsimage.cgi", *upsstatpath="upsstats.cgi";
-static UPSCONN_t	ups;
+static char	*upsimgpath = NULL, *upsstatpath = NULL;
+static UPSCONN_t	*ups = NULL;
 
-static FILE	*tf;
-static long	forofs = 0;
+	/* the template line being read, and where FOREACHUPS was */
+static size_t	tline = 0, forofs = 0;
 
 static ulist_t	*ulhead = NULL, *currups = NULL;
 
 static int	skip_clause = 0, skip_block = 0;
 
+	/* kept from one FastCGI request to the next */
+static ulist_t	*hosts = NULL;
+static struct stat	hostsst;
+static conn_t	*connhead = NULL, *currconn = NULL;
+static template_t	*templates = NULL;
+static unsigned int	reqnum = 0;
+
+	/* the variables of currups, from one LIST VAR */
+static char	**snapvar = NULL, **snapval = NULL;
+static size_t	numsnap = 0;
+static int	snapstate = 0;		/* 1: listed, -1: failed */
+
 void parsearg(char *var, char *value)
 {
 	/* avoid bogus junk from evil people */
@@ -71,16 +83,16 @@ void parsearg(char *var, char *value)
 
 static void report_error(void)
 {
-	if (upscli_upserror(&ups) == UPSCLI_ERR_VARNOTSUPP)
+	if (upscli_upserror(ups) == UPSCLI_ERR_VARNOTSUPP)
 		printf("Not supported\n");
 	else
-		printf("[error: %s]\n", upscli_strerror(&ups));
+		printf("[error: %s]\n", upscli_strerror(ups));
 }
 
 /* make sure we're actually connected to upsd */
 static int check_ups_fd(int do_report)
 {
-	if (upscli_fd(&ups) == -1) {
+	if (upscli_fd(ups) == -1) {
 		if (do_report)
 			report_error();
 
@@ -100,46 +112,121 @@ static int check_ups_fd(int do_report)
 	return 1;
 }
 
-static int get_var(const char *var, char *buf, size_t buflen, int verbose)
+static void free_vars(void)
+{
+	size_t	i;
+
+	for (i = 0; i < numsnap; i++) {
+		free(snapvar[i]);
+		free(snapval[i]);
+	}
+
+	free(snapvar);
+	free(snapval);
+
+	snapvar = snapval = NULL;
+	numsnap = 0;
+	snapstate = 0;
+}
+
+static int list_vars(void)
 {
 	int	ret;
 	unsigned int	numq, numa;
 	const	char	*query[4];
 	char	**answer;
 
-	if (!check_ups_fd(1))
+	query[0] = "VAR";
+	query[1] = upsname;
+	numq = 2;
+
+	if (upscli_list_start(ups, numq, query) < 0)
 		return 0;
 
-	if (!upsname) {
-		if (verbose)
-			printf("[No UPS name specified]\n");
+	while ((ret = upscli_list_next(ups, numq, query, &numa, &answer)) == 1) {
 
-		return 0;
+		/* VAR <upsname> <varname> <val> */
+		if (numa < 4)
+			continue;
+
+		snapvar = xrealloc(snapvar, (numsnap + 1) * sizeof(*snapvar));
+		snapval = xrealloc(snapval, (numsnap + 1) * sizeof(*snapval));
+
+		snapvar[numsnap] = xstrdup(answer[2]);
+		snapval[numsnap] = xstrdup(answer[3]);
+		numsnap++;
 	}
 
-	query[0] = "VAR";
-	query[1] = upsname;
-	query[2] = var;
+	return (ret == 0);
+}
+
+static void conn_open(conn_t *conn)
+{
+	conn->reqnum = reqnum;
+
+	upscli_disconnect(&conn->ups);
 
-	numq = 3;
+	if (upscli_connect(&conn->ups, conn->hostname, conn->port, 0) < 0)
+		fprintf(stderr, "UPS [%s]: can't connect to server: %s\n", currups->sys, upscli_strerror(&conn->ups));
+}
+
+/* get all the variables of the UPS at once, for the rest of the page */
+static int load_vars(int verbose)
+{
+	int	err;
 
-	ret = upscli_get(&ups, numq, query, &numa, &answer);
+	if (snapstate == 0) {
+		snapstate = list_vars() ? 1 : -1;
+		err = upscli_upserror(ups);
+
+		/* upsd may have dropped a connection from an earlier request */
+		if ((snapstate < 0) && (currconn->reqnum != reqnum)
+			&& ((err == UPSCLI_ERR_READ) || (err == UPSCLI_ERR_WRITE)
+			|| (err == UPSCLI_ERR_SRVDISC) || (err == UPSCLI_ERR_SSLERR))) {
+
+			free_vars();
+			conn_open(currconn);
+			snapstate = list_vars() ? 1 : -1;
+		}
+	}
 
-	if (ret < 0) {
+	if (snapstate < 0) {
 		if (verbose)
 			report_error();
 		return 0;
 	}
 
-	if (numa < numq) {
+	return 1;
+}
+
+static int get_var(const char *var, char *buf, size_t buflen, int verbose)
+{
+	size_t	i;
+
+	if (!check_ups_fd(1))
+		return 0;
+
+	if (!upsname) {
 		if (verbose)
-			printf("[Invalid response]\n");
-		
+			printf("[No UPS name specified]\n");
+
 		return 0;
 	}
 
-	snprintf(buf, buflen, "%s", answer[3]);
-	return 1;
+	if (!load_vars(verbose))
+		return 0;
+
+	for (i = 0; i < numsnap; i++) {
+		if (!strcmp(snapvar[i], var)) {
+			snprintf(buf, buflen, "%s", snapval[i]);
+			return 1;
+		}
+	}
+
+	if (verbose)
+		printf("Not supported\n");
+
+	return 0;
 }
 
 static void parse_var(const char *var)
@@ -345,61 +432,42 @@ static int do_img(char *buf)
 	return 0;
 }
 
+/* switch to currups, on a connection to its upsd from earlier if there's one */
 static void ups_connect(void)
 {
-	static ulist_t	*lastups = NULL;
-	char	*newups, *newhost;
-	int	newport;
-
-	/* try to minimize reconnects */
-	if (lastups) {
-
-		/* don't reconnect if these are both the same UPS */
-		if (!strcmp(lastups->sys, currups->sys)) {
-			lastups = currups;
-			return;
-		}
-
-		/* see if it's just on the same host */
-		newups = newhost = NULL;
+	conn_t	*conn;
 
-		if (upscli_splitname(currups->sys, &newups, &newhost, 
-			&newport) != 0) {
-			printf("Unusable UPS definition [%s]\n", currups->sys);
-			fprintf(stderr, "Unusable UPS definition [%s]\n", 
-				currups->sys);
-			exit(EXIT_FAILURE);
-		}		
-
-		if ((!strcmp(newhost, hostname)) && (port == newport)) {
-			free(upsname);
-			upsname = newups;
-
-			free(newhost);
-			lastups = currups;
-			return;
-		}
-
-		/* not the same upsd, so disconnect */
-		free(newups);
-		free(newhost);
-	}
-
-	upscli_disconnect(&ups);
+	free_vars();
 
 	free(upsname);
 	free(hostname);
+	upsname = hostname = NULL;
 
 	if (upscli_splitname(currups->sys, &upsname, &hostname, &port) != 0) {
 		printf("Unusable UPS definition [%s]\n", currups->sys);
 		fprintf(stderr, "Unusable UPS definition [%s]\n", currups->sys);
-		exit(EXIT_FAILURE);
+		cgi_exit(EXIT_FAILURE);
 	}
 
-	if (upscli_connect(&ups, hostname, port, 0) < 0)
-		fprintf(stderr, "UPS [%s]: can't connect to server: %s\n", currups->sys, upscli_strerror(&ups));
+	for (conn = connhead; conn != NULL; conn = conn->next) {
+		if ((!strcmp(conn->hostname, hostname)) && (conn->port == port))
+			break;
+	}
 
-	lastups = currups;
+	if (!conn) {
+		conn = xcalloc(1, sizeof(*conn));
+		conn->hostname = xstrdup(hostname);
+		conn->port = port;
+		conn->next = connhead;
+		connhead = conn;
+	}
+
+	currconn = conn;
+	ups = &conn->ups;
+
+	/* if upsd is down, only try it once per request */
+	if ((upscli_fd(ups) == -1) && (conn->reqnum != reqnum))
+		conn_open(conn);
 }
 
 static void do_hostlink(void)
@@ -550,14 +618,16 @@ static void do_ifbetween(const char *s)
 static void do_upsstatpath(const char *s) {
 
 	if(strlen(s)) {
-		upsstatpath = strdup(s);
+		free(upsstatpath);
+		upsstatpath = xstrdup(s);
 	}
 }
 
 static void do_upsimgpath(const char *s) {
 
 	if(strlen(s)) {
-		upsimgpath = strdup(s);
+		free(upsimgpath);
+		upsimgpath = xstrdup(s);
 	}
 }
 
@@ -722,7 +792,7 @@ static int do_command(char *cmd)
 	}
 
 	if (!strcmp(cmd, "FOREACHUPS")) {
-		forofs = ftell(tf);
+		forofs = tline;
 
 		currups = ulhead;
 		ups_connect();
@@ -739,7 +809,7 @@ static int do_command(char *cmd)
 		currups = currups->next;
 
 		if (currups) {
-			fseek(tf, forofs, SEEK_SET);
+			tline = forofs;
 			ups_connect();
 		}
 
@@ -840,34 +910,82 @@ static void parse_line(const char *buf)
 	}
 }
 
+/* read a template, unless it hasn't changed since an earlier request */
+static template_t *load_template(const char *fn)
+{
+	char	buf[LARGEBUF];
+	struct	stat	st;
+	template_t	*tmp;
+	FILE	*tf;
+	size_t	i;
+
+	for (tmp = templates; tmp != NULL; tmp = tmp->next) {
+		if (!strcmp(tmp->fn, fn))
+			break;
+	}
+
+	if (stat(fn, &st) != 0)
+		return NULL;
+
+	if ((tmp) && (tmp->st.st_ino == st.st_ino)
+		&& (tmp->st.st_mtime == st.st_mtime) && (tmp->st.st_size == st.st_size))
+		return tmp;
+
+	tf = fopen(fn, "r");
+
+	if (!tf)
+		return NULL;
+
+	if (!tmp) {
+		tmp = xcalloc(1, sizeof(*tmp));
+		tmp->fn = xstrdup(fn);
+		tmp->next = templates;
+		templates = tmp;
+	}
+
+	for (i = 0; i < tmp->numlines; i++)
+		free(tmp->line[i]);
+
+	tmp->numlines = 0;
+
+	while (fgets(buf, sizeof(buf), tf)) {
+		tmp->line = xrealloc(tmp->line, (tmp->numlines + 1) * sizeof(*tmp->line));
+		tmp->line[tmp->numlines++] = xstrdup(buf);
+	}
+
+	fclose(tf);
+
+	tmp->st = st;
+
+	return tmp;
+}
+
 static void display_template(const char *tfn)
 {
-	char	fn[SMALLBUF], buf[LARGEBUF];	
+	char	fn[SMALLBUF];
+	template_t	*tmpl;
 
 	snprintf(fn, sizeof(fn), "%s/%s", confpath(), tfn);
 
-	tf = fopen(fn, "r");
+	tmpl = load_template(fn);
 
-	if (!tf) {
+	if (!tmpl) {
 		fprintf(stderr, "upsstats: Can't open %s: %s\n", fn, strerror(errno));
 
 		printf("Error: can't open template file (%s)\n", tfn);
 
-		exit(EXIT_FAILURE);
+		cgi_exit(EXIT_FAILURE);
 	}
 
-	while (fgets(buf, sizeof(buf), tf)) {
-		parse_line(buf);
-	}
+	forofs = 0;
 
-	fclose(tf);
+	for (tline = 0; tline < tmpl->numlines; )
+		parse_line(tmpl->line[tline++]);
 }
 
 static void display_tree(int verbose)
 {
-	unsigned int	numq, numa;
-	const	char	*query[4];
-	char	**answer;
+	size_t	i;
 
 	if (!upsname) {
 		if (verbose)
@@ -875,15 +993,8 @@ static void display_tree(int verbose)
 		return;
 	}
 
-	query[0] = "VAR";
-	query[1] = upsname;
-	numq = 2;
-
-	if (upscli_list_start(&ups, numq, query) < 0) {
-		if (verbose)
-			report_error();
+	if (!load_vars(verbose))
 		return;
-	}
 
 	printf("<!DOCTYPE HTML PUBLIC \"-//W3C//DTD HTML 4.0 Transitional//EN\"\n");
 	printf("	\"http://www.w3.org/TR/REC-html40/loose.dtd\">\n");
@@ -904,21 +1015,13 @@ static void display_tree(int verbose)
 
 	printf("<TR><TH COLSPAN=3 BGCOLOR=\"#60B0B0\"></TH></TR>\n");
 
-	while (upscli_list_next(&ups, numq, query, &numa, &answer) == 1) {
-
-		/* VAR <upsname> <varname> <val> */
-		if (numa < 4) {
-			if (verbose)
-				printf("[Invalid response]\n");
-		
-			return;
-		}
+	for (i = 0; i < numsnap; i++) {
 
 		printf("<TR BGCOLOR=\"#60B0B0\" ALIGN=\"LEFT\">\n");
 	
-		printf("<TD>%s</TD>\n", answer[2]);
+		printf("<TD>%s</TD>\n", snapvar[i]);
 		printf("<TD>:</TD>\n");
-		printf("<TD>%s<br></TD>\n", answer[3]);
+		printf("<TD>%s<br></TD>\n", snapval[i]);
 
 		printf("</TR>\n");
 	}
@@ -934,7 +1037,7 @@ static void add_ups(char *sys, char *desc)
 {
 	ulist_t	*tmp, *last;
 
-	tmp = last = ulhead;
+	tmp = last = hosts;
 
 	while (tmp) { 
 		last = tmp;
@@ -950,7 +1053,23 @@ static void add_ups(char *sys, char *desc)
 	if (last)
 		last->next = tmp;
 	else
-		ulhead = tmp;
+		hosts = tmp;
+}
+
+static void free_hosts(void)
+{
+	ulist_t	*tmp, *next;
+
+	for (tmp = hosts; tmp != NULL; tmp = next) {
+		next = tmp->next;
+
+		free(tmp->sys);
+		free(tmp->desc);
+		free(tmp);
+	}
+
+	hosts = NULL;
+	memset(&hostsst, 0, sizeof(hostsst));
 }
 
 /* called for fatal errors in parseconf like malloc failures */
@@ -962,10 +1081,18 @@ static void upsstats_hosts_err(const char *errmsg)
 static void load_hosts_conf(void)
 {
 	char	fn[SMALLBUF];
+	struct	stat	st;
 	PCONF_CTX_t	ctx;
 
 	snprintf(fn, sizeof(fn), "%s/hosts.conf", CONFPATH);
 
+	/* still as read by an earlier request? */
+	if ((hosts) && (stat(fn, &st) == 0) && (hostsst.st_ino == st.st_ino)
+		&& (hostsst.st_mtime == st.st_mtime) && (hostsst.st_size == st.st_size))
+		return;
+
+	free_hosts();
+
 	pconf_init(&ctx, upsstats_hosts_err);
 
 	if (!pconf_file_begin(&ctx, fn)) {
@@ -981,7 +1108,7 @@ static void load_hosts_conf(void)
 
 		/* leave something for the admin */
 		fprintf(stderr, "upsstats: %s\n", ctx.errmsg);
-		exit(EXIT_FAILURE);
+		cgi_exit(EXIT_FAILURE);
 	}
 
 	while (pconf_file_next(&ctx)) {
@@ -1002,7 +1129,10 @@ static void load_hosts_conf(void)
 
 	pconf_finish(&ctx);
 
-	if (!ulhead) {
+	if (stat(fn, &st) == 0)
+		hostsst = st;
+
+	if (!hosts) {
 		printf("<!DOCTYPE HTML PUBLIC \"-//W3C//DTD HTML 4.0 Transitional//EN\"\n");
 		printf("	\"http://www.w3.org/TR/REC-html40/loose.dtd\">\n");
 		printf("<HTML><HEAD>\n");
@@ -1013,19 +1143,25 @@ static void load_hosts_conf(void)
 
 		/* leave something for the admin */
 		fprintf(stderr, "upsstats: no hosts to monitor\n");
-		exit(EXIT_FAILURE);
+		cgi_exit(EXIT_FAILURE);
 	}
 }
 
 static void display_single(void)
 {
+	static	ulist_t	single;
+
 	if (!checkhost(monhost, &monhostdesc)) {
 		printf("Access to that host [%s] is not authorized.\n",
 			monhost);
-		exit(EXIT_FAILURE);
+		cgi_exit(EXIT_FAILURE);
 	}
 
-	add_ups(monhost, monhostdesc);
+	single.sys = monhost;
+	single.desc = monhostdesc;
+	single.next = NULL;
+
+	ulhead = &single;
 
 	currups = ulhead;
 	ups_connect();
@@ -1035,12 +1171,40 @@ static void display_single(void)
 		display_tree(1);
 	else
 		display_template("upsstats-single.html");
+}
+
+/* forget what the request set - also run by cgilib after each FastCGI
+ * request, even one that ended in cgi_exit() */
+static void reset_request(void)
+{
+	free(monhost);
+	free(monhostdesc);
+	monhost = monhostdesc = NULL;
+
+	use_celsius = 1;
+	refreshdelay = -1;
+	treemode = 0;
+
+	free(upsimgpath);
+	free(upsstatpath);
+	upsimgpath = xstrdup("upsimage.cgi");
+	upsstatpath = xstrdup("upsstats.cgi");
+
+	ulhead = currups = NULL;
+	currconn = NULL;
+	ups = NULL;
+
+	skip_clause = skip_block = 0;
+
+	free_vars();
 
-	upscli_disconnect(&ups);
+	reqnum++;
 }
 
-int main(int argc, char **argv)
+static void upsstats(void)
 {
+	reset_request();
+
 	extractcgiargs();
 
 	printf("Content-type: text/html\n"); 
@@ -1050,18 +1214,27 @@ int main(int argc, char **argv)
 	/* if a host is specified, use upsstats-single.html instead */
 	if (monhost) {
 		display_single();
-		exit(EXIT_SUCCESS);
+		return;
 	}
 
 	/* default: multimon replacement mode */
 
 	load_hosts_conf();
 
+	ulhead = hosts;
 	currups = ulhead;
 
 	display_template("upsstats.html");
+}
+
+int main(int argc, char **argv)
+{
+	conn_t	*conn;
+
+	cgi_main(upsstats, reset_request);
 
-	upscli_disconnect(&ups);
+	for (conn = connhead; conn != NULL; conn = conn->next)
+		upscli_disconnect(&conn->ups);
 
 	return 0;
 }
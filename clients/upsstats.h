@@ -29,6 +29,24 @@ typedef struct {
 	void	*next;
 }	ulist_t;
 
+/* a connection to upsd, kept from one FastCGI request to the next */
+typedef struct {
+	char	*hostname;
+	int	port;
+	UPSCONN_t	ups;
+	unsigned int	reqnum;		/* of the last connection attempt */
+	void	*next;
+}	conn_t;
+
+/* a template file, read in lines */
+typedef struct {
+	char	*fn;
+	struct	stat	st;		/* to see if it changed */
+	char	**line;
+	size_t	numlines;
+	void	*next;
+}	template_t;
+
 #ifdef __cplusplus
 /* *INDENT-OFF* */
 }
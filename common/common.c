@@ -24,6 +24,7 @@
 #include <pwd.h>
 #include <grp.h>
 #include <dirent.h>
+#include <time.h>
 
 /* the reason we define UPS_VERSION as a static string, rather than a
 	macro, is to make dependency tracking easier (only common.o depends
@@ -689,6 +690,23 @@ int select_write(const int fd, const void *buf, const size_t buflen, const long
 	return write(fd, buf, buflen);
 }
 
+/* Get the current time from a monotonic clock, or from the system
+   clock where there is none. Only differences between such times
+   are meaningful. */
+void monotonic_time(struct timeval *tv)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+	struct timespec	ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0) {
+		tv->tv_sec = ts.tv_sec;
+		tv->tv_usec = ts.tv_nsec / 1000;
+		return;
+	}
+#endif
+	gettimeofday(tv, NULL);
+}
+
 
 /* FIXME: would be good to get more from /etc/ld.so.conf[.d] and/or
  * LD_LIBRARY_PATH and a smarter dependency on build bitness; also
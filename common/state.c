@@ -54,6 +54,15 @@ static void val_escape(st_tree_t *node)
 	node->val = node->safe;
 }
 
+/* parse the value once when it changes, rather than on each use */
+static void val_parse(st_tree_t *node)
+{
+	char	*end;
+
+	node->number = strtod(node->raw, &end);
+	node->isnumber = (end != node->raw) && (*end == '\0');
+}
+
 static void st_tree_enum_free(enum_t *list)
 {
 	if (!list) {
@@ -193,6 +202,7 @@ int state_setinfo(st_tree_t **nptr, const char *var, const char *val)
 		snprintf(node->raw, node->rawsize, "%s", val);
 
 		val_escape(node);
+		val_parse(node);
 
 		return 1;	/* changed */
 	}
@@ -204,6 +214,7 @@ int state_setinfo(st_tree_t **nptr, const char *var, const char *val)
 	(*nptr)->rawsize = strlen(val) + 1;
 
 	val_escape(*nptr);
+	val_parse(*nptr);
 
 	return 1;	/* added */
 }
@@ -354,6 +365,22 @@ int state_getflags(st_tree_t *root, const char *var)
 	return sttmp->flags;
 }
 
+/* return 1 and the value of var in number, if var holds a number */
+int state_getnumber(st_tree_t *root, const char *var, double *number)
+{
+	st_tree_t	*sttmp;
+
+	/* find the tree node for var */
+	sttmp = state_tree_find(root, var);
+
+	if ((!sttmp) || (!sttmp->isnumber) || (sttmp->flags & ST_FLAG_STRING)) {
+		return 0;
+	}
+
+	*number = sttmp->number;
+	return 1;
+}
+
 int state_getaux(st_tree_t *root, const char *var)
 {
 	st_tree_t	*sttmp;
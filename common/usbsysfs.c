@@ -0,0 +1,216 @@
+/* usbsysfs.c - USB device identification from the kernel cache (sysfs)
+ *
+ * Copyright (C)
+ *   2026 Network UPS Tools developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include "common.h"
+
+#include <dirent.h>
+
+#include "usbsysfs.h"
+
+#define USBSYSFS_PATH	"/sys/bus/usb/devices"
+
+static usbsysfs_device_t	*usbsysfs_head = NULL;
+static int	usbsysfs_scanned = 0;
+
+#ifdef __linux__
+
+/* Read the first line of attribute *attr* of device *name*: return 1 on success, 0 otherwise */
+static int usbsysfs_read_attr(const char *name, const char *attr, char *buf, size_t buflen)
+{
+	char	fn[SMALLBUF];
+	FILE	*f;
+
+	snprintf(fn, sizeof(fn), "%s/%s/%s", USBSYSFS_PATH, name, attr);
+
+	f = fopen(fn, "r");
+
+	if (!f) {
+		return 0;
+	}
+
+	if (!fgets(buf, buflen, f)) {
+		buf[0] = '\0';
+		fclose(f);
+		return 0;
+	}
+
+	fclose(f);
+
+	buf[strcspn(buf, "\n")] = '\0';
+
+	return 1;
+}
+
+/* Same as above, for hexadecimal (idVendor, idProduct, bcdDevice) and decimal (busnum, devnum) values */
+static int usbsysfs_read_num(const char *name, const char *attr, int base, unsigned int *val)
+{
+	char	buf[SMALLBUF], *end;
+
+	if (!usbsysfs_read_attr(name, attr, buf, sizeof(buf))) {
+		return 0;
+	}
+
+	*val = strtoul(buf, &end, base);
+
+	return (end != buf);
+}
+
+const usbsysfs_device_t	*usbsysfs_scan(void)
+{
+	DIR		*dp;
+	struct dirent	*dirp;
+	usbsysfs_device_t	*dev, *last = NULL;
+	unsigned int	busnum, devnum;
+	size_t	len;
+
+	if (usbsysfs_scanned) {
+		return usbsysfs_head;
+	}
+
+	usbsysfs_scanned = 1;
+
+	dp = opendir(USBSYSFS_PATH);
+
+	if (!dp) {
+		upsdebug_with_errno(3, "%s: can't open %s", __func__, USBSYSFS_PATH);
+		return NULL;
+	}
+
+	while ((dirp = readdir(dp)) != NULL) {
+
+		/* Only devices (e.g. "3-1.2", "usb3"), not interfaces ("3-1.2:1.0") */
+		if (dirp->d_name[0] == '.' || strchr(dirp->d_name, ':')) {
+			continue;
+		}
+
+		if (!usbsysfs_read_num(dirp->d_name, "busnum", 10, &busnum) ||
+			!usbsysfs_read_num(dirp->d_name, "devnum", 10, &devnum)) {
+			continue;
+		}
+
+		/* Can't be a port path, and wouldn't fit */
+		len = strlen(dirp->d_name);
+
+		if (len >= sizeof(dev->Port)) {
+			continue;
+		}
+
+		dev = xcalloc(1, sizeof(*dev));
+
+		dev->busnum = busnum;
+		dev->devnum = devnum;
+		memcpy(dev->Port, dirp->d_name, len + 1);
+
+		usbsysfs_read_num(dirp->d_name, "idVendor", 16, &dev->VendorID);
+		usbsysfs_read_num(dirp->d_name, "idProduct", 16, &dev->ProductID);
+		usbsysfs_read_num(dirp->d_name, "bcdDevice", 16, &dev->bcdDevice);
+
+		usbsysfs_read_attr(dirp->d_name, "manufacturer", dev->Vendor, sizeof(dev->Vendor));
+		usbsysfs_read_attr(dirp->d_name, "product", dev->Product, sizeof(dev->Product));
+		usbsysfs_read_attr(dirp->d_name, "serial", dev->Serial, sizeof(dev->Serial));
+
+		upsdebugx(4, "%s: %03d/%03d (%s) %04x:%04x", __func__, dev->busnum, dev->devnum, dev->Port, dev->VendorID, dev->ProductID);
+
+		if (last) {
+			last->next = dev;
+		} else {
+			usbsysfs_head = dev;
+		}
+
+		last = dev;
+	}
+
+	closedir(dp);
+
+	return usbsysfs_head;
+}
+
+#else	/* !__linux__ */
+
+const usbsysfs_device_t	*usbsysfs_scan(void)
+{
+	usbsysfs_scanned = 1;
+
+	return NULL;
+}
+
+#endif	/* __linux__ */
+
+const usbsysfs_device_t	*usbsysfs_find(int busnum, int devnum)
+{
+	const usbsysfs_device_t	*dev;
+
+	for (dev = usbsysfs_scan(); dev; dev = dev->next) {
+
+		if ((dev->busnum == busnum) && (dev->devnum == devnum)) {
+			return dev;
+		}
+	}
+
+	return NULL;
+}
+
+const usbsysfs_device_t	*usbsysfs_find_port(const char *port)
+{
+	const usbsysfs_device_t	*dev;
+
+	if (!port) {
+		return NULL;
+	}
+
+	for (dev = usbsysfs_scan(); dev; dev = dev->next) {
+
+		if (!strcmp(dev->Port, port)) {
+			return dev;
+		}
+	}
+
+	return NULL;
+}
+
+int	usbsysfs_complete(const usbsysfs_device_t *dev, unsigned int VendorID,
+		unsigned int ProductID, int iManufacturer, int iProduct, int iSerialNumber)
+{
+	if ((dev->VendorID != VendorID) || (dev->ProductID != ProductID)) {
+		return 0;
+	}
+
+	if ((iManufacturer && !dev->Vendor[0]) ||
+		(iProduct && !dev->Product[0]) ||
+		(iSerialNumber && !dev->Serial[0])) {
+		return 0;
+	}
+
+	return 1;
+}
+
+void	usbsysfs_flush(void)
+{
+	usbsysfs_device_t	*dev, *next;
+
+	for (dev = usbsysfs_head; dev; dev = next) {
+		next = dev->next;
+		free(dev);
+	}
+
+	usbsysfs_head = NULL;
+	usbsysfs_scanned = 0;
+}
@@ -635,7 +635,7 @@ static int apc_write_rep_i(unsigned char code, const char *fn, unsigned int ln)
 		errno = ECANCELED;
 		return -1;
 	}
-	usleep(1300000);
+	ser_delay(1300000);
 
 	ret = apc_write_i(code, fn, ln);
 	if (ret >= 0)
@@ -1461,7 +1461,7 @@ static int sdcmd_CS(const void *foo)
 		if (ret < 0) {
 			return STAT_INSTCMD_FAILED;
 		}
-		usleep(cshd);
+		ser_delay(cshd);
 	}
 	/* continue with regular soft hibernate */
 	return sdcmd_S((void *)1);
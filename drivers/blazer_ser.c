@@ -180,7 +180,7 @@ void upsdrv_initups(void)
 	/*
 	 * Allow some time to settle for the cablepower
 	 */
-	usleep(100000);
+	ser_delay(100000);
 #endif
 	blazer_initups();
 }
@@ -40,6 +40,23 @@
 	static conn_t	*connhead = NULL;
 	static cmdlist_t *cmdhead = NULL;
 
+	/* nesting level of dstate_wait_fd(), and connection whose request is being handled */
+	static int	wait_depth = 0;
+	static conn_t	*conn_active = NULL;
+
+	/* while > 0, closed connections are kept around (see sock_reap()) */
+	static int	conn_hold = 0;
+
+	/* INSTCMD/SET requests received while the driver was busy talking to the device */
+	typedef struct deferred_s {
+		conn_t	*conn;
+		int	numarg;
+		char	**arg;
+		struct deferred_s	*next;
+	} deferred_t;
+
+	static deferred_t	*deferred_head = NULL;
+
 	struct ups_handler	upsh;
 
 /* this may be a frequent stumbling point for new users, so be verbose here */
@@ -142,7 +159,17 @@ static int sock_open(const char *fn)
 
 static void sock_disconnect(conn_t *conn)
 {
+	if (conn->fd < 0) {
+		return;	/* already gone */
+	}
+
 	close(conn->fd);
+	conn->fd = -1;
+
+	/* callers up the stack may still hold this one: sock_reap() will free it */
+	if (conn_hold > 0) {
+		return;
+	}
 
 	pconf_finish(&conn->ctx);
 
@@ -182,6 +209,10 @@ static void send_to_all(const char *fmt, ...)
 	for (conn = connhead; conn; conn = cnext) {
 		cnext = conn->next;
 
+		if (conn->fd < 0) {
+			continue;
+		}
+
 		ret = write(conn->fd, buf, strlen(buf));
 
 		if (ret != (int)strlen(buf)) {
@@ -363,6 +394,34 @@ static void send_tracking(conn_t *conn, const char *id, int value)
 	send_to_one(conn, "TRACKING %s %i\n", id, value);
 }
 
+/* queue a request, to be handled by the next dstate_poll_fds() */
+static void sock_defer(conn_t *conn, int numarg, char **arg)
+{
+	int		i;
+	deferred_t	*tmp, *last = NULL;
+
+	upsdebugx(2, "%s: %s %s deferred until device I/O completes", __func__, arg[0], arg[1]);
+
+	for (tmp = deferred_head; tmp; tmp = tmp->next) {
+		last = tmp;
+	}
+
+	tmp = xcalloc(1, sizeof(*tmp));
+	tmp->conn = conn;
+	tmp->numarg = numarg;
+	tmp->arg = xcalloc(numarg, sizeof(*tmp->arg));
+
+	for (i = 0; i < numarg; i++) {
+		tmp->arg[i] = xstrdup(arg[i]);
+	}
+
+	if (last) {
+		last->next = tmp;
+	} else {
+		deferred_head = tmp;
+	}
+}
+
 static int sock_arg(conn_t *conn, int numarg, char **arg)
 {
 	if (numarg < 1) {
@@ -401,6 +460,12 @@ static int sock_arg(conn_t *conn, int numarg, char **arg)
 		return 0;
 	}
 
+	/* these need the device: don't interleave them with a pending exchange */
+	if (wait_depth > 0 && (!strcasecmp(arg[0], "INSTCMD") || !strcasecmp(arg[0], "SET"))) {
+		sock_defer(conn, numarg, arg);
+		return 1;
+	}
+
 	/* INSTCMD <cmdname> [<cmdparam>] [TRACKING <id>] */
 	if (!strcasecmp(arg[0], "INSTCMD")) {
 		int ret;
@@ -485,6 +550,7 @@ static void sock_read(conn_t *conn)
 {
 	int	i, ret;
 	char	buf[SMALLBUF];
+	conn_t	*prev_active = conn_active;
 
 	ret = read(conn->fd, buf, sizeof(buf));
 
@@ -501,6 +567,15 @@ static void sock_read(conn_t *conn)
 		}
 	}
 
+	/* peer closed the connection */
+	if (ret == 0) {
+		sock_disconnect(conn);
+		return;
+	}
+
+	/* don't read from this one again while its requests are being handled */
+	conn_active = conn;
+
 	for (i = 0; i < ret; i++) {
 
 		switch(pconf_char(&conn->ctx, buf[i]))
@@ -522,9 +597,76 @@ static void sock_read(conn_t *conn)
 
 		default: /* nothing parsed */
 			upslogx(LOG_NOTICE, "Parse error on sock: %s", conn->ctx.errmsg);
+			conn_active = prev_active;
 			return;
 		}
 	}
+
+	conn_active = prev_active;
+}
+
+/* free the connections closed while dstate_wait_fd() was in progress */
+static void sock_reap(void)
+{
+	conn_t	*conn, *cnext;
+
+	for (conn = connhead; conn; conn = cnext) {
+		cnext = conn->next;
+
+		if (conn->fd >= 0) {
+			continue;
+		}
+
+		pconf_finish(&conn->ctx);
+
+		if (conn->prev) {
+			conn->prev->next = conn->next;
+		} else {
+			connhead = conn->next;
+		}
+
+		if (conn->next) {
+			conn->next->prev = conn->prev;
+		}
+
+		free(conn);
+	}
+}
+
+/* handle the requests deferred by dstate_wait_fd(), then the connections it closed */
+static void sock_run_deferred(void)
+{
+	int		i;
+	deferred_t	*tmp, *next;
+
+	/* requests deferred while handling these are left for the next run */
+	tmp = deferred_head;
+	deferred_head = NULL;
+
+	conn_hold++;
+
+	for (; tmp; tmp = next) {
+		next = tmp->next;
+
+		if (tmp->conn->fd >= 0) {
+			sock_arg(tmp->conn, tmp->numarg, tmp->arg);
+		} else {
+			upsdebugx(2, "%s: dropping %s %s, connection closed", __func__, tmp->arg[0], tmp->arg[1]);
+		}
+
+		for (i = 0; i < tmp->numarg; i++) {
+			free(tmp->arg[i]);
+		}
+
+		free(tmp->arg);
+		free(tmp);
+	}
+
+	conn_hold--;
+
+	if (conn_hold == 0) {
+		sock_reap();
+	}
 }
 
 static void sock_close(void)
@@ -579,6 +721,8 @@ int dstate_poll_fds(struct timeval timeout, int extrafd)
 	struct timeval	now;
 	conn_t	*conn, *cnext;
 
+	sock_run_deferred();
+
 	FD_ZERO(&rfds);
 	FD_SET(sockfd, &rfds);
 
@@ -593,6 +737,10 @@ int dstate_poll_fds(struct timeval timeout, int extrafd)
 	}
 
 	for (conn = connhead; conn; conn = conn->next) {
+		if (conn->fd < 0) {
+			continue;
+		}
+
 		FD_SET(conn->fd, &rfds);
 
 		if (conn->fd > maxfd) {
@@ -645,7 +793,7 @@ int dstate_poll_fds(struct timeval timeout, int extrafd)
 	for (conn = connhead; conn; conn = cnext) {
 		cnext = conn->next;
 
-		if (FD_ISSET(conn->fd, &rfds)) {
+		if ((conn->fd >= 0) && FD_ISSET(conn->fd, &rfds)) {
 			sock_read(conn);
 		}
 	}
@@ -658,6 +806,96 @@ int dstate_poll_fds(struct timeval timeout, int extrafd)
 	return overrun;
 }
 
+/* wait until fd (if not -1) is readable or the deadline expires, serving the socket meanwhile */
+int dstate_wait_fd(struct timeval deadline, int fd)
+{
+	int	ret, maxfd, expired;
+	fd_set	rfds;
+	struct timeval	now, timeout;
+	conn_t	*conn, *cnext;
+
+	for (;;) {
+		FD_ZERO(&rfds);
+		maxfd = -1;
+
+		if (fd != -1) {
+			FD_SET(fd, &rfds);
+			maxfd = fd;
+		}
+
+		/* not yet (or no longer) serving: plain wait */
+		if (sockfd != -1) {
+			FD_SET(sockfd, &rfds);
+
+			if (sockfd > maxfd) {
+				maxfd = sockfd;
+			}
+
+			for (conn = connhead; conn; conn = conn->next) {
+				if ((conn->fd < 0) || (conn == conn_active)) {
+					continue;
+				}
+
+				FD_SET(conn->fd, &rfds);
+
+				if (conn->fd > maxfd) {
+					maxfd = conn->fd;
+				}
+			}
+		}
+
+		gettimeofday(&now, NULL);
+
+		timeout.tv_sec = deadline.tv_sec - now.tv_sec;
+		timeout.tv_usec = deadline.tv_usec - now.tv_usec;
+
+		if (timeout.tv_usec < 0) {
+			timeout.tv_sec -= 1;
+			timeout.tv_usec += 1000000;
+		}
+
+		/* no time left: still have a (non blocking) look at fd */
+		expired = (timeout.tv_sec < 0);
+
+		if (expired) {
+			timeout.tv_sec = 0;
+			timeout.tv_usec = 0;
+		}
+
+		ret = select(maxfd + 1, &rfds, NULL, NULL, &timeout);
+
+		if (ret < 1) {
+			return ret;	/* timeout or error (errno is preserved) */
+		}
+
+		if ((sockfd != -1) && (FD_ISSET(sockfd, &rfds))) {
+			sock_connect(sockfd);
+		}
+
+		wait_depth++;
+		conn_hold++;
+
+		for (conn = connhead; conn; conn = cnext) {
+			cnext = conn->next;
+
+			if ((conn->fd >= 0) && (conn != conn_active) && FD_ISSET(conn->fd, &rfds)) {
+				sock_read(conn);
+			}
+		}
+
+		conn_hold--;
+		wait_depth--;
+
+		if ((fd != -1) && (FD_ISSET(fd, &rfds))) {
+			return 1;
+		}
+
+		if (expired) {
+			return 0;
+		}
+	}
+}
+
 int dstate_setinfo(const char *var, const char *fmt, ...)
 {
 	int	ret;
@@ -817,6 +1055,11 @@ const char *dstate_getinfo(const char *var)
 	return state_getinfo(dtree_root, var);
 }
 
+int dstate_getnumber(const char *var, double *number)
+{
+	return state_getnumber(dtree_root, var, number);
+}
+
 void dstate_addcmd(const char *cmdname)
 {
 	int	ret;
@@ -959,23 +1202,19 @@ void status_set(const char *buf)
 void status_commit(void)
 {
 	while (ignorelb) {
-		const char	*val, *low;
-
-		val = dstate_getinfo("battery.charge");
-		low = dstate_getinfo("battery.charge.low");
+		double	val, low;
 
-		if (val && low && (strtol(val, NULL, 10) < strtol(low, NULL, 10))) {
+		if (dstate_getnumber("battery.charge", &val) && dstate_getnumber("battery.charge.low", &low) &&
+			(val < low)) {
 			snprintfcat(status_buf, sizeof(status_buf), " LB");
-			upsdebugx(2, "%s: appending LB flag [charge '%s' below '%s']", __func__, val, low);
+			upsdebugx(2, "%s: appending LB flag [charge '%g' below '%g']", __func__, val, low);
 			break;
 		}
 
-		val = dstate_getinfo("battery.runtime");
-		low = dstate_getinfo("battery.runtime.low");
-
-		if (val && low && (strtol(val, NULL, 10) < strtol(low, NULL, 10))) {
+		if (dstate_getnumber("battery.runtime", &val) && dstate_getnumber("battery.runtime.low", &low) &&
+			(val < low)) {
 			snprintfcat(status_buf, sizeof(status_buf), " LB");
-			upsdebugx(2, "%s: appending LB flag [runtime '%s' below '%s']", __func__, val, low);
+			upsdebugx(2, "%s: appending LB flag [runtime '%g' below '%g']", __func__, val, low);
 			break;
 		}
 
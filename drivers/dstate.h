@@ -52,6 +52,10 @@ typedef struct conn_s {
 
 void dstate_init(const char *prog, const char *devname);
 int dstate_poll_fds(struct timeval timeout, int extrafd);
+/* wait for fd (or just until the deadline, if -1) while still serving the
+ * driver socket; INSTCMD and SET requests are deferred to dstate_poll_fds().
+ * returns > 0 if fd is readable, 0 on timeout and < 0 on error */
+int dstate_wait_fd(struct timeval deadline, int fd);
 int dstate_setinfo(const char *var, const char *fmt, ...)
 	__attribute__ ((__format__ (__printf__, 2, 3)));
 int dstate_addenum(const char *var, const char *fmt, ...)
@@ -62,6 +66,7 @@ void dstate_addflags(const char *var, const int addflags);
 void dstate_delflags(const char *var, const int delflags);
 void dstate_setaux(const char *var, int aux);
 const char *dstate_getinfo(const char *var);
+int dstate_getnumber(const char *var, double *number);
 void dstate_addcmd(const char *cmdname);
 int dstate_delinfo(const char *var);
 int dstate_delenum(const char *var, const char *val);
@@ -75,15 +75,10 @@ int unsigned interrupt_size = 0;
 
 void free_report_buffer(reportbuf_t *rbuf)
 {
-	int i;
-
 	if (!rbuf)
 		return;
 
-	for (i=0; i<256; i++) {
-		free(rbuf->data[i]);
-	}
-
+	free(rbuf->arena);
 	free(rbuf);
 }
 
@@ -104,34 +99,50 @@ reportbuf_t *new_report_buffer(HIDDesc_t *pDesc)
 		return NULL;
 	}
 
-	/* now go through all items that are part of this report */
+	/* first, find out which reports are used by the items */
 	for (i=0; i<pDesc->nitems; i++) {
 
 		pData = &pDesc->item[i];
 
 		id = pData->ReportID;
 
-		/* skip reports that already have been allocated */
-		if (rbuf->data[id])
-			continue;
-
 		/* first byte holds id */
 		rbuf->len[id] = pDesc->replen[id] + 1;
+	}
+
+	/* then lay them out in the arena, in report id order */
+	for (id=0; id<256; id++) {
 
-		/* skip zero length reports */
+		/* skip unused and zero length reports */
 		if (rbuf->len[id] < 1) {
+			rbuf->len[id] = 0;
 			continue;
 		}
 
-		rbuf->data[id] = calloc(rbuf->len[id], sizeof(*(rbuf->data[id])));
-		if (rbuf->data[id])
-			continue;
+		if (rbuf->size + rbuf->len[id] > UINT16_MAX) {
+			upsdebugx(1, "%s: report buffer too large", __func__);
+			free(rbuf);
+			errno = EFBIG;
+			return NULL;
+		}
 
-		/* on failure, give up what we got so far */
-		free_report_buffer(rbuf);
+		rbuf->offset[id] = rbuf->size;
+		rbuf->size += rbuf->len[id];
+
+		if (rbuf->len[id] > rbuf->maxlen) {
+			rbuf->maxlen = rbuf->len[id];
+		}
+	}
+
+	/* one allocation for all of them (and the scratch space) */
+	rbuf->arena = calloc(rbuf->size + rbuf->maxlen, sizeof(*(rbuf->arena)));
+	if (!rbuf->arena) {
+		free(rbuf);
 		return NULL;
 	}
 
+	upsdebugx(3, "%s: %d bytes for all the reports (largest one: %d bytes)", __func__, rbuf->size, rbuf->maxlen);
+
 	return rbuf;
 }
 
@@ -152,14 +163,27 @@ static int refresh_report_buffer(reportbuf_t *rbuf, hid_dev_handle_t udev, HIDDa
 	int	id = pData->ReportID;
 	int	r;
 
+	unsigned char	*data = REPORT_DATA(rbuf, id);
+
 	if (interrupt_only || rbuf->ts[id] + age > time(NULL)) {
 		/* buffered report is still good; nothing to do */
-		upsdebug_hex(3, "Report[buf]", rbuf->data[id], rbuf->len[id]);
+		upsdebug_hex(3, "Report[buf]", data, rbuf->len[id]);
 		return 0;
 	}
 
-	r = comm_driver->get_report(udev, id, rbuf->data[id],
-		max_report_size ? (int)sizeof(rbuf->data[id]):rbuf->len[id]);
+	if (max_report_size) {
+		/* read as much as the largest report into the scratch space,
+		   then keep what fits */
+		unsigned char	*scratch = rbuf->arena + rbuf->size;
+
+		r = comm_driver->get_report(udev, id, scratch, rbuf->maxlen);
+
+		if (r > 0) {
+			memcpy(data, scratch, (r < rbuf->len[id]) ? r : rbuf->len[id]);
+		}
+	} else {
+		r = comm_driver->get_report(udev, id, data, rbuf->len[id]);
+	}
 
 	if (r <= 0) {
 		return -1;
@@ -167,9 +191,9 @@ static int refresh_report_buffer(reportbuf_t *rbuf, hid_dev_handle_t udev, HIDDa
 
 	if (rbuf->len[id] != r) {
 		upsdebugx(2, "%s: expected %d bytes, but got %d instead", __func__, rbuf->len[id], r);
-		upsdebug_hex(3, "Report[err]", rbuf->data[id], r);
+		upsdebug_hex(3, "Report[err]", data, (r < rbuf->len[id]) ? r : rbuf->len[id]);
 	} else {
-		upsdebug_hex(3, "Report[get]", rbuf->data[id], rbuf->len[id]);
+		upsdebug_hex(3, "Report[get]", data, rbuf->len[id]);
 	}
 
 	/* have (valid) report */
@@ -192,34 +216,84 @@ static int get_item_buffered(reportbuf_t *rbuf, hid_dev_handle_t udev, HIDData_t
 		return -1;
 	}
 
-	GetValue(rbuf->data[id], pData, Value);
+	GetValue(REPORT_DATA(rbuf, id), pData, Value);
 
 	return 0;
 }
 
-/* set the logical value for the given pData. No physical to logical
-   conversion is performed. On success, return 0, and failure, return
-   -1 and set errno. The updated value is sent to the device. */
-static int set_item_buffered(reportbuf_t *rbuf, hid_dev_handle_t udev, HIDData_t *pData, long Value)
+/* stage the logical value for the given pData. No physical to logical
+   conversion is performed. The value is only stored in the buffered
+   report, and the report id is queued for the next flush_staged_buffered()
+   call, so that several items of the same report are sent at once. */
+static void stage_item_buffered(reportbuf_t *rbuf, HIDData_t *pData, long Value)
 {
 	int id = pData->ReportID;
-	int r;
+	int i;
 
-	SetValue(pData, rbuf->data[id], Value);
+	SetValue(pData, REPORT_DATA(rbuf, id), Value);
 
-	r = comm_driver->set_report(udev, id, rbuf->data[id], rbuf->len[id]);
-	if (r <= 0) {
-		return -1;
+	for (i = 0; i < rbuf->nstaged; i++) {
+		if (rbuf->staged[i] == id) {
+			return;
+		}
+	}
+
+	rbuf->staged[rbuf->nstaged++] = id;
+}
+
+/* send the staged reports to the device, in the order they were first
+   staged. What was sent is what the device now holds, so each report
+   written is kept in the buffer as a fresh one. On success, return 0,
+   and failure, return -1 and set errno (the reports that were not sent
+   are expired). */
+static int flush_staged_buffered(reportbuf_t *rbuf, hid_dev_handle_t udev)
+{
+	int	i, r, id;
+
+	for (i = 0; i < rbuf->nstaged; i++) {
+
+		id = rbuf->staged[i];
+
+		r = comm_driver->set_report(udev, id, REPORT_DATA(rbuf, id), rbuf->len[id]);
+		if (r <= 0) {
+			upsdebug_with_errno(1, "Can't set Report %02x", id);
+			break;
+		}
+
+		upsdebug_hex(3, "Report[set]", REPORT_DATA(rbuf, id), rbuf->len[id]);
 	}
 
-	upsdebug_hex(3, "Report[set]", rbuf->data[id], rbuf->len[id]);
+	if (i < rbuf->nstaged) {
+		/* these hold values the device never got */
+		for (; i < rbuf->nstaged; i++) {
+			rbuf->ts[rbuf->staged[i]] = 0;
+		}
+
+		rbuf->nstaged = 0;
+		return -1;
+	}
 
-	/* expire report */
-	rbuf->ts[id] = 0;
+	for (i = 0; i < rbuf->nstaged; i++) {
+		time(&rbuf->ts[rbuf->staged[i]]);
+	}
 
+	rbuf->nstaged = 0;
 	return 0;
 }
 
+/* drop the staged reports without sending them. They are expired, so
+   that the values the device really holds are read again. */
+static void discard_staged_buffered(reportbuf_t *rbuf)
+{
+	int	i;
+
+	for (i = 0; i < rbuf->nstaged; i++) {
+		rbuf->ts[rbuf->staged[i]] = 0;
+	}
+
+	rbuf->nstaged = 0;
+}
+
 /* file a given report in the report buffer. This is used when the
    report has been obtained without having been explicitly requested,
    e.g., it arrived through an interrupt transfer. Returns 0 on
@@ -229,13 +303,13 @@ static int file_report_buffer(reportbuf_t *rbuf, unsigned char *buf, int buflen)
 	int id = buf[0];
 
 	/* broken report descriptors are common, so store whatever we can */
-	memcpy(rbuf->data[id], buf, (buflen < rbuf->len[id]) ? buflen : rbuf->len[id]);
+	memcpy(REPORT_DATA(rbuf, id), buf, (buflen < rbuf->len[id]) ? buflen : rbuf->len[id]);
 
 	if (rbuf->len[id] != buflen) {
 		upsdebugx(2, "%s: expected %d bytes, but got %d instead", __func__, rbuf->len[id], buflen);
 		upsdebug_hex(3, "Report[err]", buf, buflen);
 	} else {
-		upsdebug_hex(3, "Report[int]", rbuf->data[id], rbuf->len[id]);
+		upsdebug_hex(3, "Report[int]", REPORT_DATA(rbuf, id), rbuf->len[id]);
 	}
 
 	/* have (valid) report */
@@ -434,12 +508,13 @@ char *HIDGetItemString(hid_dev_handle_t udev, const char *hidpath, char *buf, si
 	return HIDGetIndexString(udev, Index, buf, buflen);
 }
 
-/* Set the given physical value for the variable associated with
- * path. return 1 if OK, 0 on fail, -errno otherwise (ie disconnect).
+/* Stage the given physical value for the variable associated with
+ * path. Nothing is sent until HIDFlushStaged() is called, and items
+ * that share a report are sent with a single set_report.
+ * return 1 if OK, 0 on fail.
  */
-int HIDSetDataValue(hid_dev_handle_t udev, HIDData_t *hiddata, double Value)
+int HIDStageDataValue(HIDData_t *hiddata, double Value)
 {
-	int	r;
 	long	hValue;
 
 	if (hiddata == NULL) {
@@ -459,19 +534,52 @@ int HIDSetDataValue(hid_dev_handle_t udev, HIDData_t *hiddata, double Value)
 	/* Convert Physical Min, Max and Value into Logical */
 	hValue = physical_to_logical(hiddata, Value);
 
-	r = set_item_buffered(reportbuf, udev, hiddata, hValue);
-	if (r<0) {
-		upsdebug_with_errno(1, "Can't set Report %02x", hiddata->ReportID);
-		return -errno;
+	stage_item_buffered(reportbuf, hiddata, hValue);
+
+	upsdebugx(4, "Staged report %02x", hiddata->ReportID);
+	return 1;
+}
+
+/* Send all the staged reports to the device.
+ * return 1 if OK (or nothing staged), -errno otherwise (ie disconnect).
+ */
+int HIDFlushStaged(hid_dev_handle_t udev)
+{
+	if (reportbuf->nstaged == 0) {
+		return 1;
 	}
 
-	/* flush the report buffer (data may have changed) */
+	/* writing may have side effects on the other reports (status,
+	 * timers...), so expire these; the ones written are then kept */
 	memset(reportbuf->ts, 0, sizeof(reportbuf->ts));
-	
+
+	if (flush_staged_buffered(reportbuf, udev) < 0) {
+		return -errno;
+	}
+
 	upsdebugx(4, "Set report succeeded");
 	return 1;
 }
 
+/* Forget about the staged values, without sending them.
+ */
+void HIDDiscardStaged(void)
+{
+	discard_staged_buffered(reportbuf);
+}
+
+/* Set the given physical value for the variable associated with
+ * path. return 1 if OK, 0 on fail, -errno otherwise (ie disconnect).
+ */
+int HIDSetDataValue(hid_dev_handle_t udev, HIDData_t *hiddata, double Value)
+{
+	if (HIDStageDataValue(hiddata, Value) != 1) {
+		return 0;
+	}
+
+	return HIDFlushStaged(udev);
+}
+
 bool_t HIDSetItemValue(hid_dev_handle_t udev, const char *hidpath, double Value, usage_tables_t *utab)
 {
 	if (HIDSetDataValue(udev, HIDGetItemData(hidpath, utab), Value) != 1)
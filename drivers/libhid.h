@@ -80,13 +80,23 @@ extern communication_subdriver_t *comm_driver;
 extern HIDDesc_t	*pDesc;	/* parsed Report Descriptor */
 
 /* report buffer structure: holds data about most recent report for
-   each given report id */
+   each given report id. The data of all the reports is stored in a
+   single arena, one after the other in report id order, so that the
+   whole buffer can be dumped (or replayed) as a single blob. */
 typedef struct reportbuf_s {
        time_t	ts[256];			/* timestamp when report was retrieved */
-       int	len[256];			/* size of report data */
-       unsigned char	*data[256];		/* report data (allocated) */
+       int	len[256];			/* size of report data (0: unknown report) */
+       uint16_t	offset[256];			/* start of report data in the arena */
+       int	maxlen;				/* size of the largest report */
+       int	size;				/* size of the arena */
+       unsigned char	*arena;			/* report data, followed by maxlen bytes of scratch space */
+       unsigned char	staged[256];		/* ids of the reports with staged writes, in order */
+       int	nstaged;			/* number of reports with staged writes */
 } reportbuf_t;
 
+/* report data for the given report id */
+#define REPORT_DATA(rbuf, id)	((rbuf)->arena + (rbuf)->offset[(id)])
+
 extern reportbuf_t	*reportbuf;	/* buffer for most recent reports */
 
 extern int interrupt_only;
@@ -129,6 +139,13 @@ int HIDGetDataValue(hid_dev_handle_t udev, HIDData_t *hiddata, double *Value, in
  * -------------------------------------------------------------------------- */
 int HIDSetDataValue(hid_dev_handle_t udev, HIDData_t *hiddata, double Value);
 
+/*
+ * HIDStageDataValue, HIDFlushStaged, HIDDiscardStaged
+ * -------------------------------------------------------------------------- */
+int HIDStageDataValue(HIDData_t *hiddata, double Value);
+int HIDFlushStaged(hid_dev_handle_t udev);
+void HIDDiscardStaged(void);
+
 /*
  * HIDGetIndexString
  * -------------------------------------------------------------------------- */
@@ -31,10 +31,11 @@
 #include "config.h" /* for HAVE_USB_DETACH_KERNEL_DRIVER_NP flag */
 #include "common.h" /* for xmalloc, upsdebugx prototypes */
 #include "usb-common.h"
+#include "usbsysfs.h"
 #include "libusb.h"
 
 #define USB_DRIVER_NAME		"USB communication driver"
-#define USB_DRIVER_VERSION	"0.33"
+#define USB_DRIVER_VERSION	"0.34"
 
 /* driver description structure */
 upsdrv_info_t comm_upsdrv_info = {
@@ -47,6 +48,9 @@ upsdrv_info_t comm_upsdrv_info = {
 
 #define MAX_REPORT_SIZE         0x1800
 
+/* Port (bus and port path, e.g. "3-1.2") of the device we last connected to, tried first on reconnection */
+static char	*last_port = NULL;
+
 static void libusb_close(usb_dev_handle *udev);
 
 /*! Add USB-related driver variables with addvar().
@@ -87,6 +91,70 @@ static inline int matches(USBDeviceMatcher_t *matcher, USBDevice_t *device) {
 	return matcher->match_function(device, matcher->privdata);
 }
 
+/* invoke all the matchers against device: return 1 if it matches, 0 if it
+ * doesn't, -2 if a matcher couldn't tell */
+static int match_device(USBDeviceMatcher_t *matcher, USBDevice_t *device)
+{
+	USBDeviceMatcher_t	*m;
+	int	ret;
+
+	upsdebugx(2, "Trying to match device");
+	for (m = matcher; m; m=m->next) {
+		ret = matches(m, device);
+		if (ret==0) {
+			upsdebugx(2, "Device does not match - skipping");
+			return 0;
+		} else if (ret==-1) {
+			fatal_with_errno(EXIT_FAILURE, "matcher");
+		} else if (ret==-2) {
+			upsdebugx(2, "matcher: unspecified error");
+			return -2;
+		}
+	}
+	upsdebugx(2, "Device matches");
+
+	return 1;
+}
+
+static void libusb_debug_device(USBDevice_t *curDevice)
+{
+	upsdebugx(2, "- VendorID: %04x", curDevice->VendorID);
+	upsdebugx(2, "- ProductID: %04x", curDevice->ProductID);
+	upsdebugx(2, "- Manufacturer: %s", curDevice->Vendor ? curDevice->Vendor : "unknown");
+	upsdebugx(2, "- Product: %s", curDevice->Product ? curDevice->Product : "unknown");
+	upsdebugx(2, "- Serial Number: %s", curDevice->Serial ? curDevice->Serial : "unknown");
+	upsdebugx(2, "- Bus: %s", curDevice->Bus ? curDevice->Bus : "unknown");
+	upsdebugx(2, "- Device release number: %04x", curDevice->bcdDevice);
+}
+
+/* fill in the identifying information of a device from what the kernel
+ * already knows about it, without any USB traffic */
+static void libusb_sysfs_device(USBDevice_t *curDevice, const usbsysfs_device_t *sysdev, const char *busname)
+{
+	free(curDevice->Vendor);
+	free(curDevice->Product);
+	free(curDevice->Serial);
+	free(curDevice->Bus);
+	memset(curDevice, '\0', sizeof(*curDevice));
+
+	curDevice->VendorID = sysdev->VendorID;
+	curDevice->ProductID = sysdev->ProductID;
+	curDevice->Bus = strdup(busname);
+	curDevice->bcdDevice = sysdev->bcdDevice;
+
+	if (sysdev->Vendor[0]) {
+		curDevice->Vendor = strdup(sysdev->Vendor);
+	}
+
+	if (sysdev->Product[0]) {
+		curDevice->Product = strdup(sysdev->Product);
+	}
+
+	if (sysdev->Serial[0]) {
+		curDevice->Serial = strdup(sysdev->Serial);
+	}
+}
+
 /*! If needed, set the USB alternate interface.
  *
  * In NUT 2.7.2 and earlier, the following call was made unconditionally:
@@ -143,7 +211,6 @@ static int libusb_open(usb_dev_handle **udevp, USBDevice_t *curDevice, USBDevice
 	int retries;
 #endif
 	int rdlen1, rdlen2; /* report descriptor length, method 1+2 */
-	USBDeviceMatcher_t *m;
 	struct usb_device *dev;
 	struct usb_bus *bus;
 	usb_dev_handle *udev;
@@ -153,7 +220,8 @@ static int libusb_open(usb_dev_handle **udevp, USBDevice_t *curDevice, USBDevice
 	unsigned char buf[20];
 	unsigned char *p;
 	char string[256];
-	int i;
+	int i, pass, sysmatch;
+	const usbsysfs_device_t *sysdev, *lastdev;
 	/* All devices use HID descriptor at index 0. However, some newer
 	 * Eaton units have a light HID descriptor at index 0, and the full
 	 * version is at index 1 (in which case, bcdDevice == 0x0202) */
@@ -175,239 +243,264 @@ static int libusb_open(usb_dev_handle **udevp, USBDevice_t *curDevice, USBDevice
 
 	upsdebugx(3, "usb_busses=%p", usb_busses);
 
-	for (bus = usb_busses; bus; bus = bus->next) {
-		for (dev = bus->devices; dev; dev = dev->next) {
-			upsdebugx(2, "Checking device (%04X/%04X) (%s/%s)", dev->descriptor.idVendor,
-				dev->descriptor.idProduct, bus->dirname, dev->filename);
+	/* what the kernel knows about the devices (if anything), read once for all of them */
+	usbsysfs_flush();
+	lastdev = usbsysfs_find_port(last_port);
 
-			/* supported vendors are now checked by the
-			   supplied matcher */
+	/* first pass: only the device we were last connected to (if still
+	 * there), so that reconnecting doesn't need to walk all the others;
+	 * second pass: all the other devices */
+	for (pass = 0; pass < 2; pass++) {
+		for (bus = usb_busses; bus; bus = bus->next) {
+			for (dev = bus->devices; dev; dev = dev->next) {
+				sysdev = usbsysfs_find(atoi(bus->dirname), atoi(dev->filename));
 
-			/* open the device */
-			*udevp = udev = usb_open(dev);
-			if (!udev) {
-				upsdebugx(2, "Failed to open device, skipping. (%s)", usb_strerror());
-				continue;
-			}
-
-			/* collect the identifying information of this
-			   device. Note that this is safe, because
-			   there's no need to claim an interface for
-			   this (and therefore we do not yet need to
-			   detach any kernel drivers). */
-
-			free(curDevice->Vendor);
-			free(curDevice->Product);
-			free(curDevice->Serial);
-			free(curDevice->Bus);
-			memset(curDevice, '\0', sizeof(*curDevice));
-
-			curDevice->VendorID = dev->descriptor.idVendor;
-			curDevice->ProductID = dev->descriptor.idProduct;
-			curDevice->Bus = strdup(bus->dirname);
-			curDevice->bcdDevice = dev->descriptor.bcdDevice;
-
-			if (dev->descriptor.iManufacturer) {
-				ret = usb_get_string_simple(udev, dev->descriptor.iManufacturer,
-					string, sizeof(string));
-				if (ret > 0) {
-					curDevice->Vendor = strdup(string);
+				if ((pass == 0) != (sysdev != NULL && sysdev == lastdev)) {
+					continue;
 				}
-			}
 
-			if (dev->descriptor.iProduct) {
-				ret = usb_get_string_simple(udev, dev->descriptor.iProduct,
-					string, sizeof(string));
-				if (ret > 0) {
-					curDevice->Product = strdup(string);
+				upsdebugx(2, "Checking device (%04X/%04X) (%s/%s)", dev->descriptor.idVendor,
+					dev->descriptor.idProduct, bus->dirname, dev->filename);
+
+				/* supported vendors are now checked by the
+				   supplied matcher */
+
+				/* if the kernel already knows the identifying
+				   information of this device, check it before
+				   opening the device, so that we won't need to
+				   talk to devices that don't match. If some of
+				   it is missing, or the matchers can't tell,
+				   read it from the device as well. */
+				sysmatch = 0;
+
+				if (sysdev && usbsysfs_complete(sysdev, dev->descriptor.idVendor,
+						dev->descriptor.idProduct, dev->descriptor.iManufacturer,
+						dev->descriptor.iProduct, dev->descriptor.iSerialNumber)) {
+					libusb_sysfs_device(curDevice, sysdev, bus->dirname);
+					libusb_debug_device(curDevice);
+					upsdebugx(2, "- Port: %s", sysdev->Port);
+
+					ret = match_device(matcher, curDevice);
+					if (ret == 0) {
+						continue;
+					}
+
+					sysmatch = (ret == 1);
 				}
-			}
 
-			if (dev->descriptor.iSerialNumber) {
-				ret = usb_get_string_simple(udev, dev->descriptor.iSerialNumber,
-					string, sizeof(string));
-				if (ret > 0) {
-					curDevice->Serial = strdup(string);
+				/* open the device */
+				*udevp = udev = usb_open(dev);
+				if (!udev) {
+					upsdebugx(2, "Failed to open device, skipping. (%s)", usb_strerror());
+					continue;
 				}
-			}
-
-			upsdebugx(2, "- VendorID: %04x", curDevice->VendorID);
-			upsdebugx(2, "- ProductID: %04x", curDevice->ProductID);
-			upsdebugx(2, "- Manufacturer: %s", curDevice->Vendor ? curDevice->Vendor : "unknown");
-			upsdebugx(2, "- Product: %s", curDevice->Product ? curDevice->Product : "unknown");
-			upsdebugx(2, "- Serial Number: %s", curDevice->Serial ? curDevice->Serial : "unknown");
-			upsdebugx(2, "- Bus: %s", curDevice->Bus ? curDevice->Bus : "unknown");
-			upsdebugx(2, "- Device release number: %04x", curDevice->bcdDevice);
 
-			if ((curDevice->VendorID == 0x463) && (curDevice->bcdDevice == 0x0202)) {
-				hid_desc_index = 1;
-			}
+				/* otherwise, collect the identifying information
+				   of this device. Note that this is safe, because
+				   there's no need to claim an interface for
+				   this (and therefore we do not yet need to
+				   detach any kernel drivers). */
+				if (!sysmatch) {
+					free(curDevice->Vendor);
+					free(curDevice->Product);
+					free(curDevice->Serial);
+					free(curDevice->Bus);
+					memset(curDevice, '\0', sizeof(*curDevice));
+
+					curDevice->VendorID = dev->descriptor.idVendor;
+					curDevice->ProductID = dev->descriptor.idProduct;
+					curDevice->Bus = strdup(bus->dirname);
+					curDevice->bcdDevice = dev->descriptor.bcdDevice;
+
+					if (dev->descriptor.iManufacturer) {
+						ret = usb_get_string_simple(udev, dev->descriptor.iManufacturer,
+							string, sizeof(string));
+						if (ret > 0) {
+							curDevice->Vendor = strdup(string);
+						}
+					}
+
+					if (dev->descriptor.iProduct) {
+						ret = usb_get_string_simple(udev, dev->descriptor.iProduct,
+							string, sizeof(string));
+						if (ret > 0) {
+							curDevice->Product = strdup(string);
+						}
+					}
+
+					if (dev->descriptor.iSerialNumber) {
+						ret = usb_get_string_simple(udev, dev->descriptor.iSerialNumber,
+							string, sizeof(string));
+						if (ret > 0) {
+							curDevice->Serial = strdup(string);
+						}
+					}
+
+					libusb_debug_device(curDevice);
+
+					if (match_device(matcher, curDevice) != 1) {
+						goto next_device;
+					}
+				}
 
-			upsdebugx(2, "Trying to match device");
-			for (m = matcher; m; m=m->next) {
-				ret = matches(m, curDevice);
-				if (ret==0) {
-					upsdebugx(2, "Device does not match - skipping");
-					goto next_device;
-				} else if (ret==-1) {
-					fatal_with_errno(EXIT_FAILURE, "matcher");
-					goto next_device;
-				} else if (ret==-2) {
-					upsdebugx(2, "matcher: unspecified error");
-					goto next_device;
+				if ((curDevice->VendorID == 0x463) && (curDevice->bcdDevice == 0x0202)) {
+					hid_desc_index = 1;
 				}
-			}
-			upsdebugx(2, "Device matches");
 
-			/* Now we have matched the device we wanted. Claim it. */
+				/* Now we have matched the device we wanted. Claim it. */
 
 #ifdef HAVE_USB_DETACH_KERNEL_DRIVER_NP
-			/* this method requires at least libusb 0.1.8:
-			 * it force device claiming by unbinding
-			 * attached driver... From libhid */
-			retries = 3;
-			while (usb_claim_interface(udev, 0) < 0) {
+				/* this method requires at least libusb 0.1.8:
+				 * it force device claiming by unbinding
+				 * attached driver... From libhid */
+				retries = 3;
+				while (usb_claim_interface(udev, 0) < 0) {
 
-				upsdebugx(2, "failed to claim USB device: %s", usb_strerror());
+					upsdebugx(2, "failed to claim USB device: %s", usb_strerror());
 
-				if (usb_detach_kernel_driver_np(udev, 0) < 0) {
-					upsdebugx(2, "failed to detach kernel driver from USB device: %s", usb_strerror());
-				} else {
-					upsdebugx(2, "detached kernel driver from USB device...");
-				}
+					if (usb_detach_kernel_driver_np(udev, 0) < 0) {
+						upsdebugx(2, "failed to detach kernel driver from USB device: %s", usb_strerror());
+					} else {
+						upsdebugx(2, "detached kernel driver from USB device...");
+					}
 
-				if (retries-- > 0) {
-					continue;
-				}
+					if (retries-- > 0) {
+						continue;
+					}
 
-				fatalx(EXIT_FAILURE, "Can't claim USB device [%04x:%04x]: %s", curDevice->VendorID, curDevice->ProductID, usb_strerror());
-			}
+					fatalx(EXIT_FAILURE, "Can't claim USB device [%04x:%04x]: %s", curDevice->VendorID, curDevice->ProductID, usb_strerror());
+				}
 #else
-			if (usb_claim_interface(udev, 0) < 0) {
-				fatalx(EXIT_FAILURE, "Can't claim USB device [%04x:%04x]: %s", curDevice->VendorID, curDevice->ProductID, usb_strerror());
-			}
+				if (usb_claim_interface(udev, 0) < 0) {
+					fatalx(EXIT_FAILURE, "Can't claim USB device [%04x:%04x]: %s", curDevice->VendorID, curDevice->ProductID, usb_strerror());
+				}
 #endif
 
-			nut_usb_set_altinterface(udev);
+				nut_usb_set_altinterface(udev);
 
-			if (!callback) {
-				return 1;
-			}
+				/* remember where it is, for a faster reconnection */
+				free(last_port);
+				last_port = sysdev ? strdup(sysdev->Port) : NULL;
 
-			if (!dev->config) { /* ?? this should never happen */
-				upsdebugx(2, "  Couldn't retrieve descriptors");
-				goto next_device;
-			}
+				if (!callback) {
+					return 1;
+				}
 
-			rdlen1 = -1;
-			rdlen2 = -1;
+				if (!dev->config) { /* ?? this should never happen */
+					upsdebugx(2, "  Couldn't retrieve descriptors");
+					goto next_device;
+				}
 
-			/* Get HID descriptor */
+				rdlen1 = -1;
+				rdlen2 = -1;
 
-			/* FIRST METHOD: ask for HID descriptor directly. */
-			/* res = usb_get_descriptor(udev, USB_DT_HID, hid_desc_index, buf, 0x9); */
-			res = usb_control_msg(udev, USB_ENDPOINT_IN+1, USB_REQ_GET_DESCRIPTOR,
-					      (USB_DT_HID << 8) + hid_desc_index, 0, buf, 0x9, USB_TIMEOUT);
+				/* Get HID descriptor */
 
-			if (res < 0) {
-				upsdebugx(2, "Unable to get HID descriptor (%s)", usb_strerror());
-			} else if (res < 9) {
-				upsdebugx(2, "HID descriptor too short (expected %d, got %d)", 8, res);
-			} else {
+				/* FIRST METHOD: ask for HID descriptor directly. */
+				/* res = usb_get_descriptor(udev, USB_DT_HID, hid_desc_index, buf, 0x9); */
+				res = usb_control_msg(udev, USB_ENDPOINT_IN+1, USB_REQ_GET_DESCRIPTOR,
+						      (USB_DT_HID << 8) + hid_desc_index, 0, buf, 0x9, USB_TIMEOUT);
 
-				upsdebug_hex(3, "HID descriptor, method 1", buf, 9);
+				if (res < 0) {
+					upsdebugx(2, "Unable to get HID descriptor (%s)", usb_strerror());
+				} else if (res < 9) {
+					upsdebugx(2, "HID descriptor too short (expected %d, got %d)", 8, res);
+				} else {
 
-				rdlen1 = buf[7] | (buf[8] << 8);
-			}
+					upsdebug_hex(3, "HID descriptor, method 1", buf, 9);
 
-			if (rdlen1 < -1) {
-				upsdebugx(2, "Warning: HID descriptor, method 1 failed");
-			}
-			upsdebugx(3, "HID descriptor length (method 1) %d", rdlen1);
-
-			/* SECOND METHOD: find HID descriptor among "extra" bytes of
-			   interface descriptor, i.e., bytes tucked onto the end of
-			   descriptor 2. */
-
-			/* Note: on some broken UPS's (e.g. Tripp Lite Smart1000LCD),
-				only this second method gives the correct result */
-
-			/* for now, we always assume configuration 0, interface 0,
-			   altsetting 0, as above. */
-			iface = &dev->config[0].interface[0].altsetting[0];
-			for (i=0; i<iface->extralen; i+=iface->extra[i]) {
-				upsdebugx(4, "i=%d, extra[i]=%02x, extra[i+1]=%02x", i,
-					iface->extra[i], iface->extra[i+1]);
-				if (i+9 <= iface->extralen && iface->extra[i] >= 9 && iface->extra[i+1] == 0x21) {
-					p = &iface->extra[i];
-					upsdebug_hex(3, "HID descriptor, method 2", p, 9);
-					rdlen2 = p[7] | (p[8] << 8);
-					break;
+					rdlen1 = buf[7] | (buf[8] << 8);
 				}
-			}
 
-			if (rdlen2 < -1) {
-				upsdebugx(2, "Warning: HID descriptor, method 2 failed");
-			}
-			upsdebugx(3, "HID descriptor length (method 2) %d", rdlen2);
-
-			/* when available, always choose the second value, as it
-				seems to be more reliable (it is the one reported e.g. by
-				lsusb). Note: if the need arises, can change this to use
-				the maximum of the two values instead. */
-			if ((curDevice->VendorID == 0x463) && (curDevice->bcdDevice == 0x0202)) {
-				upsdebugx(1, "Eaton device v2.02. Using full report descriptor");
-				rdlen = rdlen1;
-			}
-			else {
-				rdlen = rdlen2 >= 0 ? rdlen2 : rdlen1;
-			}
+				if (rdlen1 < -1) {
+					upsdebugx(2, "Warning: HID descriptor, method 1 failed");
+				}
+				upsdebugx(3, "HID descriptor length (method 1) %d", rdlen1);
+
+				/* SECOND METHOD: find HID descriptor among "extra" bytes of
+				   interface descriptor, i.e., bytes tucked onto the end of
+				   descriptor 2. */
+
+				/* Note: on some broken UPS's (e.g. Tripp Lite Smart1000LCD),
+					only this second method gives the correct result */
+
+				/* for now, we always assume configuration 0, interface 0,
+				   altsetting 0, as above. */
+				iface = &dev->config[0].interface[0].altsetting[0];
+				for (i=0; i<iface->extralen; i+=iface->extra[i]) {
+					upsdebugx(4, "i=%d, extra[i]=%02x, extra[i+1]=%02x", i,
+						iface->extra[i], iface->extra[i+1]);
+					if (i+9 <= iface->extralen && iface->extra[i] >= 9 && iface->extra[i+1] == 0x21) {
+						p = &iface->extra[i];
+						upsdebug_hex(3, "HID descriptor, method 2", p, 9);
+						rdlen2 = p[7] | (p[8] << 8);
+						break;
+					}
+				}
 
-			if (rdlen < 0) {
-				upsdebugx(2, "Unable to retrieve any HID descriptor");
-				goto next_device;
-			}
-			if (rdlen1 >= 0 && rdlen2 >= 0 && rdlen1 != rdlen2) {
-				upsdebugx(2, "Warning: two different HID descriptors retrieved (Reportlen = %d vs. %d)", rdlen1, rdlen2);
-			}
+				if (rdlen2 < -1) {
+					upsdebugx(2, "Warning: HID descriptor, method 2 failed");
+				}
+				upsdebugx(3, "HID descriptor length (method 2) %d", rdlen2);
+
+				/* when available, always choose the second value, as it
+					seems to be more reliable (it is the one reported e.g. by
+					lsusb). Note: if the need arises, can change this to use
+					the maximum of the two values instead. */
+				if ((curDevice->VendorID == 0x463) && (curDevice->bcdDevice == 0x0202)) {
+					upsdebugx(1, "Eaton device v2.02. Using full report descriptor");
+					rdlen = rdlen1;
+				}
+				else {
+					rdlen = rdlen2 >= 0 ? rdlen2 : rdlen1;
+				}
 
-			upsdebugx(2, "HID descriptor length %d", rdlen);
+				if (rdlen < 0) {
+					upsdebugx(2, "Unable to retrieve any HID descriptor");
+					goto next_device;
+				}
+				if (rdlen1 >= 0 && rdlen2 >= 0 && rdlen1 != rdlen2) {
+					upsdebugx(2, "Warning: two different HID descriptors retrieved (Reportlen = %d vs. %d)", rdlen1, rdlen2);
+				}
 
-			if (rdlen > (int)sizeof(rdbuf)) {
-				upsdebugx(2, "HID descriptor too long %d (max %d)", rdlen, (int)sizeof(rdbuf));
-				goto next_device;
-			}
+				upsdebugx(2, "HID descriptor length %d", rdlen);
 
-			/* res = usb_get_descriptor(udev, USB_DT_REPORT, hid_desc_index, bigbuf, rdlen); */
-			res = usb_control_msg(udev, USB_ENDPOINT_IN+1, USB_REQ_GET_DESCRIPTOR,
-				(USB_DT_REPORT << 8) + hid_desc_index, 0, rdbuf, rdlen, USB_TIMEOUT);
+				if (rdlen > (int)sizeof(rdbuf)) {
+					upsdebugx(2, "HID descriptor too long %d (max %d)", rdlen, (int)sizeof(rdbuf));
+					goto next_device;
+				}
 
-			if (res < 0)
-			{
-				upsdebug_with_errno(2, "Unable to get Report descriptor");
-				goto next_device;
-			}
+				/* res = usb_get_descriptor(udev, USB_DT_REPORT, hid_desc_index, bigbuf, rdlen); */
+				res = usb_control_msg(udev, USB_ENDPOINT_IN+1, USB_REQ_GET_DESCRIPTOR,
+					(USB_DT_REPORT << 8) + hid_desc_index, 0, rdbuf, rdlen, USB_TIMEOUT);
 
-			if (res < rdlen)
-			{
-				upsdebugx(2, "Warning: report descriptor too short (expected %d, got %d)", rdlen, res);
-				rdlen = res; /* correct rdlen if necessary */
-			}
+				if (res < 0)
+				{
+					upsdebug_with_errno(2, "Unable to get Report descriptor");
+					goto next_device;
+				}
 
-			res = callback(udev, curDevice, rdbuf, rdlen);
-			if (res < 1) {
-				upsdebugx(2, "Caller doesn't like this device");
-				goto next_device;
-			}
+				if (res < rdlen)
+				{
+					upsdebugx(2, "Warning: report descriptor too short (expected %d, got %d)", rdlen, res);
+					rdlen = res; /* correct rdlen if necessary */
+				}
 
-			upsdebugx(2, "Report descriptor retrieved (Reportlen = %d)", rdlen);
-			upsdebugx(2, "Found HID device");
-			fflush(stdout);
+				res = callback(udev, curDevice, rdbuf, rdlen);
+				if (res < 1) {
+					upsdebugx(2, "Caller doesn't like this device");
+					goto next_device;
+				}
 
-			return rdlen;
+				upsdebugx(2, "Report descriptor retrieved (Reportlen = %d)", rdlen);
+				upsdebugx(2, "Found HID device");
+				fflush(stdout);
 
-		next_device:
-			usb_close(udev);
+				return rdlen;
+
+			next_device:
+				usb_close(udev);
+			}
 		}
 	}
 
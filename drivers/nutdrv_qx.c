@@ -130,15 +130,24 @@ static time_t	lastpoll;	/* Timestamp the last polling */
 static int	is_usb = 0;	/* Whether the device is connected through USB (1) or serial (0) */
 #endif	/* QX_USB && QX_SERIAL */
 
+/* Answers got from the UPS during a data walk, so that each command is sent only once per walk */
+#define QX_WALK_CACHE_SIZE	32
+
 static struct {
-	char	command[SMALLBUF];	/* Command sent to the UPS to get answer/to execute an instant command */
-	char	answer[SMALLBUF];	/* Answer from the UPS, filled at runtime */
-} previous_item = { "", "" };	/* Hold the values of the item processed just before the actual one */
+	int	active;			/* Whether we are in a data walk (i.e. answers can be reused) */
+	int	count;			/* Number of cached answers */
+	struct {
+		char	command[SMALLBUF];	/* Command sent to the UPS (after preprocess_command(), if any) */
+		char	answer[SMALLBUF];	/* Raw answer from the UPS (before preprocess_answer(), if any) */
+		int	len;			/* Length of the raw answer */
+	} entry[QX_WALK_CACHE_SIZE];
+} walk_cache;
 
 
 /* == Support functions == */
 static int	subdriver_matcher(void);
 static int	qx_command(const char *cmd, char *buf, size_t buflen);
+static int	qx_command_cached(const char *cmd, char *buf, size_t buflen);
 static int	qx_process_answer(item_t *item, const int len);
 static bool_t	qx_ups_walk(walkmode_t mode);
 static void	ups_status_set(void);
@@ -1899,7 +1908,7 @@ void	upsdrv_initups(void)
 		ser_set_rts(upsfd, cablepower[i].rts);
 
 		/* Allow some time to settle for the cablepower */
-		usleep(100000);
+		ser_delay(100000);
 
 	#endif	/* TESTING */
 
@@ -2253,6 +2262,45 @@ static int	qx_command(const char *cmd, char *buf, size_t buflen)
 #endif	/* TESTING */
 }
 
+/* Same as qx_command(), but, while walking the data, reuse the answer already got for the same command, if any.
+ * Only successful (non empty) answers are cached: errors and timeouts are always retried. */
+static int	qx_command_cached(const char *cmd, char *buf, size_t buflen)
+{
+	int	i, len;
+	size_t	size;
+
+	if (!walk_cache.active)
+		return qx_command(cmd, buf, buflen);
+
+	for (i = 0; i < walk_cache.count; i++) {
+
+		if (strcmp(walk_cache.entry[i].command, cmd))
+			continue;
+
+		upsdebugx(4, "%s: reusing answer to '%.*s'", __func__, (int)strcspn(cmd, "\r"), cmd);
+
+		size = (size_t)walk_cache.entry[i].len < buflen ? (size_t)walk_cache.entry[i].len : buflen;
+		memset(buf, 0, buflen);
+		memcpy(buf, walk_cache.entry[i].answer, size);
+
+		return (int)size;
+
+	}
+
+	len = qx_command(cmd, buf, buflen);
+
+	if (len <= 0 || walk_cache.count >= QX_WALK_CACHE_SIZE || strlen(cmd) >= sizeof(walk_cache.entry[0].command))
+		return len;
+
+	snprintf(walk_cache.entry[walk_cache.count].command, sizeof(walk_cache.entry[0].command), "%s", cmd);
+	size = (size_t)len < sizeof(walk_cache.entry[0].answer) ? (size_t)len : sizeof(walk_cache.entry[0].answer);
+	memcpy(walk_cache.entry[walk_cache.count].answer, buf, size);
+	walk_cache.entry[walk_cache.count].len = (int)size;
+	walk_cache.count++;
+
+	return len;
+}
+
 /* See header file for details.
  * Interpretation is done in ups_status_set(). */
 void	update_status(const char *value)
@@ -2435,9 +2483,9 @@ static bool_t	qx_ups_walk(walkmode_t mode)
 		batt.chrg.act = -1;
 	}
 
-	/* Clear data from previous_item */
-	memset(previous_item.command, 0, sizeof(previous_item.command));
-	memset(previous_item.answer, 0, sizeof(previous_item.answer));
+	/* Start with an empty cache: answers are only reused within the same walk */
+	walk_cache.count = 0;
+	walk_cache.active = 1;
 
 	/* 3 modes: QX_WALKMODE_INIT, QX_WALKMODE_QUICK_UPDATE and QX_WALKMODE_FULL_UPDATE */
 
@@ -2525,24 +2573,8 @@ static bool_t	qx_ups_walk(walkmode_t mode)
 
 		}
 
-		/* Check whether the previous item uses the same command and then use its answer, if available.. */
-		if (strlen(previous_item.command) > 0 && strlen(previous_item.answer) > 0 && !strcasecmp(previous_item.command, item->command)) {
-
-			snprintf(item->answer, sizeof(item->answer), "%s", previous_item.answer);
-
-			/* Process the answer */
-			retcode = qx_process_answer(item, strlen(item->answer));
-
-		/* ..otherwise: execute command to get answer from the UPS */
-		} else {
-
-			retcode = qx_process(item, NULL);
-
-		}
-
-		/* Record item as previous_item */
-		snprintf(previous_item.command, sizeof(previous_item.command), "%s", item->command);
-		snprintf(previous_item.answer, sizeof(previous_item.answer), "%s", item->answer);
+		/* Get the answer from the UPS (or from the walk cache, if the same command has already been sent) */
+		retcode = qx_process(item, NULL);
 
 		if (retcode) {
 
@@ -2550,8 +2582,10 @@ static bool_t	qx_ups_walk(walkmode_t mode)
 			memset(item->answer, 0, sizeof(item->answer));
 			memset(item->value, 0, sizeof(item->value));
 
-			if (item->qxflags & QX_FLAG_QUICK_POLL)
+			if (item->qxflags & QX_FLAG_QUICK_POLL) {
+				walk_cache.active = 0;
 				return FALSE;
+			}
 
 			if (mode == QX_WALKMODE_INIT)
 				/* Skip this item from now on */
@@ -2572,8 +2606,10 @@ static bool_t	qx_ups_walk(walkmode_t mode)
 		/* Uh-oh! Some error! */
 		if (retcode == -1) {
 
-			if (item->qxflags & QX_FLAG_QUICK_POLL)
+			if (item->qxflags & QX_FLAG_QUICK_POLL) {
+				walk_cache.active = 0;
 				return FALSE;
+			}
 
 			continue;
 
@@ -2586,6 +2622,9 @@ static bool_t	qx_ups_walk(walkmode_t mode)
 
 	}
 
+	/* Answers are not to be reused outside of the walk (e.g. by instcmd/setvar) */
+	walk_cache.active = 0;
+
 	/* Update battery guesstimation */
 	if (mode == QX_WALKMODE_FULL_UPDATE && (batt.runt.act == -1 || batt.chrg.act == -1)) {
 
@@ -2766,8 +2805,8 @@ int	qx_process(item_t *item, const char *command)
 		return -1;
 	}
 
-	/* Send the command */
-	len = qx_command(cmd, buf, sizeof(buf));
+	/* Send the command (or reuse the answer already got during this walk) */
+	len = qx_command_cached(cmd, buf, sizeof(buf));
 
 	memset(item->answer, 0, sizeof(item->answer));
 	memcpy(item->answer, buf, sizeof(buf));
@@ -88,33 +88,25 @@ static int powpan_command(const char *command)
 
 	ser_flush_io(upsfd);
 
-	ret = ser_send_pace(upsfd, UPSDELAY, "%s", command);
-
-	if (ret < 0) {
-		upsdebug_with_errno(3, "send");
-		return -1;
-	}
-
-	if (ret == 0) {
-		upsdebug_with_errno(3, "send: timeout");
-		return -1;
-	}
-
 	upsdebug_hex(3, "send", command, strlen(command));
 
-	usleep(100000);
-
-	ret = ser_get_line(upsfd, powpan_answer, sizeof(powpan_answer),
-		ENDCHAR, IGNCHAR, SER_WAIT_SEC, SER_WAIT_USEC);
+	/* the UPS gets the same time to answer as it had after the former
+	   fixed 100 ms pause, but a quick answer is no longer waited for.
+	   Reading before that pause is over is safe: nothing is flushed
+	   after the command is sent, so the answer comes out of the tty
+	   buffer as it did, only as soon as its ENDCHAR is in */
+	ret = ser_transact_line(upsfd, command, strlen(command), UPSDELAY,
+		powpan_answer, sizeof(powpan_answer), ENDCHAR, IGNCHAR,
+		SER_WAIT_SEC, SER_WAIT_USEC + 100000 + strlen(command) * UPSDELAY);
 
 	if (ret < 0) {
-		upsdebug_with_errno(3, "read");
+		upsdebug_with_errno(3, "transact");
 		upsdebug_hex(4, "  \\_", powpan_answer, strlen(powpan_answer));
 		return -1;
 	}
 
 	if (ret == 0) {
-		upsdebugx(3, "read: timeout");
+		upsdebugx(3, "transact: timeout");
 		upsdebug_hex(4, "  \\_", powpan_answer, strlen(powpan_answer));
 		return -1;
 	}
@@ -21,6 +21,7 @@
 #include "timehead.h"
 #include "serial.h"
 #include "main.h"
+#include "dstate.h"
 
 #include <grp.h>
 #include <pwd.h>
@@ -36,6 +37,34 @@
 
 	static unsigned int	comm_failures = 0;
 
+/* absolute deadline d_sec + d_usec from now */
+static void ser_deadline(struct timeval *tv, long d_sec, long d_usec)
+{
+	gettimeofday(tv, NULL);
+
+	tv->tv_sec += d_sec + d_usec / 1000000;
+	tv->tv_usec += d_usec % 1000000;
+
+	if (tv->tv_usec >= 1000000) {
+		tv->tv_sec++;
+		tv->tv_usec -= 1000000;
+	}
+}
+
+/* like select_read(), but up to an absolute deadline and serving the driver socket meanwhile */
+static int ser_read_until(int fd, void *buf, size_t buflen, struct timeval deadline)
+{
+	int	ret;
+
+	ret = dstate_wait_fd(deadline, fd);
+
+	if (ret < 1) {
+		return ret;
+	}
+
+	return read(fd, buf, buflen);
+}
+
 static void ser_open_error(const char *port)
 {
 	struct	stat	fs;
@@ -327,22 +356,49 @@ int ser_send_buf_pace(int fd, unsigned long d_usec, const void *buf,
 			return ret;
 		}
 
-		usleep(d_usec);
+		ser_delay(d_usec);
 	}
 
 	return sent;
 }
 
+/* sleep d_usec, while still serving the driver socket */
+void ser_delay(unsigned long d_usec)
+{
+	struct timeval	deadline;
+
+	if (d_usec == 0) {
+		return;
+	}
+
+	ser_deadline(&deadline, 0, d_usec);
+
+	/* interrupted by a signal: the caller will notice exit_flag */
+	while (dstate_wait_fd(deadline, -1) < 0) {
+		if ((errno != EINTR) || (exit_flag != 0)) {
+			break;
+		}
+	}
+}
+
 int ser_get_char(int fd, void *ch, long d_sec, long d_usec)
 {
-	return select_read(fd, ch, 1, d_sec, d_usec);
+	struct timeval	deadline;
+
+	ser_deadline(&deadline, d_sec, d_usec);
+
+	return ser_read_until(fd, ch, 1, deadline);
 }
 
 int ser_get_buf(int fd, void *buf, size_t buflen, long d_sec, long d_usec)
 {
+	struct timeval	deadline;
+
 	memset(buf, '\0', buflen);
 
-	return select_read(fd, buf, buflen, d_sec, d_usec);
+	ser_deadline(&deadline, d_sec, d_usec);
+
+	return ser_read_until(fd, buf, buflen, deadline);
 }
 
 /* keep reading until buflen bytes are received or a timeout occurs */
@@ -351,12 +407,15 @@ int ser_get_buf_len(int fd, void *buf, size_t buflen, long d_sec, long d_usec)
 	int	ret;
 	size_t	recv;
 	char	*data = buf;
+	struct timeval	deadline;
 
 	memset(buf, '\0', buflen);
 
 	for (recv = 0; recv < buflen; recv += ret) {
 
-		ret = select_read(fd, &data[recv], buflen - recv, d_sec, d_usec);
+		ser_deadline(&deadline, d_sec, d_usec);
+
+		ret = ser_read_until(fd, &data[recv], buflen - recv, deadline);
 
 		if (ret < 1) {
 			return ret;
@@ -366,23 +425,30 @@ int ser_get_buf_len(int fd, void *buf, size_t buflen, long d_sec, long d_usec)
 	return recv;
 }
 
-/* reads a line up to <endchar>, discarding anything else that may follow,
-   with callouts to the handler if anything matches the alertset */
-int ser_get_line_alert(int fd, void *buf, size_t buflen, char endchar,
-	const char *ignset, const char *alertset, void handler(char ch), 
-	long d_sec, long d_usec)
+/* read a line, either with a timeout for each read (deadline == NULL) or
+   until the given deadline */
+static int get_line(int fd, void *buf, size_t buflen, char endchar,
+	const char *ignset, const char *alertset, void handler(char ch),
+	const struct timeval *deadline, long d_sec, long d_usec)
 {
 	int	i, ret;
 	char	tmp[64];
 	char	*data = buf;
 	size_t	count = 0, maxcount;
+	struct timeval	tv;
 
 	memset(buf, '\0', buflen);
 
 	maxcount = buflen - 1;		/* for trailing \0 */
 
 	while (count < maxcount) {
-		ret = select_read(fd, tmp, sizeof(tmp), d_sec, d_usec);
+		if (deadline) {
+			tv = *deadline;
+		} else {
+			ser_deadline(&tv, d_sec, d_usec);
+		}
+
+		ret = ser_read_until(fd, tmp, sizeof(tmp), tv);
 
 		if (ret < 1) {
 			return ret;
@@ -411,6 +477,16 @@ int ser_get_line_alert(int fd, void *buf, size_t buflen, char endchar,
 	return count;
 }
 
+/* reads a line up to <endchar>, discarding anything else that may follow,
+   with callouts to the handler if anything matches the alertset */
+int ser_get_line_alert(int fd, void *buf, size_t buflen, char endchar,
+	const char *ignset, const char *alertset, void handler(char ch),
+	long d_sec, long d_usec)
+{
+	return get_line(fd, buf, buflen, endchar, ignset, alertset, handler,
+		NULL, d_sec, d_usec);
+}
+
 /* as above, only with no alertset handling (just a wrapper) */
 int ser_get_line(int fd, void *buf, size_t buflen, char endchar,
 	const char *ignset, long d_sec, long d_usec)
@@ -419,6 +495,27 @@ int ser_get_line(int fd, void *buf, size_t buflen, char endchar,
 		d_sec, d_usec);
 }
 
+/* send a request and read the answer up to <endchar>, the whole
+   transaction being bound to d_sec + d_usec */
+int ser_transact_line(int fd, const void *req, size_t reqlen,
+	unsigned long d_pace, void *buf, size_t buflen, char endchar,
+	const char *ignset, long d_sec, long d_usec)
+{
+	int	ret;
+	struct timeval	deadline;
+
+	ser_deadline(&deadline, d_sec, d_usec);
+
+	ret = ser_send_buf_pace(fd, d_pace, req, reqlen);
+
+	if (ret < (int)reqlen) {
+		return (ret < 0) ? ret : -1;
+	}
+
+	return get_line(fd, buf, buflen, endchar, ignset, "", NULL,
+		&deadline, 0, 0);
+}
+
 int ser_flush_in(int fd, const char *ignset, int verbose)
 {
 	int	ret, extra = 0;
@@ -51,6 +51,9 @@ int ser_send_buf(int fd, const void *buf, size_t buflen);
 int ser_send_buf_pace(int fd, unsigned long d_usec, const void *buf, 
 	size_t buflen);
 
+/* sleep d_usec, while still serving the driver socket */
+void ser_delay(unsigned long d_usec);
+
 int ser_get_char(int fd, void *ch, long d_sec, long d_usec);
 
 int ser_get_buf(int fd, void *buf, size_t buflen, long d_sec, long d_usec);
@@ -68,6 +71,13 @@ int ser_get_line_alert(int fd, void *buf, size_t buflen, char endchar,
 int ser_get_line(int fd, void *buf, size_t buflen, char endchar,
 	const char *ignset, long d_sec, long d_usec);
 
+/* send reqlen bytes from req with d_pace delay after each char, then read
+   a line as ser_get_line() does: the whole transaction must complete
+   within d_sec + d_usec */
+int ser_transact_line(int fd, const void *req, size_t reqlen,
+	unsigned long d_pace, void *buf, size_t buflen, char endchar,
+	const char *ignset, long d_sec, long d_usec);
+
 int ser_flush_in(int fd, const char *ignset, int verbose);
 
 /* unified failure reporting: call these often */
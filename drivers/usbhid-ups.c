@@ -28,7 +28,7 @@
  */
 
 #define DRIVER_NAME	"Generic HID driver"
-#define DRIVER_VERSION		"0.43"
+#define DRIVER_VERSION		"0.44"
 
 #include "main.h"
 #include "libhid.h"
@@ -113,6 +113,7 @@ bool_t use_interrupt_pipe = TRUE;
 bool_t use_interrupt_pipe = FALSE;
 #endif
 static time_t lastpoll; /* Timestamp the last polling */
+static int write_batch = 0; /* >0 while the writes of a compound command are staged */
 hid_dev_handle_t udev;
 
 /* support functions */
@@ -126,6 +127,8 @@ static void ups_status_set(void);
 static bool_t hid_ups_walk(walkmode_t mode);
 static int reconnect_ups(void);
 static int ups_infoval_set(hid_info_t *item, double value);
+static int hid_write(hid_info_t *item, double value);
+static int instcmd_batch_end(int ret);
 static int callback(hid_dev_handle_t udev, HIDDevice_t *hd, unsigned char *rdbuf, int rdlen);
 #ifdef DEBUG
 static double interval(void);
@@ -537,33 +540,37 @@ int instcmd(const char *cmdname, const char *extradata)
 		if (!strcasecmp(cmdname, "shutdown.return")) {
 			int	ret;
 
+			write_batch++;
+
 			/* Ensure "ups.start.auto" is set to "yes", if supported */
 			if (dstate_getinfo("ups.start.auto")) {
 				setvar("ups.start.auto", "yes");
 			}
 
 			ret = instcmd("load.on.delay", dstate_getinfo("ups.delay.start"));
-			if (ret != STAT_INSTCMD_HANDLED) {
-				return ret;
+			if (ret == STAT_INSTCMD_HANDLED) {
+				ret = instcmd("load.off.delay", dstate_getinfo("ups.delay.shutdown"));
 			}
 
-			return instcmd("load.off.delay", dstate_getinfo("ups.delay.shutdown"));
+			return instcmd_batch_end(ret);
 		}
 
 		if (!strcasecmp(cmdname, "shutdown.stayoff")) {
 			int	ret;
 
+			write_batch++;
+
 			/* Ensure "ups.start.auto" is set to "no", if supported */
 			if (dstate_getinfo("ups.start.auto")) {
 				setvar("ups.start.auto", "no");
 			}
 
 			ret = instcmd("load.on.delay", "-1");
-			if (ret != STAT_INSTCMD_HANDLED) {
-				return ret;
+			if (ret == STAT_INSTCMD_HANDLED) {
+				ret = instcmd("load.off.delay", dstate_getinfo("ups.delay.shutdown"));
 			}
 
-			return instcmd("load.off.delay", dstate_getinfo("ups.delay.shutdown"));
+			return instcmd_batch_end(ret);
 		}
 
 		upsdebugx(2, "instcmd: info element unavailable %s\n", cmdname);
@@ -589,7 +596,7 @@ int instcmd(const char *cmdname, const char *extradata)
 	}
 
 	/* Actual variable setting */
-	if (HIDSetDataValue(udev, hidups_item->hiddata, value) == 1) {
+	if (hid_write(hidups_item, value) == 1) {
 		upsdebugx(3, "instcmd: SUCCEED\n");
 		/* Set the status so that SEMI_STATIC vars are polled */
 		data_has_changed = TRUE;
@@ -643,7 +650,7 @@ int setvar(const char *varname, const char *val)
 	}
 
 	/* Actual variable setting */
-	if (HIDSetDataValue(udev, hidups_item->hiddata, value) == 1) {
+	if (hid_write(hidups_item, value) == 1) {
 		upsdebugx(5, "setvar: SUCCEED\n");
 		/* Set the status so that SEMI_STATIC vars are polled */
 		data_has_changed = TRUE;
@@ -1585,3 +1592,42 @@ static int ups_infoval_set(hid_info_t *item, double value)
 
 	return 1;
 }
+
+/* write the value of the given item to the device. While a compound
+   command is being processed (write_batch > 0), the value is only
+   staged, so that all the items sharing a report get sent at once by
+   instcmd_batch_end(). Return 1 on success, 0 otherwise. */
+static int hid_write(hid_info_t *item, double value)
+{
+	if (HIDStageDataValue(item->hiddata, value) != 1) {
+		return 0;
+	}
+
+	if (write_batch > 0) {
+		return 1;
+	}
+
+	return (HIDFlushStaged(udev) == 1);
+}
+
+/* end a compound command started with write_batch++. The staged writes
+   are sent if all the steps succeeded, or dropped otherwise, so that
+   the device never gets half of the command. */
+static int instcmd_batch_end(int ret)
+{
+	if (--write_batch > 0) {
+		return ret;
+	}
+
+	if (ret != STAT_INSTCMD_HANDLED) {
+		HIDDiscardStaged();
+		return ret;
+	}
+
+	if (HIDFlushStaged(udev) != 1) {
+		upsdebugx(3, "instcmd: FAILED\n");
+		return STAT_INSTCMD_FAILED;
+	}
+
+	return STAT_INSTCMD_HANDLED;
+}
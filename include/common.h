@@ -128,6 +128,9 @@ char *xstrdup(const char *string);
 int select_read(const int fd, void *buf, const size_t buflen, const long d_sec, const long d_usec);
 int select_write(const int fd, const void *buf, const size_t buflen, const long d_sec, const long d_usec);
 
+/* time for timers, which doesn't jump when the system clock is set */
+void monotonic_time(struct timeval *tv);
+
 char * get_libname(const char* base_libname);
 
 /* Buffer sizes used for various functions */
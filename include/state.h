@@ -45,6 +45,9 @@ typedef struct st_tree_s {
 	int	flags;
 	int	aux;
 
+	double	number;			/* raw parsed once, if isnumber */
+	int	isnumber;
+
 	struct enum_s		*enum_list;
 	struct range_s		*range_list;
 
@@ -58,6 +61,7 @@ int state_addrange(st_tree_t *root, const char *var, const int min, const int ma
 int state_setaux(st_tree_t *root, const char *var, const char *auxs);
 const char *state_getinfo(st_tree_t *root, const char *var);
 int state_getflags(st_tree_t *root, const char *var);
+int state_getnumber(st_tree_t *root, const char *var, double *number);
 int state_getaux(st_tree_t *root, const char *var);
 const enum_t *state_getenumlist(st_tree_t *root, const char *var);
 const range_t *state_getrangelist(st_tree_t *root, const char *var);
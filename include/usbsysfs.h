@@ -0,0 +1,80 @@
+/* usbsysfs.h - USB device identification from the kernel cache (sysfs)
+ *
+ * Copyright (C)
+ *   2026 Network UPS Tools developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#ifndef USBSYSFS_H
+#define USBSYSFS_H
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+extern "C" {
+/* *INDENT-ON* */
+#endif
+
+/* Identifying information of a USB device, as already read by the kernel
+ * when the device was plugged in: getting it costs no USB traffic at all,
+ * and does not require opening (nor having permissions on) the device.
+ * Strings are empty if the device does not provide them. */
+typedef struct usbsysfs_device_s {
+	int		busnum;		/* Bus number (e.g. 3 for bus "003") */
+	int		devnum;		/* Device address on that bus */
+	unsigned int	VendorID;
+	unsigned int	ProductID;
+	unsigned int	bcdDevice;
+	char		Vendor[128];
+	char		Product[128];
+	char		Serial[128];
+	char		Port[32];	/* Kernel name, i.e. bus and port path (e.g. "3-1.2") */
+	struct usbsysfs_device_s	*next;
+} usbsysfs_device_t;
+
+/* Enumerate the USB devices known to the kernel, once: subsequent calls
+ * return the same list until usbsysfs_flush() is called.
+ * Returns NULL if there are no devices or if sysfs is not available
+ * (i.e. not on Linux), in which case callers should fall back to opening
+ * the devices to get their information. */
+const usbsysfs_device_t	*usbsysfs_scan(void);
+
+/* Find the device with address *devnum* on bus *busnum* in the list
+ * (scanning it, if needed).  Returns NULL if not found. */
+const usbsysfs_device_t	*usbsysfs_find(int busnum, int devnum);
+
+/* Find the device on port *port* (e.g. "3-1.2") in the list (scanning it,
+ * if needed): unlike devnum, the port path survives a reconnection.
+ * Returns NULL if not found. */
+const usbsysfs_device_t	*usbsysfs_find_port(const char *port);
+
+/* See if *dev* is the device with these IDs, and has all the strings
+ * that its descriptor has indexes for (non zero).  If it hasn't, the
+ * kernel couldn't read some of them: read them from the device instead.
+ * Returns 1 if it has, 0 otherwise. */
+int	usbsysfs_complete(const usbsysfs_device_t *dev, unsigned int VendorID,
+		unsigned int ProductID, int iManufacturer, int iProduct, int iSerialNumber);
+
+/* Drop the list, so that the next call rescans the devices. */
+void	usbsysfs_flush(void);
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+}
+/* *INDENT-ON* */
+#endif
+
+#endif	/* USBSYSFS_H */
@@ -214,6 +214,36 @@ static void get_var(nut_ctype_t *client, const char *upsname, const char *var)
 		sendback(client, "VAR %s %s \"%s\"\n", upsname, var, val);
 }
 
+static void get_varnum(nut_ctype_t *client, const char *upsname, const char *var)
+{
+	const	upstype_t	*ups;
+	const	char	*val;
+	double	number;
+
+	ups = get_ups_ptr(upsname);
+
+	if (!ups) {
+		send_err(client, NUT_ERR_UNKNOWN_UPS);
+		return;
+	}
+
+	if (!ups_available(ups, client))
+		return;
+
+	if (!sstate_getnumber(ups, var, &number)) {
+		/* tell a missing variable from a non numeric one */
+		if (!sstate_getinfo(ups, var))
+			send_err(client, NUT_ERR_VAR_NOT_SUPPORTED);
+		else
+			send_err(client, NUT_ERR_INVALID_VALUE);
+		return;
+	}
+
+	/* the driver's own digits: printing the double back could add some */
+	val = sstate_getinfo(ups, var);
+	sendback(client, "VARNUM %s %s %s\n", upsname, var, val + strspn(val, " \t"));
+}
+
 void net_get(nut_ctype_t *client, int numarg, const char **arg)
 {
 	if (numarg < 1) {
@@ -263,6 +293,12 @@ void net_get(nut_ctype_t *client, int numarg, const char **arg)
 		return;
 	}
 
+	/* GET VARNUM UPS VARNAME */
+	if (!strcasecmp(arg[0], "VARNUM")) {
+		get_varnum(client, arg[1], arg[2]);
+		return;
+	}
+
 	/* GET TYPE UPS VARNAME */
 	if (!strcasecmp(arg[0], "TYPE")) {
 		get_type(client, arg[1], arg[2]);
@@ -31,6 +31,10 @@
 #include "neterr.h"
 #include "netssl.h"
 
+#ifdef WITH_OPENSSL
+	#include <openssl/rand.h>
+#endif /* WITH_OPENSSL */
+
 #ifdef WITH_NSS
 	#include <pk11pub.h>
 	#include <prinit.h>
@@ -88,12 +92,30 @@ void ssl_cleanup(void)
 {
 }
 
+void ssl_renew(void)
+{
+}
+
 #else
 
 #ifdef WITH_OPENSSL
 
 static SSL_CTX	*ssl_ctx = NULL;
 
+/* Sessions stay valid for this long (in seconds), so that clients which
+ * reconnect can resume them instead of doing a full handshake. */
+#define SSL_SESSION_LIFETIME	7200
+
+/* The session ticket keys are kept in the state path, so that the tickets
+ * survive an upsd restart: otherwise all the clients would come back at
+ * the same time for a full handshake. They are renewed once they are a
+ * day old, at startup or while upsd runs. */
+#define SSL_TICKET_KEYS_FILE	"upsd.ticketkeys"
+#define SSL_TICKET_KEYS_LIFETIME	86400
+
+/* when the keys in use were made */
+static time_t	ssl_ticket_keys_time = 0;
+
 static void ssl_debug(void)
 {
 	int	e;
@@ -250,7 +272,8 @@ void net_starttls(nut_ctype_t *client, int numarg, const char **arg)
 		return;
 	}
 	
-	if (!sendback(client, "OK STARTTLS\n")) {
+	/* the handshake follows it, so it can't wait */
+	if ((!sendback(client, "OK STARTTLS\n")) || (!client_flush(client))) {
 		return;
 	}
 
@@ -275,7 +298,8 @@ void net_starttls(nut_ctype_t *client, int numarg, const char **arg)
 	{
 	case 1:
 		client->ssl_connected = 1;
-		upsdebugx(3, "SSL connected (%s)", SSL_get_version(client->ssl));
+		upsdebugx(3, "SSL connected (%s, %s session)", SSL_get_version(client->ssl),
+			SSL_session_reused(client->ssl) ? "resumed" : "new");
 		break;
 		
 	case 0:
@@ -367,6 +391,78 @@ void net_starttls(nut_ctype_t *client, int numarg, const char **arg)
 #endif /* WITH_OPENSSL | WITH_NSS */
 }
 
+#ifdef WITH_OPENSSL
+
+/* reuse the saved keys unless renew is set or they are stale */
+static void ssl_ticket_keys(int renew)
+{
+	unsigned char	keys[SMALLBUF];
+	struct stat	st;
+	time_t	now;
+	long	len;
+	int	fd;
+
+	len = SSL_CTX_get_tlsext_ticket_keys(ssl_ctx, NULL, 0);
+
+	if ((len <= 0) || (len > (long) sizeof(keys))) {
+		upsdebugx(2, "ssl_ticket_keys: unexpected key size %ld", len);
+		return;
+	}
+
+	time(&now);
+	fd = renew ? -1 : open(SSL_TICKET_KEYS_FILE, O_RDONLY);
+
+	if (fd >= 0) {
+		if ((fstat(fd, &st) == 0) && (st.st_mtime <= now) &&
+			(now - st.st_mtime < SSL_TICKET_KEYS_LIFETIME) &&
+			(read(fd, keys, len) == len)) {
+
+			close(fd);
+
+			if (SSL_CTX_set_tlsext_ticket_keys(ssl_ctx, keys, len) == 1) {
+				upsdebugx(2, "ssl_ticket_keys: reusing keys from %s", SSL_TICKET_KEYS_FILE);
+				ssl_ticket_keys_time = st.st_mtime;
+			}
+
+			memset(keys, 0, sizeof(keys));
+			return;
+		}
+
+		close(fd);
+	}
+
+	/* missing, stale or damaged: pick new ones */
+	if (RAND_bytes(keys, len) != 1) {
+		ssl_debug();
+		return;
+	}
+
+	if (SSL_CTX_set_tlsext_ticket_keys(ssl_ctx, keys, len) != 1) {
+		ssl_debug();
+		memset(keys, 0, sizeof(keys));
+		return;
+	}
+
+	upsdebugx(2, "ssl_ticket_keys: new keys");
+	ssl_ticket_keys_time = now;
+
+	unlink(SSL_TICKET_KEYS_FILE);
+	fd = open(SSL_TICKET_KEYS_FILE, O_WRONLY | O_CREAT | O_EXCL, 0600);
+
+	if ((fd < 0) || (write(fd, keys, len) != len)) {
+		upslog_with_errno(LOG_NOTICE, "Can't save the session ticket keys to %s", SSL_TICKET_KEYS_FILE);
+		unlink(SSL_TICKET_KEYS_FILE);
+	}
+
+	if (fd >= 0) {
+		close(fd);
+	}
+
+	memset(keys, 0, sizeof(keys));
+}
+
+#endif /* WITH_OPENSSL */
+
 void ssl_init(void)
 {
 #ifdef WITH_NSS
@@ -427,6 +523,12 @@ void ssl_init(void)
 
 	SSL_CTX_set_verify(ssl_ctx, SSL_VERIFY_NONE, NULL);
 
+	/* resume sessions, by ID or by ticket */
+	SSL_CTX_set_session_id_context(ssl_ctx, (const unsigned char *) "upsd", 4);
+	SSL_CTX_set_session_cache_mode(ssl_ctx, SSL_SESS_CACHE_SERVER);
+	SSL_CTX_set_timeout(ssl_ctx, SSL_SESSION_LIFETIME);
+	ssl_ticket_keys(0);
+
 	ssl_initialized = 1;
 		
 #elif defined(WITH_NSS) /* WITH_OPENSSL */
@@ -482,6 +584,14 @@ void ssl_init(void)
 		return;
 	}
 
+	/* session IDs are in the cache configured above, tickets let the
+	 * clients resume without it */
+	status = SSL_OptionSetDefault(SSL_ENABLE_SESSION_TICKETS, PR_TRUE);
+	if (status != SECSuccess) {
+		upslogx(LOG_NOTICE, "Can not enable session tickets");
+		nss_error("ssl_init / SSL_OptionSetDefault(SSL_ENABLE_SESSION_TICKETS)");
+	}
+
 #ifdef WITH_CLIENT_CERTIFICATE_VALIDATION
 	if (certrequest < NETSSL_CERTREQ_NO &&
 		certrequest > NETSSL_CERTREQ_REQUEST) {
@@ -584,6 +694,26 @@ void ssl_finish(nut_ctype_t *client)
 	}
 }
 
+void ssl_renew(void)
+{
+#ifdef WITH_OPENSSL
+	time_t	now;
+
+	if (!ssl_initialized) {
+		return;
+	}
+
+	time(&now);
+
+	/* the tickets made with the old keys get a full handshake once;
+	 * a clock set back doesn't leave the keys in use for longer */
+	if ((now < ssl_ticket_keys_time) ||
+		(now - ssl_ticket_keys_time >= SSL_TICKET_KEYS_LIFETIME)) {
+		ssl_ticket_keys(1);
+	}
+#endif /* WITH_OPENSSL */
+}
+
 void ssl_cleanup(void)
 {
 #ifdef WITH_OPENSSL
@@ -48,6 +48,9 @@ void ssl_init(void);
 void ssl_finish(nut_ctype_t *client);
 void ssl_cleanup(void);
 
+/* renew the session ticket keys when they are due */
+void ssl_renew(void);
+
 int ssl_read(nut_ctype_t *client, char *buf, size_t buflen);
 int ssl_write(nut_ctype_t *client, const char *buf, size_t buflen);
 
@@ -41,6 +41,7 @@
 typedef struct nut_ctype_s {
 	char	*addr;
 	int	sock_fd;
+	int	local;	/* connected through the Unix socket */
 	time_t	last_heard;
 	char	*loginups;
 	char	*password;
@@ -60,6 +61,11 @@ typedef struct nut_ctype_s {
 
 	PCONF_CTX_t	ctx;
 
+	/* answers held back to go out in one write, see sendback() */
+	char	*outbuf;
+	size_t	outlen;
+	int	outhold;
+
 	/* doubly linked list */
 	struct nut_ctype_s	*prev;
 	struct nut_ctype_s	*next;
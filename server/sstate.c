@@ -321,6 +321,11 @@ int sstate_getflags(const upstype_t *ups, const char *var)
 	return state_getflags(ups->inforoot, var);
 }	
 
+int sstate_getnumber(const upstype_t *ups, const char *var, double *number)
+{
+	return state_getnumber(ups->inforoot, var, number);
+}
+
 int sstate_getaux(const upstype_t *ups, const char *var)
 {
 	return state_getaux(ups->inforoot, var);
@@ -37,6 +37,10 @@ extern "C" {
 /* *INDENT-ON* */
 #endif
 
+/* LISTEN address prefix for a Unix socket, and its default name */
+#define UNIX_PREFIX	"unix:"
+#define UNIX_SOCKET	"upsd.sock"
+
 typedef struct stype_s {
 	char	*addr;
 	char	*port;
@@ -29,6 +29,7 @@
 #include "upsconf.h"
 
 #include <sys/un.h>
+#include <sys/stat.h>
 #include <sys/socket.h>
 #include <netdb.h>
 #include <poll.h>
@@ -206,6 +207,108 @@ void listen_add(const char *addr, const char *port)
 	upsdebugx(3, "listen_add: added %s:%s", server->addr, server->port);
 }
 
+/* LISTEN unix:<path> selects a Unix socket rather than a TCP port */
+static int is_unix(const stype_t *server)
+{
+	return !strncmp(server->addr, UNIX_PREFIX, strlen(UNIX_PREFIX));
+}
+
+/* remove the socket fn, but nothing else that the config may name
+ * returns 0 if it is gone, -1 with errno set otherwise */
+static int unlink_socket(const char *fn)
+{
+	struct stat	st;
+
+	if (lstat(fn, &st) < 0) {
+		return (errno == ENOENT) ? 0 : -1;
+	}
+
+	if (!S_ISSOCK(st.st_mode)) {
+		errno = EEXIST;
+		return -1;
+	}
+
+	return unlink(fn);
+}
+
+/* create a listening socket for local connections */
+static void setupunix(stype_t *server)
+{
+	struct sockaddr_un	ssaddr;
+	const char	*path = server->addr + strlen(UNIX_PREFIX);
+	char	fn[SMALLBUF];
+	int	sock_fd, v;
+
+	/* relative names are in the state path, next to the driver sockets */
+	if (*path == '\0') {
+		path = UNIX_SOCKET;
+	}
+
+	if (*path == '/') {
+		snprintf(fn, sizeof(fn), "%s", path);
+	} else {
+		snprintf(fn, sizeof(fn), "%s/%s", statepath, path);
+	}
+
+	/* keep the full name for the logs and for the unlink() when exiting */
+	free(server->addr);
+	server->addr = xmalloc(strlen(UNIX_PREFIX) + strlen(fn) + 1);
+	sprintf(server->addr, "%s%s", UNIX_PREFIX, fn);
+
+	upsdebugx(3, "setupunix: try to bind to %s", fn);
+
+	if (strlen(fn) >= sizeof(ssaddr.sun_path)) {
+		upslogx(LOG_ERR, "not listening on %s (name too long)", fn);
+		return;
+	}
+
+	if ((sock_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+		upslog_with_errno(LOG_ERR, "not listening on %s (socket)", fn);
+		return;
+	}
+
+	memset(&ssaddr, 0, sizeof(ssaddr));
+	ssaddr.sun_family = AF_UNIX;
+	snprintf(ssaddr.sun_path, sizeof(ssaddr.sun_path), "%s", fn);
+
+	/* a stale socket from a previous run would make bind() fail */
+	if (unlink_socket(fn) < 0) {
+		upslog_with_errno(LOG_ERR, "not listening on %s (not a socket, or can't remove it)", fn);
+		close(sock_fd);
+		return;
+	}
+
+	if (bind(sock_fd, (struct sockaddr *) &ssaddr, sizeof(ssaddr)) < 0) {
+		upslog_with_errno(LOG_ERR, "not listening on %s (bind)", fn);
+		close(sock_fd);
+		return;
+	}
+
+	/* same audience as the loopback interface: upsd.users still applies */
+	if (chmod(fn, 0666) < 0) {
+		fatal_with_errno(EXIT_FAILURE, "setupunix: chmod(%s, 0666)", fn);
+	}
+
+	if ((v = fcntl(sock_fd, F_GETFL, 0)) == -1) {
+		fatal_with_errno(EXIT_FAILURE, "setupunix: fcntl(get)");
+	}
+
+	if (fcntl(sock_fd, F_SETFL, v | O_NDELAY) == -1) {
+		fatal_with_errno(EXIT_FAILURE, "setupunix: fcntl(set)");
+	}
+
+	if (listen(sock_fd, 16) < 0) {
+		upslog_with_errno(LOG_ERR, "not listening on %s (listen)", fn);
+		close(sock_fd);
+		unlink_socket(fn);
+		return;
+	}
+
+	server->sock_fd = sock_fd;
+
+	upslogx(LOG_INFO, "listening on %s", fn);
+}
+
 /* create a listening socket for tcp connections */
 static void setuptcp(stype_t *server)
 {
@@ -330,6 +433,7 @@ static void client_disconnect(nut_ctype_t *client)
 		/* lastclient = client->prev; */
 	}
 
+	free(client->outbuf);
 	free(client->addr);
 	free(client->loginups);
 	free(client->password);
@@ -339,7 +443,46 @@ static void client_disconnect(nut_ctype_t *client)
 	return;
 }
 
-/* send the buffer <sendbuf> of length <sendlen> to host <dest> */
+static int client_write(nut_ctype_t *client, const char *buf, size_t len)
+{
+	int	res;
+
+#ifdef WITH_SSL
+	if (client->ssl) {
+		res = ssl_write(client, buf, len);
+	} else 
+#endif /* WITH_SSL */
+	{
+		res = write(client->sock_fd, buf, len);
+	}
+
+	if ((res < 0) || ((size_t)res != len)) {
+		upslog_with_errno(LOG_NOTICE, "write() failed for %s", client->addr);
+		client->last_heard = 0;
+		return 0;	/* failed */
+	}
+
+	return 1;	/* OK */
+}
+
+/* send what sendback() held back */
+int client_flush(nut_ctype_t *client)
+{
+	size_t	len;
+
+	if ((!client) || (client->outlen == 0)) {
+		return 1;
+	}
+
+	len = client->outlen;
+	client->outlen = 0;
+
+	return client_write(client, client->outbuf, len);
+}
+
+/* send the formatted answer to the client, or hold it back while its
+ * commands are handled (outhold), so that the answers to all the ones
+ * that came in one read, LIST replies included, go out in one write */
 int sendback(nut_ctype_t *client, const char *fmt, ...)
 {
 	int	res, len;
@@ -356,24 +499,23 @@ int sendback(nut_ctype_t *client, const char *fmt, ...)
 
 	len = strlen(ans);
 
-#ifdef WITH_SSL
-	if (client->ssl) {
-		res = ssl_write(client, ans, len);
-	} else 
-#endif /* WITH_SSL */
-	{
-		res = write(client->sock_fd, ans, len);
+	if (!client->outhold) {
+		res = client_write(client, ans, len);
+	} else if ((client->outlen + len > NUT_NET_OUTBUF) && (!client_flush(client))) {
+		res = 0;
+	} else {
+		if (!client->outbuf) {
+			client->outbuf = xmalloc(NUT_NET_OUTBUF);
+		}
+
+		memcpy(client->outbuf + client->outlen, ans, len);
+		client->outlen += len;
+		res = 1;
 	}
 
 	upsdebugx(2, "write: [destfd=%d] [len=%d] [%s]", client->sock_fd, len, str_rtrim(ans, '\n'));
 
-	if (len != res) {
-		upslog_with_errno(LOG_NOTICE, "write() failed for %s", client->addr);
-		client->last_heard = 0;
-		return 0;	/* failed */
-	}
-
-	return 1;	/* OK */
+	return res;
 }
 
 /* just a simple wrapper for now */
@@ -449,7 +591,8 @@ static void check_command(int cmdnum, nut_ctype_t *client, int numarg,
 		request_init(&req, RQ_DAEMON, progname, RQ_FILE, client->sock_fd, RQ_USER, client->username, 0);
 		fromhost(&req);
 
-		if (!hosts_access(&req)) {
+		/* tcp-wrappers knows nothing about local sockets */
+		if (!client->local && !hosts_access(&req)) {
 			/* tcp-wrappers says access should be denied */
 			send_err(client, NUT_ERR_ACCESS_DENIED);
 			return;
@@ -484,6 +627,24 @@ static void parse_net(nut_ctype_t *client)
 	send_err(client, NUT_ERR_UNKNOWN_COMMAND);
 }
 
+/* identify a client of the Unix socket, when the system tells who it is */
+static const char *unix_peer(int fd)
+{
+#ifdef SO_PEERCRED
+	static char	str[SMALLBUF];
+	struct ucred	cred;
+	socklen_t	len = sizeof(cred);
+
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0) {
+		snprintf(str, sizeof(str), "local (uid %u, pid %u)",
+			(unsigned int) cred.uid, (unsigned int) cred.pid);
+		return str;
+	}
+#endif	/* SO_PEERCRED */
+
+	return "local";
+}
+
 /* answer incoming tcp connections */
 static void client_connect(stype_t *server)
 {
@@ -509,7 +670,12 @@ static void client_connect(stype_t *server)
 
 	time(&client->last_heard);
 
-	client->addr = xstrdup(inet_ntopW(&csock));
+	if (is_unix(server)) {
+		client->local = 1;
+		client->addr = xstrdup(unix_peer(fd));
+	} else {
+		client->addr = xstrdup(inet_ntopW(&csock));
+	}
 
 	client->tracking = 0;
 
@@ -560,6 +726,9 @@ static void client_readline(nut_ctype_t *client)
 		return;
 	}
 
+	/* answer all the commands of this read at once */
+	client->outhold = 1;
+
 	/* fragment handling code */
 	for (i = 0; i < ret; i++) {
 
@@ -577,10 +746,16 @@ static void client_readline(nut_ctype_t *client)
 		default:
 			/* parse error */
 			upslogx(LOG_NOTICE, "Parse error on sock: %s", client->ctx.errmsg);
-			return;
+			break;
 		}
+
+		/* not reading any further after a parse error */
+		break;
 	}
 
+	client->outhold = 0;
+	client_flush(client);
+
 	return;
 }
 
@@ -600,13 +775,21 @@ void server_load(void)
 	}
 
 	for (server = firstaddr; server; server = server->next) {
-		setuptcp(server);
+		if (is_unix(server)) {
+			setupunix(server);
+		} else {
+			setuptcp(server);
+		}
 	}
 	
 	/* check if we have at least 1 valid LISTEN interface */
-	if (firstaddr->sock_fd < 0) {
-		fatalx(EXIT_FAILURE, "no listening interface available");
+	for (server = firstaddr; server; server = server->next) {
+		if (server->sock_fd >= 0) {
+			return;
+		}
 	}
+
+	fatalx(EXIT_FAILURE, "no listening interface available");
 }
 
 void server_free(void)
@@ -619,6 +802,10 @@ void server_free(void)
 
 		if (server->sock_fd != -1) {
 			close(server->sock_fd);
+
+			if (is_unix(server)) {
+				unlink_socket(server->addr + strlen(UNIX_PREFIX));
+			}
 		}
 
 		free(server->addr);
@@ -940,6 +1127,9 @@ static void mainloop(void)
 	/* cleanup instcmd/setvar status tracking entries if needed */
 	tracking_cleanup();
 
+	/* rotate the TLS session ticket keys */
+	ssl_renew();
+
 	/* scan through driver sockets */
 	for (ups = firstups; ups && (nfds < maxconn); ups = ups->next) {
 
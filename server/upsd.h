@@ -45,6 +45,9 @@
 
 #define NUT_NET_ANSWER_MAX SMALLBUF
 
+/* how much of the answers to a client's commands can be held back */
+#define NUT_NET_OUTBUF	(16 * NUT_NET_ANSWER_MAX)
+
 #ifdef __cplusplus
 /* *INDENT-OFF* */
 extern "C" {
@@ -62,6 +65,7 @@ void kick_login_clients(const char *upsname);
 int sendback(nut_ctype_t *client, const char *fmt, ...)
 	__attribute__ ((__format__ (__printf__, 2, 3)));
 int send_err(nut_ctype_t *client, const char *errtype);
+int client_flush(nut_ctype_t *client);
 
 void server_load(void);
 void server_free(void);
@@ -0,0 +1,428 @@
+/* mockupsd - in-process mock upsd for the client library tests
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include "mockupsd.h"
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+/* A plausible driver tree; padded with bench.varN up to the requested size. */
+static const struct {
+	const char	*name;
+	const char	*value;
+} mock_vars[] = {
+	{ "battery.charge",		"100" },
+	{ "battery.charge.low",		"10" },
+	{ "battery.runtime",		"1860" },
+	{ "battery.runtime.low",	"120" },
+	{ "battery.voltage",		"27.3" },
+	{ "device.mfr",			"Mock" },
+	{ "device.model",		"Bench UPS 1500" },
+	{ "device.type",		"ups" },
+	{ "input.frequency",		"50.0" },
+	{ "input.voltage",		"230.4" },
+	{ "output.voltage",		"230.0" },
+	{ "ups.load",			"23" },
+	{ "ups.status",			"OL" },
+	{ "ups.temperature",		"31.5" },
+	{ NULL,				NULL }
+};
+
+MockServer::MockServer(unsigned int devices, unsigned int vars):
+_listen(-1),
+_held(false),
+_connections(0),
+_requests(0),
+_drops(0)
+{
+	_wake[0] = _wake[1] = -1;
+
+	_upslist = "BEGIN LIST UPS\n";
+	for (unsigned int d = 0; d < devices; d++) {
+		char	dev[32];
+		snprintf(dev, sizeof(dev), "ups%u", d);
+
+		_upslist += std::string("UPS ") + dev + " \"Mock UPS\"\n";
+
+		std::string& list = _list[dev];
+		list = std::string("BEGIN LIST VAR ") + dev + "\n";
+
+		for (unsigned int v = 0; v < vars; v++) {
+			char	name[32], value[32];
+
+			if (v < sizeof(mock_vars) / sizeof(mock_vars[0]) - 1) {
+				snprintf(name, sizeof(name), "%s", mock_vars[v].name);
+				snprintf(value, sizeof(value), "%s", mock_vars[v].value);
+			} else {
+				snprintf(name, sizeof(name), "bench.var%u", v);
+				snprintf(value, sizeof(value), "%u.5", v);
+			}
+
+			_get[std::string(dev) + " " + name] = value;
+			list += std::string("VAR ") + dev + " " + name + " \"" + value + "\"\n";
+		}
+
+		list += std::string("END LIST VAR ") + dev + "\n";
+	}
+	_upslist += "END LIST UPS\n";
+}
+
+MockServer::~MockServer()
+{
+	stop();
+}
+
+int MockServer::start()
+{
+	struct sockaddr_in	sa;
+	socklen_t	len = sizeof(sa);
+	int	one = 1;
+
+	_listen = socket(AF_INET, SOCK_STREAM, 0);
+	if (_listen < 0) {
+		return -1;
+	}
+
+	setsockopt(_listen, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	sa.sin_port = 0;
+
+	if ((bind(_listen, (struct sockaddr *)&sa, sizeof(sa)) < 0) ||
+		(listen(_listen, 16) < 0) ||
+		(getsockname(_listen, (struct sockaddr *)&sa, &len) < 0) ||
+		(pipe(_wake) < 0)) {
+		close(_listen);
+		_listen = -1;
+		return -1;
+	}
+
+	_thread = std::thread(&MockServer::run, this);
+
+	return ntohs(sa.sin_port);
+}
+
+void MockServer::stop()
+{
+	if (_thread.joinable()) {
+		wake('q');
+		_thread.join();
+	}
+
+	if (_listen >= 0) {
+		close(_listen);
+		_listen = -1;
+	}
+
+	for (int i = 0; i < 2; i++) {
+		if (_wake[i] >= 0) {
+			close(_wake[i]);
+			_wake[i] = -1;
+		}
+	}
+}
+
+void MockServer::hold(bool held)
+{
+	_held = held;
+
+	/* answer what came in meanwhile */
+	if (!held) {
+		wake('r');
+	}
+}
+
+void MockServer::drop()
+{
+	unsigned long	drops = _drops;
+
+	wake('d');
+
+	while ((_thread.joinable()) && (_drops == drops)) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+}
+
+void MockServer::wake(char cmd)
+{
+	if ((_thread.joinable()) && (write(_wake[1], &cmd, 1) < 0)) {
+		perror("write");
+	}
+}
+
+void MockServer::answer(const std::string& line, std::string& out, bool& bye)
+{
+	char	cmd[16], sub[16], dev[64], var[64];
+	int	n;
+
+	n = sscanf(line.c_str(), "%15s %15s %63s %63s", cmd, sub, dev, var);
+
+	if ((n >= 1) && (!strcmp(cmd, "LOGOUT"))) {
+		out += "OK Goodbye\n";
+		bye = true;
+		return;
+	}
+
+	if ((n >= 1) && (!strcmp(cmd, "VER"))) {
+		out += "Network UPS Tools upsd (nutbench mock)\n";
+		return;
+	}
+
+	if ((n >= 1) && (!strcmp(cmd, "NETVER"))) {
+		out += "1.2\n";
+		return;
+	}
+
+	if ((n == 2) && (!strcmp(cmd, "LIST")) && (!strcmp(sub, "UPS"))) {
+		out += _upslist;
+		return;
+	}
+
+	if ((n == 3) && (!strcmp(cmd, "LIST")) && (!strcmp(sub, "VAR"))) {
+		std::map<std::string,std::string>::const_iterator	it = _list.find(dev);
+
+		if (it == _list.end()) {
+			out += "ERR UNKNOWN-UPS\n";
+		} else {
+			out += it->second;
+		}
+		return;
+	}
+
+	if ((n == 3) && (!strcmp(cmd, "GET")) && (!strcmp(sub, "UPSDESC"))) {
+		if (_list.find(dev) == _list.end()) {
+			out += "ERR UNKNOWN-UPS\n";
+		} else {
+			out += std::string("UPSDESC ") + dev + " \"Mock UPS\"\n";
+		}
+		return;
+	}
+
+	if ((n == 4) && (!strcmp(cmd, "SET")) && (!strcmp(sub, "VAR"))) {
+		std::map<std::string,std::string>::iterator	it;
+		std::string	value;
+		size_t	pos;
+
+		if (_list.find(dev) == _list.end()) {
+			out += "ERR UNKNOWN-UPS\n";
+			return;
+		}
+
+		it = _get.find(std::string(dev) + " " + var);
+		if (it == _get.end()) {
+			out += "ERR VAR-NOT-SUPPORTED\n";
+			return;
+		}
+
+		/* the value is the quoted rest of the line, without escapes */
+		pos = line.find('"');
+		if ((pos == std::string::npos) || (line.size() < pos + 2) || (line[line.size() - 1] != '"')) {
+			out += "ERR INVALID-ARGUMENT\n";
+			return;
+		}
+		value = line.substr(pos + 1, line.size() - pos - 2);
+
+		/* render the LIST VAR line again */
+		std::string&	list = _list[dev];
+		std::string	old = std::string("VAR ") + dev + " " + var + " \"" + it->second + "\"\n";
+
+		pos = list.find(old);
+		if (pos != std::string::npos) {
+			list.replace(pos, old.size(), std::string("VAR ") + dev + " " + var + " \"" + value + "\"\n");
+		}
+
+		it->second = value;
+		out += "OK\n";
+		return;
+	}
+
+	if ((n == 4) && (!strcmp(cmd, "GET")) &&
+		((!strcmp(sub, "VAR")) || (!strcmp(sub, "VARNUM")))) {
+		std::map<std::string,std::string>::const_iterator	it;
+
+		if (_list.find(dev) == _list.end()) {
+			out += "ERR UNKNOWN-UPS\n";
+			return;
+		}
+
+		it = _get.find(std::string(dev) + " " + var);
+		if (it == _get.end()) {
+			out += "ERR VAR-NOT-SUPPORTED\n";
+			return;
+		}
+
+		if (!strcmp(sub, "VAR")) {
+			out += std::string("VAR ") + dev + " " + var + " \"" + it->second + "\"\n";
+			return;
+		}
+
+		char	*end;
+		strtod(it->second.c_str(), &end);
+
+		if ((end == it->second.c_str()) || (*end != '\0')) {
+			out += "ERR INVALID-VALUE\n";
+			return;
+		}
+
+		/* as upsd: the text, once it parses as a number */
+		out += std::string("VARNUM ") + dev + " " + var + " " + it->second + "\n";
+		return;
+	}
+
+	out += "ERR UNKNOWN-COMMAND\n";
+}
+
+/* Answer the complete lines received on fd, return false to close it. */
+bool MockServer::serve(int fd, std::string& in)
+{
+	std::string	out;
+	bool	bye = false;
+	size_t	pos;
+	ssize_t	ret;
+
+	while ((!bye) && ((pos = in.find('\n')) != std::string::npos)) {
+		std::string	line = in.substr(0, pos);
+
+		in.erase(0, pos + 1);
+
+		if ((!line.empty()) && (line[line.size() - 1] == '\r')) {
+			line.erase(line.size() - 1);
+		}
+
+		answer(line, out, bye);
+	}
+
+	for (size_t sent = 0; sent < out.size(); ) {
+		ret = write(fd, out.data() + sent, out.size() - sent);
+		if (ret <= 0) {
+			return false;
+		}
+		sent += ret;
+	}
+
+	return !bye;
+}
+
+void MockServer::run()
+{
+	std::map<int,std::string>	inbuf;
+
+	for (;;) {
+		std::vector<struct pollfd>	fds;
+		struct pollfd	pfd;
+
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+
+		pfd.fd = _wake[0];
+		fds.push_back(pfd);
+		pfd.fd = _listen;
+		fds.push_back(pfd);
+
+		for (std::map<int,std::string>::const_iterator it = inbuf.begin(); it != inbuf.end(); ++it) {
+			pfd.fd = it->first;
+			fds.push_back(pfd);
+		}
+
+		if (poll(&fds[0], fds.size(), -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+
+		if (fds[0].revents) {
+			char	cmd;
+
+			if ((read(_wake[0], &cmd, 1) != 1) || (cmd == 'q')) {
+				break;
+			}
+
+			for (std::map<int,std::string>::iterator it = inbuf.begin(); it != inbuf.end(); ) {
+				if ((cmd == 'd') || (!serve(it->first, it->second))) {
+					close(it->first);
+					inbuf.erase(it++);
+				} else {
+					++it;
+				}
+			}
+
+			if (cmd == 'd') {
+				_drops++;
+			}
+
+			/* the fds polled may be gone */
+			continue;
+		}
+
+		if (fds[1].revents & POLLIN) {
+			int	fd = accept(_listen, NULL, NULL);
+
+			if (fd >= 0) {
+				inbuf[fd];
+				_connections++;
+			}
+		}
+
+		for (size_t i = 2; i < fds.size(); i++) {
+			char	buf[4096];
+			ssize_t	ret;
+			bool	keep = true;
+
+			if (!fds[i].revents) {
+				continue;
+			}
+
+			ret = read(fds[i].fd, buf, sizeof(buf));
+
+			if (ret > 0) {
+				std::string&	in = inbuf[fds[i].fd];
+
+				in.append(buf, ret);
+				_requests += std::count(buf, buf + ret, '\n');
+
+				if (!_held) {
+					keep = serve(fds[i].fd, in);
+				}
+			} else {
+				keep = false;
+			}
+
+			if (!keep) {
+				close(fds[i].fd);
+				inbuf.erase(fds[i].fd);
+			}
+		}
+	}
+
+	for (std::map<int,std::string>::const_iterator it = inbuf.begin(); it != inbuf.end(); ++it) {
+		close(it->first);
+	}
+}
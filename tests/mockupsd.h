@@ -0,0 +1,78 @@
+/* mockupsd - in-process mock upsd for the client library tests
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef NUT_MOCKUPSD_H_SEEN
+#define NUT_MOCKUPSD_H_SEEN 1
+
+#include <atomic>
+#include <map>
+#include <string>
+#include <thread>
+
+/*
+ * Mock upsd.
+ *
+ * Answers the subset of the protocol the clients use (GET VAR, GET VARNUM,
+ * GET UPSDESC, LIST UPS, LIST VAR, SET VAR, VER, NETVER, LOGOUT) from
+ * answers rendered once at startup (SET VAR edits them in place), so that
+ * its own cost stays small and constant.  A single thread serves every
+ * connection with poll().
+ *
+ * Devices are named ups0, ups1...  The tests can also hold the answers
+ * back, to see what a client sends before it has any, and drop the
+ * connections, as a restarting upsd would.
+ */
+class MockServer
+{
+public:
+	MockServer(unsigned int devices, unsigned int vars);
+	~MockServer();
+
+	/* Listen on an ephemeral loopback port and return it. */
+	int start();
+	void stop();
+
+	/* While held, requests are read and counted but not answered. */
+	void hold(bool held);
+	/* Close every client connection, and return once they are closed. */
+	void drop();
+
+	/* Connections accepted and request lines read, since start(). */
+	unsigned long connections() const { return _connections; }
+	unsigned long requests() const { return _requests; }
+
+private:
+	void run();
+	void answer(const std::string& line, std::string& out, bool& bye);
+	bool serve(int fd, std::string& in);
+	void wake(char cmd);
+
+	int _listen;
+	int _wake[2];
+	std::thread _thread;
+
+	std::atomic<bool> _held;
+	std::atomic<unsigned long> _connections;
+	std::atomic<unsigned long> _requests;
+	std::atomic<unsigned long> _drops;
+
+	std::string _upslist;
+	std::map<std::string,std::string> _get;		/* "dev var" -> value */
+	std::map<std::string,std::string> _list;	/* dev -> LIST VAR answer */
+};
+
+#endif /* NUT_MOCKUPSD_H_SEEN */
@@ -0,0 +1,484 @@
+/* nutbench - throughput and latency benchmark for the NUT client libraries
+
+   Drives libupsclient (C) and libnutclient (C++) against an in-process
+   mock upsd serving a generated device tree, or against a real upsd
+   given with -H/-p, and reports requests per second, p50/p99 latency
+   and heap allocations per request for each scenario.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include "config.h"
+
+#include "nutclient.h"
+#include "upsclient.h"
+#include "mockupsd.h"
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * Allocation counting.
+ *
+ * glibc exports its allocator as __libc_malloc() and friends, so the
+ * program can interpose malloc() without dlsym() tricks.  The counter is
+ * per thread: the mock server runs in its own thread and its allocations
+ * must not be charged to the client under test.  operator new goes
+ * through malloc(), so C++ allocations are counted as well.
+ */
+#ifdef __GLIBC__
+
+static __thread unsigned long alloc_count;
+
+extern "C" {
+
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t nmemb, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size) __THROW
+{
+	alloc_count++;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) __THROW
+{
+	alloc_count++;
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) __THROW
+{
+	alloc_count++;
+	return __libc_realloc(ptr, size);
+}
+
+}
+
+#define HAVE_ALLOC_COUNT 1
+
+#endif /* __GLIBC__ */
+
+static unsigned long get_alloc_count()
+{
+#ifdef HAVE_ALLOC_COUNT
+	return alloc_count;
+#else
+	return 0;
+#endif
+}
+
+/*
+ * Measurement.
+ */
+
+struct BenchResult
+{
+	std::string	name;
+	unsigned int	requests;
+	double	seconds;
+	double	p50;	/* microseconds */
+	double	p99;
+	double	allocs;	/* per request */
+};
+
+struct BenchError
+{
+	BenchError(const std::string& msg):what(msg) {}
+	std::string	what;
+};
+
+typedef std::chrono::steady_clock bench_clock;
+
+template<typename Step>
+static BenchResult measure(const char *name, unsigned int iterations, Step step)
+{
+	BenchResult	res;
+	std::vector<double>	lat(iterations);
+	unsigned long	allocs;
+
+	/* warm up connections, caches and the branch predictor */
+	for (unsigned int i = 0; i < iterations / 10; i++) {
+		step(i);
+	}
+
+	allocs = get_alloc_count();
+	bench_clock::time_point	start = bench_clock::now();
+
+	for (unsigned int i = 0; i < iterations; i++) {
+		bench_clock::time_point	t0 = bench_clock::now();
+		step(i);
+		lat[i] = std::chrono::duration<double, std::micro>(bench_clock::now() - t0).count();
+	}
+
+	res.seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+	res.allocs = (double)(get_alloc_count() - allocs) / iterations;
+
+	std::sort(lat.begin(), lat.end());
+
+	res.name = name;
+	res.requests = iterations;
+	res.p50 = lat[iterations / 2];
+	res.p99 = lat[std::min<size_t>(iterations - 1, (size_t)iterations * 99 / 100)];
+
+	return res;
+}
+
+struct BenchTarget
+{
+	std::string	host;
+	int	port;
+	std::vector<std::string>	devices;
+	std::vector<std::pair<std::string,std::string> >	vars;	/* (dev, var) */
+	std::vector<std::pair<std::string,std::string> >	numvars;
+};
+
+/* Learn the device tree, whether mocked or real, with the C++ client. */
+static void discover(BenchTarget& target)
+{
+	nut::TcpClient	client(target.host, target.port);
+
+	std::set<std::string>	devs = client.getDeviceNames();
+
+	for (std::set<std::string>::const_iterator it = devs.begin(); it != devs.end(); ++it) {
+		std::map<std::string,std::vector<std::string> >	values = client.getDeviceVariableValues(*it);
+
+		target.devices.push_back(*it);
+
+		for (std::map<std::string,std::vector<std::string> >::const_iterator v = values.begin(); v != values.end(); ++v) {
+			char	*end;
+			const char	*str = v->second.empty() ? "" : v->second[0].c_str();
+
+			target.vars.push_back(std::make_pair(*it, v->first));
+
+			strtod(str, &end);
+			if ((end != str) && (*end == '\0')) {
+				target.numvars.push_back(std::make_pair(*it, v->first));
+			}
+		}
+	}
+
+	client.logout();
+
+	if (target.vars.empty()) {
+		throw BenchError("no variables to query");
+	}
+}
+
+/*
+ * Scenarios.  Each one opens its own connection and counts one request
+ * per step: a single GET, a complete LIST VAR of one device, or one round
+ * of LIST VAR for every device pipelined on the connection.
+ */
+
+class CConn
+{
+public:
+	CConn(const BenchTarget& target)
+	{
+		if (upscli_connect(&conn, target.host.c_str(), target.port, 0) < 0) {
+			throw BenchError(std::string("upscli_connect: ") + upscli_strerror(&conn));
+		}
+	}
+
+	~CConn()
+	{
+		upscli_disconnect(&conn);
+	}
+
+	void fail(const char *what)
+	{
+		throw BenchError(std::string(what) + ": " + upscli_strerror(&conn));
+	}
+
+	UPSCONN_t	conn;
+};
+
+static BenchResult bench_c_get(const BenchTarget& target, unsigned int iterations)
+{
+	CConn	c(target);
+
+	return measure("c-get", iterations, [&](unsigned int i) {
+		const std::pair<std::string,std::string>&	q = target.vars[i % target.vars.size()];
+		const char	*query[] = { "VAR", q.first.c_str(), q.second.c_str() };
+		unsigned int	numa;
+		char	**answer;
+
+		if (upscli_get(&c.conn, 3, query, &numa, &answer) < 0) {
+			c.fail("upscli_get");
+		}
+	});
+}
+
+static BenchResult bench_c_list(const BenchTarget& target, unsigned int iterations)
+{
+	CConn	c(target);
+
+	return measure("c-list", iterations, [&](unsigned int i) {
+		const char	*query[] = { "VAR", target.devices[i % target.devices.size()].c_str() };
+		unsigned int	numa;
+		char	**answer;
+		int	ret;
+
+		if (upscli_list_start(&c.conn, 2, query) < 0) {
+			c.fail("upscli_list_start");
+		}
+
+		while ((ret = upscli_list_next(&c.conn, 2, query, &numa, &answer)) == 1)
+			;
+
+		if (ret < 0) {
+			c.fail("upscli_list_next");
+		}
+	});
+}
+
+static BenchResult bench_c_pipeline(const BenchTarget& target, unsigned int iterations)
+{
+	CConn	c(target);
+
+	return measure("c-pipeline", iterations, [&](unsigned int) {
+		char	buf[UPSCLI_NETBUF_LEN];
+
+		for (size_t d = 0; d < target.devices.size(); d++) {
+			int	len = snprintf(buf, sizeof(buf), "LIST VAR %s\n", target.devices[d].c_str());
+
+			if (upscli_queueline(&c.conn, buf, len) < 0) {
+				c.fail("upscli_queueline");
+			}
+		}
+
+		if (upscli_flush(&c.conn) < 0) {
+			c.fail("upscli_flush");
+		}
+
+		for (size_t d = 0; d < target.devices.size(); d++) {
+			do {
+				if (upscli_readline(&c.conn, buf, sizeof(buf)) < 0) {
+					c.fail("upscli_readline");
+				}
+				if (!strncmp(buf, "ERR ", 4)) {
+					throw BenchError(std::string("LIST VAR: ") + buf);
+				}
+			} while (strncmp(buf, "END LIST VAR ", 13));
+		}
+	});
+}
+
+static BenchResult bench_cpp_get(const BenchTarget& target, unsigned int iterations)
+{
+	nut::TcpClient	client(target.host, target.port);
+
+	return measure("cpp-get", iterations, [&](unsigned int i) {
+		const std::pair<std::string,std::string>&	q = target.vars[i % target.vars.size()];
+
+		client.getDeviceVariableValue(q.first, q.second);
+	});
+}
+
+static BenchResult bench_cpp_getnum(const BenchTarget& target, unsigned int iterations)
+{
+	nut::TcpClient	client(target.host, target.port);
+
+	if (target.numvars.empty()) {
+		throw BenchError("no numeric variables to query");
+	}
+
+	return measure("cpp-getnum", iterations, [&](unsigned int i) {
+		const std::pair<std::string,std::string>&	q = target.numvars[i % target.numvars.size()];
+
+		client.getDeviceVariableNumber(q.first, q.second);
+	});
+}
+
+static BenchResult bench_cpp_list(const BenchTarget& target, unsigned int iterations)
+{
+	nut::TcpClient	client(target.host, target.port);
+
+	return measure("cpp-list", iterations, [&](unsigned int i) {
+		client.getDeviceVariableValues(target.devices[i % target.devices.size()]);
+	});
+}
+
+static BenchResult bench_cpp_pipeline(const BenchTarget& target, unsigned int iterations)
+{
+	nut::TcpClient	client(target.host, target.port);
+	std::set<std::string>	devs(target.devices.begin(), target.devices.end());
+
+	return measure("cpp-pipeline", iterations, [&](unsigned int) {
+		client.getDevicesVariableValues(devs);
+	});
+}
+
+static const struct {
+	const char	*name;
+	BenchResult	(*run)(const BenchTarget& target, unsigned int iterations);
+} scenarios[] = {
+	{ "c-get",		bench_c_get		},
+	{ "c-list",		bench_c_list		},
+	{ "c-pipeline",		bench_c_pipeline	},
+	{ "cpp-get",		bench_cpp_get		},
+	{ "cpp-getnum",		bench_cpp_getnum	},
+	{ "cpp-list",		bench_cpp_list		},
+	{ "cpp-pipeline",	bench_cpp_pipeline	},
+	{ NULL,			NULL			}
+};
+
+static void help(const char *prog)
+{
+	printf("Benchmark the NUT client libraries against a mock or real upsd.\n\n");
+	printf("usage: %s [OPTIONS] [SCENARIO ...]\n\n", prog);
+	printf("  -H <host>	- benchmark a running upsd instead of the built-in mock\n");
+	printf("  -p <port>	- port of that upsd (default %d)\n", PORT);
+	printf("  -d <num>	- number of mock devices (default 4)\n");
+	printf("  -v <num>	- number of variables per mock device (default 40)\n");
+	printf("  -n <num>	- requests per scenario (default 10000)\n");
+	printf("  -h		- display this help text\n\n");
+	printf("Scenarios (default: all):");
+	for (int i = 0; scenarios[i].name; i++) {
+		printf(" %s", scenarios[i].name);
+	}
+	printf("\n\nLatencies are in microseconds; allocations are counted per request\n");
+	printf("on the client side only%s.\n",
+#ifdef HAVE_ALLOC_COUNT
+		""
+#else
+		" (not available on this platform)"
+#endif
+		);
+}
+
+int main(int argc, char **argv)
+{
+	BenchTarget	target;
+	unsigned int	devices = 4, vars = 40, iterations = 10000;
+	int	i, ret = EXIT_SUCCESS;
+
+	target.host = "";
+	target.port = PORT;
+
+	while ((i = getopt(argc, argv, "+hH:p:d:v:n:")) != -1) {
+		switch (i)
+		{
+		case 'H':
+			target.host = optarg;
+			break;
+		case 'p':
+			target.port = atoi(optarg);
+			break;
+		case 'd':
+			devices = strtoul(optarg, NULL, 10);
+			break;
+		case 'v':
+			vars = strtoul(optarg, NULL, 10);
+			break;
+		case 'n':
+			iterations = strtoul(optarg, NULL, 10);
+			break;
+		case 'h':
+		default:
+			help(argv[0]);
+			return (i == 'h') ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	if ((devices < 1) || (vars < 1) || (iterations < 1)) {
+		fprintf(stderr, "-d, -v and -n need a positive number\n");
+		return EXIT_FAILURE;
+	}
+
+	for (int a = optind; a < argc; a++) {
+		for (i = 0; scenarios[i].name && strcmp(argv[a], scenarios[i].name); i++)
+			;
+
+		if (!scenarios[i].name) {
+			fprintf(stderr, "unknown scenario: %s\n", argv[a]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	MockServer	mock(devices, vars);
+
+	if (target.host.empty()) {
+		target.host = "127.0.0.1";
+		target.port = mock.start();
+
+		if (target.port < 0) {
+			perror("mock upsd");
+			return EXIT_FAILURE;
+		}
+
+		printf("mock upsd: %u devices, %u variables each\n", devices, vars);
+	} else {
+		printf("upsd at %s:%d\n", target.host.c_str(), target.port);
+	}
+
+	try {
+		discover(target);
+	} catch (nut::NutException& e) {
+		fprintf(stderr, "device discovery: %s\n", e.what());
+		return EXIT_FAILURE;
+	} catch (BenchError& e) {
+		fprintf(stderr, "device discovery: %s\n", e.what.c_str());
+		return EXIT_FAILURE;
+	}
+
+	printf("%-14s %10s %12s %10s %10s %12s\n",
+		"scenario", "requests", "req/s", "p50(us)", "p99(us)", "allocs/req");
+
+	for (i = 0; scenarios[i].name; i++) {
+		bool	selected = (optind >= argc);
+
+		for (int a = optind; a < argc; a++) {
+			if (!strcmp(argv[a], scenarios[i].name)) {
+				selected = true;
+			}
+		}
+
+		if (!selected) {
+			continue;
+		}
+
+		try {
+			BenchResult	r = scenarios[i].run(target, iterations);
+
+			printf("%-14s %10u %12.0f %10.1f %10.1f %12.1f\n",
+				r.name.c_str(), r.requests, r.requests / r.seconds,
+				r.p50, r.p99, r.allocs);
+		} catch (nut::NutException& e) {
+			printf("%-14s failed: %s\n", scenarios[i].name, e.what());
+			ret = EXIT_FAILURE;
+		} catch (BenchError& e) {
+			printf("%-14s failed: %s\n", scenarios[i].name, e.what.c_str());
+			ret = EXIT_FAILURE;
+		}
+
+		fflush(stdout);
+	}
+
+	mock.stop();
+
+	return ret;
+}
@@ -18,11 +18,27 @@
 */
 #include <cppunit/extensions/HelperMacros.h>
 
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
 class NutClientTest : public CppUnit::TestFixture
 {
 	CPPUNIT_TEST_SUITE( NutClientTest );
 		CPPUNIT_TEST( test_stringset_to_strarr );
 		CPPUNIT_TEST( test_stringvector_to_strarr );
+		CPPUNIT_TEST( test_explode );
+		CPPUNIT_TEST( test_async_pipelining );
+		CPPUNIT_TEST( test_async_timeout );
+		CPPUNIT_TEST( test_async_drop );
+		CPPUNIT_TEST( test_caching_ttl );
+		CPPUNIT_TEST( test_caching_changes );
+		CPPUNIT_TEST( test_pool_fanout );
+		CPPUNIT_TEST( test_pool_reconnect );
+		CPPUNIT_TEST( test_shared_handoff );
+		CPPUNIT_TEST( test_shared_threads );
+		CPPUNIT_TEST( test_shared_drop );
 	CPPUNIT_TEST_SUITE_END();
 
 public:
@@ -31,17 +47,117 @@ public:
 
 	void test_stringset_to_strarr();
 	void test_stringvector_to_strarr();
+	void test_explode();
+	void test_async_pipelining();
+	void test_async_timeout();
+	void test_async_drop();
+	void test_caching_ttl();
+	void test_caching_changes();
+	void test_pool_fanout();
+	void test_pool_reconnect();
+	void test_shared_handoff();
+	void test_shared_threads();
+	void test_shared_drop();
 };
 
 // Registers the fixture into the 'registry'
 CPPUNIT_TEST_SUITE_REGISTRATION( NutClientTest );
 
 #include "../clients/nutclient.h"
+#include "mockupsd.h"
 extern "C" {
 strarr stringset_to_strarr(const std::set<std::string>& strset);
 strarr stringvector_to_strarr(const std::vector<std::string>& strset);
 } // extern "C"
 
+namespace {
+// Expose the protocol tokenizer
+class TestTcpClient : public nut::TcpClient
+{
+public:
+	using nut::TcpClient::explode;
+};
+
+// Run the loop until the mock upsd has read n request lines
+bool pump(nut::AsyncLoop& loop, const MockServer& mock, unsigned long n)
+{
+	for(int i = 0; i < 500 && mock.requests() < n; i++)
+	{
+		loop.runOnce(10);
+	}
+	return mock.requests() == n;
+}
+
+// Run a SharedClient request in a thread, keeping its answer or error
+class SharedCall
+{
+public:
+	SharedCall(nut::SharedClient& client, const std::string& dev, const std::string& var):
+	_thread([this, &client, dev, var]()
+	{
+		try
+		{
+			value = client.getDeviceVariableValue(dev, var)[0];
+		}
+		catch(nut::IOException&)
+		{
+			error = "IOException";
+		}
+		catch(nut::NutException& ex)
+		{
+			error = ex.str();
+		}
+	})
+	{
+	}
+
+	void join()
+	{
+		_thread.join();
+	}
+
+	std::string value, error;
+
+private:
+	std::thread _thread;
+};
+
+// Name of a mock upsd in a ClientPool
+std::string poolKey(int port)
+{
+	char buf[32];
+	snprintf(buf, sizeof(buf), "127.0.0.1:%d", port);
+	return buf;
+}
+
+// Name of the exception a future holds, "" if none
+template<typename T>
+std::string failure(const std::shared_future<T>& future)
+{
+	try
+	{
+		future.get();
+	}
+	catch(nut::TimeoutException&)
+	{
+		return "TimeoutException";
+	}
+	catch(nut::NotConnectedException&)
+	{
+		return "NotConnectedException";
+	}
+	catch(nut::IOException&)
+	{
+		return "IOException";
+	}
+	catch(nut::NutException& ex)
+	{
+		return ex.str();
+	}
+	return "";
+}
+} // namespace
+
 void NutClientTest::setUp()
 {
 }
@@ -98,3 +214,474 @@ void NutClientTest::test_stringvector_to_strarr()
 	
 	strarr_free(arr);
 }
+
+void NutClientTest::test_explode()
+{
+	std::vector<std::string> res;
+
+	res = TestTcpClient::explode("VAR ups ups.status \"OL CHRG\"", 8);
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("explode(...) result has not 2 items", (size_t)2, res.size());
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("explode(...) result has not item 0==\"ups.status\"", std::string("ups.status"), res[0]);
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("explode(...) result has not item 1==\"OL CHRG\"", std::string("OL CHRG"), res[1]);
+
+	res = TestTcpClient::explode("esc\\ aped \"q\\\"x\\\\\" \"\"");
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("explode(...) result has not 3 items", (size_t)3, res.size());
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("explode(...) result has not item 0==\"esc aped\"", std::string("esc aped"), res[0]);
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("explode(...) result has not item 1==\"q\\\"x\\\\\"", std::string("q\"x\\"), res[1]);
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("explode(...) result has not empty item 2", std::string(""), res[2]);
+
+	res = TestTcpClient::explode("\"\\n\"");
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("explode(...) does not keep unknown escapes", std::string("\\n"), res[0]);
+
+	res = TestTcpClient::explode("abc", 10);
+	CPPUNIT_ASSERT_MESSAGE("explode(...) past the end is not empty", res.empty());
+}
+
+void NutClientTest::test_async_pipelining()
+{
+	MockServer mock(2, 20);
+	int port = mock.start();
+	CPPUNIT_ASSERT_MESSAGE("can't start the mock upsd", port > 0);
+
+	nut::AsyncLoop loop;
+	nut::AsyncClient client(loop);
+	client.connect("127.0.0.1", port);
+
+	// Nothing is answered until every request is in
+	mock.hold(true);
+
+	std::vector<int> order;
+	std::shared_future<std::vector<std::string> > charge = client.getDeviceVariableValue("ups0", "battery.charge",
+		[&order](const std::shared_future<std::vector<std::string> >&) { order.push_back(0); });
+	std::shared_future<std::map<std::string,std::vector<std::string> > > list = client.getDeviceVariableValues("ups1",
+		[&order](const std::shared_future<std::map<std::string,std::vector<std::string> > >&) { order.push_back(1); });
+	std::shared_future<std::vector<std::string> > missing = client.getDeviceVariableValue("ups0", "no.such.var",
+		[&order](const std::shared_future<std::vector<std::string> >&) { order.push_back(2); });
+	std::shared_future<std::set<std::string> > names = client.getDeviceNames(
+		[&order](const std::shared_future<std::set<std::string> >&) { order.push_back(3); });
+	std::shared_future<std::vector<std::string> > status = client.getDeviceVariableValue("ups1", "ups.status",
+		[&order](const std::shared_future<std::vector<std::string> >&) { order.push_back(4); });
+
+	CPPUNIT_ASSERT_MESSAGE("requests are not sent before the answers", pump(loop, mock, 5));
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("requests completed without answer", (size_t)5, client.pending());
+	CPPUNIT_ASSERT_MESSAGE("requests completed without answer", order.empty());
+
+	mock.hold(false);
+	CPPUNIT_ASSERT_MESSAGE("AsyncLoop::run(...) timed out", loop.run(5000));
+
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("answers are not completed in order", 5, (int)order.size());
+	for(int i = 0; i < 5; i++)
+	{
+		CPPUNIT_ASSERT_EQUAL_MESSAGE("answers are not completed in order", i, order[i]);
+	}
+
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("wrong GET VAR answer", std::string("100"), charge.get()[0]);
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("wrong LIST VAR answer", (size_t)20, list.get().size());
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("wrong LIST VAR answer", std::string("230.4"), list.get().at("input.voltage")[0]);
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("an error is not passed on", std::string("VAR-NOT-SUPPORTED"), failure(missing));
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("wrong LIST UPS answer", (size_t)2, names.get().size());
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("an error upsets the next answers", std::string("OL"), status.get()[0]);
+
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("requests did not share the connection", 1UL, mock.connections());
+	CPPUNIT_ASSERT_MESSAGE("connection dropped", client.isConnected());
+}
+
+void NutClientTest::test_async_timeout()
+{
+	MockServer mock(1, 14);
+	int port = mock.start();
+	CPPUNIT_ASSERT_MESSAGE("can't start the mock upsd", port > 0);
+
+	nut::AsyncLoop loop;
+	nut::AsyncClient client(loop);
+	client.setTimeout(1);
+	client.connect("127.0.0.1", port);
+
+	mock.hold(true);
+
+	std::shared_future<std::vector<std::string> > first = client.getDeviceVariableValue("ups0", "ups.load");
+	std::shared_future<std::vector<std::string> > second = client.getDeviceVariableValue("ups0", "ups.status");
+
+	CPPUNIT_ASSERT_MESSAGE("AsyncLoop::run(...) does not end on timeout", loop.run(5000));
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("late answer does not time out", std::string("TimeoutException"), failure(first));
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("next answer does not time out", std::string("TimeoutException"), failure(second));
+
+	// The answers could not be matched any more
+	CPPUNIT_ASSERT_MESSAGE("connection kept after a timeout", !client.isConnected());
+	CPPUNIT_ASSERT_THROW_MESSAGE("request accepted while disconnected",
+		client.getDeviceVariableValue("ups0", "ups.load"), nut::NotConnectedException);
+
+	mock.hold(false);
+	client.connect("127.0.0.1", port);
+	std::shared_future<std::vector<std::string> > again = client.getDeviceVariableValue("ups0", "ups.load");
+	CPPUNIT_ASSERT_MESSAGE("AsyncLoop::run(...) timed out", loop.run(5000));
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("wrong answer after reconnection", std::string("23"), again.get()[0]);
+}
+
+void NutClientTest::test_async_drop()
+{
+	MockServer mock(1, 14);
+	int port = mock.start();
+	CPPUNIT_ASSERT_MESSAGE("can't start the mock upsd", port > 0);
+
+	nut::AsyncLoop loop;
+	nut::AsyncClient client(loop);
+
+	// upsd goes away with requests in flight
+	client.connect("127.0.0.1", port);
+	mock.hold(true);
+
+	std::shared_future<std::vector<std::string> > first = client.getDeviceVariableValue("ups0", "ups.load");
+	std::shared_future<std::set<std::string> > second = client.getDeviceNames();
+
+	CPPUNIT_ASSERT_MESSAGE("requests are not sent", pump(loop, mock, 2));
+	mock.drop();
+
+	CPPUNIT_ASSERT_MESSAGE("AsyncLoop::run(...) does not end on disconnection", loop.run(5000));
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("request survives the connection", std::string("IOException"), failure(first));
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("request survives the connection", std::string("IOException"), failure(second));
+	CPPUNIT_ASSERT_MESSAGE("connection still open", !client.isConnected());
+
+	// disconnect() fails the pending requests at once
+	mock.hold(false);
+	client.connect("127.0.0.1", port);
+
+	bool called = false;
+	std::shared_future<std::vector<std::string> > local = client.getDeviceVariableValue("ups0", "ups.load",
+		[&called](const std::shared_future<std::vector<std::string> >&) { called = true; });
+	client.disconnect();
+
+	CPPUNIT_ASSERT_MESSAGE("disconnect() does not call back", called);
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("disconnect() does not fail the request", std::string("NotConnectedException"), failure(local));
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("requests left after disconnect()", (size_t)0, loop.pending());
+
+	// A callback may delete its own client, with answers still buffered
+	nut::AsyncClient* owned = new nut::AsyncClient(loop);
+	owned->connect("127.0.0.1", port);
+
+	int calls = 0;
+	std::shared_future<std::vector<std::string> > deleting = owned->getDeviceVariableValue("ups0", "ups.load",
+		[&calls, &owned](const std::shared_future<std::vector<std::string> >&) { calls++; delete owned; owned = NULL; });
+	std::shared_future<std::vector<std::string> > orphan = owned->getDeviceVariableValue("ups0", "ups.status",
+		[&calls](const std::shared_future<std::vector<std::string> >&) { calls++; });
+
+	CPPUNIT_ASSERT_MESSAGE("AsyncLoop::run(...) timed out", loop.run(5000));
+	CPPUNIT_ASSERT_MESSAGE("client not deleted", owned == NULL);
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("callbacks not called once each", 2, calls);
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("wrong answer before deletion", std::string("23"), deleting.get()[0]);
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("request survives its client", std::string("NotConnectedException"), failure(orphan));
+}
+
+void NutClientTest::test_caching_ttl()
+{
+	MockServer mock(2, 14);
+	int port = mock.start();
+	CPPUNIT_ASSERT_MESSAGE("can't start the mock upsd", port > 0);
+
+	nut::TcpClient tcp("127.0.0.1", port);
+	nut::CachingClient cache(&tcp, 60000);
+	unsigned long sent = mock.requests();
+
+	// Served from the cache after the first time
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("wrong value", std::string("23"), cache.getDeviceVariableValue("ups0", "ups.load")[0]);
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("wrong cached value", std::string("23"), cache.getDeviceVariableValue("ups0", "ups.load")[0]);
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("wrong description", std::string("Mock UPS"), cache.getDeviceDescription("ups0"));
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("wrong cached description", std::string("Mock UPS"), cache.getDeviceDescription("ups0"));
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("cached data asked again", sent + 2, mock.requests());
+
+	// A LIST VAR answers the GET VAR of any variable
+	cache.getDeviceVariableValues("ups1");
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("wrong value from the list", std::string("OL"), cache.getDeviceVariableValue("ups1", "ups.status")[0]);
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("listed variable asked again", (size_t)14, cache.getDeviceVariableValues("ups1").size());
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("listed data asked again", sent + 3, mock.requests());
+
+	// Writing a variable drops the values of the device
+	cache.setDeviceVariable("ups0", "ups.load", "42");
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("old value after a write", std::string("42"), cache.getDeviceVariableValue("ups0", "ups.load")[0]);
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("value not asked again after a write", sent + 5, mock.requests());
+
+	cache.invalidate("ups1");
+	cache.getDeviceVariableValue("ups1", "ups.status");
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("value not asked again after invalidate(...)", sent + 6, mock.requests());
+
+	// Dynamic data expires, static data doesn't
+	cache.setTTL(50);
+	cache.getDeviceVariableValue("ups1", "device.model");
+	cache.getDeviceVariableValue("ups1", "ups.load");
+	sent = mock.requests();
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("wrong static value", std::string("Bench UPS 1500"), cache.getDeviceVariableValue("ups1", "device.model")[0]);
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("static value expired", sent, mock.requests());
+	cache.getDeviceVariableValue("ups1", "ups.load");
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("dynamic value did not expire", sent + 1, mock.requests());
+
+	cache.addStaticVariable("ups.");
+	cache.getDeviceVariableValue("ups1", "ups.temperature");
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	cache.getDeviceVariableValue("ups1", "ups.temperature");
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("static prefix not honored", sent + 2, mock.requests());
+
+	// No TTL: every dynamic value is asked for
+	cache.setTTL(0);
+	cache.getDeviceVariableValue("ups0", "battery.charge");
+	cache.getDeviceVariableValue("ups0", "battery.charge");
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("cached without TTL", sent + 4, mock.requests());
+}
+
+void NutClientTest::test_caching_changes()
+{
+	MockServer mock(2, 14);
+	int port = mock.start();
+	CPPUNIT_ASSERT_MESSAGE("can't start the mock upsd", port > 0);
+
+	nut::TcpClient tcp("127.0.0.1", port);
+	nut::TcpClient other("127.0.0.1", port);
+	nut::CachingClient cache(&tcp, 60000);
+
+	nut::VariableChanges changes = cache.pollChanges("ups0");
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("first poll does not report everything", (size_t)14, changes.changed.size());
+	CPPUNIT_ASSERT_MESSAGE("first poll reports removals", changes.removed.empty());
+
+	changes = cache.pollChanges("ups0");
+	CPPUNIT_ASSERT_MESSAGE("nothing changed, but the poll says otherwise", changes.empty());
+
+	// Changed behind the cache's back: the poll asks upsd anyway
+	other.setDeviceVariable("ups0", "battery.charge", "87");
+	other.setDeviceVariable("ups1", "ups.status", "OB");
+
+	changes = cache.pollChanges("ups0");
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("change not reported", (size_t)1, changes.changed.size());
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("wrong change reported", std::string("87"), changes.changed["battery.charge"][0]);
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("poll does not refresh the cache", std::string("87"), cache.getDeviceVariableValue("ups0", "battery.charge")[0]);
+
+	std::set<std::string> devs;
+	devs.insert("ups0");
+	devs.insert("ups1");
+
+	std::map<std::string,nut::VariableChanges> all = cache.pollChanges(devs);
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("devices missing from the poll", (size_t)2, all.size());
+	CPPUNIT_ASSERT_MESSAGE("unchanged device reports changes", all["ups0"].empty());
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("first poll of a device does not report everything", (size_t)14, all["ups1"].changed.size());
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("wrong value polled", std::string("OB"), all["ups1"].changed["ups.status"][0]);
+
+	other.setDeviceVariable("ups1", "ups.status", "OL");
+	all = cache.pollChanges(devs);
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("change not reported", (size_t)1, all["ups1"].changed.size());
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("wrong change reported", std::string("OL"), all["ups1"].changed["ups.status"][0]);
+}
+
+void NutClientTest::test_pool_fanout()
+{
+	typedef std::chrono::steady_clock Clock;
+
+	MockServer two(2, 14), one(1, 14), slow(1, 14), gone(1, 14);
+	int twoPort = two.start(), onePort = one.start(), slowPort = slow.start(), gonePort = gone.start();
+	CPPUNIT_ASSERT_MESSAGE("can't start the mock upsds", twoPort > 0 && onePort > 0 && slowPort > 0 && gonePort > 0);
+
+	// Nobody listens there any more
+	gone.stop();
+	slow.hold(true);
+
+	nut::ClientPool pool(3000);
+	pool.addHost("127.0.0.1", twoPort);
+	pool.addHost("127.0.0.1", onePort);
+	pool.addHost("127.0.0.1", slowPort, 200);
+	pool.addHost("127.0.0.1", gonePort);
+	pool.addHost("127.0.0.1", onePort);
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("hosts not added once each", (size_t)4, pool.getHosts().size());
+
+	// The slow host only costs its own deadline
+	Clock::time_point start = Clock::now();
+	nut::PoolResult<std::set<std::string> > names = pool.getDeviceNames();
+	long elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start).count();
+
+	CPPUNIT_ASSERT_MESSAGE("slow host answered before its deadline", elapsed >= 200);
+	CPPUNIT_ASSERT_MESSAGE("slow host delayed the others past its deadline", elapsed < 2000);
+
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("wrong number of answers", (size_t)2, names.values.size());
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("wrong device list", (size_t)2, names.values[poolKey(twoPort)].size());
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("wrong device list", (size_t)1, names.values[poolKey(onePort)].size());
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("wrong number of errors", (size_t)2, names.errors.size());
+	CPPUNIT_ASSERT_MESSAGE("slow host not reported", names.errors.count(poolKey(slowPort)) == 1);
+	CPPUNIT_ASSERT_MESSAGE("unreachable host not reported", names.errors.count(poolKey(gonePort)) == 1);
+
+	pool.removeHost("127.0.0.1", gonePort);
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("host not removed", (size_t)3, pool.getHosts().size());
+
+	// Every device of every host, pipelined on each connection
+	slow.hold(false);
+	unsigned long sent = two.requests();
+
+	nut::PoolResult<std::map<std::string,std::vector<std::string> > > status = pool.getDeviceVariableValue("ups.status");
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("a host did not answer", (size_t)3, status.values.size());
+	CPPUNIT_ASSERT_MESSAGE("a host reports an error", status.errors.empty());
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("wrong device value", std::string("OL"), status.values[poolKey(twoPort)]["ups1"][0]);
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("device list asked again", sent + 2, two.requests());
+
+	// Unsupported by a device: left out, not an error
+	status = pool.getDeviceVariableValue("no.such.var");
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("a host did not answer", (size_t)3, status.values.size());
+	CPPUNIT_ASSERT_MESSAGE("unsupported variable reported", status.errors.empty() && status.values[poolKey(onePort)].empty());
+
+	nut::PoolResult<std::map<std::string,std::map<std::string,std::vector<std::string> > > > all = pool.getDevicesVariableValues();
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("a host did not answer", (size_t)3, all.values.size());
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("wrong devices", (size_t)2, all.values[poolKey(twoPort)].size());
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("wrong variables", (size_t)14, all.values[poolKey(slowPort)]["ups0"].size());
+
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("connection not kept", 1UL, two.connections());
+}
+
+void NutClientTest::test_pool_reconnect()
+{
+	MockServer mock(1, 14), slow(1, 14);
+	int port = mock.start(), slowPort = slow.start();
+	CPPUNIT_ASSERT_MESSAGE("can't start the mock upsds", port > 0 && slowPort > 0);
+
+	nut::ClientPool pool(200);
+	pool.addHost("127.0.0.1", port);
+	pool.addHost("127.0.0.1", slowPort);
+
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("hosts not connected", (size_t)2, pool.checkHealth());
+	CPPUNIT_ASSERT_MESSAGE("connection not kept", pool.isConnected("127.0.0.1", port));
+
+	// upsd restarts while the pool is idle
+	mock.drop();
+	slow.hold(true);
+
+	nut::PoolResult<std::set<std::string> > names = pool.getDeviceNames();
+	CPPUNIT_ASSERT_MESSAGE("closed connection not reopened", names.values.count(poolKey(port)) == 1);
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("closed connection not reopened", 2UL, mock.connections());
+	CPPUNIT_ASSERT_MESSAGE("late host not reported", names.errors.count(poolKey(slowPort)) == 1);
+
+	// The late answers could not be matched: the connection is started over
+	CPPUNIT_ASSERT_MESSAGE("connection kept after a timeout", !pool.isConnected("127.0.0.1", slowPort));
+
+	slow.hold(false);
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("late host not reconnected", (size_t)2, pool.checkHealth());
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("late host not reconnected", 2UL, slow.connections());
+}
+
+void NutClientTest::test_shared_handoff()
+{
+	MockServer mock(2, 14);
+	int port = mock.start();
+	CPPUNIT_ASSERT_MESSAGE("can't start the mock upsd", port > 0);
+
+	nut::SharedClient shared("127.0.0.1", port);
+	mock.hold(true);
+
+	// The first caller leads: it sends its request and waits for upsd
+	SharedCall leader(shared, "ups0", "ups.load");
+	for(int i = 0; i < 500 && mock.requests() < 1; i++)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("leader did not send its request", 1UL, mock.requests());
+
+	// The next ones queue theirs behind it
+	SharedCall follower(shared, "ups1", "ups.status");
+	SharedCall failing(shared, "ups0", "no.such.var");
+	SharedCall last(shared, "ups1", "battery.charge");
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+	// Once the leader has its answer, a follower takes over
+	mock.hold(false);
+	leader.join();
+	follower.join();
+	failing.join();
+	last.join();
+
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("leader: wrong answer", std::string("23"), leader.value);
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("follower: wrong answer", std::string("OL"), follower.value);
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("error not passed to its caller", std::string("VAR-NOT-SUPPORTED"), failing.error);
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("error upsets the next caller", std::string("100"), last.value);
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("requests lost or repeated", 4UL, mock.requests());
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("callers did not share the connection", 1UL, mock.connections());
+
+	// Nobody is left leading
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("client stuck after the handoff", std::string("Mock UPS"), shared.getDeviceDescription("ups1"));
+}
+
+void NutClientTest::test_shared_threads()
+{
+	static const int threads = 8, rounds = 200;
+
+	MockServer mock(2, 14);
+	int port = mock.start();
+	CPPUNIT_ASSERT_MESSAGE("can't start the mock upsd", port > 0);
+
+	nut::SharedClient shared("127.0.0.1", port);
+	std::atomic<int> wrong(0);
+	std::vector<std::thread> workers;
+
+	for(int t = 0; t < threads; t++)
+	{
+		workers.push_back(std::thread([&shared, &wrong, t]()
+		{
+			std::string dev = (t & 1) ? "ups1" : "ups0";
+			for(int i = 0; i < rounds; i++)
+			{
+				try
+				{
+					if(i % 10 == 0)
+					{
+						if(shared.getDeviceVariableValues(dev).size() != 14)
+							wrong++;
+					}
+					else if(shared.getDeviceVariableValue(dev, (i & 1) ? "ups.status" : "input.voltage")[0] != ((i & 1) ? "OL" : "230.4"))
+					{
+						wrong++;
+					}
+				}
+				catch(nut::NutException&)
+				{
+					wrong++;
+				}
+			}
+		}));
+	}
+
+	for(size_t t = 0; t < workers.size(); t++)
+	{
+		workers[t].join();
+	}
+
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("answers went to the wrong caller", 0, (int)wrong);
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("requests lost or repeated", (unsigned long)(threads * rounds), mock.requests());
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("callers did not share the connection", 1UL, mock.connections());
+}
+
+void NutClientTest::test_shared_drop()
+{
+	MockServer mock(1, 14);
+	int port = mock.start();
+	CPPUNIT_ASSERT_MESSAGE("can't start the mock upsd", port > 0);
+
+	nut::SharedClient shared("127.0.0.1", port);
+	mock.hold(true);
+
+	// upsd goes away with the leader and its followers waiting
+	SharedCall leader(shared, "ups0", "ups.load");
+	for(int i = 0; i < 500 && mock.requests() < 1; i++)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	SharedCall follower(shared, "ups0", "ups.status");
+	SharedCall other(shared, "ups0", "battery.charge");
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+	mock.drop();
+	leader.join();
+	follower.join();
+	other.join();
+
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("leader survives the connection", std::string("IOException"), leader.error);
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("follower survives the connection", std::string("IOException"), follower.error);
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("follower survives the connection", std::string("IOException"), other.error);
+	CPPUNIT_ASSERT_MESSAGE("connection still open", !shared.isConnected());
+
+	mock.hold(false);
+	shared.connect();
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("wrong answer after reconnection", std::string("OL"), shared.getDeviceVariableValue("ups0", "ups.status")[0]);
+}
@@ -0,0 +1,279 @@
+/* upslogbintest - CppUnit test of the binary upslog logs
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "../clients/upslogbin.h"
+
+class UpslogBinTest : public CppUnit::TestFixture
+{
+	CPPUNIT_TEST_SUITE( UpslogBinTest );
+		CPPUNIT_TEST( test_roundtrip );
+		CPPUNIT_TEST( test_time );
+		CPPUNIT_TEST( test_cut_record );
+	CPPUNIT_TEST_SUITE_END();
+
+public:
+	void setUp();
+	void tearDown();
+
+	void test_roundtrip();
+	void test_time();
+	void test_cut_record();
+
+private:
+	std::string _fn;
+};
+
+// Registers the fixture into the 'registry'
+CPPUNIT_TEST_SUITE_REGISTRATION( UpslogBinTest );
+
+namespace {
+
+std::vector<unsigned char> read_all(FILE* f)
+{
+	std::vector<unsigned char> buf;
+	unsigned char tmp[512];
+	size_t len;
+
+	fflush(f);
+	rewind(f);
+
+	while((len = fread(tmp, 1, sizeof(tmp), f)) > 0)
+	{
+		buf.insert(buf.end(), tmp, tmp + len);
+	}
+
+	return buf;
+}
+
+std::string format(const binval_t& val)
+{
+	char buf[64];
+	binlog_format(&val, buf, sizeof(buf));
+	return buf;
+}
+
+} // namespace
+
+void UpslogBinTest::setUp()
+{
+	char tmpl[] = "/tmp/upslogbintest.XXXXXX";
+	int fd = mkstemp(tmpl);
+
+	CPPUNIT_ASSERT_MESSAGE("mkstemp(...) failed", fd >= 0);
+	close(fd);
+
+	_fn = tmpl;
+}
+
+void UpslogBinTest::tearDown()
+{
+	unlink(_fn.c_str());
+}
+
+void UpslogBinTest::test_roundtrip()
+{
+	/* as upsd has them: the numbers must come back the same */
+	static const char* samples[][3] = {
+		{ "0",		"OL",		NULL },
+		{ "100",	"OL",		"230.5" },
+		{ "127",	"OL CHRG",	"230.5" },
+		{ "128",	"OB",		"-0.001" },
+		{ "-16384",	"OB",		"1.0000000" },
+		{ "999999999999999999",	"",	"07" },
+		{ "-999999999999999999",	"1e3",	"-0" },
+		{ "3.14",	"OL",		NULL },
+	};
+	static const size_t nsamples = sizeof(samples) / sizeof(samples[0]);
+
+	char* colname[] = { (char*)"ups.load", (char*)"ups.status", (char*)"input.voltage" };
+	binstream_t out;
+	memset(&out, 0, sizeof(out));
+
+	FILE* f = fopen(_fn.c_str(), "w+");
+	CPPUNIT_ASSERT_MESSAGE("can't open the test log", f != NULL);
+
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("binlog_header(...) of a new log", 0L, binlog_header(f));
+	binlog_schema(f, &out, 3, "ups@localhost", 3, colname);
+
+	for(size_t i = 0; i < nsamples; i++)
+	{
+		binlog_sample(f, &out, 1000 * (long long)i, (char**)samples[i]);
+	}
+
+	std::vector<unsigned char> buf = read_all(f);
+	fclose(f);
+	binstream_free(&out);
+
+	int skip = binlog_check(&buf[0], buf.size());
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("binlog_check(...) doesn't see the magic", (int)BINLOG_MAGICLEN, skip);
+
+	binreader_t br;
+	binstream_t* bs = NULL;
+	memset(&br, 0, sizeof(br));
+
+	const unsigned char* pos = &buf[0] + skip;
+	const unsigned char* end = &buf[0] + buf.size();
+
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("binlog_next(...) doesn't read the schema", BINLOG_SCHEMA, binlog_next(&br, &pos, end, &bs));
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("schema has the wrong stream id", 3u, bs->id);
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("schema has the wrong ups", std::string("ups@localhost"), std::string(bs->upsname));
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("schema has the wrong columns", (size_t)3, bs->ncols);
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("schema has the wrong column 2", std::string("input.voltage"), std::string(bs->colname[2]));
+
+	for(size_t i = 0; i < nsamples; i++)
+	{
+		CPPUNIT_ASSERT_EQUAL_MESSAGE("binlog_next(...) doesn't read a sample", BINLOG_SAMPLE, binlog_next(&br, &pos, end, &bs));
+		CPPUNIT_ASSERT_EQUAL_MESSAGE("sample has the wrong time", 1000 * (long long)i, bs->time);
+
+		for(size_t j = 0; j < 3; j++)
+		{
+			std::string expected = samples[i][j] ? samples[i][j] : "NA";
+			CPPUNIT_ASSERT_EQUAL_MESSAGE("sample has a wrong value", expected, format(bs->val[j]));
+		}
+	}
+
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("binlog_next(...) doesn't stop at the end", 0, binlog_next(&br, &pos, end, &bs));
+
+	binreader_free(&br);
+}
+
+void UpslogBinTest::test_time()
+{
+	/* zigzag deltas both ways, from one to ten bytes */
+	static const long long times[] = {
+		0, 1, -1, 63, 64, -65, 8191, 8192, 1700000000123LL, 1600000000000LL,
+		4611686018427387903LL, -4611686018427387904LL, 0,
+	};
+	static const size_t ntimes = sizeof(times) / sizeof(times[0]);
+
+	char* colname[] = { (char*)"battery.charge" };
+	char* val[] = { (char*)"100" };
+	binstream_t out;
+	memset(&out, 0, sizeof(out));
+
+	FILE* f = fopen(_fn.c_str(), "w+");
+	CPPUNIT_ASSERT_MESSAGE("can't open the test log", f != NULL);
+
+	binlog_header(f);
+	binlog_schema(f, &out, 0, "ups", 1, colname);
+
+	for(size_t i = 0; i < ntimes; i++)
+	{
+		binlog_sample(f, &out, times[i], val);
+	}
+
+	std::vector<unsigned char> buf = read_all(f);
+	fclose(f);
+	binstream_free(&out);
+
+	binreader_t br;
+	binstream_t* bs = NULL;
+	memset(&br, 0, sizeof(br));
+
+	const unsigned char* pos = &buf[0] + BINLOG_MAGICLEN;
+	const unsigned char* end = &buf[0] + buf.size();
+
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("binlog_next(...) doesn't read the schema", BINLOG_SCHEMA, binlog_next(&br, &pos, end, &bs));
+
+	for(size_t i = 0; i < ntimes; i++)
+	{
+		CPPUNIT_ASSERT_EQUAL_MESSAGE("binlog_next(...) doesn't read a sample", BINLOG_SAMPLE, binlog_next(&br, &pos, end, &bs));
+		CPPUNIT_ASSERT_EQUAL_MESSAGE("sample has the wrong time", times[i], bs->time);
+	}
+
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("binlog_next(...) doesn't stop at the end", 0, binlog_next(&br, &pos, end, &bs));
+
+	binreader_free(&br);
+}
+
+void UpslogBinTest::test_cut_record()
+{
+	char* colname[] = { (char*)"ups.status" };
+	char* val1[] = { (char*)"OL" };
+	char* val2[] = { (char*)"OB DISCHRG" };
+	binstream_t out;
+	memset(&out, 0, sizeof(out));
+
+	FILE* f = fopen(_fn.c_str(), "a+");
+	CPPUNIT_ASSERT_MESSAGE("can't open the test log", f != NULL);
+
+	binlog_header(f);
+	binlog_schema(f, &out, 0, "ups", 1, colname);
+	binlog_sample(f, &out, 1000, val1);
+	fflush(f);
+
+	long good = ftell(f);
+
+	/* the crash: half of a sample */
+	binlog_sample(f, &out, 2000, val2);
+	fclose(f);
+	CPPUNIT_ASSERT_MESSAGE("can't cut the test log", truncate(_fn.c_str(), good + 5) == 0);
+
+	/* which can't be cut through a read-only stream */
+	f = fopen(_fn.c_str(), "r");
+	CPPUNIT_ASSERT_MESSAGE("can't reopen the test log", f != NULL);
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("binlog_header(...) doesn't tell it can't cut the log", (long)BINLOG_IOERR, binlog_header(f));
+	fclose(f);
+
+	/* the next run */
+	f = fopen(_fn.c_str(), "a+");
+	CPPUNIT_ASSERT_MESSAGE("can't reopen the test log", f != NULL);
+
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("binlog_header(...) doesn't cut off the unfinished record", 5L, binlog_header(f));
+	binlog_schema(f, &out, 0, "ups", 1, colname);
+	binlog_sample(f, &out, 3000, val2);
+
+	std::vector<unsigned char> buf = read_all(f);
+	fclose(f);
+	binstream_free(&out);
+
+	binreader_t br;
+	binstream_t* bs = NULL;
+	memset(&br, 0, sizeof(br));
+
+	const unsigned char* pos = &buf[0] + BINLOG_MAGICLEN;
+	const unsigned char* end = &buf[0] + buf.size();
+
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("first run: no schema", BINLOG_SCHEMA, binlog_next(&br, &pos, end, &bs));
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("first run: no sample", BINLOG_SAMPLE, binlog_next(&br, &pos, end, &bs));
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("first run: wrong value", std::string("OL"), format(bs->val[0]));
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("next run: no schema", BINLOG_SCHEMA, binlog_next(&br, &pos, end, &bs));
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("next run: no sample", BINLOG_SAMPLE, binlog_next(&br, &pos, end, &bs));
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("next run: wrong time", 3000LL, bs->time);
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("next run: wrong value", std::string("OB DISCHRG"), format(bs->val[0]));
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("binlog_next(...) doesn't stop at the end", 0, binlog_next(&br, &pos, end, &bs));
+
+	binreader_free(&br);
+
+	/* and a text log isn't touched */
+	f = fopen(_fn.c_str(), "w+");
+	CPPUNIT_ASSERT_MESSAGE("can't open the test log", f != NULL);
+	fputs("20240101 120000 100 230.0\n", f);
+
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("binlog_header(...) takes a text log for a binary one", (long)BINLOG_NOTBIN, binlog_header(f));
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("binlog_header(...) changed a text log", (size_t)26, read_all(f).size());
+	fclose(f);
+}
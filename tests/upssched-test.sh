@@ -0,0 +1,82 @@
+#!/bin/sh
+
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+#
+#! \file    upssched-test.sh
+#  \brief   Self-test for the upssched timer daemon
+#  \details Events from two UPSes share one timer daemon: the CMDSCRIPT
+#           run for each timer must see the UPSNAME and NOTIFYTYPE of the
+#           event that started (or cancelled) it, not those of the event
+#           that started the daemon.
+
+LANG=C
+LC_ALL=C
+export LANG LC_ALL
+
+### Note: relative to where the selftest script lives, unless exported
+### by the Makefile.
+[ -n "${BUILDDIR-}" ] || BUILDDIR="`dirname $0`"
+[ -n "${UPSSCHED-}" ] || UPSSCHED="${BUILDDIR}/../clients/upssched"
+[ ! -x "${UPSSCHED}" ] && echo "FATAL : upssched not found as '$UPSSCHED'" >&2 && exit 1
+
+# the socket path must be short, so not in the build tree
+DIR="`mktemp -d "${TMPDIR:-/tmp}/upssched-test.XXXXXX"`" || exit 1
+trap 'rm -rf "$DIR"' 0
+
+cat > "$DIR/cmdscript" << EOF
+#!/bin/sh
+echo "\$1 \$UPSNAME \$NOTIFYTYPE" >> "$DIR/ran"
+EOF
+chmod +x "$DIR/cmdscript"
+
+cat > "$DIR/upssched.conf" << EOF
+CMDSCRIPT $DIR/cmdscript
+PIPEFN $DIR/upssched.pipe
+LOCKFN $DIR/upssched.lock
+AT ONBATT * START-TIMER onbatt 1
+AT LOWBATT * START-TIMER lowbatt 2
+AT ONLINE ups2@localhost CANCEL-TIMER shutdown online
+EOF
+
+NUT_CONFPATH="$DIR"
+export NUT_CONFPATH
+
+event() {
+    UPSNAME="$1" NOTIFYTYPE="$2" "$UPSSCHED" || exit 1
+}
+
+# the first one starts the daemon, the others talk to it
+event ups1@localhost ONBATT
+event ups2@localhost LOWBATT
+event ups2@localhost ONLINE
+
+# online ran at once (there was no shutdown timer to cancel), then the
+# timers trigger after one and two seconds
+sleep 4
+
+EXPECT="online ups2@localhost ONLINE
+onbatt ups1@localhost ONBATT
+lowbatt ups2@localhost LOWBATT"
+OUT="`cat "$DIR/ran" 2>/dev/null`"
+
+if [ "$OUT" != "$EXPECT" ]; then
+    printf '\t--- expected ---\n%s\n\t--- received ---\n%s\n' "$EXPECT" "$OUT" >&2
+    echo "FAILED : upssched ran CMDSCRIPT with the wrong event" >&2
+    exit 1
+fi
+
+echo "PASSED : upssched ran CMDSCRIPT with the event of each timer"
+# the daemon exits by itself once it has had no timer for a while
+exit 0
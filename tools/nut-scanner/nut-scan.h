@@ -95,6 +95,19 @@ typedef struct nutscan_xml {
 } nutscan_xml_t;
 
 /* Scanning */
+
+/* Default number of addresses probed at once by the network scans */
+#define DEFAULT_SCAN_CONCURRENCY	256
+
+/* The SNMP, XML/HTTP and NUT scans probe at most this many addresses at
+ * once, all together; 0 or less sets the default back */
+void nutscan_set_max_concurrency(int max);
+
+/* Have the network scans above pass each device to func as they find it,
+ * before it goes in the list they return.  It is not linked to other
+ * devices yet, and the calls come one at a time from the scan threads */
+void nutscan_set_device_callback(void (*func)(nutscan_device_t * device));
+
 nutscan_device_t * nutscan_scan_snmp(const char * start_ip, const char * stop_ip, long usec_timeout, nutscan_snmp_t * sec);
 
 nutscan_device_t * nutscan_scan_usb();
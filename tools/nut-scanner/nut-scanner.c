@@ -40,11 +40,12 @@
 
 #define ERR_BAD_OPTION	(-1)
 
-const char optstring[] = "?ht:s:e:E:c:l:u:W:X:w:x:p:b:B:d:L:CUSMOAm:NPqIVaD";
+const char optstring[] = "?ht:T:s:e:E:c:l:u:W:X:w:x:p:b:B:d:L:CUSMOAm:NPqIVaD";
 
 #ifdef HAVE_GETOPT_LONG
 const struct option longopts[] =
 	{{ "timeout",required_argument,NULL,'t' },
+	{ "max_concurrency",required_argument,NULL,'T' },
 	{ "start_ip",required_argument,NULL,'s' },
 	{ "end_ip",required_argument,NULL,'e' },
 	{ "eaton_serial",required_argument,NULL,'E' },
@@ -88,6 +89,15 @@ static char * end_ip = NULL;
 static char * port = NULL;
 static char * serial_ports = NULL;
 
+static void (*display_func)(nutscan_device_t * device);
+
+/* Network scans pass the devices here as they find them */
+static void show_device(nutscan_device_t * device)
+{
+	display_func(device);
+	fflush(stdout);
+}
+
 #ifdef HAVE_PTHREAD
 static pthread_t thread[TYPE_END];
 
@@ -168,6 +178,7 @@ void show_usage()
 
 	printf("\nNetwork specific options:\n");
 	printf("  -t, --timeout <timeout in seconds>: network operation timeout (default %d).\n", DEFAULT_NETWORK_TIMEOUT);
+	printf("  -T, --max_concurrency <number>: Maximum number of addresses probed at once (default %d).\n", DEFAULT_SCAN_CONCURRENCY);
 	printf("  -s, --start_ip <IP address>: First IP address to scan.\n");
 	printf("  -e, --end_ip <IP address>: Last IP address to scan.\n");
 	printf("  -m, --mask_cidr <IP address/mask>: Give a range of IP using CIDR notation.\n");
@@ -225,7 +236,7 @@ int main(int argc, char *argv[])
 	int allow_ipmi = 0;
 	int allow_eaton_serial = 0; /* MUST be requested explicitly! */
 	int quiet = 0; /* The debugging level for certain upsdebugx() progress messages; 0 = print always, quiet==1 is to require at least one -D */
-	void (*display_func)(nutscan_device_t * device);
+	int max_concurrency;
 	int ret_code = EXIT_SUCCESS;
 
 	memset(&snmp_sec, 0, sizeof(snmp_sec));
@@ -272,6 +283,13 @@ int main(int argc, char *argv[])
 					timeout = DEFAULT_NETWORK_TIMEOUT * 1000 * 1000;
 				}
 				break;
+			case 'T':
+				max_concurrency = atoi(optarg);
+				if( max_concurrency <= 0 ) {
+					fprintf(stderr,"Illegal max concurrency value, using default %d\n", DEFAULT_SCAN_CONCURRENCY);
+				}
+				nutscan_set_max_concurrency(max_concurrency);
+				break;
 			case 's':
 				start_ip = strdup(optarg);
 				if (end_ip == NULL)
@@ -463,6 +481,9 @@ display_help:
 		nutscan_cidr_to_ip(cidr, &start_ip, &end_ip);
 	}
 
+	/* Show what the network scans find as it comes, rather than at the end */
+	nutscan_set_device_callback(show_device);
+
 	if( !allow_usb && !allow_snmp && !allow_xml && !allow_oldnut &&
 		!allow_avahi && !allow_ipmi && !allow_eaton_serial) {
 		allow_all = 1;
@@ -644,18 +665,15 @@ display_help:
 	upsdebugx(1,"SCANS DONE: free resources: USB");
 	nutscan_free_device(dev[TYPE_USB]);
 
-	upsdebugx(1,"SCANS DONE: display results: SNMP");
-	display_func(dev[TYPE_SNMP]);
+	/* already displayed as found */
 	upsdebugx(1,"SCANS DONE: free resources: SNMP");
 	nutscan_free_device(dev[TYPE_SNMP]);
 
-	upsdebugx(1,"SCANS DONE: display results: XML/HTTP");
-	display_func(dev[TYPE_XML]);
+	/* already displayed as found */
 	upsdebugx(1,"SCANS DONE: free resources: XML/HTTP");
 	nutscan_free_device(dev[TYPE_XML]);
 
-	upsdebugx(1,"SCANS DONE: display results: NUT bus (old)");
-	display_func(dev[TYPE_NUT]);
+	/* already displayed as found */
 	upsdebugx(1,"SCANS DONE: free resources: NUT bus (old)");
 	nutscan_free_device(dev[TYPE_NUT]);
 
@@ -0,0 +1,195 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*! \file nutscan-pool.c
+    \brief worker threads shared by the network scans
+
+    The SNMP, XML/HTTP and NUT scans hand each address of their range to
+    nutscan_pool_add().  Up to max_workers threads run these probes, so
+    that a large range doesn't take a thread per address, and the scans
+    running at the same time share them.  A worker takes the next queued
+    job when it is done with one, and ends when there is none left.
+*/
+
+#include "common.h"
+#include "nut-scan.h"
+#include "nutscan-pool.h"
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+static size_t max_workers = DEFAULT_SCAN_CONCURRENCY;
+
+static void (*device_callback)(nutscan_device_t * device) = NULL;
+
+#ifdef HAVE_PTHREAD
+typedef struct pool_job {
+	void *		(*func)(void *);
+	void *		arg;
+	nutscan_jobs_t *	jobs;
+	struct pool_job *	next;
+} pool_job_t;
+
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_room = PTHREAD_COND_INITIALIZER;	/* a job was taken */
+static pthread_cond_t pool_done = PTHREAD_COND_INITIALIZER;	/* a job finished */
+static pool_job_t * queue_head = NULL;
+static pool_job_t * queue_tail = NULL;
+static size_t queued = 0;
+static size_t workers = 0;
+
+static pthread_mutex_t device_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+void nutscan_set_max_concurrency(int max)
+{
+	max_workers = (max > 0) ? (size_t)max : DEFAULT_SCAN_CONCURRENCY;
+}
+
+void nutscan_set_device_callback(void (*func)(nutscan_device_t * device))
+{
+	device_callback = func;
+}
+
+void nutscan_found_device(nutscan_device_t * device)
+{
+	if( device_callback == NULL ) {
+		return;
+	}
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&device_mutex);
+#endif
+	device_callback(device);
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&device_mutex);
+#endif
+}
+
+#ifdef HAVE_PTHREAD
+/* call with pool_mutex held */
+static void job_finished(pool_job_t * job)
+{
+	job->jobs->pending--;
+	pthread_cond_broadcast(&pool_done);
+	free(job);
+}
+
+static void * pool_worker(void * arg)
+{
+	pool_job_t * job = (pool_job_t *)arg;
+
+	while( job != NULL ) {
+		job->func(job->arg);
+
+		pthread_mutex_lock(&pool_mutex);
+		job_finished(job);
+
+		job = queue_head;
+		if( job != NULL ) {
+			queue_head = job->next;
+			if( queue_head == NULL ) {
+				queue_tail = NULL;
+			}
+			queued--;
+			pthread_cond_signal(&pool_room);
+		}
+		else {
+			workers--;
+		}
+		pthread_mutex_unlock(&pool_mutex);
+	}
+
+	return NULL;
+}
+
+void nutscan_pool_add(nutscan_jobs_t * jobs, void * (*func)(void *), void * arg)
+{
+	pool_job_t * job;
+	pthread_t thread;
+
+	job = malloc(sizeof(pool_job_t));
+	if( job == NULL ) {
+		upsdebugx(1, "%s: Failed to allocate job, running it here", __func__);
+		func(arg);
+		return;
+	}
+
+	job->func = func;
+	job->arg = arg;
+	job->jobs = jobs;
+	job->next = NULL;
+
+	pthread_mutex_lock(&pool_mutex);
+	jobs->pending++;
+
+	for(;;) {
+		if( workers < max_workers ) {
+			workers++;
+			if( pthread_create(&thread, NULL, pool_worker, job) == 0 ) {
+				pthread_detach(thread);
+				pthread_mutex_unlock(&pool_mutex);
+				return;
+			}
+			workers--;
+
+			/* no one to queue it for */
+			if( workers == 0 ) {
+				upsdebugx(1, "%s: Failed to create thread, running job here", __func__);
+				pthread_mutex_unlock(&pool_mutex);
+				func(arg);
+				pthread_mutex_lock(&pool_mutex);
+				job_finished(job);
+				pthread_mutex_unlock(&pool_mutex);
+				return;
+			}
+		}
+
+		if( queued < max_workers ) {
+			if( queue_tail != NULL ) {
+				queue_tail->next = job;
+			}
+			else {
+				queue_head = job;
+			}
+			queue_tail = job;
+			queued++;
+			pthread_mutex_unlock(&pool_mutex);
+			return;
+		}
+
+		pthread_cond_wait(&pool_room, &pool_mutex);
+	}
+}
+
+void nutscan_pool_wait(nutscan_jobs_t * jobs)
+{
+	pthread_mutex_lock(&pool_mutex);
+	while( jobs->pending > 0 ) {
+		pthread_cond_wait(&pool_done, &pool_mutex);
+	}
+	pthread_mutex_unlock(&pool_mutex);
+}
+#else /* HAVE_PTHREAD */
+void nutscan_pool_add(nutscan_jobs_t * jobs, void * (*func)(void *), void * arg)
+{
+	func(arg);
+}
+
+void nutscan_pool_wait(nutscan_jobs_t * jobs)
+{
+}
+#endif /* HAVE_PTHREAD */
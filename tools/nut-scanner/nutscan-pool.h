@@ -0,0 +1,64 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*! \file nutscan-pool.h
+    \brief worker threads shared by the network scans
+*/
+
+#ifndef SCAN_POOL
+#define SCAN_POOL
+
+#include "nutscan-device.h"
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+extern "C" {
+/* *INDENT-ON* */
+#endif
+
+/* the jobs of one scan, to wait for */
+typedef struct nutscan_jobs {
+	size_t	pending;
+} nutscan_jobs_t;
+
+/**
+ *  \brief  Have a worker call func(arg), blocking while all are busy
+ *          and enough jobs are queued already
+ *
+ *  \param  jobs  Scan the job is part of, zeroed before its first job
+ *  \param  func  Probe of one address
+ *  \param  arg   Its argument
+ */
+void nutscan_pool_add(nutscan_jobs_t * jobs, void * (*func)(void *), void * arg);
+
+/**
+ *  \brief  Wait until all the jobs of a scan are done
+ */
+void nutscan_pool_wait(nutscan_jobs_t * jobs);
+
+/**
+ *  \brief  Pass a device a scan found to the device callback, if any,
+ *          before it goes in the scan's list
+ */
+void nutscan_found_device(nutscan_device_t * device);
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+}
+/* *INDENT-ON* */
+#endif
+
+#endif
@@ -61,6 +61,36 @@ static nutscan_device_t * dev_ret = NULL;
 /* Remap some functions to avoid undesired behavior (drivers/main.c) */
 char *getval(const char *var) { return NULL; }
 
+/* No driver socket to serve here (drivers/dstate.c) */
+int dstate_wait_fd(struct timeval deadline, int fd)
+{
+	fd_set		fds;
+	struct timeval	now, tv;
+
+	gettimeofday(&now, NULL);
+
+	tv.tv_sec = deadline.tv_sec - now.tv_sec;
+	tv.tv_usec = deadline.tv_usec - now.tv_usec;
+
+	if (tv.tv_usec < 0) {
+		tv.tv_sec -= 1;
+		tv.tv_usec += 1000000;
+	}
+
+	if (tv.tv_sec < 0) {
+		tv.tv_sec = 0;
+		tv.tv_usec = 0;
+	}
+
+	FD_ZERO(&fds);
+
+	if (fd != -1) {
+		FD_SET(fd, &fds);
+	}
+
+	return select(fd + 1, &fds, NULL, NULL, &tv);
+}
+
 #ifdef HAVE_PTHREAD
 static pthread_mutex_t dev_mutex;
 #endif
@@ -24,6 +24,7 @@
 #include "common.h"
 #include "upsclient.h"
 #include "nut-scan.h"
+#include "nutscan-pool.h"
 #ifdef HAVE_PTHREAD
 #include <pthread.h>
 #endif
@@ -187,6 +188,7 @@ static void * list_nut_devices(void * arg)
 			if( dev->port ) {
 				snprintf(dev->port,buf_size,"%s@%s",answer[1],
 						hostname);
+				nutscan_found_device(dev);
 #ifdef HAVE_PTHREAD
 				pthread_mutex_lock(&dev_mutex);
 #endif
@@ -214,13 +216,11 @@ nutscan_device_t * nutscan_scan_nut(const char* startIP, const char* stopIP, con
 	char buf[SMALLBUF];
 	struct sigaction oldact;
 	int change_action_handler = 0;
-	int i;
 	struct scan_nut_arg *nut_arg;
-#ifdef HAVE_PTHREAD
-	pthread_t thread;
-	pthread_t * thread_array = NULL;
-	int thread_count = 0;
+	nutscan_jobs_t jobs;
 
+	memset(&jobs, 0, sizeof(jobs));
+#ifdef HAVE_PTHREAD
 	pthread_mutex_init(&dev_mutex,NULL);
 #endif
 
@@ -261,33 +261,14 @@ nutscan_device_t * nutscan_scan_nut(const char* startIP, const char* stopIP, con
 
 		nut_arg->timeout = usec_timeout;
 		nut_arg->hostname = ip_dest;
-#ifdef HAVE_PTHREAD
-		if (pthread_create(&thread,NULL,list_nut_devices,(void*)nut_arg)==0){
-			thread_count++;
-			pthread_t *new_thread_array = realloc(thread_array,
-						thread_count*sizeof(pthread_t));
-			if (new_thread_array == NULL) {
-				upsdebugx(1, "%s: Failed to realloc thread", __func__);
-				break;
-			}
-			else {
-				thread_array = new_thread_array;
-			}
-			thread_array[thread_count-1] = thread;
-		}
-#else
-		list_nut_devices(nut_arg);
-#endif
+		nutscan_pool_add(&jobs, list_nut_devices, nut_arg);
 		free(ip_str);
 		ip_str = nutscan_ip_iter_inc(&ip);
 	}
 
+	nutscan_pool_wait(&jobs);
 #ifdef HAVE_PTHREAD
-	for ( i=0; i < thread_count ; i++) {
-		pthread_join(thread_array[i],NULL);
-	}
 	pthread_mutex_destroy(&dev_mutex);
-	free(thread_array);
 #endif
 
 	if(change_action_handler) {
@@ -60,6 +60,7 @@
 #include <pthread.h>
 #endif
 #include "nutscan-snmp.h"
+#include "nutscan-pool.h"
 
 /* Address API change */
 #ifndef usmAESPrivProtocol
@@ -317,6 +318,7 @@ static void scan_snmp_add_device(nutscan_snmp_t * sec, struct snmp_pdu *response
 		}
 	}
 
+	nutscan_found_device(dev);
 #ifdef HAVE_PTHREAD
 	pthread_mutex_lock(&dev_mutex);
 #endif
@@ -663,15 +665,13 @@ try_SysOID_free:
 
 nutscan_device_t * nutscan_scan_snmp(const char * start_ip, const char * stop_ip,long usec_timeout, nutscan_snmp_t * sec)
 {
-	int i;
 	nutscan_snmp_t * tmp_sec;
 	nutscan_ip_iter_t ip;
 	char * ip_str = NULL;
-#ifdef HAVE_PTHREAD
-	pthread_t thread;
-	pthread_t * thread_array = NULL;
-	int thread_count = 0;
+	nutscan_jobs_t jobs;
 
+	memset(&jobs, 0, sizeof(jobs));
+#ifdef HAVE_PTHREAD
 	pthread_mutex_init(&dev_mutex,NULL);
 #endif
 
@@ -697,32 +697,13 @@ nutscan_device_t * nutscan_scan_snmp(const char * start_ip, const char * stop_ip
 		memcpy(tmp_sec, sec, sizeof(nutscan_snmp_t));
 		tmp_sec->peername = ip_str;
 
-#ifdef HAVE_PTHREAD
-		if (pthread_create(&thread,NULL,try_SysOID,(void*)tmp_sec)==0){
-			thread_count++;
-			pthread_t *new_thread_array = realloc(thread_array,
-						thread_count*sizeof(pthread_t));
-			if (new_thread_array == NULL) {
-				upsdebugx(1, "%s: Failed to realloc thread", __func__);
-				break;
-			}
-			else {
-				thread_array = new_thread_array;
-			}
-			thread_array[thread_count-1] = thread;
-		}
-#else
-		try_SysOID((void *)tmp_sec);
-#endif
+		nutscan_pool_add(&jobs, try_SysOID, tmp_sec);
 		ip_str = nutscan_ip_iter_inc(&ip);
 	};
 
+	nutscan_pool_wait(&jobs);
 #ifdef HAVE_PTHREAD
-	for ( i=0; i < thread_count ; i++) {
-		pthread_join(thread_array[i],NULL);
-	}
 	pthread_mutex_destroy(&dev_mutex);
-	free(thread_array);
 #endif
 	nutscan_device_t * result = nutscan_rewind_device(dev_ret);
 	dev_ret = NULL;
@@ -27,6 +27,7 @@
 #ifdef WITH_USB
 #include "upsclient.h"
 #include "nutscan-usb.h"
+#include "usbsysfs.h"
 #include <stdio.h>
 #include <string.h>
 #include <ltdl.h>
@@ -150,6 +151,7 @@ nutscan_device_t * nutscan_scan_usb()
 	struct usb_device *dev;
 	struct usb_bus *bus;
 	usb_dev_handle *udev;
+	const usbsysfs_device_t *sysdev;
 
 	nutscan_device_t * nut_dev = NULL;
 	nutscan_device_t * current_nut_dev = NULL;
@@ -163,6 +165,9 @@ nutscan_device_t * nutscan_scan_usb()
 	(*nut_usb_find_busses)();
 	(*nut_usb_find_devices)();
 
+	/* what the kernel knows about the devices, to avoid opening them */
+	usbsysfs_flush();
+
 	for (bus = (*nut_usb_busses); bus; bus = bus->next) {
 		for (dev = bus->devices; dev; dev = dev->next) {
 			if ((driver_name =
@@ -170,6 +175,34 @@ nutscan_device_t * nutscan_scan_usb()
 					dev->descriptor.idVendor,
 					dev->descriptor.idProduct)) != NULL) {
 
+				udev = NULL;
+
+				sysdev = usbsysfs_find(atoi(bus->dirname),
+						atoi(dev->filename));
+
+				/* the kernel already read the strings, unless
+				   some are missing */
+				if (sysdev && usbsysfs_complete(sysdev,
+						dev->descriptor.idVendor,
+						dev->descriptor.idProduct,
+						dev->descriptor.iManufacturer,
+						dev->descriptor.iProduct,
+						dev->descriptor.iSerialNumber)) {
+					if (sysdev->Serial[0]) {
+						serialnumber = strdup(sysdev->Serial);
+						str_rtrim(serialnumber, ' ');
+					}
+					if (sysdev->Product[0]) {
+						device_name = strdup(sysdev->Product);
+						str_rtrim(device_name, ' ');
+					}
+					if (sysdev->Vendor[0]) {
+						vendor_name = strdup(sysdev->Vendor);
+						str_rtrim(vendor_name, ' ');
+					}
+					goto add_device;
+				}
+
 				/* open the device */
 				udev = (*nut_usb_open)(dev);
 				if (!udev) {
@@ -208,6 +241,7 @@ nutscan_device_t * nutscan_scan_usb()
 					}
 				}
 
+			add_device:
 				nut_dev = nutscan_new_device();
 				if(nut_dev == NULL) {
 					fprintf(stderr,"Memory allocation \
@@ -216,6 +250,9 @@ nutscan_device_t * nutscan_scan_usb()
 					free(serialnumber);
 					free(device_name);
 					free(vendor_name);
+					if (udev) {
+						(*nut_usb_close)(udev);
+					}
 					return NULL;
 				}
 
@@ -261,7 +298,9 @@ nutscan_device_t * nutscan_scan_usb()
 
 				memset (string, 0, sizeof(string));
 
-				(*nut_usb_close)(udev);
+				if (udev) {
+					(*nut_usb_close)(udev);
+				}
 			}
 		}
 	}
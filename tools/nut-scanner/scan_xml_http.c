@@ -42,6 +42,7 @@
 #ifdef HAVE_PTHREAD
 #include <pthread.h>
 #endif
+#include "nutscan-pool.h"
 
 /* dynamic link library stuff */
 static char * libname = "libneon"; /* Note: this is for info messages, not the SONAME */
@@ -305,6 +306,7 @@ static void * nutscan_scan_xml_http_generic(void * arg)
 					sprintf(buf,"http://%s",string);
 					nut_dev->port = strdup(buf);
 					upsdebugx(3,"nutscan_scan_xml_http_generic(): Adding configuration for driver='%s' port='%s'", nut_dev->driver, nut_dev->port);
+					nutscan_found_device(nut_dev);
 					dev_ret = nutscan_add_device_to_device(
 						dev_ret,nut_dev);
 #ifdef HAVE_PTHREAD
@@ -349,7 +351,6 @@ nutscan_device_t * nutscan_scan_xml_http_range(const char * start_ip, const char
 {
 	nutscan_xml_t * tmp_sec = NULL;
 	nutscan_device_t * result = NULL;
-	int i;
 
 	if( !nutscan_avail_xml_http ) {
 		return NULL;
@@ -368,11 +369,10 @@ nutscan_device_t * nutscan_scan_xml_http_range(const char * start_ip, const char
 			/* Iterate the range of IPs to scan */
 			nutscan_ip_iter_t ip;
 			char * ip_str = NULL;
-#ifdef HAVE_PTHREAD
-			pthread_t thread;
-			pthread_t * thread_array = NULL;
-			int thread_count = 0;
+			nutscan_jobs_t jobs;
 
+			memset(&jobs, 0, sizeof(jobs));
+#ifdef HAVE_PTHREAD
 			pthread_mutex_init(&dev_mutex,NULL);
 #endif
 
@@ -385,41 +385,20 @@ nutscan_device_t * nutscan_scan_xml_http_range(const char * start_ip, const char
 				if (tmp_sec == NULL) {
 					fprintf(stderr,"Memory allocation \
 						error\n");
-					return NULL;
+					break;
 				}
 				memcpy(tmp_sec, sec, sizeof(nutscan_xml_t));
 				tmp_sec->peername = ip_str;
 				if (tmp_sec->usec_timeout < 0) tmp_sec->usec_timeout = usec_timeout;
 
-#ifdef HAVE_PTHREAD
-				if (pthread_create(&thread,NULL,nutscan_scan_xml_http_generic, (void *)tmp_sec)==0){
-					thread_count++;
-					pthread_t *new_thread_array = realloc(thread_array,
-								thread_count*sizeof(pthread_t));
-					if (new_thread_array == NULL) {
-						upsdebugx(1, "%s: Failed to realloc thread", __func__);
-						break;
-					}
-					else {
-						thread_array = new_thread_array;
-					}
-					thread_array[thread_count-1] = thread;
-				}
-#else
-				nutscan_scan_xml_http_generic((void *)tmp_sec);
-#endif
+				nutscan_pool_add(&jobs, nutscan_scan_xml_http_generic, tmp_sec);
 /*				free(ip_str); */ /* One of these free()s seems to cause a double-free */
 				ip_str = nutscan_ip_iter_inc(&ip);
 /*				free(tmp_sec); */
 			};
 
+			nutscan_pool_wait(&jobs);
 #ifdef HAVE_PTHREAD
-			if (thread_array != NULL) {
-				for ( i=0; i < thread_count ; i++) {
-						pthread_join(thread_array[i],NULL);
-				}
-				free(thread_array);
-			}
 			pthread_mutex_destroy(&dev_mutex);
 #endif
 			result = nutscan_rewind_device(dev_ret);